@@ -9,6 +9,7 @@
 #include <clock/clock.h>
 #include <syscall/syscall.h>
 #include <proc/proc.h>
+#include <vm/frametable.h>
 #include <utils/util.h>
 #include "network.h"
 
@@ -36,6 +37,12 @@ event_loop(const seL4_CPtr ep)
         /* Cleanup any of SOS' children */
         reap_dead_orphans(init);
 
+        /*
+         * Zero a cached frame before waiting. The kernel cannot poll a synchronous endpoint,
+         * so this runs whether or not a message is pending, and is kept to a single frame.
+         */
+        frame_cache_prezero();
+
         message = seL4_Wait(ep, &badge);
         label = seL4_MessageInfo_get_label(message);
         /* Interrupt */
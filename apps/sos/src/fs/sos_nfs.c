@@ -26,14 +26,22 @@ static const vnode_ops nfs_vnode_ops = {
     .vop_close = sos_nfs_close,
     .vop_read = sos_nfs_read,
     .vop_write = sos_nfs_write,
-    .vop_stat = sos_nfs_stat
+    .vop_stat = sos_nfs_stat,
+    .vop_read_batch = sos_nfs_read_batch,
+    .vop_write_batch = sos_nfs_write_batch,
+    .vop_readv = sos_nfs_readv,
+    .vop_writev = sos_nfs_writev,
+    .vop_truncate = sos_nfs_truncate
 };
 
 /* NFS callbacks */
 static void sos_nfs_lookup_callback(uintptr_t token, enum nfs_stat status, fhandle_t* fh, fattr_t* fattr);
 static void sos_nfs_write_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count);
+static void sos_nfs_write_batch_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count);
+static void sos_nfs_read_batch_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count, void *data);
 static void sos_nfs_read_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count, void* data);
 static void sos_nfs_getattr_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr);
+static void sos_nfs_truncate_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr);
 static void sos_nfs_readdir_callback(uintptr_t token, enum nfs_stat status, int num_files, char* file_names[], nfscookie_t nfscookie);
 
 /* Timer stages to setup the NFS timer callbacks */
@@ -45,11 +53,23 @@ static char **volatile global_dir = NULL;
 static volatile size_t global_size = 0;
 static volatile nfscookie_t global_cookie = 0;
 
-/* NFS operation struct to pass as the token (used only for read) */
+/* Truncation in the background, passed as the token */
+typedef struct {
+    void (*callback)(uintptr_t token, int err);
+    uintptr_t token;
+} nfs_truncate_cb;
+
+/* Outstanding request of a batch, passed as the token */
 typedef struct {
     coro routine;
+    vnode *node; /* File the request is for */
     uiovec *iv;
-} nfs_cb;
+    int count; /* Bytes transferred by the last request, -1 on failure */
+} nfs_batch_req;
+
+/* Batched operations */
+static int sos_nfs_batch(vnode *node, vnode **nodes, uiovec *iovs, size_t niovs, size_t window, bool write, bool partial);
+static int sos_nfs_batch_issue(nfs_batch_req *req, bool write);
 
 int
 sos_nfs_init(void)
@@ -101,6 +121,27 @@ sos_nfs_lookup(char *name, int create_file, vnode **result)
     return 0;
 }
 
+vnode *
+sos_nfs_vnode_create(fhandle_t *fh)
+{
+    /* Hardcopy the handle, as the memory location becomes invalid */
+    void *handle = malloc(sizeof(fhandle_t));
+    if (handle == NULL) {
+        LOG_ERROR("Failed to create handle for NFS file");
+        return NULL;
+    }
+    memcpy(handle, fh, sizeof(fhandle_t));
+
+    /* Create the vnode given the handle */
+    vnode *vn = vnode_create(handle, &nfs_vnode_ops, 0, 0);
+    if (vn == NULL) {
+        LOG_ERROR("Failed to create vnode for NFS file");
+        free(handle);
+    }
+
+    return vn;
+}
+
 int
 sos_nfs_list(char ***list, size_t *nfiles)
 {
@@ -186,24 +227,71 @@ sos_nfs_write(vnode *node, uiovec *iov)
 }
 
 int
-sos_nfs_read(vnode *node, uiovec *iov)
+sos_nfs_write_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window)
+{
+    return sos_nfs_batch(node, NULL, iovs, niovs, window, TRUE, FALSE) < 0;
+}
+
+int
+sos_nfs_read_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window)
+{
+    return sos_nfs_batch(node, NULL, iovs, niovs, window, FALSE, FALSE) < 0;
+}
+
+int
+sos_nfs_writev(vnode *node, uiovec *iovs, size_t niovs, size_t window)
+{
+    return sos_nfs_batch(node, NULL, iovs, niovs, window, TRUE, TRUE);
+}
+
+int
+sos_nfs_readv(vnode *node, uiovec *iovs, size_t niovs, size_t window)
 {
-    nfs_cb *cb = malloc(sizeof(nfs_cb));
+    return sos_nfs_batch(node, NULL, iovs, niovs, window, FALSE, TRUE);
+}
+
+int
+sos_nfs_batch_files(vnode **nodes, uiovec *iovs, size_t niovs, size_t window, bool write)
+{
+    return sos_nfs_batch(NULL, nodes, iovs, niovs, window, write, FALSE) < 0;
+}
+
+int
+sos_nfs_truncate(vnode *node, off_t size, void (*callback)(uintptr_t token, int err), uintptr_t token)
+{
+    nfs_truncate_cb *cb = malloc(sizeof(nfs_truncate_cb));
     if (cb == NULL) {
         LOG_ERROR("Error creating callback struct");
-        return -1;
+        return 1;
+    }
+    cb->callback = callback;
+    cb->token = token;
+
+    /* Only the size is changed */
+    sattr_t file_attr;
+    memset(&file_attr, 0xFF, sizeof(sattr_t));
+    file_attr.size = size;
+
+    if (nfs_setattr(node->vn_data, &file_attr, sos_nfs_truncate_callback, (uintptr_t)cb) != RPC_OK) {
+        LOG_ERROR("Failed to truncate NFS file");
+        free(cb);
+        return 1;
     }
-    cb->routine = coro_getcur();
-    cb->iv = iov;
 
+    return 0;
+}
+
+int
+sos_nfs_read(vnode *node, uiovec *iov)
+{
     int ret;
     seL4_Word total = iov->uiov_len;
 
     /* Loop to make sure entire data is read, as nfs could break it up into small packets */
     while (iov->uiov_len > 0) {
-        if (nfs_read(node->vn_data, iov->uiov_pos, iov->uiov_len, sos_nfs_read_callback, (uintptr_t)cb) != RPC_OK) {
+        if (nfs_read_into(node->vn_data, iov->uiov_pos, iov->uiov_len, iov->uiov_base, sos_nfs_read_callback,
+                          (uintptr_t)coro_getcur()) != RPC_OK) {
             LOG_ERROR("Error reading from NFS file");
-            free(cb);
             return -1;
         }
 
@@ -219,7 +307,6 @@ sos_nfs_read(vnode *node, uiovec *iov)
         iov->uiov_pos += ret;
     }
 
-    free(cb);
     return total - iov->uiov_len;
 }
 
@@ -251,8 +338,8 @@ sos_nfs_close(vnode *node, fmode_t mode)
     node->writecount -= 1;
 
     close_file:
-        /* Free the handle */
-        if (node->readcount > 0 || node->writecount > 0) {
+        /* Free the handle once the last reference is gone, a mapping of the file may outlive its fd */
+        if (node->readcount == 0 && node->writecount == 0) {
             free(node->vn_data);
             free(node);
         }
@@ -260,6 +347,112 @@ sos_nfs_close(vnode *node, fmode_t mode)
     return 0;
 }
 
+/*
+ * Transfer several io vectors, keeping up to window requests in flight at once.
+ * Vectors each for a file of their own are independent, a failed vector does not stop the others.
+ * @param node, the vnode of the file
+ * @param nodes, the vnode of the file of each vector, else NULL if every vector is for node
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding requests
+ * @param write, TRUE to write the vectors to the file, FALSE to read them from it
+ * @param partial, TRUE if a read may stop short at the end of the file, else every vector must be transferred in full
+ * @returns number of bytes transferred on success, else -1
+ */
+static int
+sos_nfs_batch(vnode *node, vnode **nodes, uiovec *iovs, size_t niovs, size_t window, bool write, bool partial)
+{
+    nfs_batch_req *reqs = malloc(sizeof(nfs_batch_req) * niovs);
+    if (reqs == NULL) {
+        LOG_ERROR("Failed to allocate batch requests");
+        return -1;
+    }
+
+    int transferred = 0;
+
+    int err = 0;
+    size_t next = 0;
+    size_t outstanding = 0;
+    nfs_batch_req *req;
+
+    /*
+     * Keep the window full, each completion resumes us with its request.
+     * After an error on a single file no more requests are issued, but the outstanding ones are drained
+     * as their callbacks still refer to the requests.
+     */
+    bool stop = FALSE;
+    while (TRUE) {
+        while (!stop && next < niovs && outstanding < window) {
+            req = &reqs[next];
+            req->routine = coro_getcur();
+            req->node = (nodes != NULL) ? nodes[next] : node;
+            req->iv = &iovs[next++];
+            if (sos_nfs_batch_issue(req, write) != 0) {
+                err = 1;
+                stop = (nodes == NULL);
+                continue;
+            }
+
+            outstanding++;
+        }
+
+        if (outstanding == 0)
+            break;
+
+        req = yield(NULL);
+        outstanding--;
+
+        /* A read of nothing is the end of the file, the rest of the vector is left untransferred */
+        if (req->count < 0 || (req->count == 0 && (write || !partial))) {
+            err = 1;
+            stop = (nodes == NULL);
+            continue;
+        }
+
+        /* Progress over the data, reissuing the remainder of a short transfer */
+        req->iv->uiov_len -= req->count;
+        req->iv->uiov_base += req->count;
+        req->iv->uiov_pos += req->count;
+        transferred += req->count;
+        if (req->iv->uiov_len == 0 || req->count == 0 || stop)
+            continue;
+
+        if (sos_nfs_batch_issue(req, write) != 0) {
+            err = 1;
+            stop = (nodes == NULL);
+            continue;
+        }
+
+        outstanding++;
+    }
+
+    free(reqs);
+    return err ? -1 : transferred;
+}
+
+/*
+ * Issue the request for the remainder of a batched io vector
+ * @param req, the request
+ * @param write, TRUE to write, FALSE to read
+ * @returns 0 on success, else 1
+ */
+static int
+sos_nfs_batch_issue(nfs_batch_req *req, bool write)
+{
+    vnode *node = req->node;
+    uiovec *iov = req->iv;
+    enum rpc_stat stat = write ?
+        nfs_write(node->vn_data, iov->uiov_pos, iov->uiov_len, iov->uiov_base, sos_nfs_write_batch_callback, (uintptr_t)req) :
+        nfs_read_into(node->vn_data, iov->uiov_pos, iov->uiov_len, iov->uiov_base, sos_nfs_read_batch_callback, (uintptr_t)req);
+
+    if (stat != RPC_OK) {
+        LOG_ERROR("Failed to %s NFS file", write ? "write to" : "read from");
+        return 1;
+    }
+
+    return 0;
+}
+
 /*
  * Callback for the lookup function
  * NFS tells us if the file exists
@@ -274,25 +467,26 @@ sos_nfs_lookup_callback(uintptr_t token, enum nfs_stat status, fhandle_t* fh, fa
         goto coro_resume;
     }
 
-    /* Hardcopy the handle, as the memory location becomes invalid */
-    void *handle = malloc(sizeof(fhandle_t));
-    if (handle == NULL) {
-        LOG_ERROR("Failed to create handle for NFS file");
-        goto coro_resume;
-    }
-    memcpy(handle, fh, sizeof(fhandle_t));
-
-    /* Create the vnode given the handle */
-    if ((vn = vnode_create(handle, &nfs_vnode_ops, 0, 0)) == NULL) {
-        LOG_ERROR("Failed to create vnode for NFS file");
-        free(handle);
-        goto coro_resume;
-    }
+    vn = sos_nfs_vnode_create(fh);
 
     coro_resume:
         resume((coro)token, (void *)vn);
 }
 
+/*
+ * Callback for truncating a file
+ */
+static void
+sos_nfs_truncate_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr)
+{
+    nfs_truncate_cb *cb = (nfs_truncate_cb *)token;
+    if (status != NFS_OK)
+        LOG_ERROR("Invalid nfs status %d", status);
+
+    cb->callback(cb->token, status != NFS_OK);
+    free(cb);
+}
+
 /*
  * Callback to read directory entries
  */
@@ -340,31 +534,61 @@ sos_nfs_write_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, in
         resume((coro)token, (void *)ret);
 }
 
+/*
+ * Batched write callback
+ * Record the result against the request and resume the writer with it
+ */
+static void
+sos_nfs_write_batch_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count)
+{
+    nfs_batch_req *req = (nfs_batch_req *)token;
+    assert(req != NULL);
+
+    req->count = count;
+    if (status != NFS_OK) {
+        LOG_ERROR("Invalid nfs status %d", status);
+        req->count = -1;
+    }
+
+    resume(req->routine, (void *)req);
+}
+
+/*
+ * Batched read callback
+ * The data is already in the request's io vector, resume the reader with the request
+ */
+static void
+sos_nfs_read_batch_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count, void *data)
+{
+    nfs_batch_req *req = (nfs_batch_req *)token;
+    assert(req != NULL);
+
+    req->count = count;
+    if (status != NFS_OK) {
+        LOG_ERROR("Invalid nfs status %d", status);
+        req->count = -1;
+    }
+
+    resume(req->routine, (void *)req);
+}
+
 /*
  * Read callback
- * Copy the memory into the buffer specified by the iov_base
+ * The data is already in the buffer specified by the iov_base
+ * Return number of bytes read
  */
 static void
 sos_nfs_read_callback(uintptr_t token, enum nfs_stat status, fattr_t *fattr, int count, void *data)
 {
     int ret = -1;
-
-    /* Unwrap the callback data */
-    nfs_cb *call_data = (nfs_cb *)token;
-    assert(call_data != NULL);
-
     if (status != NFS_OK) {
         LOG_ERROR("Invalid nfs status %d", status);
         goto coro_resume;
     }
 
-    /* Hardcopy the data into the specified memory region */
-    uiovec *iov = (uiovec *)call_data->iv;
-    memcpy(iov->uiov_base, data, count);
-
     ret = count;
     coro_resume:
-        resume(call_data->routine, (void *)ret);
+        resume((coro)token, (void *)ret);
 }
 
 /*
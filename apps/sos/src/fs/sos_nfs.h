@@ -7,8 +7,10 @@
 #ifndef _SOS_NFS_H_
 #define _SOS_NFS_H_
 
+#include <nfs/nfs.h>
 #include <vfs/vfs.h>
 #include <sos.h>
+#include <stdbool.h>
 
 /*
  * Initialise the NFS file system
@@ -25,6 +27,13 @@ int sos_nfs_init(void);
  */
 int sos_nfs_lookup(char *name, int create_file, vnode **result);
 
+/*
+ * Create the vnode of an NFS file from its handle
+ * @param fh, the handle of the file, copied into the vnode
+ * @returns pointer to vnode on success, else NULL
+ */
+vnode *sos_nfs_vnode_create(fhandle_t *fh);
+
 /*
  * List all files
  * @param[out] list, the list of file names
@@ -49,6 +58,72 @@ int sos_nfs_open(vnode *vnode, fmode_t mode);
  */
 int sos_nfs_write(vnode *node, uiovec *iov);
 
+/*
+ * Write several io vectors to an NFS file, keeping up to window writes in flight at once.
+ * Each vector is written in full, the vectors are advanced as their data is written.
+ * @param node, the vnode of the file
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding writes
+ * @returns 0 on success, else 1
+ */
+int sos_nfs_write_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window);
+
+/*
+ * Read several io vectors from an NFS file, keeping up to window reads in flight at once.
+ * Each vector is read in full, the vectors are advanced as their data is read.
+ * @param node, the vnode of the file
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding reads
+ * @returns 0 on success, else 1
+ */
+int sos_nfs_read_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window);
+
+/*
+ * Write io vectors to an NFS file, keeping up to window writes in flight at once.
+ * As for sos_nfs_write_batch, but returning the number of bytes written.
+ * @param node, the vnode of the file
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding writes
+ * @returns number of bytes written on success, else -1
+ */
+int sos_nfs_writev(vnode *node, uiovec *iovs, size_t niovs, size_t window);
+
+/*
+ * Read io vectors from an NFS file, keeping up to window reads in flight at once.
+ * The data is read straight into the vectors. A vector past the end of the file is left short.
+ * @param node, the vnode of the file
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding reads
+ * @returns number of bytes read on success, else -1
+ */
+int sos_nfs_readv(vnode *node, uiovec *iovs, size_t niovs, size_t window);
+
+/*
+ * Transfer io vectors each to or from a file of its own, keeping up to window requests in flight across the files.
+ * A failed vector does not stop the others, it is left with the part of it that was not transferred.
+ * @param nodes, the vnode of the NFS file of each io vector
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding requests
+ * @param write, TRUE to write the vectors, FALSE to read them
+ * @returns 0 on success, else 1 if any vector was not transferred in full
+ */
+int sos_nfs_batch_files(vnode **nodes, uiovec *iovs, size_t niovs, size_t window, bool write);
+
+/*
+ * Truncate or extend an NFS file, without waiting for the server
+ * @param node, the vnode of the file
+ * @param size, the new size of the file in bytes
+ * @param callback, called with the token once the server has responded, err is 0 on success
+ * @param token, passed to the callback
+ * @returns 0 if the request was sent, else 1 and the callback is never called
+ */
+int sos_nfs_truncate(vnode *node, off_t size, void (*callback)(uintptr_t token, int err), uintptr_t token);
+
 /*
  * Read from an NFS file
  * @param node, the vnode of the file
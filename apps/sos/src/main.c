@@ -143,11 +143,6 @@ sos_init(seL4_CPtr *ipc_ep, seL4_CPtr *async_ep)
     dma_addr = ut_steal_mem(DMA_SIZE_BITS);
     conditional_panic(dma_addr == (seL4_Word)NULL, "Failed to reserve DMA memory\n");
 
-    /* Pagefile table represents the pagefile in memory, its a bit array with PAGEFILE_MAX_PAGES entries */
-    seL4_Word pagefile_table_size_in_bits = LOG_BASE_2(nearest_power_of_two(PAGEFILE_MAX_PAGES / 8));
-    seL4_Word pagefile_metadata_table = ut_steal_mem(pagefile_table_size_in_bits);
-    conditional_panic(pagefile_metadata_table == (seL4_Word)NULL, "Failed to reserve Pagefile memory\n");
-
     /* find available memory */
     ut_find_memory(&low, &high);
 
@@ -157,7 +152,7 @@ sos_init(seL4_CPtr *ipc_ep, seL4_CPtr *async_ep)
      * We then map this into virtual memory in frame_table_init.
      */
     seL4_Word n_pages = BYTES_TO_4K_PAGES(high - low);
-    seL4_Word frame_table_size_in_bits = LOG_BASE_2(nearest_power_of_two(sizeof(frame_entry) * n_pages));
+    seL4_Word frame_table_size_in_bits = LOG_BASE_2(nearest_power_of_two(FRAME_TABLE_BYTES(n_pages)));
     seL4_Word frame_table_paddr = ut_steal_mem(frame_table_size_in_bits);
     conditional_panic(frame_table_paddr == (seL4_Word)NULL, "Failed to reserve frametable memory\n");
 
@@ -179,6 +174,10 @@ sos_init(seL4_CPtr *ipc_ep, seL4_CPtr *async_ep)
     err = frame_table_init(frame_table_paddr, frame_table_size_in_bits, low, high);
     conditional_panic(err, "Failed to intiialise frame table\n");
 
+    /* Allocate the zero page shared by untouched memory */
+    err = sos_zero_page_init();
+    conditional_panic(err, "Failed to initialise the zero page\n");
+
     /* Initialise IPC endpoints */
     sos_ipc_init(ipc_ep, async_ep);
 
@@ -198,7 +197,7 @@ sos_init(seL4_CPtr *ipc_ep, seL4_CPtr *async_ep)
     conditional_panic(err, "Failed to mount NFS\n");
 
     /* Must happen after NFS is initialised because it creates pagefile */
-    err = init_pager(pagefile_metadata_table, pagefile_table_size_in_bits);
+    err = init_pager();
     conditional_panic(err, "Failed to initialise demand pager\n");
 }
 
@@ -239,6 +238,9 @@ main(void)
     
     /* Unit tests; Not for submission */
     /* test_m2(); */
+    /* test_pagefile_map(); */
+    /* test_swap(); */
+    /* test_regions(); */
     /* test_m1(); *//* After so as to have time to enter event loop */
 
     /* Wait on synchronous endpoint for IPC */
@@ -19,6 +19,9 @@
 
 extern const seL4_BootInfo *_boot_info;
 
+/* Frame of the shared zero page */
+static seL4_Word zero_page_frame_id = -1;
+
 /*
  * Maps a page table into the root servers page directory
  * @param vaddr The virtual address of the mapping
@@ -96,16 +99,29 @@ map_device(void *paddr, int size)
 
 
 int
-sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_Word *kvaddr)
+sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_Word flags, seL4_Word *kvaddr)
 {
     assert(IS_ALIGNED_4K(page_id));
 
-    seL4_Word frame_id = frame_alloc(kvaddr);
+    seL4_Word frame_id = frame_alloc(kvaddr, flags);
     if (frame_id == -1) {
         LOG_ERROR("Failed to allocate a frame");
         return 1;
     }
 
+    if (sos_map_frame(curproc, page_id, frame_id, permissions) != 0) {
+        frame_free(frame_id);
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+sos_map_frame(proc *curproc, seL4_Word page_id, seL4_Word frame_id, unsigned long permissions)
+{
+    assert(IS_ALIGNED_4K(page_id));
+
     seL4_ARM_Page frame_cap = frame_table_get_capability(frame_id);
     assert(frame_cap);
 
@@ -116,7 +132,6 @@ sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_W
     seL4_CPtr new_frame_cap = cspace_copy_cap(cur_cspace, cur_cspace, frame_cap, seL4_AllRights);
     if (new_frame_cap == (seL4_CPtr)NULL) {
         LOG_ERROR("Failed to copy the capability");
-        frame_free(frame_id);
         return 1;
     }
 
@@ -127,16 +142,14 @@ sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_W
     if (map_page(new_frame_cap, as->vspace, page_id, permissions, seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
         LOG_ERROR("Failed to map page");
         cspace_delete_cap(cur_cspace, new_frame_cap);
-        frame_free(frame_id);
         return 1;
     }
 
     /* Insert the capability into the processes 2-level page table */
-    if (page_directory_insert(as->directory, page_id, new_frame_cap, pt_cap) != 0) {
+    if (page_directory_insert(as->directory, page_id, new_frame_cap, frame_id, pt_cap) != 0) {
         LOG_ERROR("Failed to insert cap into the page table");
         seL4_ARM_Page_Unmap(new_frame_cap);
         cspace_delete_cap(cur_cspace, new_frame_cap);
-        frame_free(frame_id);
         return 1;
     }
 
@@ -144,5 +157,136 @@ sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_W
     assert(frame_table_set_page_id(frame_id, curproc->pid, page_id) == 0);
     assert(frame_table_set_chance(frame_id, FIRST_CHANCE) == 0);
 
+    curproc->p_vmstats.small_maps++;
+    curproc->rss++;
+    return 0;
+}
+
+int
+sos_map_large_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_Word *kvaddr)
+{
+    assert(IS_ALIGNED_LARGE(page_id));
+
+    seL4_Word frame_id = frame_alloc_large(kvaddr);
+    if (frame_id == -1) {
+        LOG_INFO("Unable to allocate a large frame");
+        return 1;
+    }
+
+    seL4_ARM_Page frame_cap = frame_table_get_capability(frame_id);
+    assert(frame_cap);
+
+    /* Copy the capability, as the original is mapped into SOS's address space */
+    seL4_CPtr new_frame_cap = cspace_copy_cap(cur_cspace, cur_cspace, frame_cap, seL4_AllRights);
+    if (new_frame_cap == (seL4_CPtr)NULL) {
+        LOG_ERROR("Failed to copy the capability");
+        frame_free(frame_id);
+        return 1;
+    }
+
+    addrspace *as = curproc->p_addrspace;
+
+    /* Map the large page into the process addrspace */
+    seL4_CPtr pt_cap;
+    if (map_page(new_frame_cap, as->vspace, page_id, permissions, seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
+        LOG_ERROR("Failed to map large page");
+        cspace_delete_cap(cur_cspace, new_frame_cap);
+        frame_free(frame_id);
+        return 1;
+    }
+
+    /* Insert the capability into every entry of the processes 2-level page table the large page covers */
+    if (page_directory_insert_large(as->directory, page_id, new_frame_cap, frame_id, pt_cap) != 0) {
+        LOG_ERROR("Failed to insert cap into the page table");
+        seL4_ARM_Page_Unmap(new_frame_cap);
+        cspace_delete_cap(cur_cspace, new_frame_cap);
+        frame_free(frame_id);
+        return 1;
+    }
+
+    assert(frame_table_set_page_id(frame_id, curproc->pid, page_id) == 0);
+    assert(frame_table_set_chance(frame_id, FIRST_CHANCE) == 0);
+
+    curproc->p_vmstats.large_maps++;
+    curproc->rss += FRAMES_PER_LARGE;
+    return 0;
+}
+
+int
+sos_remap_page(proc *curproc, seL4_Word page_id, unsigned long permissions)
+{
+    assert(IS_ALIGNED_4K(page_id));
+
+    addrspace *as = curproc->p_addrspace;
+    seL4_CPtr cap;
+    if (page_directory_lookup(as->directory, page_id, &cap) != 0) {
+        LOG_ERROR("Failed to find the page");
+        return 1;
+    }
+
+    if (IS_EVICTED(cap) || IS_LARGE(cap)) {
+        LOG_ERROR("Page is not a resident 4K page");
+        return 1;
+    }
+
+    /* The page table already exists, so mapping again only changes the rights */
+    seL4_ARM_Page_Unmap(cap);
+    if (seL4_ARM_Page_Map(cap, as->vspace, page_id, permissions, seL4_ARM_Default_VMAttributes) != 0) {
+        LOG_ERROR("Failed to remap the page");
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+sos_zero_page_init(void)
+{
+    seL4_Word vaddr;
+    if ((zero_page_frame_id = frame_alloc(&vaddr, FRAME_ALLOC_ZERO)) == -1) {
+        LOG_ERROR("Failed to allocate the zero page");
+        return 1;
+    }
+
+    /* The zero page belongs to no process, and is never paged */
+    assert(frame_table_set_chance(zero_page_frame_id, PINNED) == 0);
+    return 0;
+}
+
+int
+sos_map_zero_page(proc *curproc, seL4_Word page_id, unsigned long permissions)
+{
+    assert(IS_ALIGNED_4K(page_id));
+    assert(zero_page_frame_id != -1);
+
+    if (permissions & seL4_CanWrite) {
+        LOG_ERROR("The zero page cannot be mapped writable");
+        return 1;
+    }
+
+    /* Every mapping of the zero page needs its own copy of the cap */
+    seL4_CPtr new_frame_cap = cspace_copy_cap(cur_cspace, cur_cspace, frame_table_get_capability(zero_page_frame_id), seL4_AllRights);
+    if (new_frame_cap == (seL4_CPtr)NULL) {
+        LOG_ERROR("Failed to copy the capability");
+        return 1;
+    }
+
+    addrspace *as = curproc->p_addrspace;
+
+    seL4_CPtr pt_cap;
+    if (map_page(new_frame_cap, as->vspace, page_id, permissions, seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
+        LOG_ERROR("Failed to map the zero page");
+        cspace_delete_cap(cur_cspace, new_frame_cap);
+        return 1;
+    }
+
+    if (page_directory_insert(as->directory, page_id, new_frame_cap, zero_page_frame_id | PTE_ZERO_PAGE, pt_cap) != 0) {
+        LOG_ERROR("Failed to insert cap into the page table");
+        seL4_ARM_Page_Unmap(new_frame_cap);
+        cspace_delete_cap(cur_cspace, new_frame_cap);
+        return 1;
+    }
+
+    curproc->p_vmstats.zero_maps++;
     return 0;
 }
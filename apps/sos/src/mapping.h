@@ -42,9 +42,55 @@ void *map_device(void *paddr, int size);
  * @param curproc, the process to map into
  * @param page_id, the virtual address of the page
  * @param permissions, the permissions of the page
+ * @param flags, frame allocation flags for the new frame
  * @param[out] kvaddr, the sos virtual address to access the physical memory
  * @returns 0 on success, else 1
  */
-int sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_Word *kvaddr);
+int sos_map_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_Word flags, seL4_Word *kvaddr);
+
+/*
+ * Map a frame that has already been allocated into a process address space
+ * @param curproc, the process to map into
+ * @param page_id, the virtual address of the page
+ * @param frame_id, the id of the 4K frame, which is left to the caller on failure
+ * @param permissions, the permissions of the page
+ * @returns 0 on success, else 1
+ */
+int sos_map_frame(proc *curproc, seL4_Word page_id, seL4_Word frame_id, unsigned long permissions);
+
+/*
+ * Create a 64K large page in a process address space
+ * The frame is zero filled.
+ * @param curproc, the process to map into
+ * @param page_id, the 64K aligned virtual address of the page
+ * @param permissions, the permissions of the page
+ * @param[out] kvaddr, the sos virtual address to access the physical memory
+ * @returns 0 on success, else 1
+ */
+int sos_map_large_page(proc *curproc, seL4_Word page_id, unsigned long permissions, seL4_Word *kvaddr);
+
+/*
+ * Change the permissions of a resident 4K page in a process address space
+ * @param curproc, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @param permissions, the new permissions of the page
+ * @returns 0 on success, else 1
+ */
+int sos_remap_page(proc *curproc, seL4_Word page_id, unsigned long permissions);
+
+/*
+ * Allocate the zero page, a frame of zeros shared by every page that has not been written
+ * @returns 0 on success, else 1
+ */
+int sos_zero_page_init(void);
+
+/*
+ * Map the shared zero page into a process address space
+ * @param curproc, the process to map into
+ * @param page_id, the virtual address of the page
+ * @param permissions, the permissions of the page, which must not include write
+ * @returns 0 on success, else 1
+ */
+int sos_map_zero_page(proc *curproc, seL4_Word page_id, unsigned long permissions);
 
 #endif /* _MAPPING_H_ */
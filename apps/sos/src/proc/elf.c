@@ -10,6 +10,7 @@
 
 #include "elf.h"
 
+#include <autoconf.h>
 #include <assert.h>
 #include <cspace/cspace.h>
 #include <elf/elf.h>
@@ -174,12 +175,35 @@ load_segment_into_vspace(proc *curproc, vnode *file, uint64_t offset,
     /* We work a page at a time in the destination vspace. */
     unsigned long pos = 0;
     unsigned long nbytes = 0;
+    unsigned long segment_end = dst + segment_size;
     seL4_Word kdst;
 
+    /* The large page covering the current page, if any */
+    seL4_Word large_start = 0;
+    seL4_Word large_end = 0;
+    seL4_Word large_kvaddr = 0;
+
     while (pos < segment_size) {
         /* Create a mapping inside curproc, and a frame */
         seL4_Word vpage = PAGE_ALIGN_4K(dst);
-        if (sos_map_page(curproc, vpage, permissions, &kdst) != 0) {
+
+        /* Pages entirely overwritten by file data do not need to be zeroed first */
+        seL4_Word flags = FRAME_ALLOC_ZERO;
+        if (vpage == dst && pos + PAGE_SIZE_4K <= file_size)
+            flags = FRAME_ALLOC_NOZERO;
+
+        if (vpage >= large_start && vpage < large_end) {
+            /* Already mapped as part of a large page */
+            kdst = large_kvaddr + (vpage - large_start);
+#ifdef CONFIG_SOS_LARGE_PAGES
+        } else if (IS_ALIGNED_LARGE(vpage) && vpage + LARGE_FRAME_SIZE <= segment_end &&
+                   sos_map_large_page(curproc, vpage, permissions, &kdst) == 0) {
+            /* The segment covers this whole large page */
+            large_start = vpage;
+            large_end = vpage + LARGE_FRAME_SIZE;
+            large_kvaddr = kdst;
+#endif
+        } else if (sos_map_page(curproc, vpage, permissions, flags, &kdst) != 0) {
             LOG_ERROR("Failed to map a page into the process");
             return 1;
         }
@@ -210,10 +234,11 @@ load_segment_into_vspace(proc *curproc, vnode *file, uint64_t offset,
             assert(frame_table_set_chance(frame_id, original_chance) == 0);
         }
 
-        /* Not observable to I-cache yet so flush the frame */
-        seL4_Word frame_id = frame_table_sos_vaddr_to_index(kdst);
+        /* Not observable to I-cache yet so flush the frame, offset into the frame if it is large */
+        seL4_Word frame_id = frame_table_get_head(frame_table_sos_vaddr_to_index(kdst));
         seL4_Word frame_cap = frame_table_get_capability(frame_id);
-        seL4_ARM_Page_Unify_Instruction(frame_cap, 0, PAGE_SIZE_4K);
+        seL4_Word frame_offset = kdst - frame_table_index_to_sos_vaddr(frame_id);
+        seL4_ARM_Page_Unify_Instruction(frame_cap, frame_offset, frame_offset + PAGE_SIZE_4K);
 
         pos += nbytes;
         dst += nbytes;
@@ -33,6 +33,7 @@ static proc *proc_create(void);
 static int proc_next_pid(pid_t *new_pid);
 static int _proc_delete(proc *victim);
 static bool proc_is_waiting(proc *parent, proc *child);
+static int proc_create_thread(proc *new_proc, seL4_CPtr fault_ep, char *name);
 
 pid_t
 proc_bootstrap(void)
@@ -86,10 +87,9 @@ proc_start(char *app_name, seL4_CPtr fault_ep, pid_t parent_pid)
     /* Store new proc */
     sos_procs[new_pid] = new_proc;
 
-    /* Create IPC buffer */
-    seL4_Word paddr = ut_alloc(seL4_PageBits);
-    if (paddr == (seL4_Word)NULL) {
-        LOG_ERROR("Failed to allocate memory for the IPC buffer");
+    /* Create the thread of the process */
+    if (proc_create_thread(new_proc, fault_ep, app_name) != 0) {
+        LOG_ERROR("Failed to create the thread");
         /*
          * We're calling _proc_delete because we dont want parent waiting resuming logic.
          * This applies to all other delete code in this function.
@@ -99,64 +99,6 @@ proc_start(char *app_name, seL4_CPtr fault_ep, pid_t parent_pid)
         proc_destroy(new_proc);
         return -1;
     }
-    
-    /* Allocate IPC buffer */
-    if (cspace_ut_retype_addr(paddr, seL4_ARM_SmallPageObject, seL4_PageBits, cur_cspace, &new_proc->ipc_buffer_cap) != 0) {
-        LOG_ERROR("Failed to retype memory for IPC buffer");
-        _proc_delete(new_proc);
-        proc_destroy(new_proc);
-        return -1;
-    }
-
-    /* Copy the fault endpoint to the user app to enable IPC */
-    seL4_CPtr user_ep_cap = cspace_mint_cap(
-        new_proc->croot, cur_cspace, fault_ep, seL4_AllRights,
-        seL4_CapData_Badge_new(SET_PROCID_BADGE(NEW_EP_BADGE, new_pid))
-    );
-
-    /* Should be the first slot in the space, hack I know */
-    assert(user_ep_cap == 1);
-
-    /* Create a new TCB object */
-    if ((new_proc->tcb_addr = ut_alloc(seL4_TCBBits)) == (seL4_Word)NULL) {
-        LOG_ERROR("Failed to allocate memory for TCB");
-        _proc_delete(new_proc);
-        proc_destroy(new_proc);
-        return -1;
-    }
-    
-    if (cspace_ut_retype_addr(new_proc->tcb_addr, seL4_TCBObject, seL4_TCBBits, cur_cspace, &(new_proc->tcb_cap)) != 0) {
-        LOG_ERROR("Failed to retype memory for TCB");
-        _proc_delete(new_proc);
-        proc_destroy(new_proc);
-        return -1;
-    }
-
-    /* Configure the TCB */
-    if (seL4_TCB_Configure(new_proc->tcb_cap, user_ep_cap, NEW_EP_BADGE_PRIORITY,
-                             new_proc->croot->root_cnode, seL4_NilData,
-                             new_proc->p_addrspace->vspace, seL4_NilData, PROCESS_IPC_BUFFER,
-                             new_proc->ipc_buffer_cap)) {
-        LOG_ERROR("Failed to configure the TCB");
-        _proc_delete(new_proc);
-        proc_destroy(new_proc);
-        return -1;
-    }
-
-    /* Provide a logical name for the thread -- Helpful for debugging */
-#ifdef SEL4_DEBUG_KERNEL
-    seL4_DebugNameThread(new_proc->tcb_cap, app_name);
-#endif
-
-    /* Map in the IPC buffer for the thread */
-    seL4_CPtr pt_cap;
-    if (map_page(new_proc->ipc_buffer_cap, new_proc->p_addrspace->vspace,
-        PROCESS_IPC_BUFFER, seL4_AllRights, seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
-        LOG_ERROR("Failed to map IPC buffer for process");
-        _proc_delete(new_proc);
-        proc_destroy(new_proc);
-        return -1;
-    }
 
     /* Create region for the ipc buffer */
     if (as_define_region(new_proc->p_addrspace, PROCESS_IPC_BUFFER, PAGE_SIZE_4K, seL4_CanRead | seL4_CanWrite) != 0) {
@@ -239,6 +181,103 @@ proc_start(char *app_name, seL4_CPtr fault_ep, pid_t parent_pid)
     return new_pid;
 }
 
+pid_t
+proc_fork(proc *parent, seL4_CPtr fault_ep)
+{
+    pid_t new_pid;
+    pid_t last_pid = curr_pid;
+
+    /* Assign a PID to this proc */
+    if (proc_next_pid(&new_pid) != 0) {
+        LOG_ERROR("Failed to acquire an unused pid");
+        curr_pid = last_pid;
+        return -1;
+    }
+
+    /* Create a process struct */
+    proc *new_proc = proc_create();
+    if (new_proc == NULL) {
+        LOG_ERROR("Failed to create a new process");
+        curr_pid = last_pid;
+        return -1;
+    }
+    new_proc->pid = new_pid;
+    new_proc->ppid = parent->pid;
+
+    /* Store new proc */
+    sos_procs[new_pid] = new_proc;
+
+    /* As in proc_start, _proc_delete skips the parent waiting resuming logic */
+    if (proc_create_thread(new_proc, fault_ep, parent->proc_name) != 0) {
+        LOG_ERROR("Failed to create the thread");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+
+    if (as_copy(parent->p_addrspace, new_proc->p_addrspace) != 0) {
+        LOG_ERROR("Failed to copy the addrspace");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+
+    if (fdtable_copy(parent->file_table, new_proc->file_table) != 0) {
+        LOG_ERROR("Failed to copy the fdtable");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+
+    /* Set the start time */
+    new_proc->stime = time_stamp();
+    new_proc->proc_name = strdup(parent->proc_name);
+    new_proc->rss_soft = parent->rss_soft;
+    new_proc->rss_hard = parent->rss_hard;
+
+    if (list_prepend(parent->children, (void *)new_pid) != 0) {
+        LOG_ERROR("Failed to register process as a child");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+
+    /* The pages are shared copy on write, rather than copied */
+    if (vm_fork(parent, new_proc) != 0) {
+        LOG_ERROR("Failed to share the pages");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+
+    /*
+     * The child returns from the same system call as the parent, with a reply of 0.
+     * The saved pc of a thread blocked in a call is the swi, so the child resumes after it.
+     * The reply is in registers, r1 holds the message info and r2 the first message register.
+     */
+    seL4_UserContext context;
+    if (seL4_TCB_ReadRegisters(parent->tcb_cap, 0, 0, sizeof(context) / sizeof(seL4_Word), &context) != 0) {
+        LOG_ERROR("Failed to read the registers of the parent");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+    context.pc += sizeof(seL4_Word);
+    context.r1 = seL4_MessageInfo_new(0, 0, 0, 1).words[0];
+    context.r2 = 0;
+
+    /* Start the new process */
+    if (seL4_TCB_WriteRegisters(new_proc->tcb_cap, 1, 0, sizeof(context) / sizeof(seL4_Word), &context) != 0) {
+        LOG_ERROR("Failed to start the child");
+        _proc_delete(new_proc);
+        proc_destroy(new_proc);
+        return -1;
+    }
+
+    new_proc->p_state = RUNNING;
+    return new_pid;
+}
+
 int
 proc_delete(proc *victim)
 {
@@ -401,6 +440,10 @@ proc_create(void)
     new_proc->proc_name = NULL;
     new_proc->stime = -1;
     new_proc->kill_flag = FALSE;
+    memset(&new_proc->p_vmstats, 0, sizeof(vm_stats));
+    new_proc->rss = 0;
+    new_proc->rss_soft = 0;
+    new_proc->rss_hard = 0;
 
     return new_proc;
 }
@@ -492,6 +535,21 @@ _proc_delete(proc *victim)
     }
     victim->croot = NULL;
 
+    /* Shared file mappings are written back before their pages are freed */
+    for (seL4_Word i = 0; victim->p_addrspace && i < victim->p_addrspace->nregions; i++) {
+        region *reg = victim->p_addrspace->regions[i];
+        if (reg->vn != NULL && (reg->flags & REGION_SHARED) && vm_unmap(victim, reg->start, reg->end) != 0) {
+            LOG_ERROR("Failed to unmap a shared mapping");
+            return 1;
+        }
+    }
+
+    /* Pages shared copy on write are left to the other processes sharing them */
+    if (victim->p_addrspace && vm_unshare(victim) != 0) {
+        LOG_ERROR("Failed to unshare pages");
+        return 1;
+    }
+
     /* Destroy the addrspace if existing */
     if (victim->p_addrspace && as_destroy(victim->p_addrspace) != 0) {
         LOG_ERROR("Failed to destroy addrspace");
@@ -514,3 +572,72 @@ _proc_delete(proc *victim)
 
     return 0;
 }
+
+/*
+ * Create the thread of a process, with its IPC buffer, endpoint and TCB.
+ * The thread is configured but not started, its resources are released by _proc_delete.
+ * @param new_proc, the process, with a pid and an address space
+ * @param fault_ep, endpoint for IPC
+ * @param name, name of the thread for debugging
+ * @returns 0 on success, else 1
+ */
+static int
+proc_create_thread(proc *new_proc, seL4_CPtr fault_ep, char *name)
+{
+    /* Create IPC buffer */
+    seL4_Word paddr = ut_alloc(seL4_PageBits);
+    if (paddr == (seL4_Word)NULL) {
+        LOG_ERROR("Failed to allocate memory for the IPC buffer");
+        return 1;
+    }
+    
+    /* Allocate IPC buffer */
+    if (cspace_ut_retype_addr(paddr, seL4_ARM_SmallPageObject, seL4_PageBits, cur_cspace, &new_proc->ipc_buffer_cap) != 0) {
+        LOG_ERROR("Failed to retype memory for IPC buffer");
+        return 1;
+    }
+
+    /* Copy the fault endpoint to the user app to enable IPC */
+    seL4_CPtr user_ep_cap = cspace_mint_cap(
+        new_proc->croot, cur_cspace, fault_ep, seL4_AllRights,
+        seL4_CapData_Badge_new(SET_PROCID_BADGE(NEW_EP_BADGE, new_proc->pid))
+    );
+
+    /* Should be the first slot in the space, hack I know */
+    assert(user_ep_cap == 1);
+
+    /* Create a new TCB object */
+    if ((new_proc->tcb_addr = ut_alloc(seL4_TCBBits)) == (seL4_Word)NULL) {
+        LOG_ERROR("Failed to allocate memory for TCB");
+        return 1;
+    }
+    
+    if (cspace_ut_retype_addr(new_proc->tcb_addr, seL4_TCBObject, seL4_TCBBits, cur_cspace, &(new_proc->tcb_cap)) != 0) {
+        LOG_ERROR("Failed to retype memory for TCB");
+        return 1;
+    }
+
+    /* Configure the TCB */
+    if (seL4_TCB_Configure(new_proc->tcb_cap, user_ep_cap, NEW_EP_BADGE_PRIORITY,
+                             new_proc->croot->root_cnode, seL4_NilData,
+                             new_proc->p_addrspace->vspace, seL4_NilData, PROCESS_IPC_BUFFER,
+                             new_proc->ipc_buffer_cap)) {
+        LOG_ERROR("Failed to configure the TCB");
+        return 1;
+    }
+
+    /* Provide a logical name for the thread -- Helpful for debugging */
+#ifdef SEL4_DEBUG_KERNEL
+    seL4_DebugNameThread(new_proc->tcb_cap, name);
+#endif
+
+    /* Map in the IPC buffer for the thread */
+    seL4_CPtr pt_cap;
+    if (map_page(new_proc->ipc_buffer_cap, new_proc->p_addrspace->vspace,
+        PROCESS_IPC_BUFFER, seL4_AllRights, seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
+        LOG_ERROR("Failed to map IPC buffer for process");
+        return 1;
+    }
+
+    return 0;
+}
@@ -26,6 +26,18 @@ typedef enum {
     BLOCKED  /* Blocked on SOS */
 } proc_states;
 
+/* Per process virtual memory statistics */
+typedef struct {
+    seL4_Word faults; /* Number of vm faults taken */
+    seL4_Word small_maps; /* Number of 4K pages mapped */
+    seL4_Word large_maps; /* Number of 64K pages mapped */
+    seL4_Word page_ins; /* Number of page ins from the pagefile */
+    seL4_Word readahead; /* Number of pages read ahead of a page in */
+    seL4_Word soft_faults; /* Faults on resident pages, unmapped to track their references */
+    seL4_Word hard_faults; /* Faults on evicted pages, that read from the pagefile */
+    seL4_Word zero_maps; /* Pages mapped to the shared zero page */
+} vm_stats;
+
 /* Process Struct */
 typedef struct _proc {
     seL4_Word tcb_addr;             /* Physical address of the TCB */
@@ -34,6 +46,10 @@ typedef struct _proc {
     cspace_t *croot;                /* cspace root pointer */
 
     addrspace *p_addrspace;         /* Process address space */
+    vm_stats p_vmstats;             /* Virtual memory statistics */
+    seL4_Word rss;                  /* Resident set size, in 4K frames */
+    seL4_Word rss_soft;             /* Frames held before pages are preferred as victims, 0 for a fair share */
+    seL4_Word rss_hard;             /* Frames held before pages replace each other, 0 for no limit */
     fdtable *file_table;            /* File table */
     list_t *children;               /* Linked list of children */
 
@@ -66,6 +82,16 @@ pid_t proc_bootstrap(void);
  */
 pid_t proc_start(char *app_name, seL4_CPtr fault_ep, pid_t parent_pid);
 
+/*
+ * Fork a process
+ * The child has a copy of the regions and files of the parent, and shares its pages copy on write.
+ * It resumes from the system call the parent is blocked in, with a reply of 0.
+ * @param parent, the process to fork, blocked in a system call
+ * @param fault_ep, endpoint for IPC
+ * @return -1 on error, pid of the child on success
+ */
+pid_t proc_fork(proc *parent, seL4_CPtr fault_ep);
+
 /*
  * Delete a process
  * Remove all data required for the process to run
@@ -14,7 +14,15 @@
 #include <vm/vm.h>
 #include <utils/util.h>
 
+/* Most pages of a buffer pinned for a single vectored read or write */
+#define RW_SEGMENTS 64
+
+/* Most requests of a vectored read or write in flight at once */
+#define RW_WINDOW 16
+
 static int syscall_do_read_write(seL4_Word access_mode, proc *curproc);
+static int read_write_vectored(proc *curproc, file *open_file, seL4_Word access_mode, seL4_Word buf, seL4_Word nbytes);
+static int read_write_by_page(proc *curproc, file *open_file, seL4_Word access_mode, seL4_Word buf, seL4_Word nbytes);
 
 int
 syscall_open(proc *curproc)
@@ -223,6 +231,103 @@ syscall_do_read_write(seL4_Word access_mode, proc *curproc)
         goto message_reply;
     }
 
+    /* Files that take io vectors transfer the whole buffer at once, devices go a page at a time */
+    const vnode_ops *ops = open_file->vn->vn_ops;
+    if ((access_mode == ACCESS_READ && ops->vop_readv != NULL) || (access_mode == ACCESS_WRITE && ops->vop_writev != NULL))
+        result = read_write_vectored(curproc, open_file, access_mode, buf, nbytes);
+    else
+        result = read_write_by_page(curproc, open_file, access_mode, buf, nbytes);
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+/*
+ * Read or write a buffer with vectored operations on the vnode.
+ * The frames of up to RW_SEGMENTS pages of the buffer are pinned, and transferred
+ * by a single operation with a segment for each page.
+ * @param curproc, the process requesting
+ * @param open_file, the file
+ * @param access_mode, operation type
+ * @param buf, the buffer in the process
+ * @param nbytes, the size of the buffer
+ * @returns nbytes transferred on success, else -1
+ */
+static int
+read_write_vectored(proc *curproc, file *open_file, seL4_Word access_mode, seL4_Word buf, seL4_Word nbytes)
+{
+    vnode *vn = open_file->vn;
+    uiovec iovs[RW_SEGMENTS];
+    seL4_Word frame_ids[RW_SEGMENTS];
+    enum chance_type chances[RW_SEGMENTS];
+    seL4_Word nbytes_remaining = nbytes;
+
+    while (nbytes_remaining > 0) {
+        /* Pin the frames first, so translating a later page cannot page out an earlier one */
+        seL4_Word nsegs = 0;
+        seL4_Word bytes_this_round = 0;
+        bool translated = TRUE;
+        while (nsegs < RW_SEGMENTS && bytes_this_round < nbytes_remaining) {
+            seL4_Word vaddr = buf + bytes_this_round;
+            seL4_Word kvaddr;
+            if (!(kvaddr = vaddr_to_sos_vaddr(curproc, vaddr, !access_mode))) {
+                LOG_ERROR("Failed to translate virtual address to sos virtual");
+                translated = FALSE;
+                break;
+            }
+
+            frame_ids[nsegs] = frame_table_sos_vaddr_to_index(kvaddr);
+            assert(frame_table_get_chance(frame_ids[nsegs], &chances[nsegs]) == 0);
+            assert(frame_table_set_chance(frame_ids[nsegs], PINNED) == 0);
+
+            iovs[nsegs].uiov_base = (char *)kvaddr;
+            iovs[nsegs].uiov_len = MIN((PAGE_ALIGN_4K(vaddr) + PAGE_SIZE_4K) - vaddr, nbytes_remaining - bytes_this_round);
+            iovs[nsegs].uiov_pos = open_file->fp + bytes_this_round;
+            bytes_this_round += iovs[nsegs++].uiov_len;
+        }
+
+        int result = -1;
+        if (translated) {
+            result = (access_mode == ACCESS_READ) ?
+                vn->vn_ops->vop_readv(vn, iovs, nsegs, RW_WINDOW) :
+                vn->vn_ops->vop_writev(vn, iovs, nsegs, RW_WINDOW);
+        }
+
+        /* Reset the chances in reverse, a frame pinned twice, such as the zero page, recorded PINNED the second time */
+        for (seL4_Word i = nsegs; i > 0; i--)
+            assert(frame_table_set_chance(frame_ids[i - 1], chances[i - 1]) == 0);
+
+        if (result == -1) {
+            LOG_ERROR("Failed to %s the vnode", access_mode == ACCESS_READ ? "read from" : "write to");
+            return -1; /* Return failure, rather than the ammount succesfully transferred */
+        }
+
+        nbytes_remaining -= result;
+        buf += result;
+        open_file->fp += result;
+
+        /* A short read is the end of the file */
+        if (result != bytes_this_round)
+            break;
+    }
+
+    return nbytes - nbytes_remaining;
+}
+
+/*
+ * Read or write a buffer one page at a time
+ * @param curproc, the process requesting
+ * @param open_file, the file
+ * @param access_mode, operation type
+ * @param buf, the buffer in the process
+ * @param nbytes, the size of the buffer
+ * @returns nbytes transferred on success, else -1
+ */
+static int
+read_write_by_page(proc *curproc, file *open_file, seL4_Word access_mode, seL4_Word buf, seL4_Word nbytes)
+{
+    int result = -1;
     vnode *vn = open_file->vn;
     /* The number of bytes in the transaction this round */
     seL4_Word bytes_this_round = 0;
@@ -232,8 +337,7 @@ syscall_do_read_write(seL4_Word access_mode, proc *curproc)
     while (nbytes_remaining > 0) {
         if (!(kvaddr = vaddr_to_sos_vaddr(curproc, buf, !access_mode))) {
             LOG_ERROR("Failed to translate virtual address to sos virtual");
-            result = -1; /* Return failure, rather than the ammount succesfully written */
-            goto message_reply;
+            return -1; /* Return failure, rather than the ammount succesfully written */
         }
 
         /*
@@ -259,7 +363,7 @@ syscall_do_read_write(seL4_Word access_mode, proc *curproc)
             if ((result = vn->vn_ops->vop_read(vn, &iov)) == -1) {
                 LOG_ERROR("Failed to read from the vnode");
                 assert(frame_table_set_chance(frame_id, original_chance) == 0);
-                goto message_reply;
+                return -1;
             }
 
             /*
@@ -270,6 +374,7 @@ syscall_do_read_write(seL4_Word access_mode, proc *curproc)
              */
             if (result != bytes_this_round) {
                 LOG_INFO("Early exit, returned bytes %d requested %d", result, bytes_this_round);
+                assert(frame_table_set_chance(frame_id, original_chance) == 0);
                 nbytes_remaining -= result;
                 open_file->fp += result;
                 break;
@@ -278,7 +383,7 @@ syscall_do_read_write(seL4_Word access_mode, proc *curproc)
             if ((result = vn->vn_ops->vop_write(vn, &iov)) == -1) {
                 LOG_ERROR("Failed to write to the vnode");
                 assert(frame_table_set_chance(frame_id, original_chance) == 0);
-                goto message_reply;
+                return -1;
             }
         }
 
@@ -292,9 +397,5 @@ syscall_do_read_write(seL4_Word access_mode, proc *curproc)
     }
 
     /* Return the total amount of data sent / received */
-    result = nbytes - nbytes_remaining;
-
-    message_reply:
-        seL4_SetMR(0, result);
-        return 1;
+    return nbytes - nbytes_remaining;
 }
@@ -39,6 +39,14 @@ syscall_proc_create(proc *curproc)
         return 1; /* nwords in message */
 }
 
+int
+syscall_proc_fork(proc *curproc)
+{
+    LOG_SYSCALL(curproc->pid, "sos_process_fork()");
+    seL4_SetMR(0, (seL4_Word)proc_fork(curproc, _sos_ipc_ep_cap));
+    return 1;
+}
+
 int
 syscall_proc_delete(proc *curproc)
 {
@@ -51,4 +51,11 @@ int syscall_proc_wait(proc *curproc);
  */
 int syscall_exit(proc *curproc);
 
+/*
+ * Syscall to fork the current process
+ * The child returns from the same syscall with 0
+ * @returns nwords in return message
+ */
+int syscall_proc_fork(proc *curproc);
+
 #endif /* _SYS_PROC_H_ */
@@ -6,8 +6,19 @@
 
 #include "sys_vm.h"
 
+#include <fcntl.h>
 #include <proc/proc.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <utils/util.h>
+#include <vm/frametable.h>
+#include <vm/layout.h>
+#include <vm/swap.h>
+
+static seL4_Word prot_to_permissions(int prot);
+static bool range_is_mapped(addrspace *as, seL4_Word start, seL4_Word end, bool covered);
+static bool range_is_shareable(addrspace *as, seL4_Word start, seL4_Word end);
+static bool range_is_covered(addrspace *as, seL4_Word start, seL4_Word end);
 
 int
 syscall_brk(proc *curproc)
@@ -26,6 +37,13 @@ syscall_brk(proc *curproc)
             goto brk_epilogue;
         }
 
+        /* Shrinking the heap releases the pages past the new end, as MADV_DONTNEED would */
+        if (newbrk >= heap_s && newbrk < *heap_e &&
+            vm_unmap(curproc, ROUND_UP(newbrk, PAGE_SIZE_4K), ROUND_UP(*heap_e, PAGE_SIZE_4K)) != 0) {
+            LOG_ERROR("Failed to release the heap");
+            goto brk_epilogue;
+        }
+
         *heap_e = newbrk;
     }
 
@@ -34,3 +52,504 @@ syscall_brk(proc *curproc)
         seL4_SetMR(0, *heap_e);
         return 1;
 }
+
+int
+syscall_vm_stats(proc *curproc)
+{
+    LOG_SYSCALL(curproc->pid, "sos_vm_stats()");
+
+    seL4_SetMR(0, curproc->p_vmstats.faults);
+    seL4_SetMR(1, curproc->p_vmstats.small_maps);
+    seL4_SetMR(2, curproc->p_vmstats.large_maps);
+    seL4_SetMR(3, curproc->p_vmstats.page_ins);
+    seL4_SetMR(4, curproc->p_vmstats.readahead);
+    seL4_SetMR(5, curproc->p_vmstats.soft_faults);
+    seL4_SetMR(6, curproc->p_vmstats.hard_faults);
+    seL4_SetMR(7, curproc->p_vmstats.zero_maps);
+    seL4_SetMR(8, curproc->rss);
+
+    /* The frame cache is shared by every process */
+    frame_cache_stats cache;
+    frame_cache_get_stats(&cache);
+    seL4_SetMR(9, cache.size);
+    seL4_SetMR(10, cache.zeroed);
+    seL4_SetMR(11, cache.low_watermark);
+    seL4_SetMR(12, cache.high_watermark);
+    seL4_SetMR(13, cache.hits);
+    seL4_SetMR(14, cache.misses);
+    seL4_SetMR(15, cache.releases);
+    seL4_SetMR(16, cache.zero_hits);
+    return 17;
+}
+
+int
+syscall_swap_stats(proc *curproc)
+{
+    seL4_Word index = seL4_GetMR(1);
+
+    LOG_SYSCALL(curproc->pid, "sos_swap_stats(%d)", index);
+
+    swap_stats stats;
+    if (swap_get_stats(index, &stats) != 0) {
+        seL4_SetMR(0, -1);
+        return 1;
+    }
+
+    seL4_SetMR(0, 0);
+    seL4_SetMR(1, stats.priority);
+    seL4_SetMR(2, stats.slots);
+    seL4_SetMR(3, stats.used);
+    seL4_SetMR(4, stats.allocs);
+    seL4_SetMR(5, stats.reads);
+    seL4_SetMR(6, stats.writes);
+    seL4_SetMR(7, stats.errors);
+    seL4_SetMR(8, stats.limit);
+
+    /* Pack the name into the words that follow */
+    seL4_Word name[SWAP_NAME_LEN / sizeof(seL4_Word)];
+    memcpy(name, stats.name, SWAP_NAME_LEN);
+    for (seL4_Word i = 0; i < ARRAY_SIZE(name); i++)
+        seL4_SetMR(9 + i, name[i]);
+
+    return 9 + ARRAY_SIZE(name);
+}
+
+int
+syscall_rss_limit(proc *curproc)
+{
+    int result = -1;
+
+    pid_t pid = seL4_GetMR(1);
+    seL4_Word soft = seL4_GetMR(2);
+    seL4_Word hard = seL4_GetMR(3);
+
+    LOG_SYSCALL(curproc->pid, "sos_rss_limit(%d, %u, %u)", pid, soft, hard);
+
+    /* Only the limits of the caller and its children can be set */
+    if (pid != curproc->pid && !proc_is_child(curproc, pid)) {
+        LOG_ERROR("%d is not the calling proc or its child", pid);
+        goto message_reply;
+    }
+
+    if (hard != 0 && soft > hard) {
+        LOG_ERROR("Soft limit is above the hard limit");
+        goto message_reply;
+    }
+
+    /* The hard limit is enforced on the next mapping, each one paging out a page of the process until it is met */
+    proc *target = get_proc(pid);
+    assert(target != NULL);
+    target->rss_soft = soft;
+    target->rss_hard = hard;
+    result = 0;
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+int
+syscall_mmap(proc *curproc)
+{
+    seL4_Word result = (seL4_Word)NULL;
+    addrspace *as = curproc->p_addrspace;
+
+    seL4_Word addr = seL4_GetMR(1);
+    seL4_Word length = seL4_GetMR(2);
+    int prot = seL4_GetMR(3);
+    int flags = seL4_GetMR(4);
+    int fd = seL4_GetMR(5);
+    seL4_Word offset = seL4_GetMR(6);
+
+    LOG_SYSCALL(curproc->pid, "mmap(%p, %u, %d, %d, %d, %u)", (void *)addr, length, prot, flags, fd, offset);
+
+    if (length == 0 || length > PROCESS_MMAP_TOP || !IS_ALIGNED_4K(offset) ||
+        !(flags & (MAP_SHARED | MAP_PRIVATE))) {
+        LOG_ERROR("Invalid mapping");
+        goto message_reply;
+    }
+    length = ROUND_UP(length, PAGE_SIZE_4K);
+
+    /* A file mapping reads from the file, and a shared writable one writes back to it */
+    vnode *vn = NULL;
+    fmode_t mode = O_RDONLY;
+    seL4_Word file_size = 0;
+    if (!(flags & MAP_ANONYMOUS)) {
+        file *open_file;
+        if (fdtable_get(curproc->file_table, fd, &open_file) != 0) {
+            LOG_ERROR("Invalid fd %d", fd);
+            goto message_reply;
+        }
+
+        if (open_file->mode == O_WRONLY ||
+            ((flags & MAP_SHARED) && (prot & PROT_WRITE) && open_file->mode != O_RDWR)) {
+            LOG_ERROR("File is not open for the access");
+            goto message_reply;
+        }
+
+        /* The console is a stream, only files read at any position can be mapped */
+        vn = open_file->vn;
+        if (vn->vn_ops->vop_read_batch == NULL) {
+            LOG_ERROR("File cannot be mapped");
+            goto message_reply;
+        }
+
+        sos_stat_t *stat;
+        if (vn->vn_ops->vop_stat(vn, &stat) != 0) {
+            LOG_ERROR("Failed to stat the file");
+            goto message_reply;
+        }
+        file_size = stat->st_size;
+        free(stat);
+
+        /* A private mapping never writes to the file */
+        if (flags & MAP_SHARED)
+            mode = open_file->mode;
+    }
+
+    /* The mapping goes at the hint if it is free, else in the highest gap it fits in */
+    seL4_Word start = addr;
+    if (addr == 0 || !IS_ALIGNED_4K(addr) || addr + length > PROCESS_MMAP_TOP || addr + length < addr ||
+        as_region_collision_check(as, NULL, addr, addr + length) != 0) {
+        if (flags & MAP_FIXED) {
+            LOG_ERROR("Fixed mapping is not free");
+            goto message_reply;
+        }
+
+        if (as_find_free(as, length, &start) != 0)
+            goto message_reply;
+    }
+
+    region *reg = as_create_region(start, length, prot_to_permissions(prot));
+    if (reg == NULL)
+        goto message_reply;
+
+    reg->flags = REGION_MMAP | ((flags & MAP_SHARED) ? REGION_SHARED : 0);
+    if (vn != NULL) {
+        if (vfs_dup(vn, mode) != 0) {
+            as_destroy_region(reg);
+            goto message_reply;
+        }
+
+        reg->vn = vn;
+        reg->mode = mode;
+        reg->offset = offset;
+        reg->file_size = file_size;
+    }
+
+    if (as_add_region(as, reg) != 0) {
+        as_destroy_region(reg);
+        goto message_reply;
+    }
+
+    result = start;
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+int
+syscall_munmap(proc *curproc)
+{
+    int result = -1;
+    addrspace *as = curproc->p_addrspace;
+
+    seL4_Word addr = seL4_GetMR(1);
+    seL4_Word length = seL4_GetMR(2);
+
+    LOG_SYSCALL(curproc->pid, "munmap(%p, %u)", (void *)addr, length);
+
+    seL4_Word end = ROUND_UP(addr + length, PAGE_SIZE_4K);
+    if (!IS_ALIGNED_4K(addr) || length == 0 || end <= addr) {
+        LOG_ERROR("Invalid range");
+        goto message_reply;
+    }
+
+    if (!range_is_mapped(as, addr, end, FALSE)) {
+        LOG_ERROR("Range holds a region not made by mmap");
+        goto message_reply;
+    }
+
+    /* The regions are split first, so a failure leaves every page in place */
+    if (as_split_range(as, addr, end) != 0 || vm_unmap(curproc, addr, end) != 0) {
+        LOG_ERROR("Failed to unmap the range");
+        goto message_reply;
+    }
+
+    as_remove_range(as, addr, end);
+    result = 0;
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+int
+syscall_mprotect(proc *curproc)
+{
+    int result = -1;
+    addrspace *as = curproc->p_addrspace;
+
+    seL4_Word addr = seL4_GetMR(1);
+    seL4_Word length = seL4_GetMR(2);
+    int prot = seL4_GetMR(3);
+
+    LOG_SYSCALL(curproc->pid, "mprotect(%p, %u, %d)", (void *)addr, length, prot);
+
+    seL4_Word end = ROUND_UP(addr + length, PAGE_SIZE_4K);
+    if (!IS_ALIGNED_4K(addr) || length == 0 || end <= addr) {
+        LOG_ERROR("Invalid range");
+        goto message_reply;
+    }
+
+    if (!range_is_mapped(as, addr, end, TRUE)) {
+        LOG_ERROR("Range is not covered by regions made by mmap");
+        goto message_reply;
+    }
+
+    /* A shared mapping is only writable through a reference that can write to the file */
+    seL4_Word permissions = prot_to_permissions(prot);
+    seL4_Word first;
+    seL4_Word nregions = as_range_regions(as, addr, end, &first);
+    for (seL4_Word i = first; i < first + nregions; i++) {
+        region *reg = as->regions[i];
+        if (reg->vn != NULL && (reg->flags & REGION_SHARED) && reg->mode == O_RDONLY &&
+            (permissions & seL4_CanWrite)) {
+            LOG_ERROR("File is not open for writing");
+            goto message_reply;
+        }
+    }
+
+    if (as_split_range(as, addr, end) != 0) {
+        LOG_ERROR("Failed to split the regions");
+        goto message_reply;
+    }
+
+    nregions = as_range_regions(as, addr, end, &first);
+    for (seL4_Word i = first; i < first + nregions; i++)
+        as->regions[i]->permissions = permissions;
+
+    if (vm_protect(curproc, addr, end) != 0) {
+        LOG_ERROR("Failed to apply the permissions");
+        goto message_reply;
+    }
+
+    result = 0;
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+int
+syscall_share_vm(proc *curproc)
+{
+    int result = -1;
+
+    seL4_Word addr = seL4_GetMR(1);
+    seL4_Word size = seL4_GetMR(2);
+    bool writable = (seL4_GetMR(3) != 0);
+
+    LOG_SYSCALL(curproc->pid, "sos_share_vm(%p, %u, %d)", (void *)addr, size, writable);
+
+    if (!IS_ALIGNED_4K(addr) || !IS_ALIGNED_4K(size) || size == 0 || addr + size <= addr) {
+        LOG_ERROR("Invalid range");
+        goto message_reply;
+    }
+
+    if (!range_is_shareable(curproc->p_addrspace, addr, addr + size)) {
+        LOG_ERROR("Range is not covered by writable anonymous memory");
+        goto message_reply;
+    }
+
+    for (seL4_Word page_id = addr; page_id < addr + size; page_id += PAGE_SIZE_4K) {
+        if (vm_share(curproc, page_id, writable) != 0) {
+            LOG_ERROR("Failed to share %p", (void *)page_id);
+            goto message_reply;
+        }
+    }
+
+    result = 0;
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+int
+syscall_madvise(proc *curproc)
+{
+    int result = -1;
+    addrspace *as = curproc->p_addrspace;
+
+    seL4_Word addr = seL4_GetMR(1);
+    seL4_Word length = seL4_GetMR(2);
+    int advice = seL4_GetMR(3);
+
+    LOG_SYSCALL(curproc->pid, "madvise(%p, %u, %d)", (void *)addr, length, advice);
+
+    seL4_Word end = ROUND_UP(addr + length, PAGE_SIZE_4K);
+    if (!IS_ALIGNED_4K(addr) || length == 0 || end <= addr) {
+        LOG_ERROR("Invalid range");
+        goto message_reply;
+    }
+
+    if (!range_is_covered(as, addr, end)) {
+        LOG_ERROR("Range is not covered by regions");
+        goto message_reply;
+    }
+
+    seL4_Word first;
+    seL4_Word nregions = as_range_regions(as, addr, end, &first);
+    switch (advice) {
+        /* Access patterns apply to the whole of each region the range overlaps */
+        case MADV_NORMAL:
+        case MADV_SEQUENTIAL:
+        case MADV_RANDOM:
+            for (seL4_Word i = first; i < first + nregions; i++) {
+                region *reg = as->regions[i];
+                reg->flags &= ~(REGION_SEQUENTIAL | REGION_RANDOM);
+                if (advice == MADV_SEQUENTIAL)
+                    reg->flags |= REGION_SEQUENTIAL;
+                else if (advice == MADV_RANDOM)
+                    reg->flags |= REGION_RANDOM;
+            }
+            break;
+
+        case MADV_WILLNEED:
+            if (vm_prefault(curproc, addr, end) != 0) {
+                LOG_ERROR("Failed to page in the range");
+                goto message_reply;
+            }
+            break;
+
+        /*
+         * Anonymous memory reads as zeros again, a file mapping is read again from its file.
+         * The regions of the ELF are loaded up front and have no file to read again, so only the heap,
+         * the stack and mappings made by mmap can be released.
+         */
+        case MADV_DONTNEED:
+            for (seL4_Word i = first; i < first + nregions; i++) {
+                region *reg = as->regions[i];
+                if (reg != as->region_heap && reg != as->region_stack && !(reg->flags & REGION_MMAP)) {
+                    LOG_ERROR("Range includes a region that cannot be released");
+                    goto message_reply;
+                }
+            }
+
+            if (vm_unmap(curproc, addr, end) != 0) {
+                LOG_ERROR("Failed to release the range");
+                goto message_reply;
+            }
+            break;
+
+        default:
+            LOG_ERROR("Unknown advice");
+            goto message_reply;
+    }
+
+    result = 0;
+
+    message_reply:
+        seL4_SetMR(0, result);
+        return 1;
+}
+
+/*
+ * Convert PROT_ flags to the permissions of a region, pages cannot be mapped write or execute only
+ * @param prot, the PROT_ flags
+ * @returns the permissions
+ */
+static seL4_Word
+prot_to_permissions(int prot)
+{
+    seL4_Word permissions = 0;
+    if (prot & (PROT_READ | PROT_EXEC))
+        permissions |= seL4_CanRead;
+    if (prot & PROT_WRITE)
+        permissions |= seL4_CanRead | seL4_CanWrite;
+
+    return permissions;
+}
+
+/*
+ * Check that every region overlapping a range was made by mmap
+ * @param as, the address space
+ * @param start, the start of the range
+ * @param end, the end of the range
+ * @param covered, TRUE if the regions must also cover the whole range
+ * @returns TRUE if the range is mapped, else FALSE
+ */
+static bool
+range_is_mapped(addrspace *as, seL4_Word start, seL4_Word end, bool covered)
+{
+    seL4_Word first;
+    seL4_Word nregions = as_range_regions(as, start, end, &first);
+    seL4_Word next = start;
+
+    for (seL4_Word i = first; i < first + nregions; i++) {
+        region *reg = as->regions[i];
+        if (!(reg->flags & REGION_MMAP))
+            return FALSE;
+
+        /* A gap before the region */
+        if (covered && reg->start > next)
+            return FALSE;
+
+        next = reg->end;
+    }
+
+    return !covered || next >= end;
+}
+
+/*
+ * Check that a range is covered by regions of anonymous memory that can be read and written
+ * @param as, the address space
+ * @param start, the start of the range
+ * @param end, the end of the range
+ * @returns TRUE if the range can be shared, else FALSE
+ */
+static bool
+range_is_shareable(addrspace *as, seL4_Word start, seL4_Word end)
+{
+    seL4_Word first;
+    seL4_Word nregions = as_range_regions(as, start, end, &first);
+    seL4_Word next = start;
+
+    for (seL4_Word i = first; i < first + nregions; i++) {
+        region *reg = as->regions[i];
+        if (reg->start > next || reg->vn != NULL || (reg->permissions & (seL4_CanRead | seL4_CanWrite)) !=
+            (seL4_CanRead | seL4_CanWrite))
+            return FALSE;
+
+        next = reg->end;
+    }
+
+    return next >= end;
+}
+
+/*
+ * Check that a range is covered by regions, of any kind
+ * @param as, the address space
+ * @param start, the start of the range
+ * @param end, the end of the range
+ * @returns TRUE if the range is covered, else FALSE
+ */
+static bool
+range_is_covered(addrspace *as, seL4_Word start, seL4_Word end)
+{
+    seL4_Word first;
+    seL4_Word nregions = as_range_regions(as, start, end, &first);
+    seL4_Word next = start;
+
+    for (seL4_Word i = first; i < first + nregions; i++) {
+        region *reg = as->regions[i];
+        if (reg->start > next)
+            return FALSE;
+
+        next = reg->end;
+    }
+
+    return next >= end;
+}
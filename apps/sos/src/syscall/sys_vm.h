@@ -16,4 +16,73 @@
  */
 int syscall_brk(proc *curproc);
 
+/*
+ * Syscall for retrieving the virtual memory statistics of the calling process
+ * @returns nwords in return message
+ */
+int syscall_vm_stats(proc *curproc);
+
+/*
+ * Syscall for retrieving the statistics of a swap backend
+ * msg(1) index of the backend
+ * @returns nwords in return message
+ */
+int syscall_swap_stats(proc *curproc);
+
+/*
+ * Syscall for setting the resident set limits of a process
+ * msg(1) pid of the caller or one of its children
+ * msg(2) soft limit in frames
+ * msg(3) hard limit in frames
+ * @returns nwords in return message
+ */
+int syscall_rss_limit(proc *curproc);
+
+/*
+ * Syscall for mapping anonymous memory or a file into the calling process
+ * msg(1) address hint, the mapping goes there if it is page aligned and free
+ * msg(2) length in bytes
+ * msg(3) PROT_ flags
+ * msg(4) MAP_ flags
+ * msg(5) fd of the file, unless MAP_ANONYMOUS
+ * msg(6) page aligned offset into the file
+ * @returns nwords in return message
+ */
+int syscall_mmap(proc *curproc);
+
+/*
+ * Syscall for unmapping a range of mappings made by mmap
+ * msg(1) page aligned start of the range
+ * msg(2) length in bytes
+ * @returns nwords in return message
+ */
+int syscall_munmap(proc *curproc);
+
+/*
+ * Syscall for changing the permissions of a range of mappings made by mmap
+ * msg(1) page aligned start of the range
+ * msg(2) length in bytes
+ * msg(3) PROT_ flags
+ * @returns nwords in return message
+ */
+int syscall_mprotect(proc *curproc);
+
+/*
+ * Syscall for sharing a range of memory with the other processes sharing the same addresses
+ * msg(1) page aligned start of the range
+ * msg(2) page aligned size in bytes
+ * msg(3) non zero if the other processes may write to the range
+ * @returns nwords in return message
+ */
+int syscall_share_vm(proc *curproc);
+
+/*
+ * Syscall for advising how the calling process will use a range of its memory
+ * msg(1) page aligned start of the range
+ * msg(2) length in bytes
+ * msg(3) MADV_ advice
+ * @returns nwords in return message
+ */
+int syscall_madvise(proc *curproc);
+
 #endif /* _SYS_VM_H_ */
@@ -32,6 +32,15 @@ static int (*syscall_table[])(proc *) = {
     syscall_proc_status,
     syscall_proc_wait,
     syscall_exit,
+    syscall_vm_stats,
+    syscall_swap_stats,
+    syscall_rss_limit,
+    syscall_mmap,
+    syscall_munmap,
+    syscall_mprotect,
+    syscall_proc_fork,
+    syscall_share_vm,
+    syscall_madvise,
 };
 
 void
@@ -8,8 +8,13 @@
 
 #include <assert.h>
 #include <clock/clock.h>
+#include <stdlib.h>
 #include <utils/time.h>
+#include <vm/addrspace.h>
 #include <vm/frametable.h>
+#include <vm/layout.h>
+#include <vm/pagefile_map.h>
+#include <vm/swap.h>
 
 #define verbose 5
 #include <sys/debug.h>
@@ -66,7 +71,7 @@ test_m2(void)
     /* Test 1: Allocate a frame and test read & write */
     seL4_Word frame_id;
     seL4_Word vaddr;
-    frame_id = frame_alloc(&vaddr);
+    frame_id = frame_alloc(&vaddr, FRAME_ALLOC_ZERO);
     assert(vaddr);
 
     /* Test you can touch the page */
@@ -84,7 +89,7 @@ test_m2(void)
     /* Test 2: Allocate 10 pages and make sure you can touch them all */
     for (int i = 0; i < 10; i++) {
         /* Allocate a page */
-        frame_id = frame_alloc(&vaddr);
+        frame_id = frame_alloc(&vaddr, FRAME_ALLOC_ZERO);
         assert(vaddr);
 
         /* Test you can touch the page  */
@@ -98,7 +103,7 @@ test_m2(void)
     dprintf(0, "Test 2 Passed\n");
 
     /* Test 3: Allocate then Free */
-    frame_id = frame_alloc(&vaddr);
+    frame_id = frame_alloc(&vaddr, FRAME_ALLOC_ZERO);
     assert(vaddr);
 
     /* Test you can touch the page */
@@ -111,7 +116,7 @@ test_m2(void)
     /* Test 4 Test that you never run out of memory if you always free frames. */
     for (int i = 0; i < 1000000; i++) {
         /* Allocate a page */
-        seL4_Word frame_id = frame_alloc(&vaddr);
+        seL4_Word frame_id = frame_alloc(&vaddr, FRAME_ALLOC_ZERO);
         assert(vaddr != 0);
 
         /* Test you can touch the page  */
@@ -130,7 +135,7 @@ test_m2(void)
     /* Test 5 Test that watermarking works */
     int frames[65];
     for (int i = 0; i < 65; i++) {
-        frames[i] = frame_alloc(&vaddr);
+        frames[i] = frame_alloc(&vaddr, FRAME_ALLOC_ZERO);
         assert(vaddr != 0);
 
         /* Test you can touch the page  */
@@ -146,7 +151,7 @@ test_m2(void)
     /* Test 5: Test that you eventually run out of memory gracefully, and doesn't crash */
     while (1) {
         /* Allocate a page */
-        seL4_Word frame_id = frame_alloc(&vaddr);
+        seL4_Word frame_id = frame_alloc(&vaddr, FRAME_ALLOC_ZERO);
         if (vaddr == (seL4_Word)NULL) {
             printf("Out of memory!\n");
             break;
@@ -167,6 +172,158 @@ test_m2(void)
     dprintf(0, "All tests pass, you are awesome! :)\n");
 }
 
+/* Number of free and allocate pairs timed at each occupancy */
+#define PAGEFILE_BENCH_OPS 100000
+
+/* Pagefile slot allocator benchmark */
+void
+test_pagefile_map(void)
+{
+    const seL4_Word occupancy[] = {10, 50, 95};
+    seL4_Word nslots = PAGEFILE_MAX_PAGES;
+
+    pagefile_map map;
+    seL4_Word *mem = malloc(pagefile_map_bytes(nslots));
+    seL4_Word *slots = malloc(nslots * sizeof(seL4_Word));
+    assert(mem && slots);
+
+    for (int i = 0; i < ARRAY_SIZE(occupancy); i++) {
+        assert(pagefile_map_init(&map, mem, nslots) == 0);
+
+        /* Fill the map to the occupancy being measured */
+        seL4_Word used = (nslots * occupancy[i]) / 100;
+        for (seL4_Word j = 0; j < used; j++)
+            assert(pagefile_map_alloc(&map, &slots[j]) == 0);
+
+        /* Churn random slots, as evictions and page ins do */
+        timestamp_t start = time_stamp();
+        for (int j = 0; j < PAGEFILE_BENCH_OPS; j++) {
+            seL4_Word victim = rand() % used;
+            pagefile_map_free(&map, slots[victim]);
+            assert(pagefile_map_alloc(&map, &slots[victim]) == 0);
+        }
+        timestamp_t elapsed = time_stamp() - start;
+
+        pagefile_map_stats stats;
+        pagefile_map_get_stats(&map, &stats);
+        assert(stats.used == used);
+
+        dprintf(0, "Pagefile map at %d%% occupancy: %d free/alloc pairs in %lld us\n",
+            occupancy[i], PAGEFILE_BENCH_OPS, elapsed);
+    }
+
+    /* A full map fails gracefully */
+    assert(pagefile_map_init(&map, mem, nslots) == 0);
+    for (seL4_Word j = 0; j < nslots; j++)
+        assert(pagefile_map_alloc(&map, &slots[j]) == 0);
+
+    seL4_Word slot;
+    assert(pagefile_map_alloc(&map, &slot) == 1);
+
+    free(slots);
+    free(mem);
+    dprintf(0, "Pagefile map benchmark complete\n");
+}
+
+/* Swap space round trip through the memory backend, which needs no NFS traffic */
+void
+test_swap(void)
+{
+    swap_stats before, after;
+    if (swap_get_stats(0, &before) != 0 || before.priority != SWAP_PRIORITY_MEMORY) {
+        dprintf(0, "Swap test skipped, swapping to memory is not configured\n");
+        return;
+    }
+
+    /* Fill the slots of the memory backend left by the pager, growing it to its cap */
+    seL4_Word npages = before.limit - before.used;
+    seL4_Word *slots = malloc(npages * sizeof(seL4_Word));
+    seL4_Word *page = malloc(PAGE_SIZE_4K);
+    assert(slots && page);
+
+    /* The highest priority backend is filled first */
+    for (seL4_Word i = 0; i < npages; i++) {
+        assert(swap_alloc(&slots[i]) == 0);
+        for (seL4_Word j = 0; j < PAGE_SIZE_4K / sizeof(seL4_Word); j++)
+            page[j] = (i << 16) ^ j;
+
+        uiovec iov = {.uiov_base = page, .uiov_len = PAGE_SIZE_4K, .uiov_pos = slots[i] * PAGE_SIZE_4K};
+        assert(swap_write_batch(&iov, 1, 1) == 0);
+    }
+
+    swap_get_stats(0, &after);
+    assert(after.used == after.limit && after.slots == after.limit);
+    assert(after.writes - before.writes == npages);
+    dprintf(0, "Test 1 Passed\n");
+
+    /* Once full, slots come from the next priority */
+    seL4_Word spill;
+    if (swap_alloc(&spill) == 0) {
+        swap_get_stats(0, &after);
+        assert(after.used == after.limit);
+        swap_free(spill);
+    }
+    dprintf(0, "Test 2 Passed\n");
+
+    /* Every page reads back as written */
+    for (seL4_Word i = 0; i < npages; i++) {
+        uiovec iov = {.uiov_base = page, .uiov_len = PAGE_SIZE_4K, .uiov_pos = slots[i] * PAGE_SIZE_4K};
+        assert(swap_read_batch(&iov, 1, 1) == 0);
+        for (seL4_Word j = 0; j < PAGE_SIZE_4K / sizeof(seL4_Word); j++)
+            assert(page[j] == ((i << 16) ^ j));
+
+        swap_free(slots[i]);
+    }
+
+    swap_get_stats(0, &after);
+    assert(after.used == before.used);
+    assert(after.reads - before.reads == npages);
+    dprintf(0, "Test 3 Passed\n");
+
+    free(page);
+    free(slots);
+    dprintf(0, "Swap tests complete\n");
+}
+
+/* Region array operations behind mmap, on an address space with no page table */
+void
+test_regions(void)
+{
+    addrspace as = {0};
+    seL4_Word start, first;
+
+    /* Mappings are placed down from the top of the mmap area, below any region in the way */
+    assert(as_define_region(&as, PROCESS_MMAP_TOP - (5 * PAGE_SIZE_4K), 3 * PAGE_SIZE_4K, seL4_CanRead) == 0);
+    assert(as_find_free(&as, 2 * PAGE_SIZE_4K, &start) == 0 && start == PROCESS_MMAP_TOP - (2 * PAGE_SIZE_4K));
+    assert(as_find_free(&as, 3 * PAGE_SIZE_4K, &start) == 0 && start == PROCESS_MMAP_TOP - (8 * PAGE_SIZE_4K));
+    dprintf(0, "Test 1 Passed\n");
+
+    /* Splitting in the middle leaves three regions, the file offset following each part */
+    seL4_Word base = PROCESS_MMAP_TOP - (5 * PAGE_SIZE_4K);
+    as.regions[0]->flags = REGION_MMAP;
+    as.regions[0]->offset = PAGE_SIZE_4K;
+    assert(as_split_range(&as, base + PAGE_SIZE_4K, base + (2 * PAGE_SIZE_4K)) == 0);
+    assert(as.nregions == 3 && as.regions[1]->start == base + PAGE_SIZE_4K);
+    assert(as.regions[0]->end == base + PAGE_SIZE_4K && as.regions[1]->end == base + (2 * PAGE_SIZE_4K));
+    assert(as.regions[1]->offset == 2 * PAGE_SIZE_4K && as.regions[2]->offset == 3 * PAGE_SIZE_4K);
+    assert(as_range_regions(&as, base, base + (2 * PAGE_SIZE_4K), &first) == 2 && first == 0);
+    dprintf(0, "Test 2 Passed\n");
+
+    /* Removing a range leaves the rest, and the region found last is forgotten */
+    region *found;
+    assert(as_find_region(&as, base + PAGE_SIZE_4K, &found) == 0 && as.region_hit == found);
+    as_remove_range(&as, base + PAGE_SIZE_4K, base + (2 * PAGE_SIZE_4K));
+    assert(as.nregions == 2 && as.region_hit == NULL);
+    assert(as_find_region(&as, base + PAGE_SIZE_4K, &found) == 1);
+    assert(as_find_region(&as, base, &found) == 0 && as_find_region(&as, base + (2 * PAGE_SIZE_4K), &found) == 0);
+    dprintf(0, "Test 3 Passed\n");
+
+    as_remove_range(&as, base, base + (3 * PAGE_SIZE_4K));
+    assert(as.nregions == 0);
+    free(as.regions);
+    dprintf(0, "Region tests complete\n");
+}
+
 void callback1(uint32_t id, void *data) {
     dprintf(0, "100ms Callback, id:%d, time: %lld\n", id, time_stamp());
     dprintf(0, "registered callback: %d\n", register_timer(100000, callback1, NULL));
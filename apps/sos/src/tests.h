@@ -13,4 +13,13 @@ void test_m1(void);
 /* Frametable tests */
 void test_m2(void);
 
+/* Pagefile slot allocator benchmark */
+void test_pagefile_map(void);
+
+/* Swap space tests */
+void test_swap(void);
+
+/* Region split and removal tests */
+void test_regions(void);
+
 #endif /* _TESTS_H_ */
@@ -18,7 +18,7 @@
  * minimum size_bits of untyped objects such that any object can be
  * allocated provided that the address is aligned correctly
  */
-#define MIN_UT_SIZE_BITS seL4_PageDirBits
+#define MIN_UT_SIZE_BITS 16 /* 64K large page */
 
 
 /*
@@ -18,8 +18,8 @@
 #include <sys/debug.h>
 #include <sys/panic.h>
  
-#define FLOOR14(x) ((x) & ~((1 << 14) - 1))
-#define CEILING14(x) FLOOR14((x) + (1 << 14) - 1)
+#define FLOOR16(x) ((x) & ~((1 << 16) - 1))
+#define CEILING16(x) FLOOR16((x) + (1 << 16) - 1)
 
 typedef struct suballocator {
     struct suballocator **prev;
@@ -28,6 +28,7 @@ typedef struct suballocator {
     bitfield_t *bitfield;
 } suballocator_t;
 
+static bitfield_t*     _pool16 = NULL;
 static bitfield_t*     _pool14 = NULL;
 static bitfield_t*     _pool12 = NULL;
 static bitfield_t*     _pool10 = NULL;
@@ -37,8 +38,9 @@ static suballocator_t* _pool4  = NULL;
 static int _initialised = 0;
 static seL4_Word _pool_base = 0;
 
-#define PRIMARY_POOL_SIZEBITS 14
-#define PRIMARY_POOL          _pool14
+/* The primary pool hands out 64K blocks so large pages can be retyped */
+#define PRIMARY_POOL_SIZEBITS 16
+#define PRIMARY_POOL          _pool16
 
 
 /*********************
@@ -113,6 +115,9 @@ do_ut_alloc_from_bitfield(int sizebits)
 
     /* Select the appropriate pool */
     switch(sizebits) {
+    case 16:
+        pool = _pool16;
+        break;
     case 14:
         pool = _pool14;
         break;
@@ -153,6 +158,9 @@ do_ut_free_from_bitfield(seL4_Word addr, int sizebits)
 
     /* Select the correct pool */
     switch(sizebits) {
+    case 16:
+        pool = _pool16;
+        break;
     case 14:
         pool = _pool14;
         break;
@@ -361,20 +369,21 @@ ut_allocator_init(seL4_Word low, seL4_Word high)
 
     assert(!_initialised);
 
-    /* Align memory bounds */
-    low = FLOOR14(low);
-    high = CEILING14(high);
+    /* Align memory bounds, inwards so the pool never covers memory outside of low and high */
+    low = CEILING16(low);
+    high = FLOOR16(high);
 
     mem_size = high - low;
 
     _pool_base = low;
+    _pool16 = new_bitfield(mem_size >> 16, BITFIELD_INIT_FILLED);
     _pool14 = new_bitfield(mem_size >> 14, BITFIELD_INIT_FILLED);
     _pool12 = new_bitfield(mem_size >> 12, BITFIELD_INIT_FILLED);
     _pool10 = new_bitfield(mem_size >> 10, BITFIELD_INIT_FILLED);
 
     /* Marked untyped as available */
-    for (int i = 0; i < mem_size >> 14; i++)
-        bf_clr(_pool14, i);
+    for (int i = 0; i < mem_size >> 16; i++)
+        bf_clr(_pool16, i);
 
     /* Initialise sub allocators */
     _pool9 = NULL;
@@ -402,6 +411,7 @@ ut_alloc(int sizebits)
     case 10:
     case 12:
     case 14:
+    case 16:
         addr = do_ut_alloc_from_bitfield(sizebits);
         break;
     default:
@@ -427,6 +437,7 @@ ut_free(seL4_Word addr, int sizebits)
     case 10:
     case 12:
     case 14:
+    case 16:
         do_ut_free_from_bitfield(addr, sizebits);
         break;
     default:
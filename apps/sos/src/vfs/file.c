@@ -71,6 +71,33 @@ fdtable_destroy(fdtable *table)
     return 0;
 }
 
+int
+fdtable_copy(fdtable *src, fdtable *dst)
+{
+    for (size_t fd = 0; fd < PROCESS_MAX_FILES; ++fd) {
+        file *open_file = src->table[fd];
+        if (open_file == NULL)
+            continue;
+
+        if (vfs_dup(open_file->vn, open_file->mode) != 0) {
+            LOG_INFO("fd %d is not inherited", fd);
+            continue;
+        }
+
+        file *copy;
+        if ((copy = malloc(sizeof(file))) == NULL) {
+            LOG_ERROR("Failed to copy a file");
+            vfs_close(open_file->vn, open_file->mode);
+            return 1;
+        }
+
+        *copy = *open_file;
+        fdtable_insert(dst, fd, copy);
+    }
+
+    return 0;
+}
+
 int
 fdtable_get(fdtable *fdt, int fd, file **f)
 {
@@ -53,6 +53,16 @@ fdtable *fdtable_create(void);
  */
 int fdtable_destroy(fdtable *table);
 
+/*
+ * Copy a fdtable for a forked process
+ * Each open file is opened again on the same vnode, with its own file pointer.
+ * A file that cannot be opened again, such as the console for reading, is left closed in the copy.
+ * @param src, the fdtable to copy
+ * @param dst, the new fdtable, with no open files
+ * @returns 0 on success else 1
+ */
+int fdtable_copy(fdtable *src, fdtable *dst);
+
 /*
  * Return the file corresponding to a file descriptor number.
  * @param table, the file descriptor table
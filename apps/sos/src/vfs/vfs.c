@@ -116,6 +116,18 @@ vfs_close(vnode *vn, fmode_t mode)
     vn->vn_ops->vop_close(vn, mode);
 }
 
+int
+vfs_dup(vnode *vn, fmode_t mode)
+{
+    /* Opening the node again counts the reference */
+    if (vn->vn_ops->vop_open(vn, mode) != 0) {
+        LOG_ERROR("Failed to reference the file");
+        return 1;
+    }
+
+    return 0;
+}
+
 int
 vfs_stat(char *name, sos_stat_t **buf)
 {
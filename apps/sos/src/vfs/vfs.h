@@ -30,6 +30,11 @@ typedef struct {
     int (*vop_read)(vnode *node, uiovec *iov);
     int (*vop_write)(vnode *node, uiovec *iov);
     int (*vop_stat)(vnode *node, sos_stat_t **buf);
+    int (*vop_read_batch)(vnode *node, uiovec *iovs, size_t niovs, size_t window); /* Several reads in flight at once */
+    int (*vop_write_batch)(vnode *node, uiovec *iovs, size_t niovs, size_t window); /* Several writes in flight at once */
+    int (*vop_readv)(vnode *node, uiovec *iovs, size_t niovs, size_t window); /* Scatter read, returns bytes read, short at the end of the file */
+    int (*vop_writev)(vnode *node, uiovec *iovs, size_t niovs, size_t window); /* Gather write, returns bytes written */
+    int (*vop_truncate)(vnode *node, off_t size, void (*callback)(uintptr_t token, int err), uintptr_t token); /* Completes in the background */
 
     int (*vop_lookup)(char *name, int create_file, vnode **result); /* Lookup for a mount point */
     int (*vop_list)(char ***dir, size_t *nfiles); /* list all the files in a mount point */
@@ -77,6 +82,15 @@ int vfs_open(char *name, fmode_t mode, vnode **ret);
  */
 void vfs_close(vnode *vn, fmode_t mode);
 
+/*
+ * Take another reference to an open vnode, such as for a mapping of the file.
+ * The reference is released with vfs_close.
+ * @param vn, the node
+ * @param mode, the mode of access the reference is for
+ * @returns 0 on success else 1
+ */
+int vfs_dup(vnode *vn, fmode_t mode);
+
 /*
  * Get the attributes of a file
  * @param name, the name of the file to stat
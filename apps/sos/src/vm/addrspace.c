@@ -13,6 +13,9 @@
 
 #define WITHIN_REGION(as, addr) (addr >= as->start && addr < as->end) 
 
+static seL4_Word as_region_search(addrspace *as, seL4_Word vaddr);
+static int as_split_region(addrspace *as, region *reg, seL4_Word vaddr);
+
 addrspace *
 as_create(void)
 {
@@ -22,7 +25,10 @@ as_create(void)
         return NULL;
     }
 
-    as->region_list = NULL;
+    as->regions = NULL;
+    as->nregions = 0;
+    as->max_regions = 0;
+    as->region_hit = NULL;
     as->region_stack = NULL;
     as->region_heap = NULL;
 
@@ -71,13 +77,16 @@ as_destroy(addrspace *as)
     ut_free(as->vspace_addr, seL4_PageDirBits);
     as->vspace_addr = (seL4_Word)NULL;
 
-    for (region *curr = as->region_list; curr != NULL; curr = curr->next_region) {
-        if (as_destroy_region(curr) != 0) {
+    for (seL4_Word i = 0; i < as->nregions; i++) {
+        if (as_destroy_region(as->regions[i]) != 0) {
             LOG_ERROR("Failed to destroy region");
             return 1;
         }
     }
-    as->region_list = NULL;
+    free(as->regions);
+    as->regions = NULL;
+    as->nregions = 0;
+    as->region_hit = NULL;
 
     free(as);
     return 0;
@@ -96,6 +105,11 @@ as_create_region(seL4_Word start, seL4_Word size, seL4_Word permissions)
     new_region->start = start;
     new_region->end = start + size;
     new_region->permissions = permissions;
+    new_region->flags = 0;
+    new_region->vn = NULL;
+    new_region->mode = 0;
+    new_region->offset = 0;
+    new_region->file_size = 0;
 
     return new_region;
 }
@@ -108,6 +122,10 @@ as_destroy_region(region *reg)
         return 1;
     }
 
+    /* Release the reference of a file mapping */
+    if (reg->vn != NULL)
+        vfs_close(reg->vn, reg->mode);
+
     free(reg);
     return 0;
 }
@@ -115,25 +133,149 @@ as_destroy_region(region *reg)
 int
 as_add_region(addrspace *as, region *new_region)
 {
+    if (new_region == NULL) {
+        LOG_ERROR("Region cannot be null");
+        return 1;
+    }
+
     LOG_INFO("Adding region %p -> %p", (void *)new_region->start, (void *)new_region->end);
 
-    /* If there are no previous regions */
-    if (as->region_list == NULL) {
-        as->region_list = new_region;
-        goto end_add;
+    /* Grow the array when full */
+    if (as->nregions == as->max_regions) {
+        seL4_Word max_regions = as->max_regions ? as->max_regions * 2 : AS_REGIONS_MIN;
+        region **regions = realloc(as->regions, max_regions * sizeof(region *));
+        if (regions == NULL) {
+            LOG_ERROR("Failed to grow the region array");
+            return 1;
+        }
+
+        as->regions = regions;
+        as->max_regions = max_regions;
+    }
+
+    /* Insert after every region starting at or before it, an empty region goes before a region of the same start */
+    seL4_Word index = as_region_search(as, new_region->start);
+    while (index > 0 && as->regions[index - 1]->start == new_region->start &&
+           as->regions[index - 1]->end > new_region->end)
+        index--;
+
+    for (seL4_Word i = as->nregions; i > index; i--)
+        as->regions[i] = as->regions[i - 1];
+
+    as->regions[index] = new_region;
+    as->nregions++;
+    return 0;
+}
+
+int
+as_find_free(addrspace *as, seL4_Word size, seL4_Word *start)
+{
+    /* Walk down from the top, the gap below each region ends at its start */
+    seL4_Word end = PROCESS_MMAP_TOP;
+    for (seL4_Word i = as_region_search(as, end - 1); i > 0; i--) {
+        region *below = as->regions[i - 1];
+        if (below->end <= end && end - below->end >= size) {
+            *start = end - size;
+            return 0;
+        }
+
+        end = MIN(end, below->start);
+    }
+
+    /* The first page is never mapped, so a null pointer always faults */
+    if (end < size + PAGE_SIZE_4K) {
+        LOG_ERROR("No gap of %u bytes for the mapping", size);
+        return 1;
+    }
+
+    *start = end - size;
+    return 0;
+}
+
+seL4_Word
+as_range_regions(addrspace *as, seL4_Word start, seL4_Word end, seL4_Word *first)
+{
+    /* The last region starting at or before start overlaps the range if it ends past it */
+    seL4_Word index = as_region_search(as, start);
+    if (index > 0 && as->regions[index - 1]->end > start)
+        index--;
+
+    *first = index;
+    return as_region_search(as, end - 1) - index;
+}
+
+int
+as_split_range(addrspace *as, seL4_Word start, seL4_Word end)
+{
+    region *reg;
+    if (as_find_region(as, start, &reg) == 0 && reg->start < start && as_split_region(as, reg, start) != 0)
+        return 1;
+
+    if (as_find_region(as, end - 1, &reg) == 0 && reg->end > end && as_split_region(as, reg, end) != 0)
+        return 1;
+
+    return 0;
+}
+
+void
+as_remove_range(addrspace *as, seL4_Word start, seL4_Word end)
+{
+    seL4_Word first;
+    seL4_Word nregions = as_range_regions(as, start, end, &first);
+
+    for (seL4_Word i = first; i < first + nregions; i++) {
+        region *reg = as->regions[i];
+        LOG_INFO("Removing region %p -> %p", (void *)reg->start, (void *)reg->end);
+        assert(reg->start >= start && reg->end <= end);
+
+        if (as->region_hit == reg)
+            as->region_hit = NULL;
+
+        as_destroy_region(reg);
     }
 
-    /* Add region to the end of the list */
-    region *cur_reg = as->region_list;
-    region *prev_reg = as->region_list;
-    while (cur_reg != NULL) {
-        prev_reg = cur_reg;       
-        cur_reg = cur_reg->next_region;
+    for (seL4_Word i = first; i + nregions < as->nregions; i++)
+        as->regions[i] = as->regions[i + nregions];
+
+    as->nregions -= nregions;
+}
+
+int
+as_copy(addrspace *src, addrspace *dst)
+{
+    for (seL4_Word i = 0; i < src->nregions; i++) {
+        region *reg = src->regions[i];
+        region *copy = as_create_region(reg->start, reg->end - reg->start, reg->permissions);
+        if (copy == NULL) {
+            LOG_ERROR("Failed to copy a region");
+            return 1;
+        }
+
+        copy->flags = reg->flags;
+        copy->offset = reg->offset;
+        copy->file_size = reg->file_size;
+
+        /* The copy of a file mapping holds its own reference to the file */
+        if (reg->vn != NULL) {
+            if (vfs_dup(reg->vn, reg->mode) != 0) {
+                as_destroy_region(copy);
+                return 1;
+            }
+
+            copy->vn = reg->vn;
+            copy->mode = reg->mode;
+        }
+
+        if (as_add_region(dst, copy) != 0) {
+            as_destroy_region(copy);
+            return 1;
+        }
+
+        if (reg == src->region_stack)
+            dst->region_stack = copy;
+        if (reg == src->region_heap)
+            dst->region_heap = copy;
     }
-    prev_reg->next_region = new_region;
-    
-    end_add:
-        new_region->next_region = NULL;
 
     return 0;
 }
@@ -147,17 +289,25 @@ as_define_region(addrspace *as, seL4_Word start, seL4_Word size, seL4_Word permi
 int
 as_find_region(addrspace *as, seL4_Word vaddr, region **found_region)
 {
-    /* Search through the linked list until found */
-    region *curr = as->region_list;
-    while (curr != NULL) {
-        if (vaddr >= curr->start && vaddr < curr->end) {
-            *found_region = curr;
-            return 0;
-        }
-        curr = curr->next_region;
+    /* Faults and copies tend to land in the region found last */
+    region *curr = as->region_hit;
+    if (curr != NULL && WITHIN_REGION(curr, vaddr)) {
+        *found_region = curr;
+        return 0;
     }
 
-    return 1;
+    /* Only the last region starting at or before vaddr can contain it */
+    seL4_Word index = as_region_search(as, vaddr);
+    if (index == 0)
+        return 1;
+
+    curr = as->regions[index - 1];
+    if (!WITHIN_REGION(curr, vaddr))
+        return 1;
+
+    as->region_hit = curr;
+    *found_region = curr;
+    return 0;
 }
 
 int
@@ -171,7 +321,12 @@ as_region_collision_check(addrspace *as, region *exempt, seL4_Word start, seL4_W
 
     /* Region can however decrease back down so the start == end (heap does this) */
 
-    for (region *curr = as->region_list; curr != NULL; curr = curr->next_region) {
+    /*
+     * Only regions starting at or before the end can collide. Walking back from the last of them,
+     * the ends only decrease, so the walk stops at the first region that ends before the start.
+     */
+    for (seL4_Word i = as_region_search(as, end); i > 0 && as->regions[i - 1]->end >= start; i--) {
+        region *curr = as->regions[i - 1];
         if (curr == exempt)
             continue;
 
@@ -257,3 +412,66 @@ as_define_heap(addrspace *as, uint32_t heap_loc)
     as->region_heap = heap;
     return as_add_region(as, heap);
 }
+
+/*
+ * Binary search the regions of an address space
+ * @param as, the address space
+ * @param vaddr, the address to search for
+ * @returns the number of regions starting at or before vaddr
+ */
+static seL4_Word
+as_region_search(addrspace *as, seL4_Word vaddr)
+{
+    seL4_Word lo = 0;
+    seL4_Word hi = as->nregions;
+    while (lo < hi) {
+        seL4_Word mid = lo + (hi - lo) / 2;
+        if (as->regions[mid]->start <= vaddr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Split a region in two at vaddr, the region keeps the lower part
+ * @param as, the address space
+ * @param reg, the region to split
+ * @param vaddr, the page aligned address within the region to split at
+ * @returns 0 on success, else 1
+ */
+static int
+as_split_region(addrspace *as, region *reg, seL4_Word vaddr)
+{
+    region *upper = as_create_region(vaddr, reg->end - vaddr, reg->permissions);
+    if (upper == NULL) {
+        LOG_ERROR("Failed to create the upper part of the region");
+        return 1;
+    }
+
+    upper->flags = reg->flags;
+    upper->offset = reg->offset + (vaddr - reg->start);
+    upper->file_size = reg->file_size;
+
+    /* Each part holds its own reference to the file */
+    if (reg->vn != NULL) {
+        if (vfs_dup(reg->vn, reg->mode) != 0) {
+            as_destroy_region(upper);
+            return 1;
+        }
+
+        upper->vn = reg->vn;
+        upper->mode = reg->mode;
+    }
+
+    /* The upper part sorts straight after the lower, which is shrunk once the upper part is in place */
+    if (as_add_region(as, upper) != 0) {
+        as_destroy_region(upper);
+        return 1;
+    }
+
+    reg->end = vaddr;
+    return 0;
+}
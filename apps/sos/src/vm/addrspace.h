@@ -10,31 +10,50 @@
 #include <sel4/sel4.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <utils/util.h>
+#include <vfs/vfs.h>
 
 /* Maximum size limit of the stack region (16mb) */
 #define RLIMIT_STACK_SZ 16780000
 
+/* Initial capacity of the region array of an address space, it doubles as regions are added */
+#define AS_REGIONS_MIN 8
+
 /* Forward declaration of a page directory */
 typedef struct page_dir page_directory;
 
+/* Flags of a region */
+#define REGION_MMAP BIT(0) /* Made by mmap, it can be unmapped and protected */
+#define REGION_SHARED BIT(1) /* Changes to a file mapping are written back to the file */
+#define REGION_SEQUENTIAL BIT(2) /* Advised to be accessed sequentially, read ahead further and replace first */
+#define REGION_RANDOM BIT(3) /* Advised to be accessed randomly, no read ahead */
+
 /*
  * Region structure to specify regions in an address space
- * Each region has a start and end address, access permissions
- * and a pointer to the next region in the linked list
+ * Each region has a start and end address, and access permissions.
+ * A file mapping holds a reference to the vnode of the file, its pages are read from the file on demand.
  */
 typedef struct region_t {
     seL4_Word start;
     seL4_Word end;
     seL4_Word permissions;
-    struct region_t *next_region;
+    seL4_Word flags; /* REGION_ flags */
+    vnode *vn; /* File the region maps, NULL for anonymous memory */
+    fmode_t mode; /* Mode of the reference to the file */
+    seL4_Word offset; /* Offset into the file of the start of the region */
+    seL4_Word file_size; /* Size of the file when it was mapped, pages are never written back past it */
 } region;
 
 /*
- * An address space is made of a list of regions
+ * An address space is made of an array of regions, sorted by start address so a lookup is a binary search.
+ * Regions never overlap, so they are sorted by their end address as well.
  * A 2 level page table, and bookkeeping of the kernel page table caps
  */
 typedef struct {
-    region *region_list;
+    region **regions; /* Regions in order of start address */
+    seL4_Word nregions; /* Number of regions */
+    seL4_Word max_regions; /* Capacity of the regions array */
+    region *region_hit; /* Region last found, checked before searching as faults cluster in one region */
     region *region_stack;
     region *region_heap;
 
@@ -83,6 +102,52 @@ int as_destroy_region(region *reg);
   */
 int as_add_region(addrspace *as, region *new_region);
 
+/*
+ * Find a gap for a mapping, searching down from PROCESS_MMAP_TOP
+ * @param as, the address space
+ * @param size, the page aligned size of the mapping
+ * @param[out] start, the start of the highest gap the mapping fits in
+ * @returns 0 on success, else 1 if there is no such gap
+ */
+int as_find_free(addrspace *as, seL4_Word size, seL4_Word *start);
+
+/*
+ * Find the regions overlapping a range, they are consecutive in the region array
+ * @param as, the address space
+ * @param start, the start of the range
+ * @param end, the end of the range
+ * @param[out] first, the index of the first region overlapping the range
+ * @returns the number of regions overlapping the range
+ */
+seL4_Word as_range_regions(addrspace *as, seL4_Word start, seL4_Word end, seL4_Word *first);
+
+/*
+ * Split the regions crossing either end of a range, so every region overlapping the range lies within it.
+ * The upper part of a file mapping takes its own reference to the file.
+ * @param as, the address space
+ * @param start, the page aligned start of the range
+ * @param end, the page aligned end of the range
+ * @returns 0 on success, else 1
+ */
+int as_split_range(addrspace *as, seL4_Word start, seL4_Word end);
+
+/*
+ * Remove and destroy the regions within a range, the range must have been split
+ * @param as, the address space
+ * @param start, the start of the range
+ * @param end, the end of the range
+ */
+void as_remove_range(addrspace *as, seL4_Word start, seL4_Word end);
+
+/*
+ * Copy the regions of an address space into the address space of a forked process.
+ * A file mapping in the copy takes its own reference to the file, the pages are shared by vm_fork.
+ * @param src, the address space to copy
+ * @param dst, the new address space, which has no regions
+ * @returns 0 on success, else 1
+ */
+int as_copy(addrspace *src, addrspace *dst);
+
 /*
  * Create and add a region to an address space
  * @param as, the address space to add the region into
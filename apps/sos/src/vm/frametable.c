@@ -23,18 +23,76 @@
 // #define ARTIFICIAL_FRAME_LIMIT (BYTES_TO_4K_PAGES(ut_top - ut_base) * FT_PORTION)
 #define ARTIFICIAL_FRAME_LIMIT (8 * BYTES_TO_4K_PAGES(BIT(20))) /* 8 MB frametable size */
 
-/* High and low watermark for number of free frames */
-#define HIGH_WATERMARK 64
-#define LOW_WATERMARK 32
+/*
+ * High and low watermark of the frame cache, as a percentage of the frame limit.
+ * Once the cache holds more than the high watermark, it is trimmed back to the low watermark.
+ */
+#define FRAME_CACHE_HIGH_PERCENT 25
+#define FRAME_CACHE_LOW_PERCENT 12
+
+/* Minimum size of the cache, regardless of the frame limit */
+#define FRAME_CACHE_MIN_WATERMARK 32
+
+/* Sentinel for the end of the frame cache list */
+#define FRAME_CACHE_END ((seL4_Word)-1)
+
+/* Maximum number of frames zeroed each time the event loop waits, this adds to the latency of the next message */
+#define FRAME_PREZERO_BATCH 1
+
+/*
+ * Layout of the packed info word of a frame entry
+ * | page number (20) | pid (8) | unused (2) | type (2) |
+ */
+#define INFO_PID_SHIFT 4
+#define INFO_PID_BITS 8
+#define INFO_PAGE(info) ((info) & ~MASK(seL4_PageBits))
+#define INFO_PID(info) (((info) >> INFO_PID_SHIFT) & MASK(INFO_PID_BITS))
+#define INFO_TYPE(info) ((info) & MASK(2))
+#define INFO_PACK(page_id, pid, type) (INFO_PAGE(page_id) | ((pid) << INFO_PID_SHIFT) | (type))
+
+/* While cached, the page number field of the info word is the id of the next cached frame */
+#define INFO_NEXT_END (MASK(seL4_WordBits - seL4_PageBits))
+#define INFO_NEXT(info) ((info) >> seL4_PageBits)
+#define INFO_PACK_NEXT(next) (((next) == FRAME_CACHE_END ? INFO_NEXT_END : (next)) << seL4_PageBits)
+
+compile_time_assert(pid_fits_frame_entry, MAX_PROCS <= BIT(INFO_PID_BITS));
+compile_time_assert(pids_fit_sharers, MAX_PROCS <= seL4_WordBits);
+compile_time_assert(frame_entry_packed, sizeof(frame_entry) == 2 * sizeof(seL4_Word));
 
 /* Private functions */
 static void _frame_free(seL4_Word frame_id);
 static seL4_Word _frame_alloc(seL4_Word *vaddr, seL4_Word nframes);
-static int retype_and_map(seL4_Word paddr, seL4_Word vaddr, seL4_ARM_Page *frame_cap);
+static void _frame_free_large(seL4_Word frame_id);
+static int retype_and_map(seL4_Word paddr, seL4_Word vaddr, seL4_Word type, seL4_Word size_bits, seL4_ARM_Page *frame_cap);
+static seL4_Word frame_cache_pop(seL4_Word *head);
+static void frame_cache_push(seL4_Word *head, seL4_Word frame_id);
+static void frame_cache_trim(void);
+static void frame_state_reset(seL4_Word frame_id);
+static void frame_unreference(seL4_Word frame_id);
+static void frame_unmap(seL4_Word pid, seL4_Word page_id);
 
 /* The frame table is an array of frame entries */
 static frame_entry *frame_table = NULL;
 
+/*
+ * Replacement state of each frame, one bit per frame id.
+ * Valid frames hold a capability, pinned frames are never selected as a victim,
+ * and referenced frames have been used since the replacement policy last cleared their bit.
+ */
+static seL4_Word *frame_valid = NULL;
+static seL4_Word *frame_pinned = NULL;
+static seL4_Word *frame_referenced = NULL;
+static seL4_Word frame_bitmap_words = 0;
+
+/* One more than the pagefile slot holding a clean copy of each frame, 0 if none, only looked at by the pager */
+static seL4_Word *frame_swap = NULL;
+
+/* Bitmap of the pids mapping each frame, copy on write or with sos_share_vm, 0 if only its owner maps it */
+static seL4_Word *frame_sharers = NULL;
+
+/* The bitmaps as seen by the replacement policy */
+static replacement_frames frame_state;
+
 /* The base and limit of the untyped memory chunk we manage as part of the frame table */
 static seL4_Word ut_base;
 static seL4_Word ut_top;
@@ -43,9 +101,13 @@ static seL4_Word ut_top;
 static seL4_Word frame_table_max = 0;
 volatile static seL4_Word frame_table_cnt = 0;
 
-/* Global buffer to store free frames */
-static seL4_Word free_frames[HIGH_WATERMARK];
-volatile static seL4_Word free_index = 0;
+/*
+ * Frame cache, lists of free frames threaded through the frame table.
+ * Dirty frames still hold the contents of their previous owner, zeroed frames are ready to hand out.
+ */
+static seL4_Word frame_cache_dirty = FRAME_CACHE_END;
+static seL4_Word frame_cache_zeroed = FRAME_CACHE_END;
+static frame_cache_stats frame_cache;
 
 int
 frame_table_init(seL4_Word paddr, seL4_Word size_in_bits, seL4_Word low, seL4_Word high)
@@ -72,16 +134,34 @@ frame_table_init(seL4_Word paddr, seL4_Word size_in_bits, seL4_Word low, seL4_Wo
     frame_table_max = ARTIFICIAL_FRAME_LIMIT;
     LOG_INFO("Maximum number of frames: %d", frame_table_max);
 
+    /* Size the frame cache against the frame limit */
+    frame_cache.high_watermark = MAX(FRAME_CACHE_MIN_WATERMARK, (frame_table_max * FRAME_CACHE_HIGH_PERCENT) / 100);
+    frame_cache.low_watermark = MAX(FRAME_CACHE_MIN_WATERMARK / 2, (frame_table_max * FRAME_CACHE_LOW_PERCENT) / 100);
+    LOG_INFO("Frame cache watermarks: low %d, high %d", frame_cache.low_watermark, frame_cache.high_watermark);
+
     seL4_ARM_Page frame_cap;
     seL4_Word vaddr = PHYSICAL_VSTART + paddr;
+    seL4_Word nframes = ADDR_TO_INDEX(ut_top);
+    if (FRAME_TABLE_BYTES(nframes) > BIT(size_in_bits)) {
+        LOG_ERROR("Frame table memory too small for %d frames", nframes);
+        return 1;
+    }
+
+    /* The entries are followed by the state bitmaps, the clean slots and the sharers, all zeroed on retype */
     frame_table = (frame_entry *)vaddr;
+    frame_bitmap_words = FRAME_BITMAP_WORDS(nframes);
+    frame_valid = (seL4_Word *)(frame_table + nframes);
+    frame_pinned = frame_valid + frame_bitmap_words;
+    frame_referenced = frame_pinned + frame_bitmap_words;
+    frame_swap = frame_referenced + frame_bitmap_words;
+    frame_sharers = frame_swap + nframes;
 
     /*
      * Map our frame table memory into virtual memory.
      * Do not need to store these capability as we do not share or free the frame table.
      */
     for (int i = 0; i < BYTES_TO_4K_PAGES(BIT(size_in_bits)); i++) {
-        if (retype_and_map(paddr, vaddr, &frame_cap) != 0) {
+        if (retype_and_map(paddr, vaddr, seL4_ARM_SmallPageObject, seL4_PageBits, &frame_cap) != 0) {
             LOG_ERROR("Failed to map in the frame table");
             return 1;
         }
@@ -90,47 +170,87 @@ frame_table_init(seL4_Word paddr, seL4_Word size_in_bits, seL4_Word low, seL4_Wo
         paddr += PAGE_SIZE_4K;
     }
 
+    /* The policy keeps its own state after the arrays */
+    frame_state.nframes = nframes;
+    frame_state.words = frame_bitmap_words;
+    frame_state.capacity = MIN(frame_table_max, nframes);
+    frame_state.valid = frame_valid;
+    frame_state.pinned = frame_pinned;
+    frame_state.referenced = frame_referenced;
+    frame_state.unreference = frame_unreference;
+    replacement_init(&frame_state, frame_sharers + nframes);
+
     return 0;
 }
 
 seL4_Word
-frame_alloc(seL4_Word *vaddr)
+frame_alloc(seL4_Word *vaddr, seL4_Word flags)
 {
     seL4_Word paddr;
     seL4_Word p_id;
+    bool zero = !(flags & FRAME_ALLOC_NOZERO);
 
     if (frame_table == NULL) {
         LOG_ERROR("Frame table uninitialised");
         goto frame_alloc_error;
     }
 
-    /* Ensure we aren't exceeding limits */
-    if (frame_table_cnt >= frame_table_max) {
-        LOG_INFO("Frame table limit reached");
-        goto frame_alloc_page;
+    /*
+     * If there are free frames in the cache, they are already counted against the limit.
+     * Zeroed frames are saved for callers that need them, other callers take dirty frames first.
+     */
+    if (zero && (p_id = frame_cache_pop(&frame_cache_zeroed)) != FRAME_CACHE_END) {
+        frame_cache.zeroed--;
+        frame_cache.zero_hits++;
+        zero = FALSE;
+    } else if ((p_id = frame_cache_pop(&frame_cache_dirty)) == FRAME_CACHE_END &&
+               (p_id = frame_cache_pop(&frame_cache_zeroed)) != FRAME_CACHE_END) {
+        frame_cache.zeroed--;
     }
 
-    /* If there are free frames in the buffer */
-    if (free_index > 0) {
-        free_index--;
-        p_id = free_frames[free_index];
-
+    if (p_id != FRAME_CACHE_END) {
+        frame_cache.hits++;
         paddr = INDEX_TO_ADDR(p_id);
         *vaddr = PHYSICAL_VSTART + paddr;
-        bzero((void *)(*vaddr), PAGE_SIZE_4K);
-        frame_table[p_id].chance = FIRST_CHANCE; /* Reset the chance */
+        if (zero)
+            bzero((void *)(*vaddr), PAGE_SIZE_4K);
+        frame_state_reset(p_id); /* Reset the chance */
         return p_id;
     }
 
-    /* Else, we need to allocate a frame from the UT Memory pool */
+    frame_cache.misses++;
+
+    /* Ensure we aren't exceeding limits */
+    if (frame_table_cnt >= frame_table_max) {
+        LOG_INFO("Frame table limit reached");
+        goto frame_alloc_page;
+    }
+
+    /* Else, we need to allocate a frame from the UT Memory pool, the kernel zeroes it on retype */
     /* If we are out of memory, try paging to disk */
     if ((p_id = _frame_alloc(vaddr, 1)) != -1)
         return p_id;
 
     frame_alloc_page:
+        if (flags & FRAME_ALLOC_NOPAGE)
+            goto frame_alloc_error;
+
         LOG_INFO("Failed to allocate frame, trying to page");
-        if ((p_id = page_out(vaddr)) != -1)
+        if ((p_id = page_out(vaddr)) != -1) {
+            /* A large victim is released whole, and a small frame is retyped in its place */
+            if (INFO_TYPE(frame_table[p_id].info) == FRAME_LARGE) {
+                _frame_free_large(p_id);
+                if ((p_id = _frame_alloc(vaddr, 1)) == -1)
+                    goto frame_alloc_error;
+
+                return p_id;
+            }
+
+            /* A paged out frame still holds the victims contents */
+            if (zero)
+                bzero((void *)(*vaddr), PAGE_SIZE_4K);
             return p_id;
+        }
 
     /* On error, set the vaddr to null and return -1 */
     frame_alloc_error:
@@ -139,6 +259,56 @@ frame_alloc(seL4_Word *vaddr)
         return -1;
 }
 
+seL4_Word
+frame_alloc_large(seL4_Word *vaddr)
+{
+    seL4_Word paddr;
+    seL4_Word p_id;
+    seL4_ARM_Page frame_cap;
+
+    if (frame_table == NULL) {
+        LOG_ERROR("Frame table uninitialised");
+        goto frame_alloc_large_error;
+    }
+
+    /* Ensure we aren't exceeding limits, large frames never cause paging */
+    if (frame_table_cnt + FRAMES_PER_LARGE > frame_table_max)
+        goto frame_alloc_large_error;
+
+    if ((paddr = ut_alloc(LARGE_FRAME_BITS)) == (seL4_Word)NULL) {
+        LOG_INFO("Failed to allocate memory for a large frame");
+        goto frame_alloc_large_error;
+    }
+
+    /* The kernel zeroes the frame as it is retyped */
+    *vaddr = PHYSICAL_VSTART + paddr;
+    if (retype_and_map(paddr, *vaddr, seL4_ARM_LargePageObject, LARGE_FRAME_BITS, &frame_cap) != 0) {
+        LOG_ERROR("Failed to retype memory into a large frame");
+        if (frame_cap)
+            cspace_delete_cap(cur_cspace, frame_cap);
+        ut_free(paddr, LARGE_FRAME_BITS);
+        goto frame_alloc_large_error;
+    }
+
+    /* The first entry holds the cap and metadata, the remaining entries refer back to it */
+    p_id = ADDR_TO_INDEX(paddr);
+    for (seL4_Word i = 0; i < FRAMES_PER_LARGE; i++) {
+        assert(frame_table[p_id + i].cap == (seL4_ARM_Page)NULL);
+        frame_table[p_id + i].info = INFO_PACK(0, 0, FRAME_LARGE_TAIL);
+    }
+
+    frame_table[p_id].cap = frame_cap;
+    frame_table[p_id].info = INFO_PACK(0, 0, FRAME_LARGE); /* Reset the pid and page_id */
+    frame_state_reset(p_id);
+
+    frame_table_cnt += FRAMES_PER_LARGE;
+    return p_id;
+
+    frame_alloc_large_error:
+        *vaddr = (seL4_Word)NULL;
+        return -1;
+}
+
 void
 frame_free(seL4_Word frame_id)
 {
@@ -157,22 +327,72 @@ frame_free(seL4_Word frame_id)
         return;
     }
 
-    /* If there is space to place the frame into the free frame buffer */
-    if (free_index < HIGH_WATERMARK) {
-        free_frames[free_index] = frame_id;
-        free_index++;
+    replacement_free(frame_id);
+
+    /* The contents are no longer wanted, so neither is the clean copy in the pagefile */
+    if (frame_swap[frame_id]) {
+        pagefile_free_add(frame_swap[frame_id] - 1);
+        frame_swap[frame_id] = 0;
+    }
+    frame_sharers[frame_id] = 0;
+
+    /* Large frames are not cached */
+    if (INFO_TYPE(frame_table[frame_id].info) == FRAME_LARGE) {
+        _frame_free_large(frame_id);
         return;
     }
 
-    /* 
-     * Free index if equal to high watermark, we should release the current frame
-     * And all frames from low watermark to high watermark
-     */
-    _frame_free(frame_id);
-    for (uint32_t id = LOW_WATERMARK; id < HIGH_WATERMARK; id++)
-        _frame_free(free_frames[id]);
+    frame_cache_push(&frame_cache_dirty, frame_id);
+
+    /* Once past the high watermark, release frames back to UT down to the low watermark */
+    if (frame_cache.size > frame_cache.high_watermark)
+        frame_cache_trim();
+}
+
+seL4_Word
+frame_table_get_head(seL4_Word frame_id)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return frame_id;
+
+    if (INFO_TYPE(frame_table[frame_id].info) != FRAME_LARGE_TAIL)
+        return frame_id;
+
+    /* Large frames are aligned to their size in physical memory */
+    return ADDR_TO_INDEX(LARGE_FRAME_ALIGN(INDEX_TO_ADDR(frame_id)));
+}
+
+bool
+frame_table_is_large(seL4_Word frame_id)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return FALSE;
 
-    free_index = LOW_WATERMARK;
+    return INFO_TYPE(frame_table[frame_id].info) != FRAME_SMALL;
+}
+
+void
+frame_cache_prezero(void)
+{
+    seL4_Word frame_id;
+
+    if (frame_table == NULL)
+        return;
+
+    for (int i = 0; i < FRAME_PREZERO_BATCH; i++) {
+        if ((frame_id = frame_cache_pop(&frame_cache_dirty)) == FRAME_CACHE_END)
+            return;
+
+        bzero((void *)frame_table_index_to_sos_vaddr(frame_id), PAGE_SIZE_4K);
+        frame_cache_push(&frame_cache_zeroed, frame_id);
+        frame_cache.zeroed++;
+    }
+}
+
+void
+frame_cache_get_stats(frame_cache_stats *stats)
+{
+    *stats = frame_cache;
 }
 
 seL4_ARM_Page 
@@ -220,6 +440,13 @@ multi_frame_alloc(seL4_Word *vaddr, seL4_Word nframes)
         return -1;
     }
 
+    /* The untyped allocator only serves blocks of a page, 16K and 64K */
+    if (nframes != 1 && nframes != 4 && nframes != FRAMES_PER_LARGE) {
+        LOG_ERROR("Cannot allocate %d contiguous frames", nframes);
+        *vaddr = (seL4_Word)NULL;
+        return -1;
+    }
+
     return _frame_alloc(vaddr, nframes);
 }
 
@@ -236,6 +463,17 @@ frame_table_get_limits(seL4_Word *lower, seL4_Word *upper)
     return 0;
 }
 
+seL4_Word
+frame_table_next_victim(void)
+{
+    if (frame_table == NULL) {
+        LOG_ERROR("Frame table uninitialised");
+        return -1;
+    }
+
+    return replacement_scan();
+}
+
 int
 frame_table_get_chance(seL4_Word frame_id, enum chance_type *chance)
 {
@@ -249,12 +487,21 @@ frame_table_get_chance(seL4_Word frame_id, enum chance_type *chance)
         return 1;
     }
 
+    /* Large frames keep their metadata in the first entry */
+    frame_id = frame_table_get_head(frame_id);
+
     if (!frame_table[frame_id].cap) {
         LOG_ERROR("Frame is invalid");
         return 1;
     }
 
-    *chance = frame_table[frame_id].chance;
+    if (FRAME_BIT_GET(frame_pinned, frame_id))
+        *chance = PINNED;
+    else if (FRAME_BIT_GET(frame_referenced, frame_id))
+        *chance = FIRST_CHANCE;
+    else
+        *chance = SECOND_CHANCE;
+
     return 0;
 }
 
@@ -271,15 +518,49 @@ frame_table_set_chance(seL4_Word frame_id, enum chance_type chance)
         return 1;
     }
 
+    /* Large frames keep their metadata in the first entry */
+    frame_id = frame_table_get_head(frame_id);
+
     if (!frame_table[frame_id].cap) {
         LOG_ERROR("Frame is invalid");
         return 1;
     }
 
-    frame_table[frame_id].chance = chance;
+    switch (chance) {
+        case PINNED:
+            FRAME_BIT_SET(frame_pinned, frame_id);
+            break;
+
+        case FIRST_CHANCE:
+            FRAME_BIT_CLR(frame_pinned, frame_id);
+            FRAME_BIT_SET(frame_referenced, frame_id);
+            replacement_access(frame_id);
+            break;
+
+        case SECOND_CHANCE:
+            FRAME_BIT_CLR(frame_pinned, frame_id);
+            FRAME_BIT_CLR(frame_referenced, frame_id);
+            break;
+    }
+
     return 0;
 }
 
+void
+frame_table_reference(seL4_Word frame_id)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return;
+
+    /* Large frames keep their metadata in the first entry */
+    frame_id = frame_table_get_head(frame_id);
+    if (!frame_table[frame_id].cap)
+        return;
+
+    FRAME_BIT_SET(frame_referenced, frame_id);
+    replacement_access(frame_id);
+}
+
 int
 frame_table_set_page_id(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
 {
@@ -293,14 +574,18 @@ frame_table_set_page_id(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
         return 1;
     }
 
+    /* Large frames keep their metadata in the first entry */
+    frame_id = frame_table_get_head(frame_id);
+
     if (!frame_table[frame_id].cap) {
         LOG_ERROR("Frame is invalid");
         return 1;
     }
 
-    /* With this implementation, we cannot support shared memory */
-    frame_table[frame_id].pid = pid;
-    frame_table[frame_id].page_id = page_id;
+    /* A shared frame is mapped by every process sharing it at the same page id, which makes the sharers its reverse map */
+    assert(pid < BIT(INFO_PID_BITS));
+    frame_table[frame_id].info = INFO_PACK(page_id, pid, INFO_TYPE(frame_table[frame_id].info));
+    replacement_fault(frame_id, pid, page_id);
     return 0;
 }
 
@@ -317,16 +602,122 @@ frame_table_get_page_id(seL4_Word frame_id, seL4_Word *pid, seL4_Word *page_id)
         return 1;
     }
 
+    /* Large frames keep their metadata in the first entry */
+    frame_id = frame_table_get_head(frame_id);
+
+    if (!frame_table[frame_id].cap) {
+        LOG_ERROR("Frame is invalid");
+        return 1;
+    }
+
+    *pid = INFO_PID(frame_table[frame_id].info);
+    *page_id = INFO_PAGE(frame_table[frame_id].info);
+    return 0;
+}
+
+int
+frame_table_set_swap(seL4_Word frame_id, seL4_Word pagefile_id)
+{
+    if (frame_table == NULL) {
+        LOG_ERROR("Frame table uninitialised");
+        return 1;
+    }
+
+    if (!ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top))) {
+        LOG_ERROR("frame_id: %d out of bounds", frame_id);
+        return 1;
+    }
+
+    /* Large frames are written out a 4K page at a time, they never keep a copy */
+    if (!frame_table[frame_id].cap || INFO_TYPE(frame_table[frame_id].info) != FRAME_SMALL) {
+        LOG_ERROR("Frame is invalid");
+        return 1;
+    }
+
+    assert(!frame_swap[frame_id]);
+    frame_swap[frame_id] = pagefile_id + 1;
+    return 0;
+}
+
+int
+frame_table_get_swap(seL4_Word frame_id, seL4_Word *pagefile_id)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return 1;
+
+    if (!frame_swap[frame_id])
+        return 1;
+
+    *pagefile_id = frame_swap[frame_id] - 1;
+    return 0;
+}
+
+void
+frame_table_clear_swap(seL4_Word frame_id)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return;
+
+    frame_swap[frame_id] = 0;
+}
+
+int
+frame_table_share(seL4_Word frame_id, seL4_Word pid)
+{
+    if (frame_table == NULL) {
+        LOG_ERROR("Frame table uninitialised");
+        return 1;
+    }
+
+    if (!ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top))) {
+        LOG_ERROR("frame_id: %d out of bounds", frame_id);
+        return 1;
+    }
+
+    /* Large frames keep their metadata in the first entry */
+    frame_id = frame_table_get_head(frame_id);
+
     if (!frame_table[frame_id].cap) {
         LOG_ERROR("Frame is invalid");
         return 1;
     }
 
-    *pid = frame_table[frame_id].pid;
-    *page_id = frame_table[frame_id].page_id;
+    /* The owner is the first process sharing the frame */
+    if (!frame_sharers[frame_id])
+        frame_sharers[frame_id] = BIT(INFO_PID(frame_table[frame_id].info));
+
+    frame_sharers[frame_id] |= BIT(pid);
     return 0;
 }
 
+void
+frame_table_unshare(seL4_Word frame_id, seL4_Word pid)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return;
+
+    frame_id = frame_table_get_head(frame_id);
+    assert(frame_sharers[frame_id] & BIT(pid));
+
+    seL4_Word sharers = frame_sharers[frame_id] & ~BIT(pid);
+    seL4_Word info = frame_table[frame_id].info;
+
+    /* The frame passes to one of the processes still sharing it */
+    if (INFO_PID(info) == pid)
+        frame_table[frame_id].info = INFO_PACK(INFO_PAGE(info), CTZ(sharers), INFO_TYPE(info));
+
+    frame_sharers[frame_id] = (POPCOUNT(sharers) > 1) ? sharers : 0;
+}
+
+seL4_Word
+frame_table_get_sharers(seL4_Word frame_id)
+{
+    if (frame_table == NULL || !ISINRANGE(0, frame_id, ADDR_TO_INDEX(ut_top)))
+        return 0;
+
+    return frame_sharers[frame_table_get_head(frame_id)];
+}
+
 /*
  * Main code to allocate nframes many contiguous frames
  * @param[out] vaddr, the sos vaddr of the frame
@@ -351,7 +742,7 @@ _frame_alloc(seL4_Word *vaddr, seL4_Word nframes)
     /* Retype a page at a time */
     *vaddr = PHYSICAL_VSTART + paddr;
     for (int i = 0; i < nframes; i++) {
-        if (retype_and_map(paddr, *vaddr + (i * PAGE_SIZE_4K), &frame_cap) != 0) {
+        if (retype_and_map(paddr, *vaddr + (i * PAGE_SIZE_4K), seL4_ARM_SmallPageObject, seL4_PageBits, &frame_cap) != 0) {
             LOG_ERROR("Failed to retype memory into a frame");
             goto _frame_alloc_error;
         }
@@ -361,18 +752,17 @@ _frame_alloc(seL4_Word *vaddr, seL4_Word nframes)
 
         /* Store the metadata in the frame table */
         assert(frame_table[p_id].cap == (seL4_ARM_Page)NULL);
-        assert(frame_table[p_id].chance == FIRST_CHANCE);
+        assert(!FRAME_BIT_GET(frame_valid, p_id));
 
         frame_table[p_id].cap = frame_cap;
-        frame_table[p_id].chance = FIRST_CHANCE; /* Reset the chance */
-        frame_table[p_id].pid = 0; /* Reset the pid */
-        frame_table[p_id].page_id = 0; /* Reset the page_id */
+        frame_table[p_id].info = INFO_PACK(0, 0, FRAME_SMALL); /* Reset the pid and page_id */
+        frame_state_reset(p_id);
 
         frame_table_cnt++;
         paddr += PAGE_SIZE_4K;
     }
 
-    bzero((void *)(*vaddr), PAGE_SIZE_4K * nframes);
+    /* Retyping memory into a frame zeroes it, so there is no need to bzero here */
     return top_frame_id;
 
     /* On error, set the vaddr to null and return -1 */
@@ -393,9 +783,10 @@ _frame_free(seL4_Word frame_id)
 
     seL4_ARM_Page frame_cap = frame_table[frame_id].cap;
     frame_table[frame_id].cap = (seL4_ARM_Page)NULL; /* Error guarding */
-    frame_table[frame_id].chance = FIRST_CHANCE; /* Reset the chance */
-    frame_table[frame_id].pid = 0; /* Reset the pid */
-    frame_table[frame_id].page_id = 0; /* Reset the page_id */
+    frame_table[frame_id].info = INFO_PACK(0, 0, FRAME_SMALL);
+    FRAME_BIT_CLR(frame_valid, frame_id);
+    FRAME_BIT_CLR(frame_pinned, frame_id);
+    FRAME_BIT_CLR(frame_referenced, frame_id);
 
     if (!frame_cap) {
         LOG_ERROR("Capability for %d does not exist", frame_id);
@@ -411,17 +802,47 @@ _frame_free(seL4_Word frame_id)
     ut_free(INDEX_TO_ADDR(frame_id), seL4_PageBits);
 }
 
+/*
+ * Private function to release a large frame back to the UT manager
+ * @param frame_id, id of the first entry of the large frame
+ */
+static void
+_frame_free_large(seL4_Word frame_id)
+{
+    LOG_INFO("Releasing large frame id %d", frame_id);
+
+    seL4_ARM_Page frame_cap = frame_table[frame_id].cap;
+    for (seL4_Word i = 0; i < FRAMES_PER_LARGE; i++) {
+        frame_table[frame_id + i].cap = (seL4_ARM_Page)NULL;
+        frame_table[frame_id + i].info = INFO_PACK(0, 0, FRAME_SMALL);
+    }
+
+    /* Only the head of a large frame has state bits */
+    FRAME_BIT_CLR(frame_valid, frame_id);
+    FRAME_BIT_CLR(frame_pinned, frame_id);
+    FRAME_BIT_CLR(frame_referenced, frame_id);
+
+    seL4_ARM_Page_Unmap(frame_cap);
+    frame_table_cnt -= FRAMES_PER_LARGE;
+
+    cspace_delete_cap(cur_cspace, frame_cap);
+    ut_free(INDEX_TO_ADDR(frame_id), LARGE_FRAME_BITS);
+}
+
 /*
  * Private function to retype and map untyped memory into a virtual address space 
  * @param paddr, the physical address to retype
  * @param vaddr, the virtual adddress to map onto
+ * @param type, the frame object type to retype into
+ * @param size_bits, the size of the frame object in bits
  * @param[out] frame_cap, the capabilty to the mapped frame
  * @returns 0 on success, else 1
  */
 static int
-retype_and_map(seL4_Word paddr, seL4_Word vaddr, seL4_ARM_Page *frame_cap)
+retype_and_map(seL4_Word paddr, seL4_Word vaddr, seL4_Word type, seL4_Word size_bits, seL4_ARM_Page *frame_cap)
 {
-    if (cspace_ut_retype_addr(paddr, seL4_ARM_SmallPageObject, seL4_PageBits, cur_cspace, frame_cap) != 0) {
+    *frame_cap = (seL4_ARM_Page)NULL;
+    if (cspace_ut_retype_addr(paddr, type, size_bits, cur_cspace, frame_cap) != 0) {
         LOG_ERROR("Failed to retype frame");
         return 1;
     }
@@ -434,3 +855,109 @@ retype_and_map(seL4_Word paddr, seL4_Word vaddr, seL4_ARM_Page *frame_cap)
 
     return 0;
 }
+
+/*
+ * Remove a frame from the head of a frame cache list
+ * @param head, the head of the list to remove from
+ * @returns id of the frame, else FRAME_CACHE_END if the list is empty
+ */
+static seL4_Word
+frame_cache_pop(seL4_Word *head)
+{
+    seL4_Word frame_id = *head;
+    if (frame_id == FRAME_CACHE_END)
+        return FRAME_CACHE_END;
+
+    seL4_Word next = INFO_NEXT(frame_table[frame_id].info);
+    *head = (next == INFO_NEXT_END) ? FRAME_CACHE_END : next;
+    frame_table[frame_id].info = INFO_PACK(0, 0, FRAME_SMALL);
+    frame_cache.size--;
+    return frame_id;
+}
+
+/*
+ * Place a frame onto the head of a frame cache list.
+ * The frame is pinned so the page replacement algorithm will not select it as a victim.
+ * @param head, the head of the list to place the frame onto
+ * @param frame_id, id of the frame to cache
+ */
+static void
+frame_cache_push(seL4_Word *head, seL4_Word frame_id)
+{
+    FRAME_BIT_SET(frame_pinned, frame_id);
+
+    /* The pid and page_id are dropped, the page number field links the list */
+    frame_table[frame_id].info = INFO_PACK_NEXT(*head) | FRAME_SMALL;
+    *head = frame_id;
+    frame_cache.size++;
+}
+
+/*
+ * Release frames from the frame cache back to the UT pool until the cache is at the low watermark.
+ * Dirty frames are released first, as zeroed frames have already had work put into them.
+ */
+static void
+frame_cache_trim(void)
+{
+    seL4_Word frame_id;
+    while (frame_cache.size > frame_cache.low_watermark) {
+        if ((frame_id = frame_cache_pop(&frame_cache_dirty)) == FRAME_CACHE_END) {
+            frame_id = frame_cache_pop(&frame_cache_zeroed);
+            frame_cache.zeroed--;
+        }
+
+        _frame_free(frame_id);
+        frame_cache.releases++;
+    }
+}
+
+/*
+ * Mark a newly allocated frame as valid and referenced, so it is on its first chance
+ * @param frame_id, id of the frame
+ */
+static void
+frame_state_reset(seL4_Word frame_id)
+{
+    FRAME_BIT_SET(frame_valid, frame_id);
+    FRAME_BIT_CLR(frame_pinned, frame_id);
+    FRAME_BIT_SET(frame_referenced, frame_id);
+}
+
+/*
+ * Unmap a frame from the processes it belongs to, once the replacement policy has cleared its reference.
+ * The frame stays resident and its page table entries are kept, so the next use
+ * takes a soft fault that maps it back in and marks it referenced.
+ * @param frame_id, id of the frame
+ */
+static void
+frame_unreference(seL4_Word frame_id)
+{
+    seL4_Word info = frame_table[frame_id].info;
+    seL4_Word sharers = frame_sharers[frame_id] ? frame_sharers[frame_id] : BIT(INFO_PID(info));
+
+    /* A use by any of the processes sharing the frame counts as a reference */
+    while (sharers) {
+        seL4_Word pid = CTZ(sharers);
+        sharers &= ~BIT(pid);
+        frame_unmap(pid, INFO_PAGE(info));
+    }
+}
+
+/*
+ * Unmap a resident page from a process, keeping its page table entry
+ * @param pid, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ */
+static void
+frame_unmap(seL4_Word pid, seL4_Word page_id)
+{
+    proc *owner = get_proc(pid);
+    if (owner == NULL || owner->p_addrspace == NULL)
+        return;
+
+    seL4_CPtr cap;
+    if (page_directory_lookup(owner->p_addrspace->directory, page_id, &cap) != 0 || IS_EVICTED(cap))
+        return;
+
+    seL4_ARM_Page_Unmap(PTE_CAP(cap));
+}
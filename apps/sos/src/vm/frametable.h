@@ -8,15 +8,62 @@
 #define _FRAMETABLE_H_
 
 #include "pager.h"
+#include "replacement.h"
 
-/* Individual frame */
+/* Large frames are 64K, and span multiple contiguous entries of the frame table */
+#define LARGE_FRAME_BITS 16
+#define LARGE_FRAME_SIZE BIT(LARGE_FRAME_BITS)
+#define LARGE_FRAME_MASK (LARGE_FRAME_SIZE - 1)
+#define LARGE_FRAME_ALIGN(addr) ((addr) & ~LARGE_FRAME_MASK)
+#define IS_ALIGNED_LARGE(addr) IS_ALIGNED(addr, LARGE_FRAME_BITS)
+#define FRAMES_PER_LARGE BIT(LARGE_FRAME_BITS - seL4_PageBits)
+
+/* Size of the frame an entry belongs to */
+enum frame_type {
+    FRAME_SMALL, /* A 4K frame */
+    FRAME_LARGE, /* First 4K of a large frame, holds the cap and metadata for the whole frame */
+    FRAME_LARGE_TAIL, /* Remainder of a large frame, refers back to the first entry */
+};
+
+/*
+ * Individual frame, packed into two words to keep the table dense for the victim scan.
+ * The info word holds the page number of the process vaddr, the pid and the frame type.
+ * While a frame sits in the frame cache, the page number field holds the id of the next cached frame.
+ * The replacement state of each frame is kept in bitmaps alongside the table, and the slot
+ * holding a clean copy of each frame and the processes sharing it in arrays after them, see FRAME_TABLE_BYTES.
+ */
 typedef struct {
     seL4_CPtr cap; /* The cap for the frame */
-    enum chance_type chance; /* Second page replacement status */
-    seL4_Word pid; /* ID of the process this page is mapped into */
-    seL4_Word page_id; /* Page id of the process vaddr this page is mapped into */
+    seL4_Word info; /* Page number (20 bits), pid (8 bits) and frame type (2 bits) */
 } frame_entry;
 
+/* Valid, pinned and referenced bitmaps are placed directly after the entries */
+#define FRAME_BITMAPS 3
+
+/* Clean slot and sharers arrays are placed after the bitmaps */
+#define FRAME_ARRAYS 2
+
+/* Number of bytes needed for a frame table of n frames, including its bitmaps, arrays and the state of the replacement policy */
+#define FRAME_TABLE_BYTES(n) ((sizeof(frame_entry) * (n)) + (FRAME_BITMAPS * sizeof(seL4_Word) * FRAME_BITMAP_WORDS(n)) + \
+                              (FRAME_ARRAYS * sizeof(seL4_Word) * (n)) + replacement_bytes(n))
+
+/* Frame cache statistics */
+typedef struct {
+    seL4_Word size; /* Number of frames currently held in the cache */
+    seL4_Word zeroed; /* Number of cached frames that have already been zeroed */
+    seL4_Word low_watermark; /* Number of frames the cache is trimmed down to */
+    seL4_Word high_watermark; /* Number of frames before the cache is trimmed */
+    seL4_Word hits; /* Allocations served from the cache */
+    seL4_Word misses; /* Allocations that had to retype new memory or page */
+    seL4_Word releases; /* Frames released back to the UT pool */
+    seL4_Word zero_hits; /* Zeroed allocations served without zeroing on the allocation path */
+} frame_cache_stats;
+
+/* Frame allocation flags */
+#define FRAME_ALLOC_ZERO 0 /* The frame is returned zero filled */
+#define FRAME_ALLOC_NOZERO (1 << 0) /* The caller will overwrite the entire frame, contents are undefined */
+#define FRAME_ALLOC_NOPAGE (1 << 1) /* Fail rather than page out a frame to make room, for callers within the pager */
+
 /*
  * Initialise the frame table.
  * @param paddr, the physical address of the frame_table
@@ -30,18 +77,32 @@ int frame_table_init(seL4_Word paddr, seL4_Word size_in_bits, seL4_Word low, seL
 /*
  * Reserve a physical frame.
  * @param[out] virtual address of the frame
+ * @param flags, FRAME_ALLOC_ZERO or FRAME_ALLOC_NOZERO, optionally with FRAME_ALLOC_NOPAGE
+ * @returns ID of the frame on success, else -1
+ */
+seL4_Word frame_alloc(seL4_Word *vaddr, seL4_Word flags);
+
+/*
+ * Reserve a 64K large frame.
+ * Large frames are opportunistic, they are never paged out to make room for one.
+ * The frame is zero filled.
+ * @param[out] virtual address of the frame
  * @returns ID of the frame on success, else -1
  */
-seL4_Word frame_alloc(seL4_Word *vaddr);
+seL4_Word frame_alloc_large(seL4_Word *vaddr);
 
 /*
  * Free an allocated frame.
+ * The frame is placed into the frame cache, the cache is trimmed
+ * back to the low watermark once it grows past the high watermark.
+ * Large frames are released straight back to the UT pool.
  * @param frame_id of the frame to be freed.
  */
 void frame_free(seL4_Word vaddr);
 
 /*
  * Return the capabilty for a frame.
+ * The tail of a large frame has no capability of its own, see frame_table_get_head.
  * @param frame_id, id of the frame to lookup
  * @return capability of the frame, NULL on error.
  */
@@ -71,7 +132,7 @@ seL4_Word frame_table_paddr_to_sos_vaddr(seL4_Word paddr);
 /*
  * Allocate multiple contiguous frames.
  * @param[out] vaddr, sos vaddr to access the memory
- * @param nframes, number of frames to allocate
+ * @param nframes, number of frames to allocate, 1, 4 or FRAMES_PER_LARGE
  * @return frame id of the starting first frame on success, else -1
  */
 seL4_Word multi_frame_alloc(seL4_Word *vaddr, seL4_Word nframes);
@@ -84,6 +145,12 @@ seL4_Word multi_frame_alloc(seL4_Word *vaddr, seL4_Word nframes);
  */
 int frame_table_get_limits(seL4_Word *lower, seL4_Word *upper);
 
+/*
+ * Select the next frame to evict with the replacement policy chosen at build time.
+ * @returns id of the victim frame, else -1 if every frame is pinned
+ */
+seL4_Word frame_table_next_victim(void);
+
 /*
  * Return whether this frame is on it's first or second chance
  * @param id, the id of the frame
@@ -94,12 +161,19 @@ int frame_table_get_chance(seL4_Word frame_id, enum chance_type *chance);
 
 /*
  * Set the chance type for a frame
+ * The chance and page id of any part of a large frame apply to the whole large frame.
  * @param frame_id, id of the frame
  * @param chance, the chance of the frame
  * @returns 0 on success, else 1
  */
 int frame_table_set_chance(seL4_Word frame_id, enum chance_type chance);
 
+/*
+ * Record a use of a frame for the replacement policy, without changing whether it is pinned
+ * @param frame_id, id of the frame
+ */
+void frame_table_reference(seL4_Word frame_id);
+
 /*
  * Set the process page id associated with this frame
  * @param frame_id, id of the frame
@@ -118,4 +192,80 @@ int frame_table_set_page_id(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id
  */
 int frame_table_get_page_id(seL4_Word frame_id, seL4_Word *pid, seL4_Word *page_id);
 
+/*
+ * Share a frame with another process, copy on write or with sos_share_vm, which maps it at the same page id.
+ * The owner of the frame stays responsible for it in the replacement policy.
+ * @param frame_id, id of the frame
+ * @param pid, the process now sharing the frame
+ * @returns 0 on success, else 1
+ */
+int frame_table_share(seL4_Word frame_id, seL4_Word pid);
+
+/*
+ * Stop sharing a frame with a process, once it has dropped its mapping of the frame.
+ * If the process owned the frame, one of the other processes sharing it becomes the owner.
+ * A frame left with a single process is no longer shared, that process owns it.
+ * @param frame_id, id of the frame, which must be shared
+ * @param pid, the process no longer sharing the frame
+ */
+void frame_table_unshare(seL4_Word frame_id, seL4_Word pid);
+
+/*
+ * Find the processes sharing a frame
+ * @param frame_id, id of the frame
+ * @returns bitmap of the pids sharing the frame, 0 if the frame is not shared
+ */
+seL4_Word frame_table_get_sharers(seL4_Word frame_id);
+
+/*
+ * Zero a bounded batch of frames in the frame cache ahead of time,
+ * so zeroed allocations do not have to memset on the fault path.
+ * Called by the event loop before each wait, whether or not a message is pending.
+ */
+void frame_cache_prezero(void);
+
+/*
+ * Find the frame holding the metadata for this frame.
+ * For the tail of a large frame this is the first entry of the large frame.
+ * @param frame_id, id of the frame
+ * @returns id of the head frame
+ */
+seL4_Word frame_table_get_head(seL4_Word frame_id);
+
+/*
+ * Determine if a frame is a large frame
+ * @param frame_id, id of the frame
+ * @returns TRUE if the frame is part of a large frame, else FALSE
+ */
+bool frame_table_is_large(seL4_Word frame_id);
+
+/*
+ * Record that a pagefile slot holds a clean copy of this frame.
+ * The frame owns the slot until the copy is cleared, or the frame is freed.
+ * @param frame_id, id of the frame
+ * @param pagefile_id, id of the slot in the pagefile
+ * @returns 0 on success, else 1
+ */
+int frame_table_set_swap(seL4_Word frame_id, seL4_Word pagefile_id);
+
+/*
+ * Find the pagefile slot holding a clean copy of this frame
+ * @param frame_id, id of the frame
+ * @param[out] pagefile_id, id of the slot in the pagefile
+ * @returns 0 if the frame has a clean copy, else 1
+ */
+int frame_table_get_swap(seL4_Word frame_id, seL4_Word *pagefile_id);
+
+/*
+ * Forget the clean copy of this frame, without releasing its pagefile slot
+ * @param frame_id, id of the frame
+ */
+void frame_table_clear_swap(seL4_Word frame_id);
+
+/*
+ * Retrieve the statistics of the frame cache
+ * @param[out] stats, the statistics of the cache
+ */
+void frame_cache_get_stats(frame_cache_stats *stats);
+
 #endif /* _FRAMETABLE_H_ */
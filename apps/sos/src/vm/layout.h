@@ -33,6 +33,7 @@
 /* Constants for how SOS will layout the address space of any
  * processes it loads up */
 #define PROCESS_STACK_TOP   (0x90000000)
+#define PROCESS_MMAP_TOP    (0x80000000) /* mmap places mappings below here, clear of the stack limit */
 #define PROCESS_IPC_BUFFER  (0xA0000000)
 #define PROCESS_VMEM_START  (0xC0000000)
 
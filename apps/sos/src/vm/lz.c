@@ -0,0 +1,233 @@
+/*
+ * LZ Page Compression Implementation
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "lz.h"
+
+#include <string.h>
+#include <utils/util.h>
+
+/* Shortest match worth encoding, a match costs a token and a 2 byte offset */
+#define LZ_MIN_MATCH 4
+
+/* Length fields of a token are 4 bits, longer lengths continue in the following bytes */
+#define LZ_TOKEN_MAX 15
+
+/* Furthest back a match can refer to */
+#define LZ_MAX_OFFSET 0xFFFF
+
+/* Size of the table of previous positions, indexed by a hash of the next 4 bytes */
+#define LZ_HASH_BITS 11
+#define LZ_HASH(seq) (((seq) * 2654435761u) >> (32 - LZ_HASH_BITS))
+
+/* After this many misses in a row, the search steps further each time through incompressible data */
+#define LZ_SKIP_SHIFT 5
+
+/* Positions of the last sequence with each hash, compression never yields so one table is shared */
+static uint16_t lz_table[BIT(LZ_HASH_BITS)];
+
+/* Private functions */
+static uint32_t lz_read32(const uint8_t *p);
+static int lz_write_length(uint8_t **op, uint8_t *end, seL4_Word length);
+static int lz_write_sequence(uint8_t **op, uint8_t *end, const uint8_t *literals, seL4_Word nliterals,
+                             seL4_Word offset, seL4_Word match);
+static int lz_read_length(const uint8_t **ip, const uint8_t *end, seL4_Word *length);
+
+seL4_Word
+lz_compress(const uint8_t *src, seL4_Word len, uint8_t *dst, seL4_Word capacity)
+{
+    uint8_t *op = dst;
+    uint8_t *oend = dst + capacity;
+    seL4_Word anchor = 0;
+    seL4_Word ip = 0;
+    seL4_Word misses = 0;
+
+    /* Positions are 16 bits */
+    if (len > LZ_MAX_OFFSET + 1)
+        return 0;
+
+    memset(lz_table, 0, sizeof(lz_table));
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq = lz_read32(src + ip);
+        uint32_t hash = LZ_HASH(seq);
+        seL4_Word candidate = lz_table[hash];
+        lz_table[hash] = ip;
+
+        if (candidate >= ip || lz_read32(src + candidate) != seq) {
+            ip += 1 + (misses++ >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        seL4_Word match = LZ_MIN_MATCH;
+        while (ip + match < len && src[candidate + match] == src[ip + match])
+            match++;
+
+        if (lz_write_sequence(&op, oend, src + anchor, ip - anchor, ip - candidate, match) != 0)
+            return 0;
+
+        ip += match;
+        anchor = ip;
+        misses = 0;
+    }
+
+    /* The remaining input is written as literals with no match */
+    if (lz_write_sequence(&op, oend, src + anchor, len - anchor, 0, 0) != 0)
+        return 0;
+
+    return op - dst;
+}
+
+seL4_Word
+lz_decompress(const uint8_t *src, seL4_Word len, uint8_t *dst, seL4_Word capacity)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        seL4_Word nliterals = token >> 4;
+        if (nliterals == LZ_TOKEN_MAX && lz_read_length(&ip, iend, &nliterals) != 0)
+            return 0;
+
+        if (nliterals > (seL4_Word)(iend - ip) || nliterals > (seL4_Word)(oend - op))
+            return 0;
+
+        memcpy(op, ip, nliterals);
+        ip += nliterals;
+        op += nliterals;
+
+        /* The last sequence ends with its literals */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return 0;
+
+        seL4_Word offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        seL4_Word match = token & LZ_TOKEN_MAX;
+        if (match == LZ_TOKEN_MAX && lz_read_length(&ip, iend, &match) != 0)
+            return 0;
+        match += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (seL4_Word)(op - dst) || match > (seL4_Word)(oend - op))
+            return 0;
+
+        /* Byte at a time, as a match may overlap the bytes it produces */
+        const uint8_t *from = op - offset;
+        for (seL4_Word i = 0; i < match; i++)
+            op[i] = from[i];
+        op += match;
+    }
+
+    return op - dst;
+}
+
+/*
+ * Read 4 bytes from any alignment
+ * @param p, the bytes to read
+ * @returns the bytes as a word
+ */
+static uint32_t
+lz_read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/*
+ * Write the part of a length that did not fit in its token
+ * @param[in/out] op, the output position
+ * @param end, the end of the output
+ * @param length, the length minus LZ_TOKEN_MAX
+ * @returns 0 on success, else 1 if the output is full
+ */
+static int
+lz_write_length(uint8_t **op, uint8_t *end, seL4_Word length)
+{
+    while (length >= 255) {
+        if (*op >= end)
+            return 1;
+        *(*op)++ = 255;
+        length -= 255;
+    }
+
+    if (*op >= end)
+        return 1;
+    *(*op)++ = length;
+    return 0;
+}
+
+/*
+ * Write a sequence of literals, followed by a match if there is one
+ * @param[in/out] op, the output position
+ * @param end, the end of the output
+ * @param literals, the literal bytes
+ * @param nliterals, the number of literal bytes
+ * @param offset, the distance back to the match
+ * @param match, the length of the match, 0 for the last sequence
+ * @returns 0 on success, else 1 if the output is full
+ */
+static int
+lz_write_sequence(uint8_t **op, uint8_t *end, const uint8_t *literals, seL4_Word nliterals,
+                  seL4_Word offset, seL4_Word match)
+{
+    if (*op >= end)
+        return 1;
+
+    seL4_Word match_code = match ? match - LZ_MIN_MATCH : 0;
+    uint8_t *token = (*op)++;
+    *token = (MIN(nliterals, LZ_TOKEN_MAX) << 4) | MIN(match_code, LZ_TOKEN_MAX);
+
+    if (nliterals >= LZ_TOKEN_MAX && lz_write_length(op, end, nliterals - LZ_TOKEN_MAX) != 0)
+        return 1;
+
+    if (nliterals > (seL4_Word)(end - *op))
+        return 1;
+
+    memcpy(*op, literals, nliterals);
+    *op += nliterals;
+
+    if (!match)
+        return 0;
+
+    if (end - *op < 2)
+        return 1;
+
+    *(*op)++ = offset & 0xFF;
+    *(*op)++ = offset >> 8;
+
+    if (match_code >= LZ_TOKEN_MAX && lz_write_length(op, end, match_code - LZ_TOKEN_MAX) != 0)
+        return 1;
+
+    return 0;
+}
+
+/*
+ * Read the part of a length that did not fit in its token
+ * @param[in/out] ip, the input position
+ * @param end, the end of the input
+ * @param[in/out] length, the length from the token, with the rest added on
+ * @returns 0 on success, else 1 if the input is malformed
+ */
+static int
+lz_read_length(const uint8_t **ip, const uint8_t *end, seL4_Word *length)
+{
+    uint8_t byte;
+    do {
+        if (*ip >= end)
+            return 1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * LZ Page Compression
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <sel4/sel4.h>
+#include <stdint.h>
+
+/*
+ * Compress a buffer.
+ * The output is a series of sequences in the style of LZ4, each a run of literals followed by a
+ * match against the previous 64K of input. The last sequence has literals only.
+ * @param src, the buffer to compress
+ * @param len, the length of the buffer
+ * @param dst, the buffer to write the compressed data to
+ * @param capacity, the size of dst
+ * @returns length of the compressed data, else 0 if it does not fit within capacity
+ */
+seL4_Word lz_compress(const uint8_t *src, seL4_Word len, uint8_t *dst, seL4_Word capacity);
+
+/*
+ * Decompress a buffer produced by lz_compress
+ * @param src, the compressed data
+ * @param len, the length of the compressed data
+ * @param dst, the buffer to write the original data to
+ * @param capacity, the size of dst
+ * @returns length of the original data, else 0 if the data is malformed or does not fit within capacity
+ */
+seL4_Word lz_decompress(const uint8_t *src, seL4_Word len, uint8_t *dst, seL4_Word capacity);
+
+#endif /* _LZ_H_ */
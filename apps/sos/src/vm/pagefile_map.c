@@ -0,0 +1,288 @@
+/*
+ * Pagefile Slot Map Implementation
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "pagefile_map.h"
+
+#include <strings.h>
+#include <utils/util.h>
+
+/* Returned by searches that find no free slot */
+#define PAGEFILE_MAP_NONE ((seL4_Word)-1)
+
+/* Words needed for a bitmap of n bits */
+#define MAP_WORDS(n) (((n) + seL4_WordBits - 1) / seL4_WordBits)
+
+/* Test if a slot is in use */
+#define MAP_USED(map, slot) (((map)->levels[0][(slot) / seL4_WordBits] >> ((slot) % seL4_WordBits)) & 1)
+
+/* Private functions */
+static seL4_Word map_levels(seL4_Word nslots, seL4_Word *words);
+static seL4_Word map_find(pagefile_map *map, seL4_Word level, seL4_Word index);
+static seL4_Word map_find_run(pagefile_map *map, seL4_Word index, seL4_Word nslots);
+static void map_set(pagefile_map *map, seL4_Word slot);
+static int map_clear(pagefile_map *map, seL4_Word slot);
+
+seL4_Word
+pagefile_map_bytes(seL4_Word nslots)
+{
+    seL4_Word words[PAGEFILE_MAP_MAX_LEVELS];
+    seL4_Word nlevels = map_levels(nslots, words);
+    seL4_Word total = 0;
+
+    for (seL4_Word level = 0; level < nlevels; level++)
+        total += words[level];
+
+    return total * sizeof(seL4_Word);
+}
+
+int
+pagefile_map_init(pagefile_map *map, seL4_Word *mem, seL4_Word nslots)
+{
+    if ((map->nlevels = map_levels(nslots, map->words)) == 0) {
+        LOG_ERROR("Unable to build a map of %d slots", nslots);
+        return 1;
+    }
+
+    bzero(mem, pagefile_map_bytes(nslots));
+    bzero(&map->stats, sizeof(pagefile_map_stats));
+    map->nslots = nslots;
+    map->cursor = 0;
+    map->stats.slots = nslots;
+
+    /*
+     * Lay the levels out one after another.
+     * Bits past the end of each level are marked as used so a search never returns them.
+     */
+    seL4_Word nbits = nslots;
+    for (seL4_Word level = 0; level < map->nlevels; level++) {
+        map->levels[level] = mem;
+        mem += map->words[level];
+
+        for (seL4_Word bit = nbits; bit < map->words[level] * seL4_WordBits; bit++)
+            map->levels[level][bit / seL4_WordBits] |= BIT(bit % seL4_WordBits);
+
+        nbits = map->words[level];
+    }
+
+    return 0;
+}
+
+int
+pagefile_map_alloc(pagefile_map *map, seL4_Word *slot)
+{
+    /* Next fit, wrapping around to the start of the map */
+    seL4_Word found = map_find(map, 0, map->cursor);
+    if (found == PAGEFILE_MAP_NONE && map->cursor != 0)
+        found = map_find(map, 0, 0);
+
+    if (found == PAGEFILE_MAP_NONE) {
+        map->stats.failures++;
+        return 1;
+    }
+
+    map_set(map, found);
+    map->cursor = (found + 1) % map->nslots;
+
+    map->stats.allocs++;
+    map->stats.used++;
+    map->stats.peak = MAX(map->stats.peak, map->stats.used);
+
+    *slot = found;
+    return 0;
+}
+
+int
+pagefile_map_alloc_run(pagefile_map *map, seL4_Word nslots, seL4_Word *first)
+{
+    if (nslots == 0 || nslots > map->nslots)
+        return 1;
+
+    /* Next fit, wrapping around to the start of the map */
+    seL4_Word found = map_find_run(map, map->cursor, nslots);
+    if (found == PAGEFILE_MAP_NONE && map->cursor != 0)
+        found = map_find_run(map, 0, nslots);
+
+    if (found == PAGEFILE_MAP_NONE) {
+        map->stats.failures++;
+        return 1;
+    }
+
+    for (seL4_Word slot = found; slot < found + nslots; slot++)
+        map_set(map, slot);
+
+    map->cursor = (found + nslots) % map->nslots;
+
+    map->stats.allocs += nslots;
+    map->stats.used += nslots;
+    map->stats.peak = MAX(map->stats.peak, map->stats.used);
+
+    *first = found;
+    return 0;
+}
+
+void
+pagefile_map_free(pagefile_map *map, seL4_Word slot)
+{
+    if (slot >= map->nslots) {
+        LOG_ERROR("Slot %d out of bounds", slot);
+        return;
+    }
+
+    if (map_clear(map, slot) != 0) {
+        LOG_ERROR("Slot %d is already free", slot);
+        return;
+    }
+
+    map->stats.frees++;
+    map->stats.used--;
+}
+
+void
+pagefile_map_get_stats(pagefile_map *map, pagefile_map_stats *stats)
+{
+    *stats = map->stats;
+}
+
+/*
+ * Compute the number of words in each level of a map
+ * @param nslots, the number of slots in the map
+ * @param[out] words, the number of words in each level
+ * @returns number of levels, 0 if nslots cannot be represented
+ */
+static seL4_Word
+map_levels(seL4_Word nslots, seL4_Word *words)
+{
+    if (nslots == 0)
+        return 0;
+
+    seL4_Word nlevels = 0;
+    seL4_Word nbits = nslots;
+    do {
+        if (nlevels == PAGEFILE_MAP_MAX_LEVELS)
+            return 0;
+
+        words[nlevels] = MAP_WORDS(nbits);
+        nbits = words[nlevels++];
+    } while (nbits > 1);
+
+    return nlevels;
+}
+
+/*
+ * Find the first clear bit of a level at or after index.
+ * When the word holding index has no clear bits, the level above is searched
+ * for the next word that is not full, so full regions are skipped a word at a time.
+ * @param map, the map to search
+ * @param level, the level to search
+ * @param index, the bit to start searching from
+ * @returns index of the clear bit, else PAGEFILE_MAP_NONE
+ */
+static seL4_Word
+map_find(pagefile_map *map, seL4_Word level, seL4_Word index)
+{
+    seL4_Word *bitmap = map->levels[level];
+    seL4_Word word = index / seL4_WordBits;
+    if (word >= map->words[level])
+        return PAGEFILE_MAP_NONE;
+
+    seL4_Word free_bits = ~bitmap[word] & ~MASK(index % seL4_WordBits);
+    if (!free_bits) {
+        if (level + 1 == map->nlevels) {
+            /* The top level has no summary, it is only a few words */
+            for (word++; word < map->words[level]; word++) {
+                if (~bitmap[word])
+                    break;
+            }
+
+            if (word == map->words[level])
+                return PAGEFILE_MAP_NONE;
+        } else if ((word = map_find(map, level + 1, word + 1)) == PAGEFILE_MAP_NONE) {
+            return PAGEFILE_MAP_NONE;
+        }
+
+        free_bits = ~bitmap[word];
+    }
+
+    return (word * seL4_WordBits) + CTZ(free_bits);
+}
+
+/*
+ * Find the first run of free slots at or after index
+ * @param map, the map to search
+ * @param index, the slot to start searching from
+ * @param nslots, the length of the run
+ * @returns first slot of the run, else PAGEFILE_MAP_NONE
+ */
+static seL4_Word
+map_find_run(pagefile_map *map, seL4_Word index, seL4_Word nslots)
+{
+    seL4_Word slot = index;
+    while ((slot = map_find(map, 0, slot)) != PAGEFILE_MAP_NONE) {
+        if (slot + nslots > map->nslots)
+            return PAGEFILE_MAP_NONE;
+
+        seL4_Word len = 1;
+        while (len < nslots && !MAP_USED(map, slot + len))
+            len++;
+
+        if (len == nslots)
+            return slot;
+
+        /* The slot after the free run is in use, resume past it */
+        slot += len + 1;
+    }
+
+    return PAGEFILE_MAP_NONE;
+}
+
+/*
+ * Mark a slot as used, filling in the summary above it
+ * @param map, the map
+ * @param slot, the slot to mark
+ */
+static void
+map_set(pagefile_map *map, seL4_Word slot)
+{
+    seL4_Word index = slot;
+    for (seL4_Word level = 0; level < map->nlevels; level++) {
+        seL4_Word *word = &map->levels[level][index / seL4_WordBits];
+        *word |= BIT(index % seL4_WordBits);
+
+        /* Only a newly full word changes the level above */
+        if (*word != (seL4_Word)-1)
+            break;
+
+        index /= seL4_WordBits;
+    }
+}
+
+/*
+ * Mark a slot as free, clearing the summary above it
+ * @param map, the map
+ * @param slot, the slot to clear
+ * @returns 0 on success, else 1 if the slot was already free
+ */
+static int
+map_clear(pagefile_map *map, seL4_Word slot)
+{
+    seL4_Word index = slot;
+    if (!(map->levels[0][index / seL4_WordBits] & BIT(index % seL4_WordBits)))
+        return 1;
+
+    for (seL4_Word level = 0; level < map->nlevels; level++) {
+        seL4_Word *word = &map->levels[level][index / seL4_WordBits];
+        bool was_full = (*word == (seL4_Word)-1);
+        *word &= ~BIT(index % seL4_WordBits);
+
+        /* Only a word that was full is marked in the level above */
+        if (!was_full)
+            break;
+
+        index /= seL4_WordBits;
+    }
+
+    return 0;
+}
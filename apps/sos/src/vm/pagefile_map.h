@@ -0,0 +1,86 @@
+/*
+ * Pagefile Slot Map
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#ifndef _PAGEFILE_MAP_H_
+#define _PAGEFILE_MAP_H_
+
+#include <sel4/sel4.h>
+
+/* Maximum depth of the summary, 4 levels of 32 bit words can describe 2^20 slots */
+#define PAGEFILE_MAP_MAX_LEVELS 4
+
+/* Occupancy statistics of a slot map */
+typedef struct {
+    seL4_Word slots; /* Number of slots managed by the map */
+    seL4_Word used; /* Number of slots currently allocated */
+    seL4_Word peak; /* Highest number of slots allocated at once */
+    seL4_Word allocs; /* Successful allocations */
+    seL4_Word frees; /* Slots released */
+    seL4_Word failures; /* Allocations that found the map full */
+} pagefile_map_stats;
+
+/*
+ * Hierarchical bitmap of pagefile slots.
+ * Level 0 has a bit per slot, set when the slot is in use.
+ * Each higher level has a bit per word of the level below, set when that word is full.
+ */
+typedef struct {
+    seL4_Word *levels[PAGEFILE_MAP_MAX_LEVELS]; /* Bitmap of each level */
+    seL4_Word words[PAGEFILE_MAP_MAX_LEVELS]; /* Number of words in each level */
+    seL4_Word nlevels; /* Number of levels in use */
+    seL4_Word nslots; /* Number of slots in the map */
+    seL4_Word cursor; /* Next fit, the slot the next search starts from */
+    pagefile_map_stats stats;
+} pagefile_map;
+
+/*
+ * Number of bytes of memory needed for a map of nslots
+ * @param nslots, the number of slots in the map
+ * @returns size in bytes
+ */
+seL4_Word pagefile_map_bytes(seL4_Word nslots);
+
+/*
+ * Initialise a map with every slot free
+ * @param map, the map to initialise
+ * @param mem, memory for the bitmaps, at least pagefile_map_bytes(nslots) in size
+ * @param nslots, the number of slots in the map
+ * @returns 0 on success, else 1
+ */
+int pagefile_map_init(pagefile_map *map, seL4_Word *mem, seL4_Word nslots);
+
+/*
+ * Find and reserve a free slot, searching onwards from the last allocation
+ * @param map, the map to allocate from
+ * @param[out] slot, the id of the reserved slot
+ * @returns 0 on success, else 1 if the map is full
+ */
+int pagefile_map_alloc(pagefile_map *map, seL4_Word *slot);
+
+/*
+ * Find and reserve a run of contiguous free slots, searching onwards from the last allocation
+ * @param map, the map to allocate from
+ * @param nslots, the length of the run
+ * @param[out] first, the id of the first slot of the run
+ * @returns 0 on success, else 1 if there is no run of that length
+ */
+int pagefile_map_alloc_run(pagefile_map *map, seL4_Word nslots, seL4_Word *first);
+
+/*
+ * Release a slot back to the map
+ * @param map, the map the slot belongs to
+ * @param slot, the id of the slot
+ */
+void pagefile_map_free(pagefile_map *map, seL4_Word slot);
+
+/*
+ * Retrieve the occupancy statistics of a map
+ * @param map, the map
+ * @param[out] stats, the statistics of the map
+ */
+void pagefile_map_get_stats(pagefile_map *map, pagefile_map_stats *stats);
+
+#endif /* _PAGEFILE_MAP_H_ */
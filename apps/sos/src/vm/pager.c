@@ -6,284 +6,709 @@
 
 #include "pager.h"
 
+#include <autoconf.h>
 #include <coro/picoro.h>
 #include "event.h"
+#include <fcntl.h>
 #include "frametable.h"
-#include <fs/sos_nfs.h>
 #include "mapping.h"
-#include "network.h"
+#include "share.h"
 #include <string.h>
 #include <strings.h>
+#include "swap.h"
 #include <utils/util.h>
 #include <vm/layout.h>
+#include "zcache.h"
 
-/* Variable to represent where we are up to in our search for a victim page */
-static volatile seL4_Word current_page = 0;
+/* Number of victims evicted together by a single page out */
+#define PAGE_OUT_CLUSTER 8
 
-/* To spin on when waiting for asynchronous initialisation */
-static volatile seL4_Word pager_initialised = FALSE;
+/* Maximum number of pagefile writes in flight at once */
+#define PAGE_OUT_WINDOW 4
 
-/* Handle of the pagefile for NFS operations */
-static fhandle_t pagefile_handle;
+/* Maximum number of pagefile reads in flight at once */
+#define PAGE_IN_WINDOW 4
 
-/* Queue of paging operations */
-static list_t *pagefile_operations = NULL;
+/* Pages read by a single page in of a sequential region, or of a range the process will need */
+#define PAGE_IN_BATCH 16
+compile_time_assert(page_in_batch_covers_readahead, PAGE_IN_BATCH >= CONFIG_SOS_PAGE_READAHEAD);
 
-/* Bit array representing the pagefile */
-static int *pagefile_metatable = NULL;
+/* Victims passed over in favour of a process above its share, before taking one regardless */
+#define PAGE_OUT_FAIR_SCANS 16
 
-/* Private functions */
-static int next_victim(void);
-static int evict_frame(seL4_Word frame_id);
-static int page_gate_open(void);
-static int page_gate_close(void);
-static void pagefile_create_callback(uintptr_t token, enum nfs_stat status, fhandle_t* fh, fattr_t* fattr);
+/* Buckets of the table of shared pagefile slots, a power of two */
+#define SLOT_SHARE_BUCKETS 64
+#define SLOT_SHARE_INDEX(pagefile_id) ((pagefile_id) & (SLOT_SHARE_BUCKETS - 1))
+
+/*
+ * A page with a read or write to the pagefile in flight.
+ * Its frame is kept pinned for the duration, so the frame table needs no tracking of its own.
+ */
+typedef struct {
+    seL4_Word pid; /* Process the page belongs to */
+    seL4_Word page_id; /* Virtual address of the page */
+    seL4_Word pagefile_id; /* Slot being read or written */
+    bool release; /* The slot was freed during the operation, release it once the operation completes */
+    list_t waiters; /* Coroutines waiting for the operation to complete */
+} page_op;
+
+/* Pages with a paging operation in flight */
+static list_t *pages_in_flight = NULL;
+
+/*
+ * A pagefile slot referenced by the page tables or frames of more than one process, after a fork.
+ * A slot referenced once has no entry, it is released by its first pagefile_free_add.
+ */
+typedef struct slot_share {
+    seL4_Word pagefile_id; /* The shared slot */
+    seL4_Word refs; /* References beyond the first */
+    struct slot_share *next; /* Next shared slot in the bucket */
+} slot_share;
 
-/* Determine if the pager is locked */
-static volatile bool global_page_lock = FALSE;
+/* Shared slots, hashed on their id */
+static slot_share *slot_shares[SLOT_SHARE_BUCKETS];
 
-/* Specify an exempt coroutine from the locking mechanism */
-static volatile coro lock_free_coro = NULL;
+/* Private functions */
+static int page_in_batch(proc *curproc, seL4_Word page_id, seL4_Word access_type, seL4_Word npages_max);
+static int page_out_cluster(pid_t target, seL4_Word nvictims_max, seL4_Word *page_id);
+static seL4_Word next_victim(pid_t target);
+static bool rss_contended(seL4_Word *share);
+static bool rss_over_share(proc *curproc, seL4_Word share);
+static int evict_frame(seL4_Word frame_id, uiovec *iovs, page_op **ops, seL4_Word *evicted);
+static int unevict_frame(seL4_Word frame_id, seL4_Word sharers, seL4_Word evicted);
+static int evict_file_page(proc *curproc, region *reg, seL4_Word frame_id, seL4_Word page_id);
+static int evict_sharers(seL4_Word frame_id, seL4_Word page_id, seL4_Word *pagefile_ids, seL4_Word npages);
+static int page_write_file(region *reg, seL4_Word page_id, seL4_Word sos_vaddr);
+static bool page_is_zero(seL4_Word vaddr);
+static void page_in_complete(proc *curproc, region *page_region, seL4_Word page_id, seL4_Word pagefile_id,
+                             seL4_Word frame_id, seL4_Word access_type);
+static page_op *page_op_begin(seL4_Word pid, seL4_Word page_id, seL4_Word pagefile_id);
+static page_op *page_op_find(seL4_Word pid, seL4_Word page_id);
+static page_op *page_op_find_slot(seL4_Word pagefile_id);
+static int page_op_wait(page_op *op);
+static void page_op_end(page_op *op);
+static void page_writeback(void);
 
 int
-init_pager(seL4_Word paddr, seL4_Word size_in_bits)
+init_pager(void)
 {
-    const sattr_t file_attr = {
-        .mode = 0664, /* Read write for owner and group, read for everyone */
-    };
-
-    if (nfs_create(&mnt_point, "pagefile", &file_attr, pagefile_create_callback, (uintptr_t)NULL) != RPC_OK) {
-        LOG_ERROR("Failed to create pagefile");
+    /* Page file operations */
+    if ((pages_in_flight = malloc(sizeof(list_t))) == NULL) {
+        LOG_ERROR("Failed to allocate memory for paging operations list");
         return 1;
     }
 
-    seL4_Word badge;
+    list_init(pages_in_flight);
 
-    /* Spin until the pager is initialised */
-    LOG_INFO("Spinning until pager is initialised");
-    while (pager_initialised == FALSE) {
-        seL4_Wait(_sos_ipc_ep_cap, &badge);
-        if (badge & IRQ_EP_BADGE && badge & IRQ_BADGE_NETWORK)
-            network_irq();
+    /* Create the pagefiles and the other backends of the swap space, their slot maps grow with them */
+    if (swap_init() != 0) {
+        LOG_ERROR("Failed to initialise the swap space");
+        return 1;
     }
 
     LOG_INFO("Resuming sos initialisation");
 
-    /* Page file operations */
-    if ((pagefile_operations = malloc(sizeof(list_t))) == NULL) {
-        LOG_ERROR("Failed to allocate memory for paging operations queue");
+    if (zcache_init() != 0) {
+        LOG_ERROR("Failed to initialise the compressed page cache");
         return 1;
     }
 
-    list_init(pagefile_operations);
+    return 0;
+}
 
-    /* Initilizer the pagefile metatable */
-    seL4_Word vaddr = PHYSICAL_VSTART + paddr;
-    pagefile_metatable = (int *)vaddr;
-    seL4_ARM_Page frame_cap;
+int
+page_in(proc *curproc, seL4_Word page_id, seL4_Word access_type)
+{
+    return page_in_batch(curproc, page_id, access_type, 0);
+}
 
-    for (int i = 0; i < BYTES_TO_4K_PAGES(BIT(size_in_bits)); i++) {
-        if (cspace_ut_retype_addr(paddr, seL4_ARM_SmallPageObject, seL4_PageBits, cur_cspace, &frame_cap) != 0) {
-            LOG_ERROR("Failed to retype frame");
-            return 1;
-        }
+int
+page_in_ahead(proc *curproc, seL4_Word page_id, seL4_Word npages)
+{
+    return page_in_batch(curproc, page_id, ACCESS_READ, MAX(npages, 1));
+}
 
-        seL4_CPtr pt_cap;
-        if (map_page(frame_cap, seL4_CapInitThreadPD, vaddr, seL4_AllRights, seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
-            LOG_ERROR("Failed to map frame");
-            return 1;
-        }
+int
+page_in_file(proc *curproc, region *reg, seL4_Word page_id, seL4_Word access_type, seL4_Word *sos_vaddr)
+{
+    int result = 1;
+    page_directory *dir = curproc->p_addrspace->directory;
+
+    LOG_INFO("Reading in %p from its file", (void *)page_id);
+
+    /* Wait out the write back of the page, the file is stale until it lands */
+    if (page_wait(curproc->pid, page_id) != 0)
+        return 1;
+
+    /* Another fault mapped the page while we waited */
+    seL4_CPtr cap;
+    if (page_directory_lookup(dir, page_id, &cap) == 0)
+        return 0;
 
-        vaddr += PAGE_SIZE_4K;
-        paddr += PAGE_SIZE_4K;
+    /* Claim the page before vm_map can yield, so other faults on it wait for this read */
+    page_op *op;
+    if ((op = page_op_begin(curproc->pid, page_id, -1)) == NULL) {
+        LOG_ERROR("Failed to track the page in");
+        return 1;
     }
 
-    return 0;
+    if (vm_map(curproc, page_id, access_type, FRAME_ALLOC_ZERO, sos_vaddr) != 0) {
+        LOG_ERROR("Failed to map in the page");
+        goto page_in_file_epilogue;
+    }
+
+    /* The frame is pinned until the read completes, reading short at the end of the file leaves zeros */
+    seL4_Word frame_id = frame_table_sos_vaddr_to_index(*sos_vaddr);
+    assert(frame_table_set_chance(frame_id, PINNED) == 0);
+
+    uiovec iov = {
+        .uiov_base = (void *)*sos_vaddr,
+        .uiov_len = PAGE_SIZE_4K,
+        .uiov_pos = reg->offset + (page_id - reg->start),
+    };
+    if (reg->vn->vn_ops->vop_read(reg->vn, &iov) < 0) {
+        LOG_ERROR("Failed to read from the file");
+        assert(page_directory_remove(dir, page_id) == 0);
+        frame_free(frame_id);
+        curproc->rss--;
+        goto page_in_file_epilogue;
+    }
+
+    /* A page of a sequential region is replaced first, the process is not expected to return to it */
+    assert(frame_table_set_chance(frame_id, (reg->flags & REGION_SEQUENTIAL) ? SECOND_CHANCE : FIRST_CHANCE) == 0);
+
+    /* Flush the cache in case this page was instruction data */
+    seL4_ARM_Page_Unify_Instruction(frame_table_get_capability(frame_id), 0, PAGE_SIZE_4K);
+    result = 0;
+
+    page_in_file_epilogue:
+        page_op_end(op);
+        return result;
 }
 
 int
-page_in(proc *curproc, seL4_Word page_id, seL4_Word access_type)
+page_out_file(proc *curproc, region *reg, seL4_Word page_id)
 {
-    int result = 1;
+    /* Wait out an eviction of the page, which writes it back itself */
+    if (page_wait(curproc->pid, page_id) != 0)
+        return 1;
+
+    seL4_Word frame;
+    if (page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) != 0)
+        return 0;
 
-    /* Pass through the gate, or wait */
-    if (page_gate_open() != 0) {
-        LOG_ERROR("Failed to pass through the paging gate");
+    /* A reference that cannot write to the file has nothing to write back */
+    if (reg->mode == O_RDONLY)
+        return 0;
+
+    /* The frame is pinned while it is written, so it is not evicted from under the write */
+    page_op *op;
+    if ((op = page_op_begin(curproc->pid, page_id, -1)) == NULL) {
+        LOG_ERROR("Failed to track the write back");
         return 1;
     }
 
+    seL4_Word frame_id = PTE_FRAME(frame);
+    assert(frame_table_set_chance(frame_id, PINNED) == 0);
+    int err = page_write_file(reg, page_id, frame_table_index_to_sos_vaddr(frame_id));
+    assert(frame_table_set_chance(frame_id, FIRST_CHANCE) == 0);
+
+    page_op_end(op);
+    return err;
+}
+
+int
+page_out(seL4_Word *page_id)
+{
+    return page_out_cluster(-1, PAGE_OUT_CLUSTER, page_id);
+}
+
+int
+page_trim(proc *curproc)
+{
+    seL4_Word page_id;
+    int frame_id = page_out_cluster(curproc->pid, 1, &page_id);
+    if (frame_id == -1)
+        return 1;
+
+    /* The frame is parked in the frame cache for the mapping to come */
+    frame_free(frame_id);
+    return 0;
+}
+
+/*
+ * Page in an evicted page, reading ahead the evicted pages that follow it in its region
+ * @param curproc, the process requesting the page in
+ * @param page_id, the vaddr of the page in the process
+ * @param access_type, the type of access for this page (for permissions mapping)
+ * @param npages_max, the most pages to read, or 0 for the read ahead of the region
+ * @returns 0 on success, else 1
+ */
+static int
+page_in_batch(proc *curproc, seL4_Word page_id, seL4_Word access_type, seL4_Word npages_max)
+{
+    int result = 1;
+    page_directory *dir = curproc->p_addrspace->directory;
+
+    /* The faulting page comes first, followed by the pages read ahead of it */
+    uiovec iovs[PAGE_IN_BATCH];
+    seL4_Word pages[PAGE_IN_BATCH];
+    seL4_Word pagefile_ids[PAGE_IN_BATCH];
+    seL4_Word frame_ids[PAGE_IN_BATCH];
+    page_op *ops[PAGE_IN_BATCH];
+    seL4_Word npages = 0;
+
     LOG_INFO("Paging in %p", (void *)page_id);
 
+    /* Wait out any operation on this page, its slot is not safe to read until a write completes */
+    if (page_wait(curproc->pid, PAGE_ALIGN_4K(page_id)) != 0)
+        return 1;
+
     seL4_CPtr pagefile_id;
-    if (page_directory_lookup(curproc->p_addrspace->directory, PAGE_ALIGN_4K(page_id), &pagefile_id) != 0) {
+    if (page_directory_lookup(dir, PAGE_ALIGN_4K(page_id), &pagefile_id) != 0) {
         LOG_ERROR("Failed to find page associated with vaddr");
-        goto page_in_epilogue;
+        return 1;
     }
 
-    assert((pagefile_id & EVICTED_BIT) != 0);
+    /* The operation we waited on paged it in for us */
+    if (!IS_EVICTED(pagefile_id))
+        return 0;
+
+    /* A page that was all zeros has nothing to read */
+    if (IS_ZERO(pagefile_id))
+        return vm_map_zero(curproc, PAGE_ALIGN_4K(page_id), access_type);
+
     pagefile_id &= (~EVICTED_BIT);
     LOG_INFO("Page is stored at entry %lu in the pagefile", pagefile_id);
 
-    /*
-     * Turn off the locking mechanism for paging until this function returns.
-     * The reason being is that vm_map might call page_out, and we want that operation to
-     * occur immediately, rather than be queued for later
-     */
+    /* A slot shared with another process may be written under an operation on the page of that process */
+    page_op *op;
+    bool waited = FALSE;
+    while ((op = page_op_find_slot(pagefile_id)) != NULL) {
+        if (page_op_wait(op) != 0) {
+            LOG_ERROR("Failed to wait for the slot");
+            return 1;
+        }
+        waited = TRUE;
+    }
+
+    /* A process sharing the page with sos_share_vm may have paged it in for every process sharing it */
+    if (waited) {
+        seL4_CPtr cap;
+        if (page_directory_lookup(dir, PAGE_ALIGN_4K(page_id), &cap) != 0) {
+            LOG_ERROR("Failed to find page associated with vaddr");
+            return 1;
+        }
+
+        if (!IS_EVICTED(cap))
+            return 0;
+    }
+
+    region *page_region;
+    if (as_find_region(curproc->p_addrspace, page_id, &page_region) != 0) {
+        LOG_ERROR("Evicted page is outside of any region");
+        return 1;
+    }
+
+    /* Sequential regions read ahead a whole batch, random regions read only the faulting page */
+    if (npages_max == 0) {
+        if (page_region->flags & REGION_SEQUENTIAL)
+            npages_max = PAGE_IN_BATCH;
+        else if (page_region->flags & REGION_RANDOM)
+            npages_max = 1;
+        else
+            npages_max = CONFIG_SOS_PAGE_READAHEAD;
+    }
+    npages_max = MIN(npages_max, PAGE_IN_BATCH);
+
+    /* Claim the page before vm_map can yield, so other faults on it wait for this read */
+    if ((ops[0] = page_op_begin(curproc->pid, PAGE_ALIGN_4K(page_id), pagefile_id)) == NULL) {
+        LOG_ERROR("Failed to track the page in");
+        return 1;
+    }
+
     seL4_Word sos_vaddr;
-    global_page_lock = FALSE;
-    lock_free_coro = coro_getcur();
-    if (vm_map(curproc, page_id, access_type, &sos_vaddr) != 0) {
+    if (vm_map(curproc, page_id, access_type, FRAME_ALLOC_NOZERO, &sos_vaddr) != 0) {
         LOG_ERROR("Failed to map in the page");
-        global_page_lock = TRUE;
-        lock_free_coro = NULL;
-        goto page_in_epilogue;
+        page_op_end(ops[0]);
+        return 1;
     }
 
-    global_page_lock = TRUE;
-    lock_free_coro = NULL;
-
     /* A page was just pushed to disk, page_id now corresponds to a legit page and 
      * sos_vaddr is where we can access that frame */
+    pages[npages] = PAGE_ALIGN_4K(page_id);
+    pagefile_ids[npages] = pagefile_id;
+    frame_ids[npages++] = frame_table_sos_vaddr_to_index(sos_vaddr);
 
-    /* Read the page in from the pagefile and into memory */
-    vnode handle = {.vn_data = &pagefile_handle};
-    uiovec iov = {
-       .uiov_base = (char *)sos_vaddr,
-       .uiov_len = PAGE_SIZE_4K,
-       .uiov_pos = pagefile_id * PAGE_SIZE_4K
-    };
+    /*
+     * Read ahead the evicted pages that follow in the same region.
+     * Every frame is pinned until its read completes, so making room for
+     * the next one cannot choose it as a victim.
+     * Read ahead stops at a page that is already in flight.
+     */
+    assert(frame_table_set_chance(frame_ids[0], PINNED) == 0);
+    for (seL4_Word vaddr = pages[0] + PAGE_SIZE_4K; npages < npages_max; vaddr += PAGE_SIZE_4K) {
+        if (vaddr >= page_region->end || page_directory_lookup(dir, vaddr, &pagefile_id) != 0 ||
+            !IS_EVICTED(pagefile_id) || IS_ZERO(pagefile_id))
+            break;
+
+        if (page_op_find(curproc->pid, vaddr) != NULL || page_op_find_slot(pagefile_id & (~EVICTED_BIT)) != NULL)
+            break;
+
+        if ((ops[npages] = page_op_begin(curproc->pid, vaddr, pagefile_id & (~EVICTED_BIT))) == NULL)
+            break;
+
+        if (vm_map(curproc, vaddr, ACCESS_READ, FRAME_ALLOC_NOZERO, &sos_vaddr) != 0) {
+            page_op_end(ops[npages]);
+            break;
+        }
+
+        pages[npages] = vaddr;
+        pagefile_ids[npages] = pagefile_id & (~EVICTED_BIT);
+        frame_ids[npages] = frame_table_sos_vaddr_to_index(sos_vaddr);
+        assert(frame_table_set_chance(frame_ids[npages++], PINNED) == 0);
+    }
 
-    /* sos_nfs_read gauruntees entire data is read */
-    if (sos_nfs_read(&handle, &iov) == -1) {
+    /* Pages held compressed in memory need no read, the rest are read from the pagefile with the reads in flight together */
+    seL4_Word niovs = 0;
+    for (seL4_Word i = 0; i < npages; i++) {
+        void *page = (void *)frame_table_index_to_sos_vaddr(frame_ids[i]);
+        if (zcache_load(pagefile_ids[i], page) == 0)
+            continue;
+
+        iovs[niovs].uiov_base = page;
+        iovs[niovs].uiov_len = PAGE_SIZE_4K;
+        iovs[niovs++].uiov_pos = pagefile_ids[i] * PAGE_SIZE_4K;
+    }
+
+    if (niovs > 0 && swap_read_batch(iovs, niovs, PAGE_IN_WINDOW) != 0) {
         LOG_ERROR("Failed to read from pagefile");
+
+        /*
+         * Every page goes back to being evicted, their contents are still in the pagefile or the cache.
+         * The frames were not zeroed, so none may stay mapped with what they held before.
+         */
+        for (seL4_Word i = 0; i < npages; i++) {
+            assert(page_directory_evict(dir, pages[i], pagefile_ids[i]) == 0);
+            frame_free(frame_ids[i]);
+            curproc->rss--;
+        }
+
         goto page_in_epilogue;
     }
 
-    /* Mark the page as free in the pagefile */
-    pagefile_free_add(pagefile_id);
+    /*
+     * The faulting page is referenced, pages read ahead are replaced first if they go unused.
+     * Every page of a sequential region is replaced first.
+     */
+    page_in_complete(curproc, page_region, pages[0], pagefile_ids[0], frame_ids[0], access_type);
+    assert(frame_table_set_chance(frame_ids[0],
+        (page_region->flags & REGION_SEQUENTIAL) ? SECOND_CHANCE : FIRST_CHANCE) == 0);
+    for (seL4_Word i = 1; i < npages; i++) {
+        page_in_complete(curproc, page_region, pages[i], pagefile_ids[i], frame_ids[i], ACCESS_READ);
+        assert(frame_table_set_chance(frame_ids[i], SECOND_CHANCE) == 0);
+    }
 
-    /* Flush the cache in case this page was instruction data */
-    seL4_ARM_Page_Unify_Instruction(frame_table_get_capability(frame_table_sos_vaddr_to_index(sos_vaddr)), 0, PAGE_SIZE_4K);
+    /* The processes sharing a page with sos_share_vm share the frame it was read into */
+    for (seL4_Word i = 0; i < npages; i++)
+        vm_share_propagate(curproc, pages[i]);
+
+    curproc->p_vmstats.page_ins++;
+    curproc->p_vmstats.readahead += npages - 1;
 
     result = 0;
     page_in_epilogue:
-        /* Exit through the gate */
-        page_gate_close();
+        /* Wake the faults waiting on these pages */
+        for (seL4_Word i = 0; i < npages; i++)
+            page_op_end(ops[i]);
         return result;
 }
 
-int
-page_out(seL4_Word *page_id)
+/*
+ * Page out a cluster of victims, returning the first to the caller
+ * @param target, the pid of the process to take the victims from, else -1 for any process
+ * @param nvictims_max, the maximum number of victims to evict
+ * @param[out] page_id, the sos vaddr of the returned frame
+ * @returns id of the frame on success, else -1
+ */
+static int
+page_out_cluster(pid_t target, seL4_Word nvictims_max, seL4_Word *page_id)
 {
     int frame_id = -1;
+    seL4_Word victims[PAGE_OUT_CLUSTER];
+    seL4_Word sharers[PAGE_OUT_CLUSTER];
+    seL4_Word evicted[PAGE_OUT_CLUSTER];
+    seL4_Word nvictims = 0;
+    seL4_Word niovs = 0;
+    int npages;
 
-    if (page_gate_open() != 0) {
-        LOG_ERROR("Failed to pass through the paging gate");
-        return -1;
+    /* Writes of the cluster, and the page each write is for */
+    uiovec iovs[PAGE_OUT_CLUSTER * FRAMES_PER_LARGE];
+    page_op *ops[PAGE_OUT_CLUSTER * FRAMES_PER_LARGE];
+
+    /* Make room in the compressed page cache for the victims to come */
+    if (zcache_needs_writeback())
+        page_writeback();
+
+    /*
+     * Select a cluster of victims, pinning each so it is not selected again.
+     * Each victim is detached from its process before any write is issued.
+     */
+    assert(nvictims_max <= PAGE_OUT_CLUSTER);
+    while (nvictims < nvictims_max) {
+        seL4_Word victim = next_victim(target);
+        if (victim == -1)
+            break;
+
+        assert(frame_table_set_chance(victim, PINNED) == 0);
+        LOG_INFO("Paging out %d", victim);
+
+        /* Eviction unshares the frame, the sharers are kept to restore it should the write fail */
+        sharers[nvictims] = frame_table_get_sharers(victim);
+        if ((npages = evict_frame(victim, &iovs[niovs], &ops[niovs], &evicted[nvictims])) == -1) {
+            LOG_ERROR("Failed to evict frame");
+            assert(frame_table_set_chance(victim, FIRST_CHANCE) == 0);
+            break;
+        }
+
+        victims[nvictims++] = victim;
+        niovs += npages;
     }
 
-    if ((frame_id = next_victim()) == -1) {
+    if (nvictims == 0) {
         LOG_ERROR("Failed to select a victim frame");
         goto page_out_epilogue; /* We're unable to choose a vicitm, all pages are pinned */
     }
 
-    LOG_INFO("Paging out %d", frame_id);
+    /* Push the whole cluster to disk with several writes in flight, clean victims need no writes */
+    int err = (niovs > 0) ? swap_write_batch(iovs, niovs, PAGE_OUT_WINDOW) : 0;
 
-    /* Evict the frame from memory and push it to the disk */
-    if (evict_frame(frame_id) == -1) {
-        LOG_ERROR("Failed to evict frame");
-        frame_id = -1;
-        goto page_out_epilogue;
+    /*
+     * The slots may not hold the pages, so the victims stay resident in the processes they were evicted from.
+     * Their slots are released as the operations end, before the faults waiting on them look again.
+     */
+    if (err != 0) {
+        LOG_ERROR("Failed to write to the pagefile");
+        for (seL4_Word i = 0; i < nvictims; i++) {
+            if (evicted[i] && unevict_frame(victims[i], sharers[i], evicted[i]) == 0)
+                assert(frame_table_set_chance(victims[i], FIRST_CHANCE) == 0);
+            else
+                frame_free(victims[i]);
+        }
     }
 
-    /* Zero out the frame and return the page_id / frame_id */
+    /* The slots are safe to read, wake the faults waiting on these pages */
+    for (seL4_Word i = 0; i < niovs; i++)
+        page_op_end(ops[i]);
+
+    if (err != 0)
+        goto page_out_epilogue;
+
+    /* Return the page_id / frame_id, the frame is zeroed by the allocator if the caller needs it */
+    frame_id = victims[0];
     *page_id = frame_table_index_to_sos_vaddr(frame_id);
-    bzero((void *)(*page_id), PAGE_SIZE_4K);
 
-    /* Pin the frame until it is claimed */
-    assert(frame_table_set_chance(frame_id, PINNED) == 0);
+    /* The rest of the cluster is parked in the frame cache for the allocations to come */
+    for (seL4_Word i = 1; i < nvictims; i++)
+        frame_free(victims[i]);
+
+    /* A frame for the swap space to grow with is taken from those parked, if it used its last */
+    swap_reserve();
 
+    /* The returned frame stays pinned until it is claimed */
     page_out_epilogue:
-        page_gate_close();
         return frame_id;
 }
 
-void
-pagefile_free_add(seL4_CPtr pagefile_id)
+/*
+ * Select the next victim, keeping the resident set of each process near its share of memory.
+ * While a process holds more than its share, the victims of processes within their share are
+ * passed over for a bounded number of scans, so a process thrashing on its own cannot push out
+ * the working set of an interactive one such as the shell.
+ * A victim of a given process is found among its own pages, leaving the policy and other processes untouched.
+ * @param target, the pid of the process to take the victim from, else -1 for any process
+ * @returns id of the victim frame, else -1 if there is none
+ */
+static seL4_Word
+next_victim(pid_t target)
 {
-    pagefile_metatable[pagefile_id / 32] &= ~(1 << (pagefile_id % 32));
+    seL4_Word share = 0;
+    seL4_Word scans = 1;
+
+    if (target != -1) {
+        proc *curproc = get_proc(target);
+        if (curproc == NULL || curproc->p_addrspace == NULL)
+            return -1;
+
+        return page_directory_next_victim(curproc->p_addrspace->directory);
+    }
+
+    if (rss_contended(&share))
+        scans = PAGE_OUT_FAIR_SCANS;
+
+    seL4_Word fallback = -1;
+    for (seL4_Word i = 0; i < scans; i++) {
+        seL4_Word victim = frame_table_next_victim();
+        if (victim == -1)
+            break;
+
+        seL4_Word pid;
+        seL4_Word page_id;
+        assert(frame_table_get_page_id(victim, &pid, &page_id) == 0);
+
+        proc *owner = get_proc(pid);
+        if (scans == 1 || owner == NULL || rss_over_share(owner, share))
+            return victim;
+
+        /* Nothing yields during the scans, so the first victim passed over is still a candidate */
+        if (fallback == -1)
+            fallback = victim;
+    }
+
+    return fallback;
 }
 
 /*
- * Find the next page to be evicted
- * @returns -1 on failure, else frame id of the frame
+ * Determine if memory is contended, some process holding more than its share of the frame table
+ * @param[out] share, the frames each process resident is entitled to without a soft limit of its own
+ * @returns TRUE if a process is above its share, else FALSE
  */
-static int
-next_victim(void)
+static bool
+rss_contended(seL4_Word *share)
 {
-    seL4_Word lower;
-    seL4_Word upper;
-    seL4_Word current_old;
+    seL4_Word lower, upper;
     assert(frame_table_get_limits(&lower, &upper) == 0);
 
-    enum chance_type chance;
+    seL4_Word nresident = 0;
+    for (pid_t pid = 0; pid < MAX_PROCS; pid++) {
+        proc *curproc = get_proc(pid);
+        if (curproc != NULL && curproc->rss > 0)
+            nresident++;
+    }
 
-    bool starting_page_found = FALSE;
-    seL4_Word starting_page = 0;
-    seL4_Word looped = FALSE;
+    /* A lone process has nobody to be fair to */
+    if (nresident < 2)
+        return FALSE;
 
-    while (TRUE) {
-        if (!frame_table_get_capability(current_page))
-            goto next;
+    *share = upper / nresident;
+    for (pid_t pid = 0; pid < MAX_PROCS; pid++) {
+        proc *curproc = get_proc(pid);
+        if (curproc != NULL && rss_over_share(curproc, *share))
+            return TRUE;
+    }
 
-        /* Set the starting page to be the next valid page */
-        if (!starting_page_found) {
-            looped = FALSE;
-            starting_page = current_page;
+    return FALSE;
+}
+
+/*
+ * Determine if a process holds more frames than it is entitled to
+ * @param curproc, the process
+ * @param share, the fair share of a process without a soft limit
+ * @returns TRUE if the process is above its soft limit, or its share without one, else FALSE
+ */
+static bool
+rss_over_share(proc *curproc, seL4_Word share)
+{
+    return curproc->rss > (curproc->rss_soft ? curproc->rss_soft : share);
+}
+
+void
+pagefile_free_add(seL4_CPtr pagefile_id)
+{
+    /* A page of zeros never had a slot */
+    if (pagefile_id == ZERO_ID)
+        return;
+
+    /* A shared slot is released with its last reference */
+    for (slot_share **share = &slot_shares[SLOT_SHARE_INDEX(pagefile_id)]; *share != NULL; share = &(*share)->next) {
+        if ((*share)->pagefile_id != pagefile_id)
+            continue;
+
+        if (--(*share)->refs == 0) {
+            slot_share *unshared = *share;
+            *share = unshared->next;
+            free(unshared);
         }
+        return;
+    }
+
+    /* The slot may be held compressed in memory, as well as or instead of in the pagefile */
+    zcache_drop(pagefile_id);
+
+    /* A slot with an operation in flight, such as the page of a destroyed process, is released when it completes */
+    for (struct list_node *node = pages_in_flight->head; node != NULL; node = node->next) {
+        page_op *op = node->data;
+        if (op->pagefile_id == pagefile_id) {
+            op->release = TRUE;
+            return;
+        }
+    }
+
+    swap_free(pagefile_id);
+}
+
+int
+pagefile_share(seL4_CPtr pagefile_id)
+{
+    /* A page of zeros has no slot to share */
+    if (pagefile_id == ZERO_ID)
+        return 0;
 
-        assert(frame_table_get_chance(current_page, &chance) == 0);
-        switch (chance) {
-            /* Increment the chance of the current page and move on */
-            case FIRST_CHANCE:
-                frame_table_set_chance(current_page, SECOND_CHANCE);
-                goto next;
-            
-            /* can't touch this page so move on */
-            case PINNED:
-                goto next;
-
-            /* return current page and set the current as the next */
-            case SECOND_CHANCE:
-                current_old = current_page;
-                current_page = ((current_page + 1) % (upper - lower)) + lower;
-                return current_old;
+    slot_share **bucket = &slot_shares[SLOT_SHARE_INDEX(pagefile_id)];
+    for (slot_share *share = *bucket; share != NULL; share = share->next) {
+        if (share->pagefile_id == pagefile_id) {
+            share->refs++;
+            return 0;
         }
+    }
+
+    slot_share *share = malloc(sizeof(slot_share));
+    if (share == NULL) {
+        LOG_ERROR("Failed to share the slot");
+        return 1;
+    }
+
+    share->pagefile_id = pagefile_id;
+    share->refs = 1;
+    share->next = *bucket;
+    *bucket = share;
+    return 0;
+}
 
-        next:
-            if (starting_page_found && (current_page == starting_page)) {
-                /* We need this logic in order to ignore the first time this while loop goes around */
-                if (looped) {
-                    LOG_ERROR("Looped around and didnt select a page, all pages pinned");
-                    break;
-                } else {
-                    looped = TRUE;
-                }
-            }
+void
+pagefile_get_stats(pagefile_map_stats *stats)
+{
+    swap_get_map_stats(stats);
+}
 
-            current_page = ((current_page + 1) % (upper - lower)) + lower;
+int
+page_wait(seL4_Word pid, seL4_Word page_id)
+{
+    page_op *op;
+    while ((op = page_op_find(pid, page_id)) != NULL) {
+        if (page_op_wait(op) != 0) {
+            LOG_ERROR("Failed to wait for the page");
+            return 1;
+        }
     }
 
-    return -1;
+    return 0;
 }
 
 /*
- * Evict a frame from the frame table
+ * Evict a frame from the frame table.
+ * The frame is detached from its process and given slots in the pagefile, except for pages of zeros.
+ * Each page that compresses well is kept in the compressed page cache under its slot,
+ * the writes that push the rest to disk are described in iovs for the caller to issue.
+ * Each page written is tracked as in flight until the caller ends its operation.
  * @param frame_id, the id of the frame
- * @returns 0 on success else -1
+ * @param[out] iovs, an io vector for each page of the frame
+ * @param[out] ops, the paging operation for each io vector
+ * @param[out] evicted, the entry left for the first page of the frame, 0 if it was written back to its file
+ * @returns number of io vectors on success, else -1
  */
 static int
-evict_frame(seL4_Word frame_id)
+evict_frame(seL4_Word frame_id, uiovec *iovs, page_op **ops, seL4_Word *evicted)
 {
     /* Get the page id and pid of the process where this frame is mapped into*/
     seL4_Word pid;
@@ -299,107 +724,502 @@ evict_frame(seL4_Word frame_id)
         return -1;
     }
 
-    /* Find free spot in metatable */
-    seL4_Word pagefile_id = 0;
-    for (seL4_Word page = 0; page < PAGEFILE_MAX_PAGES; page++) {
-        if ((pagefile_metatable[page / 32] & (1 << (page % 32))) == 0) {
-            pagefile_metatable[page / 32] |= 1 << (page % 32);
-            pagefile_id = page;
-            goto pagefile_space_found;
+    /* The file is the backing store of a shared mapping */
+    region *page_region;
+    *evicted = 0;
+    if (as_find_region(curproc->p_addrspace, page_id, &page_region) == 0 && page_region->vn != NULL &&
+        (page_region->flags & REGION_SHARED))
+        return evict_file_page(curproc, page_region, frame_id, page_id);
+
+    /* A clean frame already has a copy in the pagefile, it is dropped without a write */
+    seL4_Word pagefile_id;
+    if (frame_table_get_swap(frame_id, &pagefile_id) == 0) {
+        if (evict_sharers(frame_id, page_id, &pagefile_id, 1) != 0) {
+            LOG_ERROR("Failed to evict the processes sharing the frame");
+            return -1;
+        }
+
+        if (page_directory_evict(curproc->p_addrspace->directory, page_id, pagefile_id) != 0) {
+            LOG_ERROR("Failed to evict directory entry");
+            return -1;
         }
+
+        /* The slot now belongs to the evicted page table entry */
+        frame_table_clear_swap(frame_id);
+        replacement_evict(frame_id, pid, page_id);
+        curproc->rss -= frame_table_is_large(frame_id) ? FRAMES_PER_LARGE : 1;
+        *evicted = pagefile_id | EVICTED_BIT;
+        return 0;
     }
 
-    /* No space found */
-    LOG_ERROR("Failed to find space in the file");
-    return -1;
+    /* A large frame is written out as a page per 4K, each to its own spot in the pagefile */
+    seL4_Word npages = frame_table_is_large(frame_id) ? FRAMES_PER_LARGE : 1;
+    seL4_Word pagefile_ids[FRAMES_PER_LARGE];
+
+    seL4_Word sos_vaddr = frame_table_index_to_sos_vaddr(frame_id);
+
+    /*
+     * Pages of zeros are marked in the page table in place of a slot, and need no write.
+     * A page shared with sos_share_vm always has a slot, so it is paged back in as the one frame for every process sharing it.
+     */
+    bool shared = share_is_member(page_id, pid);
+    seL4_Word nslots = 0;
+    for (seL4_Word i = 0; i < npages; i++) {
+        pagefile_ids[i] = (!shared && page_is_zero(sos_vaddr + (i * PAGE_SIZE_4K))) ? ZERO_ID : 0;
+        if (pagefile_ids[i] != ZERO_ID)
+            nslots++;
+    }
+
+    /* Find free spots in metatable, contiguous if possible so the writes land together */
+    seL4_Word slot;
+    bool run = (nslots > 0 && swap_alloc_run(nslots, &slot) == 0);
+    for (seL4_Word i = 0; i < npages; i++) {
+        if (pagefile_ids[i] == ZERO_ID)
+            continue;
+
+        if (run) {
+            pagefile_ids[i] = slot++;
+            continue;
+        }
+
+        if (swap_alloc(&pagefile_ids[i]) != 0) {
+            LOG_ERROR("Failed to find space in the file");
+            while (i-- > 0)
+                pagefile_free_add(pagefile_ids[i]);
+            return -1;
+        }
+    }
 
-    pagefile_space_found:
+    LOG_INFO("Free page in file at %d", pagefile_ids[0]);
+
+    /* Pages kept in the cache can be faulted straight back in, faults on the rest must wait until the writes have landed */
+    seL4_Word nwrites = 0;
+    seL4_Word writes[FRAMES_PER_LARGE];
+    for (seL4_Word i = 0; i < npages; i++) {
+        if (pagefile_ids[i] == ZERO_ID || zcache_store(pagefile_ids[i], (void *)(sos_vaddr + (i * PAGE_SIZE_4K))) == 0)
+            continue;
+
+        if ((ops[nwrites] = page_op_begin(pid, page_id + (i * PAGE_SIZE_4K), pagefile_ids[i])) == NULL) {
+            LOG_ERROR("Failed to track the page out");
+            while (nwrites-- > 0)
+                page_op_end(ops[nwrites]);
+            for (i = 0; i < npages; i++)
+                pagefile_free_add(pagefile_ids[i]);
+            return -1;
+        }
 
-    LOG_INFO("Free page in file at %d", pagefile_id);
+        writes[nwrites++] = i;
+    }
 
-    if (page_directory_evict(curproc->p_addrspace->directory, page_id, pagefile_id) != 0) {
+    /* Processes sharing the frame page it back in from the same slots, once the writes have landed */
+    int err = evict_sharers(frame_id, page_id, pagefile_ids, npages);
+    if (err == 0) {
+        err = (npages == 1) ?
+            page_directory_evict(curproc->p_addrspace->directory, page_id, pagefile_ids[0]) :
+            page_directory_evict_large(curproc->p_addrspace->directory, page_id, pagefile_ids);
+    }
+    if (err != 0) {
         LOG_ERROR("Failed to evict directory entry");
-        pagefile_free_add(pagefile_id);
+        for (seL4_Word i = 0; i < nwrites; i++)
+            page_op_end(ops[i]);
+        for (seL4_Word i = 0; i < npages; i++)
+            pagefile_free_add(pagefile_ids[i]);
         return -1;
     }
 
-    /* Write the page to disk */
-    seL4_Word sos_vaddr = frame_table_index_to_sos_vaddr(frame_id);
-    vnode handle = {.vn_data = &pagefile_handle};
-    uiovec iov = {
-       .uiov_base = (char *)sos_vaddr,
-       .uiov_len = PAGE_SIZE_4K,
-       .uiov_pos = pagefile_id * PAGE_SIZE_4K
-    };
+    replacement_evict(frame_id, pid, page_id);
+    curproc->rss -= npages;
+    *evicted = pagefile_ids[0] | EVICTED_BIT;
 
-    /* sos_nfs_write gauruntees all data is written succesfully */
-    if (sos_nfs_write(&handle, &iov) == -1) {
-        LOG_ERROR("Failed to write to the pagefile");
-        pagefile_free_add(pagefile_id);
-        return -1;
+    /* Describe the writes of the page(s) to disk */
+    for (seL4_Word i = 0; i < nwrites; i++) {
+        iovs[i].uiov_base = (char *)(sos_vaddr + (writes[i] * PAGE_SIZE_4K));
+        iovs[i].uiov_len = PAGE_SIZE_4K;
+        iovs[i].uiov_pos = pagefile_ids[writes[i]] * PAGE_SIZE_4K;
     }
 
-    return 0;
+    return nwrites;
 }
 
 /*
- * Gate to enforce a single page operation at a time
- * A coroutine will pass through the gate if the gate is open
- * But waits if it is not
+ * Evict a frame from the processes other than its owner sharing it, copy on write or with sos_share_vm.
+ * Each of their entries references the slots of the owner, which are shared with them.
+ * @param frame_id, the id of the frame
+ * @param page_id, the virtual address of the frame in every process sharing it
+ * @param pagefile_ids, the slot holding each 4K page of the frame, ZERO_ID for a page of zeros
+ * @param npages, the number of 4K pages in the frame
  * @returns 0 on success, else 1
  */
 static int
-page_gate_open(void)
+evict_sharers(seL4_Word frame_id, seL4_Word page_id, seL4_Word *pagefile_ids, seL4_Word npages)
 {
-    /* If an operation is already happening, yield */
-    if (global_page_lock) {
-        if (list_append(pagefile_operations, (void *)coro_getcur()) != 0) {
-            LOG_ERROR("Failed to queue paging operation");
+    seL4_Word owner;
+    seL4_Word owner_page_id;
+    assert(frame_table_get_page_id(frame_id, &owner, &owner_page_id) == 0);
+
+    seL4_Word sharers = frame_table_get_sharers(frame_id) & ~BIT(owner);
+    if (!sharers)
+        return 0;
+
+    /* Every reference is taken before any entry is evicted, so a failure leaves the frame shared as it was */
+    seL4_Word nrefs = 0;
+    for (seL4_Word i = 0; i < POPCOUNT(sharers) * npages; i++, nrefs++) {
+        if (pagefile_share(pagefile_ids[i % npages]) != 0) {
+            while (nrefs-- > 0)
+                pagefile_free_add(pagefile_ids[nrefs % npages]);
             return 1;
         }
+    }
+
+    while (sharers) {
+        seL4_Word pid = CTZ(sharers);
+        sharers &= ~BIT(pid);
+
+        proc *sharer = get_proc(pid);
+        assert(sharer != NULL && sharer->p_addrspace != NULL);
+        if (npages == 1)
+            assert(page_directory_evict(sharer->p_addrspace->directory, page_id, pagefile_ids[0]) == 0);
+        else
+            assert(page_directory_evict_large(sharer->p_addrspace->directory, page_id, pagefile_ids) == 0);
+
+        frame_table_unshare(frame_id, pid);
+        sharer->rss -= npages;
+    }
+
+    return 0;
+}
+
+/*
+ * Restore a frame evicted by a page out whose write failed, to every process it was evicted from.
+ * Each entry is made resident again, unmapped so its next access maps it with a soft fault, and its slots are released.
+ * An entry paged back in or unmapped while the write was in flight is left as it is.
+ * @param frame_id, the id of the frame
+ * @param sharers, the processes sharing the frame before it was evicted, else 0 if only its owner mapped it
+ * @param evicted, the entry the eviction left for the first page of the frame
+ * @returns 0 if the frame is resident again, else 1 if no process holds it any longer
+ */
+static int
+unevict_frame(seL4_Word frame_id, seL4_Word sharers, seL4_Word evicted)
+{
+    seL4_Word owner;
+    seL4_Word page_id;
+    assert(frame_table_get_page_id(frame_id, &owner, &page_id) == 0);
+
+    bool large = frame_table_is_large(frame_id);
+    seL4_Word npages = large ? FRAMES_PER_LARGE : 1;
+    seL4_Word restored = 0;
+
+    for (sharers = sharers ? sharers : BIT(owner); sharers; sharers &= ~BIT(CTZ(sharers))) {
+        seL4_Word pid = CTZ(sharers);
+        proc *sharer = get_proc(pid);
+        if (sharer == NULL || sharer->p_addrspace == NULL)
+            continue;
+
+        /* Every entry of the frame was evicted together, the first tells if they still are */
+        page_directory *dir = sharer->p_addrspace->directory;
+        seL4_CPtr entries[FRAMES_PER_LARGE];
+        if (page_directory_lookup(dir, page_id, &entries[0]) != 0 || entries[0] != evicted)
+            continue;
+
+        for (seL4_Word i = 1; i < npages; i++)
+            assert(page_directory_lookup(dir, page_id + (i * PAGE_SIZE_4K), &entries[i]) == 0);
+
+        seL4_CPtr cap = cspace_copy_cap(cur_cspace, cur_cspace, frame_table_get_capability(frame_id), seL4_AllRights);
+        assert(cap != (seL4_CPtr)NULL);
+        assert((large ? page_directory_insert_large(dir, page_id, cap, frame_id, 0) :
+                        page_directory_insert(dir, page_id, cap, frame_id, 0)) == 0);
+
+        /* A page of zeros holds no slot, releasing it is a no op */
+        for (seL4_Word i = 0; i < npages; i++)
+            pagefile_free_add(entries[i] & ~EVICTED_BIT);
+
+        sharer->rss += npages;
+        restored |= BIT(pid);
+    }
+
+    if (!restored)
+        return 1;
+
+    /* The frame is handed back to the replacement policy, and shared again if more than one process holds it */
+    owner = CTZ(restored);
+    assert(frame_table_set_page_id(frame_id, owner, page_id) == 0);
+    for (restored &= ~BIT(owner); restored; restored &= ~BIT(CTZ(restored)))
+        assert(frame_table_share(frame_id, CTZ(restored)) == 0);
+
+    return 0;
+}
+
+/*
+ * Evict a page of a shared file mapping, writing it back to the file.
+ * The page is left with no page table entry, so its next fault reads it back from the file.
+ * The write is made here with the page unmapped, faults on the page wait for it to land.
+ * A page that fails to write back stays resident, with its changes.
+ * @param curproc, the process the page belongs to
+ * @param reg, the file mapping the page belongs to
+ * @param frame_id, the id of the frame
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, as there are no writes left for the caller to issue, else -1
+ */
+static int
+evict_file_page(proc *curproc, region *reg, seL4_Word frame_id, seL4_Word page_id)
+{
+    page_op *op;
+    if ((op = page_op_begin(curproc->pid, page_id, -1)) == NULL) {
+        LOG_ERROR("Failed to track the write back");
+        return -1;
+    }
 
-        /* Wait until it is our turn to page */
-        yield(NULL);
+    /* Mappings are never promoted, so the frame is a single page */
+    seL4_CPtr cap;
+    if (page_directory_lookup(curproc->p_addrspace->directory, page_id, &cap) != 0) {
+        LOG_ERROR("Failed to find directory entry");
+        page_op_end(op);
+        return -1;
+    }
+
+    /* The process cannot change the page while it is written, its next use soft faults once the write lands */
+    seL4_ARM_Page_Unmap(PTE_CAP(cap));
+    if (reg->mode != O_RDONLY && page_write_file(reg, page_id, frame_table_index_to_sos_vaddr(frame_id)) != 0) {
+        LOG_ERROR("Failed to write back %p", (void *)page_id);
+        page_op_end(op);
+        return -1;
+    }
+
+    if (page_directory_remove(curproc->p_addrspace->directory, page_id) != 0) {
+        LOG_ERROR("Failed to remove directory entry");
+        page_op_end(op);
+        return -1;
     }
 
-    global_page_lock = TRUE;
+    replacement_evict(frame_id, curproc->pid, page_id);
+    curproc->rss--;
+
+    page_op_end(op);
     return 0;
 }
 
 /*
- * Gate to signify a finished paging operation
- * Resumes the next operation in the queue
- * If the calling coro is lock free, it passes through the gate without resuming 
- * another coroutine
+ * Write a page of a file mapping to its place in the file.
+ * Only the part of the page within the file when it was mapped is written, so the file never grows.
+ * @param reg, the file mapping the page belongs to
+ * @param page_id, the virtual address of the page
+ * @param sos_vaddr, the sos vaddr of the frame holding the page
  * @returns 0 on success, else 1
  */
 static int
-page_gate_close(void)
+page_write_file(region *reg, seL4_Word page_id, seL4_Word sos_vaddr)
 {
-    /* Exempt coroutines dont need to do this logic */
-    if (lock_free_coro == coro_getcur())
+    seL4_Word pos = reg->offset + (page_id - reg->start);
+    if (pos >= reg->file_size)
         return 0;
 
-    /* Run the next pagefile operation if any */
-    if (!list_is_empty(pagefile_operations)) {
-        /* Remove finished operation from the queue */
-        struct list_node *op = pagefile_operations->head;
-        pagefile_operations->head = op->next;
+    uiovec iov = {
+        .uiov_base = (void *)sos_vaddr,
+        .uiov_len = MIN(PAGE_SIZE_4K, reg->file_size - pos),
+        .uiov_pos = pos,
+    };
+    seL4_Word len = iov.uiov_len;
+    if (reg->vn->vn_ops->vop_write(reg->vn, &iov) != len) {
+        LOG_ERROR("Failed to write to the file");
+        return 1;
+    }
 
-        resume(op->data, NULL);
-        free(op);
+    return 0;
+}
+
+/*
+ * Determine if a page holds only zeros.
+ * The words of a cache line are combined before each test, so a page of zeros is scanned
+ * at the speed of memory and the first non zero line ends the scan.
+ * @param vaddr, the sos virtual address of the page
+ * @returns TRUE if every byte of the page is zero, else FALSE
+ */
+static bool
+page_is_zero(seL4_Word vaddr)
+{
+    const seL4_Word *words = (const seL4_Word *)vaddr;
+    for (seL4_Word i = 0; i < PAGE_SIZE_4K / sizeof(seL4_Word); i += 8) {
+        if (words[i] | words[i + 1] | words[i + 2] | words[i + 3] |
+            words[i + 4] | words[i + 5] | words[i + 6] | words[i + 7])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Finish paging in a page once its contents have been read.
+ * A page read back for a read access still matches its copy in the pagefile,
+ * so the slot is kept and the page can later be evicted without writing it.
+ * Writable pages are mapped read only until the first write makes them dirty.
+ * @param curproc, the process the page belongs to
+ * @param page_region, the region the page belongs to
+ * @param page_id, the virtual address of the page
+ * @param pagefile_id, the slot the page was read from
+ * @param frame_id, the frame now holding the page
+ * @param access_type, the type of access the page was paged in for
+ */
+static void
+page_in_complete(proc *curproc, region *page_region, seL4_Word page_id, seL4_Word pagefile_id,
+                 seL4_Word frame_id, seL4_Word access_type)
+{
+    if (access_type == ACCESS_READ && frame_table_set_swap(frame_id, pagefile_id) == 0) {
+        if ((page_region->permissions & seL4_CanWrite) &&
+            sos_remap_page(curproc, page_id, page_region->permissions & ~seL4_CanWrite) != 0) {
+            LOG_ERROR("Failed to map the clean page read only");
+            frame_table_clear_swap(frame_id);
+            pagefile_free_add(pagefile_id);
+        }
     } else {
-        /* No running operations, gate can be opened */
-        global_page_lock = FALSE;
+        /* Mark the page as free in the pagefile */
+        pagefile_free_add(pagefile_id);
+    }
+
+    /* Flush the cache in case this page was instruction data */
+    seL4_ARM_Page_Unify_Instruction(frame_table_get_capability(frame_id), 0, PAGE_SIZE_4K);
+}
+
+/*
+ * Write the oldest pages of the compressed page cache back to the pagefile.
+ * Each slot is tracked as in flight while it is written, so a slot freed in the
+ * meantime is not reused until the write completes.
+ */
+static void
+page_writeback(void)
+{
+    uiovec iovs[ZCACHE_WRITEBACK_BATCH];
+    page_op *ops[ZCACHE_WRITEBACK_BATCH];
+    seL4_Word pagefile_ids[ZCACHE_WRITEBACK_BATCH];
+    seL4_Word npages = 0;
+    void *page;
+
+    while (npages < ZCACHE_WRITEBACK_BATCH && zcache_writeback_begin(&pagefile_ids[npages], &page) == 0) {
+        /* The slot belongs to no page of any process while it is written */
+        if ((ops[npages] = page_op_begin(-1, -1, pagefile_ids[npages])) == NULL) {
+            zcache_writeback_end(pagefile_ids[npages], FALSE);
+            break;
+        }
+
+        iovs[npages].uiov_base = page;
+        iovs[npages].uiov_len = PAGE_SIZE_4K;
+        iovs[npages].uiov_pos = pagefile_ids[npages] * PAGE_SIZE_4K;
+        npages++;
     }
 
+    if (npages == 0)
+        return;
+
+    int err = swap_write_batch(iovs, npages, PAGE_OUT_WINDOW);
+    if (err != 0)
+        LOG_ERROR("Failed to write back to the pagefile");
+
+    /* Pages that failed to write stay in the cache */
+    for (seL4_Word i = 0; i < npages; i++) {
+        zcache_writeback_end(pagefile_ids[i], err == 0);
+        page_op_end(ops[i]);
+    }
+}
+
+/*
+ * Mark a page as in flight
+ * @param pid, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @param pagefile_id, the slot being read or written
+ * @returns the operation on success, else NULL
+ */
+static page_op *
+page_op_begin(seL4_Word pid, seL4_Word page_id, seL4_Word pagefile_id)
+{
+    page_op *op = malloc(sizeof(page_op));
+    if (op == NULL)
+        return NULL;
+
+    op->pid = pid;
+    op->page_id = page_id;
+    op->pagefile_id = pagefile_id;
+    op->release = FALSE;
+    list_init(&op->waiters);
+
+    if (list_prepend(pages_in_flight, op) != 0) {
+        free(op);
+        return NULL;
+    }
+
+    return op;
+}
+
+/*
+ * Find the operation in flight on a page
+ * @param pid, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @returns the operation, else NULL if the page is not in flight
+ */
+static page_op *
+page_op_find(seL4_Word pid, seL4_Word page_id)
+{
+    for (struct list_node *node = pages_in_flight->head; node != NULL; node = node->next) {
+        page_op *op = node->data;
+        if (op->pid == pid && op->page_id == page_id)
+            return op;
+    }
+
+    return NULL;
+}
+
+/*
+ * Find an operation in flight on a slot of the pagefile
+ * @param pagefile_id, the slot
+ * @returns the operation, else NULL if the slot is not in flight
+ */
+static page_op *
+page_op_find_slot(seL4_Word pagefile_id)
+{
+    for (struct list_node *node = pages_in_flight->head; node != NULL; node = node->next) {
+        page_op *op = node->data;
+        if (op->pagefile_id == pagefile_id)
+            return op;
+    }
+
+    return NULL;
+}
+
+/*
+ * Wait for an operation in flight to complete
+ * @param op, the operation
+ * @returns 0 on success, else 1
+ */
+static int
+page_op_wait(page_op *op)
+{
+    if (list_append(&op->waiters, (void *)coro_getcur()) != 0) {
+        LOG_ERROR("Failed to wait on paging operation");
+        return 1;
+    }
+
+    /* Resumed by page_op_end */
+    yield(NULL);
     return 0;
 }
 
+/*
+ * Complete an operation, resuming every coroutine waiting on it
+ * @param op, the operation
+ */
 static void
-pagefile_create_callback(uintptr_t token, enum nfs_stat status, fhandle_t* fh, fattr_t* fattr)
+page_op_end(page_op *op)
 {
-    assert(status == NFS_OK);
-    memcpy(&pagefile_handle, fh, sizeof(fhandle_t));
-    pager_initialised = TRUE;
+    list_remove(pages_in_flight, op, list_cmp_equality);
+
+    if (op->release)
+        swap_free(op->pagefile_id);
+
+    while (!list_is_empty(&op->waiters)) {
+        struct list_node *waiter = op->waiters.head;
+        op->waiters.head = waiter->next;
+
+        resume(waiter->data, NULL);
+        free(waiter);
+    }
+
+    free(op);
 }
@@ -7,10 +7,16 @@
 #ifndef _PAGER_H_
 #define _PAGER_H_
 
+#include <autoconf.h>
 #include <proc/proc.h>
+#include "pagefile_map.h"
 
-/* Maximum number of pages in the pagefile */
-#define PAGEFILE_MAX_PAGES (80 * BYTES_TO_4K_PAGES(BIT(20))) /* 80 MB pagefile size */
+/* Hard cap on the number of pages in each pagefile, they grow on demand up to it */
+#ifdef CONFIG_SOS_SWAP_PAGEFILE_MAX_MB
+#define PAGEFILE_MAX_PAGES BYTES_TO_4K_PAGES(CONFIG_SOS_SWAP_PAGEFILE_MAX_MB * BIT(20))
+#else
+#define PAGEFILE_MAX_PAGES BYTES_TO_4K_PAGES(512 * BIT(20))
+#endif
 
 /* Second chance replacement marker */
 enum chance_type {
@@ -23,7 +29,7 @@ enum chance_type {
  * Initialise the pager
  * @returns 0 on success, else 1
  */
-int init_pager(seL4_Word paddr, seL4_Word size_in_bits);
+int init_pager(void);
 
 /*
  * Page the frame belonging to this vaddr
@@ -34,6 +40,37 @@ int init_pager(seL4_Word paddr, seL4_Word size_in_bits);
  */
 int page_in(proc *curproc, seL4_Word page_id, seL4_Word access_type);
 
+/*
+ * Page in an evicted page ahead of its use, reading the evicted pages that follow it
+ * in its region in the same batch
+ * @param curproc, the process the page belongs to
+ * @param page_id, the vaddr of the page in the process
+ * @param npages, the most pages to read, the batch is capped by the pager
+ * @returns 0 on success, else 1
+ */
+int page_in_ahead(proc *curproc, seL4_Word page_id, seL4_Word npages);
+
+/*
+ * Map in a page of a file mapping, reading it from the file.
+ * Past the end of the file the page reads as zeros.
+ * @param curproc, the process the page belongs to
+ * @param reg, the file mapping the page belongs to
+ * @param page_id, the vaddr of the page in the process
+ * @param access_type, the type of access for this page (for permissions mapping)
+ * @param[out] sos_vaddr, the sos vaddr of the frame, unless the page was mapped by another fault while waiting
+ * @returns 0 on success, else 1
+ */
+int page_in_file(proc *curproc, region *reg, seL4_Word page_id, seL4_Word access_type, seL4_Word *sos_vaddr);
+
+/*
+ * Write a resident page of a shared file mapping back to the file, the page stays resident
+ * @param curproc, the process the page belongs to
+ * @param reg, the file mapping the page belongs to
+ * @param page_id, the vaddr of the page in the process
+ * @returns 0 on success, or if the page is not resident, else 1
+ */
+int page_out_file(proc *curproc, region *reg, seL4_Word page_id);
+
 /*
  * Try paging a frame out to disk to make room for a new frame
  * @param[out] vaddr, the sos vaddr of the frame
@@ -41,10 +78,40 @@ int page_in(proc *curproc, seL4_Word page_id, seL4_Word access_type);
  */
 int page_out(seL4_Word *vaddr);
 
+/*
+ * Page out one of the frames of a process, for a process at its hard resident set limit.
+ * The frame is released to the frame cache, ready for the mapping the process is making.
+ * @param curproc, the process to take the frame from
+ * @returns 0 on success, else 1 if the process has no frame that can be paged out
+ */
+int page_trim(proc *curproc);
+
+/*
+ * Wait for every operation in flight on a page to complete
+ * @param pid, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, else 1
+ */
+int page_wait(seL4_Word pid, seL4_Word page_id);
+
 /* 
  * Add a pagefile id to the pagefile free list
  * @param pagefile_id, the id of the page in the pagefile
  */
 void pagefile_free_add(seL4_CPtr pagefile_id);
 
+/*
+ * Take another reference to a pagefile slot, for an entry of a forked process that shares it.
+ * The slot is only released by the pagefile_free_add of its last reference.
+ * @param pagefile_id, the id of the page in the pagefile, or ZERO_ID
+ * @returns 0 on success, else 1
+ */
+int pagefile_share(seL4_CPtr pagefile_id);
+
+/*
+ * Retrieve the occupancy statistics of the pagefile, summed over every swap backend
+ * @param[out] stats, the statistics of the pagefile
+ */
+void pagefile_get_stats(pagefile_map_stats *stats);
+
 #endif /* _PAGER_H_ */
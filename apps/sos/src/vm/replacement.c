@@ -0,0 +1,78 @@
+/*
+ * Page Replacement Policies
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "replacement.h"
+
+#include <autoconf.h>
+#include <utils/util.h>
+
+/* The policy is chosen at build time */
+#if defined(CONFIG_SOS_REPLACEMENT_WSCLOCK)
+static const replacement_policy *policy = &wsclock_policy;
+#elif defined(CONFIG_SOS_REPLACEMENT_CLOCK_PRO)
+static const replacement_policy *policy = &clock_pro_policy;
+#else
+static const replacement_policy *policy = &clock_policy;
+#endif
+
+void
+replacement_unreference(replacement_frames *frames, seL4_Word word, seL4_Word bits)
+{
+    bits &= frames->referenced[word];
+    frames->referenced[word] &= ~bits;
+
+    while (bits) {
+        frames->unreference((word * seL4_WordBits) + CTZ(bits));
+        bits &= bits - 1;
+    }
+}
+
+seL4_Word
+replacement_bytes(seL4_Word nframes)
+{
+    return policy->bytes ? policy->bytes(nframes) : 0;
+}
+
+void
+replacement_init(replacement_frames *frames, void *mem)
+{
+    LOG_INFO("Page replacement policy: %s", policy->name);
+    policy->init(frames, mem);
+}
+
+seL4_Word
+replacement_scan(void)
+{
+    return policy->scan();
+}
+
+void
+replacement_access(seL4_Word frame_id)
+{
+    if (policy->access)
+        policy->access(frame_id);
+}
+
+void
+replacement_fault(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
+{
+    if (policy->fault)
+        policy->fault(frame_id, pid, page_id);
+}
+
+void
+replacement_evict(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
+{
+    if (policy->evict)
+        policy->evict(frame_id, pid, page_id);
+}
+
+void
+replacement_free(seL4_Word frame_id)
+{
+    if (policy->free)
+        policy->free(frame_id);
+}
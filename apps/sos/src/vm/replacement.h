@@ -0,0 +1,130 @@
+/*
+ * Page Replacement Policies
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#ifndef _REPLACEMENT_H_
+#define _REPLACEMENT_H_
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+/* Number of words in a bitmap with a bit per frame */
+#define FRAME_BITMAP_WORDS(n) (((n) + seL4_WordBits - 1) / seL4_WordBits)
+
+/* Bitmap operations on the frame state bitmaps */
+#define FRAME_BIT_SET(map, id) ((map)[(id) / seL4_WordBits] |= BIT((id) % seL4_WordBits))
+#define FRAME_BIT_CLR(map, id) ((map)[(id) / seL4_WordBits] &= ~BIT((id) % seL4_WordBits))
+#define FRAME_BIT_GET(map, id) (((map)[(id) / seL4_WordBits] >> ((id) % seL4_WordBits)) & 1)
+
+/*
+ * Replacement state the frame table keeps for every policy, one bit per frame id.
+ * Valid frames hold a capability, pinned frames are never selected as a victim,
+ * and referenced frames have been used since a policy last cleared the bit.
+ */
+typedef struct {
+    seL4_Word nframes; /* Number of frame ids covered by the bitmaps */
+    seL4_Word words; /* Number of words in each bitmap */
+    seL4_Word capacity; /* Number of frames that may be allocated at once */
+    seL4_Word *valid;
+    seL4_Word *pinned;
+    seL4_Word *referenced;
+
+    /* Hide a frame from its process, so the next use takes a soft fault that references it again */
+    void (*unreference)(seL4_Word frame_id);
+} replacement_frames;
+
+/*
+ * Hooks of a page replacement policy.
+ * Frames passed to the hooks are always the head of a large frame.
+ */
+typedef struct {
+    const char *name;
+
+    /* Bytes of memory the policy needs for its own per frame state, laid out after the frame table */
+    seL4_Word (*bytes)(seL4_Word nframes);
+
+    /* Prepare the policy, mem is bytes(nframes) in size and zeroed */
+    void (*init)(replacement_frames *frames, void *mem);
+
+    /* Select the next frame to evict, else -1 if every frame is pinned */
+    seL4_Word (*scan)(void);
+
+    /* The frame was referenced */
+    void (*access)(seL4_Word frame_id);
+
+    /* The frame now holds the page of a process, either a new page or one paged back in */
+    void (*fault)(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id);
+
+    /* The frame was detached from the page of a process to be reused */
+    void (*evict)(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id);
+
+    /* The frame no longer holds a page */
+    void (*free)(seL4_Word frame_id);
+} replacement_policy;
+
+/* Available policies, one is chosen at build time */
+extern const replacement_policy clock_policy;
+extern const replacement_policy wsclock_policy;
+extern const replacement_policy clock_pro_policy;
+
+/*
+ * Clear the reference bits of frames in a word of the bitmaps.
+ * Policies clear reference bits through this, so each frame that was referenced
+ * is unmapped from its process and its next use is seen.
+ * @param frames, the replacement state of the frame table
+ * @param word, the index of the word in the bitmaps
+ * @param bits, the frames of the word to clear
+ */
+void replacement_unreference(replacement_frames *frames, seL4_Word word, seL4_Word bits);
+
+/*
+ * Bytes of memory the chosen policy needs
+ * @param nframes, the number of frame ids in the frame table
+ * @returns size in bytes
+ */
+seL4_Word replacement_bytes(seL4_Word nframes);
+
+/*
+ * Initialise the chosen policy
+ * @param frames, the replacement state of the frame table
+ * @param mem, zeroed memory of replacement_bytes(frames->nframes) in size
+ */
+void replacement_init(replacement_frames *frames, void *mem);
+
+/*
+ * Select the next frame to evict
+ * @returns id of the victim frame, else -1 if every frame is pinned
+ */
+seL4_Word replacement_scan(void);
+
+/*
+ * Notify the policy that a frame was referenced
+ * @param frame_id, id of the frame
+ */
+void replacement_access(seL4_Word frame_id);
+
+/*
+ * Notify the policy that a frame was mapped into a process
+ * @param frame_id, id of the frame
+ * @param pid, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ */
+void replacement_fault(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id);
+
+/*
+ * Notify the policy that a victim frame was detached from its page
+ * @param frame_id, id of the frame
+ * @param pid, the process the page belonged to
+ * @param page_id, the virtual address of the page
+ */
+void replacement_evict(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id);
+
+/*
+ * Notify the policy that a frame was freed
+ * @param frame_id, id of the frame
+ */
+void replacement_free(seL4_Word frame_id);
+
+#endif /* _REPLACEMENT_H_ */
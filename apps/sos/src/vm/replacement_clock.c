@@ -0,0 +1,65 @@
+/*
+ * Second Chance Clock Replacement
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "replacement.h"
+
+/* Replacement state of the frame table */
+static replacement_frames *frames = NULL;
+
+/* Hand of the clock, the frame id the next victim scan starts from */
+static seL4_Word clock_hand = 0;
+
+static void
+clock_init(replacement_frames *state, void *mem)
+{
+    frames = state;
+    clock_hand = 0;
+}
+
+static seL4_Word
+clock_scan(void)
+{
+    /*
+     * Two sweeps of the table are enough, the first sweep at worst clears every reference bit.
+     * Bits below the hand in the first word are covered when the scan wraps back around to it.
+     */
+    seL4_Word start = clock_hand / seL4_WordBits;
+    for (seL4_Word i = 0; i <= 2 * frames->words; i++) {
+        seL4_Word word = (start + i) % frames->words;
+        seL4_Word candidates = frames->valid[word] & ~frames->pinned[word];
+        if (i == 0)
+            candidates &= ~MASK(clock_hand % seL4_WordBits);
+
+        seL4_Word victims = candidates & ~frames->referenced[word];
+        if (victims) {
+            seL4_Word bit = CTZ(victims);
+
+            /* Referenced frames the hand moved past lose their reference */
+            replacement_unreference(frames, word, candidates & MASK(bit));
+
+            seL4_Word frame_id = (word * seL4_WordBits) + bit;
+            clock_hand = (frame_id + 1) % (frames->words * seL4_WordBits);
+            return frame_id;
+        }
+
+        replacement_unreference(frames, word, candidates);
+    }
+
+    LOG_ERROR("Looped around and didnt select a page, all pages pinned");
+    return -1;
+}
+
+/* The reference bits are all the state the clock needs */
+const replacement_policy clock_policy = {
+    .name = "clock",
+    .bytes = NULL,
+    .init = clock_init,
+    .scan = clock_scan,
+    .access = NULL,
+    .fault = NULL,
+    .evict = NULL,
+    .free = NULL,
+};
@@ -0,0 +1,260 @@
+/*
+ * CLOCK-Pro Replacement
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "replacement.h"
+
+#include <utils/page.h>
+
+/* Bounds of the number of frames set aside for cold pages, as a fraction of memory */
+#define COLD_MIN_DIVISOR 64
+#define COLD_MAX_DIVISOR 2
+
+/* Marks an unused entry of the ghost ring */
+#define GHOST_NONE ((seL4_Word)-1)
+
+/* A page of a process packed into a word, the pid fits below the page number */
+#define GHOST_KEY(pid, page_id) (PAGE_ALIGN_4K(page_id) | (pid))
+
+/* Replacement state of the frame table */
+static replacement_frames *frames = NULL;
+
+/* Frames holding hot pages, the rest are cold */
+static seL4_Word *hot = NULL;
+
+/* Cold frames in their test period, a reference during the test period makes the page hot */
+static seL4_Word *test = NULL;
+
+/*
+ * Cold pages evicted during their test period, as a ring of GHOST_KEY.
+ * A page that faults back in while its ghost is in the ring is made hot straight away.
+ * The ring holds as many ghosts as there are frames, the oldest ends its test period when overwritten.
+ */
+static seL4_Word *ghosts = NULL;
+static seL4_Word ghost_next = 0;
+
+/* Number of hot frames, and the number of frames the cold pages adaptively aim for */
+static seL4_Word hot_count = 0;
+static seL4_Word cold_target = 0;
+static seL4_Word cold_min = 0;
+static seL4_Word cold_max = 0;
+
+/* Hands of the clock, the cold hand selects victims and the hot hand demotes hot frames */
+static seL4_Word hand_cold = 0;
+static seL4_Word hand_hot = 0;
+
+/* Private functions */
+static seL4_Word run_hand_hot(bool force);
+static void ghost_insert(seL4_Word key);
+static bool ghost_remove(seL4_Word key);
+
+static seL4_Word
+clock_pro_bytes(seL4_Word nframes)
+{
+    return (2 * FRAME_BITMAP_WORDS(nframes) + nframes) * sizeof(seL4_Word);
+}
+
+static void
+clock_pro_init(replacement_frames *state, void *mem)
+{
+    frames = state;
+    hot = mem;
+    test = hot + frames->words;
+    ghosts = test + frames->words;
+
+    for (seL4_Word i = 0; i < frames->capacity; i++)
+        ghosts[i] = GHOST_NONE;
+
+    cold_min = MAX(1, frames->capacity / COLD_MIN_DIVISOR);
+    cold_max = MAX(cold_min, frames->capacity / COLD_MAX_DIVISOR);
+    cold_target = cold_min;
+}
+
+static seL4_Word
+clock_pro_scan(void)
+{
+    /*
+     * The cold hand only looks at cold frames, so a stream of pages touched once is
+     * replaced among itself and cannot push out the hot pages.
+     * A referenced cold frame in its test period becomes hot, otherwise it begins a test period.
+     */
+    seL4_Word start = hand_cold / seL4_WordBits;
+    for (seL4_Word i = 0; i <= 2 * frames->words; i++) {
+        seL4_Word word = (start + i) % frames->words;
+        seL4_Word candidates = frames->valid[word] & ~frames->pinned[word] & ~hot[word];
+        if (i == 0)
+            candidates &= ~MASK(hand_cold % seL4_WordBits);
+
+        while (candidates) {
+            seL4_Word frame_id = (word * seL4_WordBits) + CTZ(candidates);
+            candidates &= candidates - 1;
+
+            if (!FRAME_BIT_GET(frames->referenced, frame_id)) {
+                hand_cold = (frame_id + 1) % (frames->words * seL4_WordBits);
+                return frame_id;
+            }
+
+            replacement_unreference(frames, word, BIT(frame_id % seL4_WordBits));
+            if (FRAME_BIT_GET(test, frame_id)) {
+                FRAME_BIT_CLR(test, frame_id);
+                FRAME_BIT_SET(hot, frame_id);
+                hot_count++;
+                if (hot_count > frames->capacity - cold_target)
+                    run_hand_hot(FALSE);
+            } else {
+                FRAME_BIT_SET(test, frame_id);
+            }
+        }
+    }
+
+    /* Every unpinned frame is hot, demote one to evict */
+    seL4_Word frame_id = run_hand_hot(TRUE);
+    if (frame_id == -1) {
+        LOG_ERROR("Looped around and didnt select a page, all pages pinned");
+        return -1;
+    }
+
+    return frame_id;
+}
+
+static void
+clock_pro_fault(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
+{
+    FRAME_BIT_CLR(hot, frame_id);
+    FRAME_BIT_CLR(test, frame_id);
+
+    /* A page faulting back in during its test period has a reuse distance that fits in memory */
+    if (ghost_remove(GHOST_KEY(pid, page_id))) {
+        FRAME_BIT_SET(hot, frame_id);
+        hot_count++;
+        cold_target = MIN(cold_max, cold_target + 1);
+        if (hot_count > frames->capacity - cold_target)
+            run_hand_hot(FALSE);
+        return;
+    }
+
+    /*
+     * New pages start cold. The fault leaves the frame referenced, so the cold hand
+     * starts its test period when it first passes, and evicts it on the next pass unless reused.
+     */
+}
+
+static void
+clock_pro_evict(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
+{
+    if (FRAME_BIT_GET(test, frame_id))
+        ghost_insert(GHOST_KEY(pid, page_id));
+
+    if (FRAME_BIT_GET(hot, frame_id))
+        hot_count--;
+
+    FRAME_BIT_CLR(hot, frame_id);
+    FRAME_BIT_CLR(test, frame_id);
+}
+
+static void
+clock_pro_free(seL4_Word frame_id)
+{
+    if (FRAME_BIT_GET(hot, frame_id))
+        hot_count--;
+
+    FRAME_BIT_CLR(hot, frame_id);
+    FRAME_BIT_CLR(test, frame_id);
+}
+
+/*
+ * Advance the hot hand until there is room for the cold target.
+ * Unreferenced hot frames are demoted to cold, referenced hot frames lose their reference.
+ * Cold frames it passes that were not referenced end their test period.
+ * @param force, stop at the first demoted frame even if the hot frames are within their target
+ * @returns id of the last demoted frame, else -1 if none was demoted
+ */
+static seL4_Word
+run_hand_hot(bool force)
+{
+    seL4_Word demoted = -1;
+
+    seL4_Word start = hand_hot / seL4_WordBits;
+    for (seL4_Word i = 0; i <= 2 * frames->words; i++) {
+        seL4_Word word = (start + i) % frames->words;
+        seL4_Word candidates = frames->valid[word] & ~frames->pinned[word];
+        if (i == 0)
+            candidates &= ~MASK(hand_hot % seL4_WordBits);
+
+        while (candidates) {
+            seL4_Word frame_id = (word * seL4_WordBits) + CTZ(candidates);
+            candidates &= candidates - 1;
+            hand_hot = (frame_id + 1) % (frames->words * seL4_WordBits);
+
+            bool referenced = FRAME_BIT_GET(frames->referenced, frame_id);
+            if (!FRAME_BIT_GET(hot, frame_id)) {
+                if (!referenced && FRAME_BIT_GET(test, frame_id)) {
+                    FRAME_BIT_CLR(test, frame_id);
+                    cold_target = MAX(cold_min, cold_target - 1);
+                }
+                continue;
+            }
+
+            if (referenced) {
+                replacement_unreference(frames, word, BIT(frame_id % seL4_WordBits));
+                continue;
+            }
+
+            FRAME_BIT_CLR(hot, frame_id);
+            hot_count--;
+            demoted = frame_id;
+
+            if (force || hot_count <= frames->capacity - cold_target)
+                return demoted;
+        }
+    }
+
+    return demoted;
+}
+
+/*
+ * Record a cold page evicted in its test period
+ * @param key, the GHOST_KEY of the page
+ */
+static void
+ghost_insert(seL4_Word key)
+{
+    /* The ghost overwritten ended its test period without being reused */
+    if (ghosts[ghost_next] != GHOST_NONE)
+        cold_target = MAX(cold_min, cold_target - 1);
+
+    ghosts[ghost_next] = key;
+    ghost_next = (ghost_next + 1) % frames->capacity;
+}
+
+/*
+ * Remove the ghost of a page, the ring is a linear search as it is only searched on a fault
+ * @param key, the GHOST_KEY of the page
+ * @returns TRUE if the page had a ghost, else FALSE
+ */
+static bool
+ghost_remove(seL4_Word key)
+{
+    for (seL4_Word i = 0; i < frames->capacity; i++) {
+        if (ghosts[i] == key) {
+            ghosts[i] = GHOST_NONE;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Scan resistant, pages must be reused within their test period to become hot */
+const replacement_policy clock_pro_policy = {
+    .name = "clock-pro",
+    .bytes = clock_pro_bytes,
+    .init = clock_pro_init,
+    .scan = clock_pro_scan,
+    .access = NULL,
+    .fault = clock_pro_fault,
+    .evict = clock_pro_evict,
+    .free = clock_pro_free,
+};
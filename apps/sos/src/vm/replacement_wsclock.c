@@ -0,0 +1,137 @@
+/*
+ * WSClock Replacement
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "replacement.h"
+
+#include "frametable.h"
+#include <proc/proc.h>
+
+/*
+ * Working set window, in units of the virtual time of the owning process.
+ * A process advances its virtual time by one for every vm fault it takes,
+ * as SOS has no other per process clock, so a window of faults approximates
+ * the pages used over the recent execution of that process alone.
+ */
+#define WSCLOCK_TAU 64
+
+/* Replacement state of the frame table */
+static replacement_frames *frames = NULL;
+
+/* Virtual time of the owning process when each frame was last seen referenced */
+static seL4_Word *last_use = NULL;
+
+/* Hand of the clock, the frame id the next victim scan starts from */
+static seL4_Word clock_hand = 0;
+
+/*
+ * Virtual time of the process a frame belongs to
+ * @param frame_id, id of the frame
+ * @returns virtual time of the process, 0 if the frame has no process
+ */
+static seL4_Word
+wsclock_vtime(seL4_Word frame_id)
+{
+    seL4_Word pid;
+    seL4_Word page_id;
+    if (frame_table_get_page_id(frame_id, &pid, &page_id) != 0)
+        return 0;
+
+    proc *owner = get_proc(pid);
+    return owner ? owner->p_vmstats.faults : 0;
+}
+
+static seL4_Word
+wsclock_bytes(seL4_Word nframes)
+{
+    return nframes * sizeof(seL4_Word);
+}
+
+static void
+wsclock_init(replacement_frames *state, void *mem)
+{
+    frames = state;
+    last_use = mem;
+    clock_hand = 0;
+}
+
+static seL4_Word
+wsclock_scan(void)
+{
+    seL4_Word oldest = -1;
+    seL4_Word oldest_age = 0;
+
+    /*
+     * Referenced frames are in the working set, their reference is cleared and their time of use recorded.
+     * The first unreferenced frame older than the window is evicted. Failing that, a full sweep
+     * falls back to the oldest unreferenced frame, a second sweep is only needed if every frame was referenced.
+     */
+    seL4_Word start = clock_hand / seL4_WordBits;
+    for (seL4_Word i = 0; i <= 2 * frames->words; i++) {
+        if (i == frames->words && oldest != -1)
+            break;
+
+        seL4_Word word = (start + i) % frames->words;
+        seL4_Word candidates = frames->valid[word] & ~frames->pinned[word];
+        if (i == 0)
+            candidates &= ~MASK(clock_hand % seL4_WordBits);
+
+        while (candidates) {
+            seL4_Word frame_id = (word * seL4_WordBits) + CTZ(candidates);
+            candidates &= candidates - 1;
+
+            seL4_Word now = wsclock_vtime(frame_id);
+            if (FRAME_BIT_GET(frames->referenced, frame_id)) {
+                replacement_unreference(frames, word, BIT(frame_id % seL4_WordBits));
+                last_use[frame_id] = now;
+                continue;
+            }
+
+            seL4_Word age = now - last_use[frame_id];
+            if (age > WSCLOCK_TAU) {
+                clock_hand = (frame_id + 1) % (frames->words * seL4_WordBits);
+                return frame_id;
+            }
+
+            if (oldest == -1 || age > oldest_age) {
+                oldest = frame_id;
+                oldest_age = age;
+            }
+        }
+    }
+
+    if (oldest == -1) {
+        LOG_ERROR("Looped around and didnt select a page, all pages pinned");
+        return -1;
+    }
+
+    clock_hand = (oldest + 1) % (frames->words * seL4_WordBits);
+    return oldest;
+}
+
+static void
+wsclock_access(seL4_Word frame_id)
+{
+    last_use[frame_id] = wsclock_vtime(frame_id);
+}
+
+static void
+wsclock_fault(seL4_Word frame_id, seL4_Word pid, seL4_Word page_id)
+{
+    proc *owner = get_proc(pid);
+    last_use[frame_id] = owner ? owner->p_vmstats.faults : 0;
+}
+
+/* Frames are evicted by age relative to their own process, so a busy process cannot age out an idle one */
+const replacement_policy wsclock_policy = {
+    .name = "wsclock",
+    .bytes = wsclock_bytes,
+    .init = wsclock_init,
+    .scan = wsclock_scan,
+    .access = wsclock_access,
+    .fault = wsclock_fault,
+    .evict = NULL,
+    .free = NULL,
+};
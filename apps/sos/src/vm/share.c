@@ -0,0 +1,142 @@
+/*
+ * Shared Memory
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "share.h"
+
+#include <stdlib.h>
+#include <utils/util.h>
+
+#define SHARE_INDEX(page_id) (((page_id) >> seL4_PageBits) & (SHARE_BUCKETS - 1))
+
+/*
+ * A page shared by processes with sos_share_vm.
+ * Every process sharing the page maps the same frame at the same address, or references the same
+ * pagefile slot while it is evicted, so the frame table records them all as sharers of the frame.
+ */
+typedef struct share_page {
+    seL4_Word page_id; /* Virtual address of the page */
+    seL4_Word members; /* Bitmap of the pids sharing the page */
+    seL4_Word writers; /* Bitmap of the pids that shared the page writable */
+    struct share_page *next; /* Next shared page in the bucket */
+} share_page;
+
+/* Shared pages, hashed on their address */
+static share_page *shares[SHARE_BUCKETS];
+
+/* Private functions */
+static share_page *share_find(seL4_Word page_id);
+
+int
+share_add(seL4_Word page_id, seL4_Word pid, bool writable)
+{
+    share_page *share = share_find(page_id);
+    if (share == NULL) {
+        if ((share = malloc(sizeof(share_page))) == NULL) {
+            LOG_ERROR("Failed to share the page");
+            return 1;
+        }
+
+        share->page_id = page_id;
+        share->members = 0;
+        share->writers = 0;
+        share->next = shares[SHARE_INDEX(page_id)];
+        shares[SHARE_INDEX(page_id)] = share;
+    }
+
+    share->members |= BIT(pid);
+    if (writable)
+        share->writers |= BIT(pid);
+    else
+        share->writers &= ~BIT(pid);
+
+    return 0;
+}
+
+void
+share_remove(seL4_Word page_id, seL4_Word pid)
+{
+    for (share_page **share = &shares[SHARE_INDEX(page_id)]; *share != NULL; share = &(*share)->next) {
+        if ((*share)->page_id != page_id)
+            continue;
+
+        (*share)->members &= ~BIT(pid);
+        (*share)->writers &= ~BIT(pid);
+
+        /* The page is no longer shared once its last process leaves */
+        if (!(*share)->members) {
+            share_page *unshared = *share;
+            *share = unshared->next;
+            free(unshared);
+        }
+        return;
+    }
+}
+
+void
+share_remove_all(seL4_Word pid)
+{
+    for (seL4_Word i = 0; i < SHARE_BUCKETS; i++) {
+        share_page **share = &shares[i];
+        while (*share != NULL) {
+            (*share)->members &= ~BIT(pid);
+            (*share)->writers &= ~BIT(pid);
+            if ((*share)->members) {
+                share = &(*share)->next;
+                continue;
+            }
+
+            share_page *unshared = *share;
+            *share = unshared->next;
+            free(unshared);
+        }
+    }
+}
+
+seL4_Word
+share_get_members(seL4_Word page_id)
+{
+    share_page *share = share_find(page_id);
+    return share ? share->members : 0;
+}
+
+seL4_Word
+share_get_writers(seL4_Word page_id)
+{
+    share_page *share = share_find(page_id);
+    return share ? share->writers : 0;
+}
+
+bool
+share_is_member(seL4_Word page_id, seL4_Word pid)
+{
+    return (share_get_members(page_id) & BIT(pid)) != 0;
+}
+
+bool
+share_can_write(seL4_Word page_id, seL4_Word pid)
+{
+    share_page *share = share_find(page_id);
+    if (share == NULL || !(share->members & BIT(pid)))
+        return TRUE;
+
+    return (share->members & ~share->writers & ~BIT(pid)) == 0;
+}
+
+/*
+ * Find the entry of a shared page
+ * @param page_id, the virtual address of the page
+ * @returns the entry, or NULL if the page is not shared
+ */
+static share_page *
+share_find(seL4_Word page_id)
+{
+    for (share_page *share = shares[SHARE_INDEX(page_id)]; share != NULL; share = share->next) {
+        if (share->page_id == page_id)
+            return share;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,70 @@
+/*
+ * Shared Memory
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#ifndef _SHARE_H_
+#define _SHARE_H_
+
+#include <sel4/sel4.h>
+#include <stdbool.h>
+
+/* Buckets of the table of shared pages, a power of two */
+#define SHARE_BUCKETS 64
+
+/*
+ * Record that a process has shared a page with sos_share_vm
+ * Sharing a page again only changes whether it is shared writable.
+ * @param page_id, the virtual address of the page, the same in every process sharing it
+ * @param pid, the process sharing the page
+ * @param writable, whether the other processes sharing the page may write to it
+ * @returns 0 on success, else 1
+ */
+int share_add(seL4_Word page_id, seL4_Word pid, bool writable);
+
+/*
+ * Record that a process no longer shares a page
+ * @param page_id, the virtual address of the page
+ * @param pid, the process
+ */
+void share_remove(seL4_Word page_id, seL4_Word pid);
+
+/*
+ * Record that a process no longer shares any page, as it is being destroyed
+ * @param pid, the process
+ */
+void share_remove_all(seL4_Word pid);
+
+/*
+ * Find the processes sharing a page
+ * @param page_id, the virtual address of the page
+ * @returns bitmap of the pids sharing the page, 0 if the page is not shared
+ */
+seL4_Word share_get_members(seL4_Word page_id);
+
+/*
+ * Find the processes sharing a page writable
+ * @param page_id, the virtual address of the page
+ * @returns bitmap of the pids sharing the page writable
+ */
+seL4_Word share_get_writers(seL4_Word page_id);
+
+/*
+ * Determine if a process shares a page
+ * @param page_id, the virtual address of the page
+ * @param pid, the process
+ * @returns TRUE if the process shares the page, else FALSE
+ */
+bool share_is_member(seL4_Word page_id, seL4_Word pid);
+
+/*
+ * Determine if a process may write to a page, which it may only once every other process sharing it has shared it writable.
+ * A page the process does not share is left to the permissions of its region.
+ * @param page_id, the virtual address of the page
+ * @param pid, the process
+ * @returns TRUE if the process may write to the page, else FALSE
+ */
+bool share_can_write(seL4_Word page_id, seL4_Word pid);
+
+#endif /* _SHARE_H_ */
@@ -0,0 +1,754 @@
+/*
+ * Swap Space Implementation
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "swap.h"
+
+#include <autoconf.h>
+#include "event.h"
+#include "frametable.h"
+#include <fs/sos_nfs.h>
+#include "network.h"
+#include "pager.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <utils/util.h>
+
+/* Pagefiles created on the NFS mount, striped together */
+#ifdef CONFIG_SOS_SWAP_PAGEFILES
+#define SWAP_PAGEFILES CONFIG_SOS_SWAP_PAGEFILES
+#else
+#define SWAP_PAGEFILES 1
+#endif
+
+/* Frames reserved for swapping to memory, a power of two so the slots split evenly into chunks */
+#if defined(CONFIG_SOS_SWAP_MEMORY_FRAMES) && CONFIG_SOS_SWAP_MEMORY_FRAMES > 0
+#define SWAP_MEMORY_FRAMES BIT(LOG_BASE_2(CONFIG_SOS_SWAP_MEMORY_FRAMES))
+#define SWAP_MEMORY_FRAMES_MAX CONFIG_SOS_SWAP_MEMORY_FRAMES
+#else
+#define SWAP_MEMORY_FRAMES 0
+#define SWAP_MEMORY_FRAMES_MAX 0
+#endif
+
+/* NFS export holding an additional pagefile, and the priority of that pagefile */
+#ifdef CONFIG_SOS_SWAP_EXPORT
+#define SWAP_EXPORT CONFIG_SOS_SWAP_EXPORT
+#define SWAP_EXPORT_PRIORITY CONFIG_SOS_SWAP_EXPORT_PRIORITY
+#else
+#define SWAP_EXPORT ""
+#define SWAP_EXPORT_PRIORITY SWAP_PRIORITY_PAGEFILE
+#endif
+
+/* Backends are configured before they are created, without their vnode */
+typedef enum {
+    SWAP_MEMORY,
+    SWAP_MOUNT_PAGEFILE, /* Pagefile on the NFS mount of the file system */
+    SWAP_EXPORT_PAGEFILE, /* Pagefile on a separately mounted NFS export */
+} swap_type;
+
+/*
+ * Backends of the same priority.
+ * Consecutive slot ids of a tier are striped round robin over its backends,
+ * so a run of slots is spread over every backend of the tier.
+ * A tier grows a chunk at a time, a chunk being chunk_pages of every backend.
+ * The slot map of each chunk lives in a frame of its own, at the start of which is the map itself.
+ */
+typedef struct {
+    seL4_Word priority;
+    seL4_Word first_backend; /* Backends are ordered by priority, a tier is a range of them */
+    seL4_Word nbackends;
+    seL4_Word first_slot; /* Slot id of the first slot of the tier, ids are reserved up to the hard cap */
+    seL4_Word chunk_pages; /* Pages each backend grows by */
+    seL4_Word chunk_slots; /* Slots of a chunk, over every backend */
+    seL4_Word max_chunks; /* Chunks at the hard cap */
+    seL4_Word nchunks; /* Chunks in use */
+    seL4_Word truncating; /* Truncations in flight, the tier does not grow until they complete */
+    pagefile_map *chunks[SWAP_MAX_CHUNKS];
+    seL4_Word chunk_frames[SWAP_MAX_CHUNKS];
+} swap_tier;
+
+/* Backends and tiers, in order of decreasing priority */
+static swap_backend backends[SWAP_MAX_BACKENDS];
+static swap_type types[SWAP_MAX_BACKENDS];
+static seL4_Word nbackends = 0;
+static swap_tier tiers[SWAP_MAX_BACKENDS];
+static seL4_Word ntiers = 0;
+
+/* Memory held by the memory backend, a frame of its own for each slot */
+typedef struct {
+    uint8_t *pages[SWAP_MEMORY_FRAMES_MAX];
+    seL4_Word size;
+} swap_memory;
+
+static swap_memory memory;
+
+/* Handle of the additional NFS export */
+static fhandle_t export_handle;
+
+/* To spin on when waiting for a pagefile to be created */
+static volatile bool pagefile_pending = FALSE;
+
+/* Frame held back for the next chunk map, so growing never has to page out */
+static seL4_Word spare_frame = -1;
+static seL4_Word spare_vaddr;
+
+/* Private functions */
+static void swap_configure(void);
+static void swap_add(swap_type type, const char *name, seL4_Word priority, seL4_Word limit);
+static int swap_locate(seL4_Word slot, swap_backend **backend, seL4_Word *local);
+static int tier_alloc(swap_tier *tier, seL4_Word nslots, seL4_Word *slot);
+static int tier_grow(swap_tier *tier);
+static void tier_shrink(swap_tier *tier);
+static void swap_truncate_callback(uintptr_t token, int err);
+static int swap_batch(uiovec *iovs, size_t niovs, size_t window, bool write);
+static int swap_create_memory(swap_backend *backend);
+static int swap_create_pagefile(swap_backend *backend, fhandle_t *dir, const char *file);
+static void swap_create_callback(uintptr_t token, enum nfs_stat status, fhandle_t *fh, fattr_t *fattr);
+static int swap_memory_read(vnode *node, uiovec *iov);
+static int swap_memory_write(vnode *node, uiovec *iov);
+static int swap_memory_copy(swap_memory *mem, uiovec *iov, bool write);
+static int swap_memory_read_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window);
+static int swap_memory_write_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window);
+
+/* Operations on the memory backend, which complete without yielding */
+static const vnode_ops swap_memory_ops = {
+    .vop_read = swap_memory_read,
+    .vop_write = swap_memory_write,
+    .vop_read_batch = swap_memory_read_batch,
+    .vop_write_batch = swap_memory_write_batch,
+};
+
+int
+swap_init(void)
+{
+    swap_configure();
+
+    for (seL4_Word i = 0; i < nbackends; i++) {
+        int err = 0;
+        switch (types[i]) {
+            case SWAP_MEMORY:
+                err = swap_create_memory(&backends[i]);
+                break;
+            case SWAP_MOUNT_PAGEFILE:
+                err = swap_create_pagefile(&backends[i], &mnt_point, backends[i].stats.name);
+                break;
+            case SWAP_EXPORT_PAGEFILE:
+                if (nfs_mount(SWAP_EXPORT, &export_handle) != RPC_OK) {
+                    LOG_ERROR("Failed to mount %s", SWAP_EXPORT);
+                    return 1;
+                }
+                err = swap_create_pagefile(&backends[i], &export_handle, "pagefile");
+                break;
+        }
+
+        if (err != 0) {
+            LOG_ERROR("Failed to create swap backend %s", backends[i].stats.name);
+            return 1;
+        }
+    }
+
+    /* The backends start empty, and grow as their slots are needed */
+    for (seL4_Word i = 0; i < nbackends; i++) {
+        LOG_INFO("Swap backend %s, priority %d, up to %d slots, stripe %d of %d", backends[i].stats.name,
+                 backends[i].stats.priority, backends[i].stats.limit, backends[i].stripe,
+                 tiers[backends[i].tier].nbackends);
+    }
+
+    if (swap_reserve() != 0) {
+        LOG_ERROR("Failed to reserve a frame for the swap slot maps");
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+swap_alloc(seL4_Word *slot)
+{
+    for (seL4_Word i = 0; i < ntiers; i++) {
+        if (tier_alloc(&tiers[i], 1, slot) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+int
+swap_alloc_run(seL4_Word nslots, seL4_Word *first)
+{
+    for (seL4_Word i = 0; i < ntiers; i++) {
+        if (tier_alloc(&tiers[i], nslots, first) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+void
+swap_free(seL4_Word slot)
+{
+    swap_backend *backend;
+    seL4_Word local;
+    if (swap_locate(slot, &backend, &local) != 0) {
+        LOG_ERROR("Slot %d is outside of the swap space", slot);
+        return;
+    }
+
+    swap_tier *tier = &tiers[backend->tier];
+    seL4_Word offset = slot - tier->first_slot;
+    pagefile_map_free(tier->chunks[offset / tier->chunk_slots], offset % tier->chunk_slots);
+    backend->stats.used--;
+
+    tier_shrink(tier);
+}
+
+int
+swap_reserve(void)
+{
+    if (spare_frame != -1)
+        return 0;
+
+    if ((spare_frame = frame_alloc(&spare_vaddr, FRAME_ALLOC_NOZERO | FRAME_ALLOC_NOPAGE)) == -1)
+        return 1;
+
+    assert(frame_table_set_chance(spare_frame, PINNED) == 0);
+    return 0;
+}
+
+int
+swap_read_batch(uiovec *iovs, size_t niovs, size_t window)
+{
+    return swap_batch(iovs, niovs, window, FALSE);
+}
+
+int
+swap_write_batch(uiovec *iovs, size_t niovs, size_t window)
+{
+    return swap_batch(iovs, niovs, window, TRUE);
+}
+
+int
+swap_get_stats(seL4_Word index, swap_stats *stats)
+{
+    if (index >= nbackends)
+        return 1;
+
+    *stats = backends[index].stats;
+    return 0;
+}
+
+void
+swap_get_map_stats(pagefile_map_stats *stats)
+{
+    bzero(stats, sizeof(pagefile_map_stats));
+    for (seL4_Word i = 0; i < ntiers; i++) {
+        for (seL4_Word j = 0; j < tiers[i].nchunks; j++) {
+            pagefile_map_stats chunk_stats;
+            pagefile_map_get_stats(tiers[i].chunks[j], &chunk_stats);
+
+            stats->slots += chunk_stats.slots;
+            stats->used += chunk_stats.used;
+            stats->peak += chunk_stats.peak;
+            stats->allocs += chunk_stats.allocs;
+            stats->frees += chunk_stats.frees;
+            stats->failures += chunk_stats.failures;
+        }
+    }
+}
+
+/*
+ * Build the backends and tiers from the configuration, once
+ */
+static void
+swap_configure(void)
+{
+    if (nbackends > 0)
+        return;
+
+    if (SWAP_MEMORY_FRAMES > 0)
+        swap_add(SWAP_MEMORY, "memory", SWAP_PRIORITY_MEMORY, SWAP_MEMORY_FRAMES);
+
+    for (seL4_Word i = 0; i < SWAP_PAGEFILES; i++) {
+        char name[SWAP_NAME_LEN];
+        if (i == 0)
+            strcpy(name, "pagefile");
+        else
+            snprintf(name, SWAP_NAME_LEN, "pagefile%d", i);
+
+        swap_add(SWAP_MOUNT_PAGEFILE, name, SWAP_PRIORITY_PAGEFILE, PAGEFILE_MAX_PAGES);
+    }
+
+    if (strlen(SWAP_EXPORT) > 0)
+        swap_add(SWAP_EXPORT_PAGEFILE, "export", SWAP_EXPORT_PRIORITY, PAGEFILE_MAX_PAGES);
+
+    /*
+     * Group the backends into tiers of equal priority.
+     * Striping uses the same number of slots from every backend of a tier,
+     * so a tier is only as deep as its smallest backend.
+     * Chunks are shrunk from the default until the map of a chunk fits in a frame.
+     */
+    seL4_Word first_slot = 0;
+    for (seL4_Word i = 0; i < nbackends; i++) {
+        if (i == 0 || backends[i].stats.priority != tiers[ntiers - 1].priority) {
+            tiers[ntiers].priority = backends[i].stats.priority;
+            tiers[ntiers].first_backend = i;
+            tiers[ntiers].nbackends = 0;
+            ntiers++;
+        }
+
+        swap_tier *tier = &tiers[ntiers - 1];
+        backends[i].tier = ntiers - 1;
+        backends[i].stripe = tier->nbackends++;
+    }
+
+    for (seL4_Word i = 0; i < ntiers; i++) {
+        swap_tier *tier = &tiers[i];
+        seL4_Word depth = backends[tier->first_backend].stats.limit;
+        for (seL4_Word j = 1; j < tier->nbackends; j++)
+            depth = MIN(depth, backends[tier->first_backend + j].stats.limit);
+
+        tier->chunk_pages = MIN(SWAP_CHUNK_PAGES, depth);
+        while (sizeof(pagefile_map) + pagefile_map_bytes(tier->chunk_pages * tier->nbackends) > PAGE_SIZE_4K)
+            tier->chunk_pages /= 2;
+
+        tier->chunk_slots = tier->chunk_pages * tier->nbackends;
+        tier->max_chunks = MIN(depth / tier->chunk_pages, SWAP_MAX_CHUNKS);
+        tier->nchunks = 0;
+        tier->truncating = 0;
+
+        for (seL4_Word j = 0; j < tier->nbackends; j++)
+            backends[tier->first_backend + j].stats.limit = tier->max_chunks * tier->chunk_pages;
+
+        tier->first_slot = first_slot;
+        first_slot += tier->max_chunks * tier->chunk_slots;
+    }
+}
+
+/*
+ * Add a backend to the configuration, keeping the backends in order of decreasing priority
+ * @param type, the type of the backend
+ * @param name, the name of the backend
+ * @param priority, the priority of the backend
+ * @param limit, the hard cap of the backend in pages
+ */
+static void
+swap_add(swap_type type, const char *name, seL4_Word priority, seL4_Word limit)
+{
+    if (nbackends == SWAP_MAX_BACKENDS) {
+        LOG_ERROR("Too many swap backends, %s is not used", name);
+        return;
+    }
+
+    seL4_Word i = nbackends++;
+    while (i > 0 && backends[i - 1].stats.priority < priority) {
+        backends[i] = backends[i - 1];
+        types[i] = types[i - 1];
+        i--;
+    }
+
+    bzero(&backends[i], sizeof(swap_backend));
+    strncpy(backends[i].stats.name, name, SWAP_NAME_LEN - 1);
+    backends[i].stats.priority = priority;
+    backends[i].stats.limit = limit;
+    types[i] = type;
+}
+
+/*
+ * Find the backend holding a slot
+ * @param slot, the id of the slot
+ * @param[out] backend, the backend of the slot
+ * @param[out] local, the slot within the backend
+ * @returns 0 on success, else 1 if the slot is outside of the swap space
+ */
+static int
+swap_locate(seL4_Word slot, swap_backend **backend, seL4_Word *local)
+{
+    for (seL4_Word i = 0; i < ntiers; i++) {
+        swap_tier *tier = &tiers[i];
+        if (slot < tier->first_slot || slot - tier->first_slot >= tier->nchunks * tier->chunk_slots)
+            continue;
+
+        seL4_Word offset = slot - tier->first_slot;
+        *backend = &backends[tier->first_backend + (offset % tier->nbackends)];
+        *local = offset / tier->nbackends;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Reserve slots from the first chunk of a tier with space, growing the tier if every chunk is full.
+ * Filling the earliest chunks first lets the trailing chunks drain, so they can be released.
+ * @param tier, the tier
+ * @param nslots, the number of contiguous slots
+ * @param[out] slot, the id of the first slot
+ * @returns 0 on success, else 1 if the tier is full
+ */
+static int
+tier_alloc(swap_tier *tier, seL4_Word nslots, seL4_Word *slot)
+{
+    if (nslots > tier->chunk_slots)
+        return 1;
+
+    seL4_Word chunk;
+    seL4_Word local;
+    for (chunk = 0; chunk < tier->nchunks; chunk++) {
+        int err = (nslots == 1) ? pagefile_map_alloc(tier->chunks[chunk], &local) :
+            pagefile_map_alloc_run(tier->chunks[chunk], nslots, &local);
+        if (err == 0)
+            break;
+    }
+
+    if (chunk == tier->nchunks) {
+        if (tier_grow(tier) != 0)
+            return 1;
+
+        int err = (nslots == 1) ? pagefile_map_alloc(tier->chunks[chunk], &local) :
+            pagefile_map_alloc_run(tier->chunks[chunk], nslots, &local);
+        if (err != 0)
+            return 1;
+    }
+
+    seL4_Word offset = (chunk * tier->chunk_slots) + local;
+    for (seL4_Word i = 0; i < nslots; i++) {
+        swap_backend *backend = &backends[tier->first_backend + ((offset + i) % tier->nbackends)];
+        backend->stats.used++;
+        backend->stats.allocs++;
+    }
+
+    *slot = tier->first_slot + offset;
+    return 0;
+}
+
+/*
+ * Add a chunk to a tier.
+ * The backends are extended by their writes, only the map of the chunk is needed.
+ * Its frame is allocated without paging, as the tier grows from within a page out,
+ * and the spare frame is used when there is no other.
+ * @param tier, the tier
+ * @returns 0 on success, else 1 if the tier is at its cap or no frame is available
+ */
+static int
+tier_grow(swap_tier *tier)
+{
+    if (tier->nchunks == tier->max_chunks || tier->truncating > 0)
+        return 1;
+
+    seL4_Word vaddr;
+    seL4_Word frame_id = frame_alloc(&vaddr, FRAME_ALLOC_NOZERO | FRAME_ALLOC_NOPAGE);
+    if (frame_id == -1) {
+        if (spare_frame == -1) {
+            LOG_ERROR("No frame to grow the swap space with");
+            return 1;
+        }
+
+        frame_id = spare_frame;
+        vaddr = spare_vaddr;
+        spare_frame = -1;
+    } else {
+        assert(frame_table_set_chance(frame_id, PINNED) == 0);
+    }
+
+    pagefile_map *map = (pagefile_map *)vaddr;
+    if (pagefile_map_init(map, (seL4_Word *)(map + 1), tier->chunk_slots) != 0) {
+        LOG_ERROR("Failed to initialise the slot map of a chunk");
+        frame_free(frame_id);
+        return 1;
+    }
+
+    tier->chunks[tier->nchunks] = map;
+    tier->chunk_frames[tier->nchunks++] = frame_id;
+
+    for (seL4_Word i = 0; i < tier->nbackends; i++)
+        backends[tier->first_backend + i].stats.slots += tier->chunk_pages;
+
+    LOG_INFO("Swap priority %d grown to %d of %d chunks", tier->priority, tier->nchunks, tier->max_chunks);
+    return 0;
+}
+
+/*
+ * Release the last chunk of a tier once it is empty, truncating its backends.
+ * A chunk is only released while the one before it is at most half full,
+ * so a tier at the boundary of a chunk does not repeatedly grow and shrink.
+ * @param tier, the tier
+ */
+static void
+tier_shrink(swap_tier *tier)
+{
+    if (tier->nchunks <= 1 || tier->truncating > 0)
+        return;
+
+    pagefile_map_stats last, prev;
+    pagefile_map_get_stats(tier->chunks[tier->nchunks - 1], &last);
+    pagefile_map_get_stats(tier->chunks[tier->nchunks - 2], &prev);
+    if (last.used > 0 || prev.used > tier->chunk_slots / 2)
+        return;
+
+    /* Keep the frame for the next growth if there is no spare */
+    seL4_Word frame_id = tier->chunk_frames[--tier->nchunks];
+    if (spare_frame == -1) {
+        spare_frame = frame_id;
+        spare_vaddr = (seL4_Word)tier->chunks[tier->nchunks];
+    } else {
+        frame_free(frame_id);
+    }
+
+    for (seL4_Word i = 0; i < tier->nbackends; i++) {
+        swap_backend *backend = &backends[tier->first_backend + i];
+        backend->stats.slots -= tier->chunk_pages;
+
+        /* Backends without truncation, such as memory, have nothing to give back */
+        const vnode_ops *ops = backend->node->vn_ops;
+        if (ops->vop_truncate != NULL &&
+            ops->vop_truncate(backend->node, backend->stats.slots * PAGE_SIZE_4K, swap_truncate_callback,
+                              (uintptr_t)backend) == 0)
+            tier->truncating++;
+    }
+
+    LOG_INFO("Swap priority %d shrunk to %d of %d chunks", tier->priority, tier->nchunks, tier->max_chunks);
+}
+
+/*
+ * Truncation of a backend has completed, the tier may grow again once all have
+ */
+static void
+swap_truncate_callback(uintptr_t token, int err)
+{
+    swap_backend *backend = (swap_backend *)token;
+    if (err != 0)
+        backend->stats.errors++;
+
+    tiers[backend->tier].truncating--;
+}
+
+/*
+ * Split a batch by backend, and issue the share of each backend through its vnode.
+ * The io vectors are left untouched, each backend is given copies positioned at its local slots.
+ * The pagefiles are issued together in one window, so the slots striped over them are transferred in parallel.
+ * A failed backend does not stop the others from being issued.
+ * @param iovs, the io vectors, positioned at slot ids
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding operations per backend
+ * @param write, TRUE to write, FALSE to read
+ * @returns 0 on success, else 1
+ */
+static int
+swap_batch(uiovec *iovs, size_t niovs, size_t window, bool write)
+{
+    int err = 1;
+    uiovec *share = malloc(sizeof(uiovec) * niovs);
+    vnode **nodes = malloc(sizeof(vnode *) * niovs);
+    swap_backend **owners = malloc(sizeof(swap_backend *) * niovs);
+    if (share == NULL || nodes == NULL || owners == NULL) {
+        LOG_ERROR("Failed to allocate the io vectors of a swap batch");
+        goto swap_batch_epilogue;
+    }
+
+    /* Vectors for the pagefiles are kept in the order of the batch at the front, those for memory at the back */
+    swap_backend *owner;
+    seL4_Word local;
+    size_t nfiles = 0;
+    size_t nmemory = 0;
+    for (size_t j = 0; j < niovs; j++) {
+        if (swap_locate(iovs[j].uiov_pos / PAGE_SIZE_4K, &owner, &local) != 0) {
+            LOG_ERROR("Position %d is outside of the swap space", iovs[j].uiov_pos);
+            goto swap_batch_epilogue;
+        }
+
+        size_t k = (types[owner - backends] == SWAP_MEMORY) ? niovs - ++nmemory : nfiles++;
+        share[k] = iovs[j];
+        share[k].uiov_pos = (local * PAGE_SIZE_4K) + (iovs[j].uiov_pos % PAGE_SIZE_4K);
+        nodes[k] = owner->node;
+        owners[k] = owner;
+    }
+
+    /* Memory is copied without yielding, a vector is marked done by emptying it as the pagefiles do */
+    for (size_t k = niovs - nmemory; k < niovs; k++) {
+        const vnode_ops *ops = nodes[k]->vn_ops;
+        if ((write ? ops->vop_write(nodes[k], &share[k]) : ops->vop_read(nodes[k], &share[k])) == share[k].uiov_len)
+            share[k].uiov_len = 0;
+    }
+
+    /* Every pagefile has its window of requests in flight at once, the vectors not transferred are found below */
+    if (nfiles > 0)
+        sos_nfs_batch_files(nodes, share, nfiles, window * nbackends, write);
+
+    /* Each backend with a vector left untransferred has failed */
+    seL4_Word failed = 0;
+    for (size_t k = 0; k < niovs; k++) {
+        if (share[k].uiov_len != 0)
+            failed |= BIT(owners[k] - backends);
+        else if (write)
+            owners[k]->stats.writes++;
+        else
+            owners[k]->stats.reads++;
+    }
+
+    for (seL4_Word i = 0; i < nbackends; i++) {
+        if (failed & BIT(i)) {
+            LOG_ERROR("Failed to %s swap backend %s", write ? "write to" : "read from", backends[i].stats.name);
+            backends[i].stats.errors++;
+        }
+    }
+
+    err = (failed != 0);
+
+    swap_batch_epilogue:
+        free(share);
+        free(nodes);
+        free(owners);
+        return err;
+}
+
+/*
+ * Reserve the frames of the memory backend
+ * @param backend, the backend
+ * @returns 0 on success, else 1
+ */
+static int
+swap_create_memory(swap_backend *backend)
+{
+    /* Slots are read and written a page at a time, so the frames need not be contiguous */
+    for (seL4_Word i = 0; i < SWAP_MEMORY_FRAMES; i++) {
+        seL4_Word vaddr;
+        seL4_Word frame_id = frame_alloc(&vaddr, FRAME_ALLOC_NOZERO | FRAME_ALLOC_NOPAGE);
+        if (frame_id == -1) {
+            LOG_ERROR("Failed to reserve frames for swapping to memory");
+            return 1;
+        }
+
+        /* The frames hold the swapped pages, they are never paged themselves */
+        assert(frame_table_set_chance(frame_id, PINNED) == 0);
+        memory.pages[i] = (uint8_t *)vaddr;
+    }
+
+    memory.size = SWAP_MEMORY_FRAMES * PAGE_SIZE_4K;
+
+    if ((backend->node = vnode_create(&memory, &swap_memory_ops, 0, 0)) == NULL) {
+        LOG_ERROR("Failed to create the vnode of the memory backend");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Create a pagefile, spinning until NFS responds as the event loop is not yet running
+ * @param backend, the backend
+ * @param dir, the handle of the directory to create the pagefile in
+ * @param file, the name of the pagefile
+ * @returns 0 on success, else 1
+ */
+static int
+swap_create_pagefile(swap_backend *backend, fhandle_t *dir, const char *file)
+{
+    const sattr_t file_attr = {
+        .mode = 0664, /* Read write for owner and group, read for everyone */
+    };
+
+    pagefile_pending = TRUE;
+    if (nfs_create(dir, file, &file_attr, swap_create_callback, (uintptr_t)backend) != RPC_OK) {
+        LOG_ERROR("Failed to create %s", file);
+        return 1;
+    }
+
+    seL4_Word badge;
+
+    LOG_INFO("Spinning until %s is created", backend->stats.name);
+    while (pagefile_pending) {
+        seL4_Wait(_sos_ipc_ep_cap, &badge);
+        if (badge & IRQ_EP_BADGE && badge & IRQ_BADGE_NETWORK)
+            network_irq();
+    }
+
+    return (backend->node == NULL) ? 1 : 0;
+}
+
+static void
+swap_create_callback(uintptr_t token, enum nfs_stat status, fhandle_t *fh, fattr_t *fattr)
+{
+    swap_backend *backend = (swap_backend *)token;
+    if (status != NFS_OK)
+        LOG_ERROR("Invalid nfs status %d", status);
+    else
+        backend->node = sos_nfs_vnode_create(fh);
+
+    pagefile_pending = FALSE;
+}
+
+/*
+ * Read from the memory backend
+ * @param node, the vnode of the backend
+ * @param iov, the io vector
+ * @returns nbytes read on success else -1
+ */
+static int
+swap_memory_read(vnode *node, uiovec *iov)
+{
+    return swap_memory_copy(node->vn_data, iov, FALSE);
+}
+
+/*
+ * Write to the memory backend
+ * @param node, the vnode of the backend
+ * @param iov, the io vector
+ * @returns nbytes written on success else -1
+ */
+static int
+swap_memory_write(vnode *node, uiovec *iov)
+{
+    return swap_memory_copy(node->vn_data, iov, TRUE);
+}
+
+/*
+ * Copy between an io vector and the frames of the memory backend, a page at a time
+ * @param mem, the memory of the backend
+ * @param iov, the io vector
+ * @param write, TRUE to copy into the backend, else FALSE to copy out of it
+ * @returns nbytes copied on success else -1
+ */
+static int
+swap_memory_copy(swap_memory *mem, uiovec *iov, bool write)
+{
+    if (iov->uiov_pos + iov->uiov_len > mem->size)
+        return -1;
+
+    for (seL4_Word done = 0, len; done < iov->uiov_len; done += len) {
+        seL4_Word pos = iov->uiov_pos + done;
+        uint8_t *page = mem->pages[pos / PAGE_SIZE_4K] + (pos % PAGE_SIZE_4K);
+        len = MIN(iov->uiov_len - done, PAGE_SIZE_4K - (pos % PAGE_SIZE_4K));
+
+        if (write)
+            memcpy(page, iov->uiov_base + done, len);
+        else
+            memcpy(iov->uiov_base + done, page, len);
+    }
+
+    return iov->uiov_len;
+}
+
+static int
+swap_memory_read_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window)
+{
+    for (size_t i = 0; i < niovs; i++) {
+        if (swap_memory_read(node, &iovs[i]) == -1)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+swap_memory_write_batch(vnode *node, uiovec *iovs, size_t niovs, size_t window)
+{
+    for (size_t i = 0; i < niovs; i++) {
+        if (swap_memory_write(node, &iovs[i]) == -1)
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Swap Space
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include <sel4/sel4.h>
+#include <vfs/vfs.h>
+#include "pagefile_map.h"
+
+/* Maximum number of backends making up the swap space */
+#define SWAP_MAX_BACKENDS 8
+
+/* Pages each backend grows by at once, the pagefiles grow 16MB at a time */
+#define SWAP_CHUNK_PAGES 4096
+
+/* Maximum number of chunks of a priority */
+#define SWAP_MAX_CHUNKS 128
+
+/* Maximum length of the name of a backend, including the terminator */
+#define SWAP_NAME_LEN N_SWAP_NAME
+
+/* Priorities of the built in backends, slots are allocated from the highest priority with space */
+#define SWAP_PRIORITY_MEMORY 2
+#define SWAP_PRIORITY_PAGEFILE 1
+
+/* Statistics of a swap backend */
+typedef struct {
+    char name[SWAP_NAME_LEN]; /* Name of the backend */
+    seL4_Word priority; /* Backends of equal priority are striped */
+    seL4_Word slots; /* Current size in pages */
+    seL4_Word limit; /* Hard cap in pages */
+    seL4_Word used; /* Slots currently allocated */
+    seL4_Word allocs; /* Slots allocated from the backend */
+    seL4_Word reads; /* Pages read */
+    seL4_Word writes; /* Pages written */
+    seL4_Word errors; /* Batches that failed */
+} swap_stats;
+
+/*
+ * A backing store of the swap space.
+ * Pages are read and written through the batch operations of its vnode,
+ * with the position of each page being its local slot in the backend.
+ */
+typedef struct {
+    vnode *node; /* File or memory holding the pages */
+    seL4_Word tier; /* Group of backends of the same priority the backend is striped with */
+    seL4_Word stripe; /* Position of the backend in its tier */
+    swap_stats stats;
+} swap_backend;
+
+/*
+ * Create the configured backends, the NFS mount must be initialised.
+ * The backends start empty and grow in chunks as slots are allocated, up to their hard cap.
+ * @returns 0 on success, else 1
+ */
+int swap_init(void);
+
+/*
+ * Reserve a slot, from the highest priority backends with space
+ * @param[out] slot, the id of the reserved slot
+ * @returns 0 on success, else 1 if the swap space is full
+ */
+int swap_alloc(seL4_Word *slot);
+
+/*
+ * Reserve a run of contiguous slot ids, striped over the backends of one priority
+ * @param nslots, the length of the run
+ * @param[out] first, the id of the first slot of the run
+ * @returns 0 on success, else 1 if there is no run of that length
+ */
+int swap_alloc_run(seL4_Word nslots, seL4_Word *first);
+
+/*
+ * Release a slot back to its backend, trailing chunks left empty are truncated from the backends
+ * @param slot, the id of the slot
+ */
+void swap_free(seL4_Word slot);
+
+/*
+ * Hold a frame back for the map of the next chunk, without paging.
+ * The swap space grows from within a page out, where no frame can be paged out to make room.
+ * @returns 0 if a frame is held, else 1
+ */
+int swap_reserve(void);
+
+/*
+ * Read pages from the swap space, each backend involved keeps up to window reads in flight.
+ * The position of each io vector is the slot id times the page size.
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding reads of a backend
+ * @returns 0 on success, else 1
+ */
+int swap_read_batch(uiovec *iovs, size_t niovs, size_t window);
+
+/*
+ * Write pages to the swap space, each backend involved keeps up to window writes in flight.
+ * The position of each io vector is the slot id times the page size.
+ * @param iovs, the io vectors
+ * @param niovs, the number of io vectors
+ * @param window, the maximum number of outstanding writes of a backend
+ * @returns 0 on success, else 1
+ */
+int swap_write_batch(uiovec *iovs, size_t niovs, size_t window);
+
+/*
+ * Retrieve the statistics of a backend
+ * @param index, the index of the backend, in order of priority
+ * @param[out] stats, the statistics of the backend
+ * @returns 0 on success, else 1 if there is no such backend
+ */
+int swap_get_stats(seL4_Word index, swap_stats *stats);
+
+/*
+ * Retrieve the occupancy statistics of the slot maps, summed over every priority
+ * @param[out] stats, the statistics of the swap space
+ */
+void swap_get_map_stats(pagefile_map_stats *stats);
+
+#endif /* _SWAP_H_ */
@@ -6,8 +6,10 @@
 
 #include "vm.h"
 
+#include <autoconf.h>
 #include "frametable.h"
 #include "mapping.h"
+#include "share.h"
 #include <string.h>
 #include <utils/util.h>
 
@@ -36,6 +38,15 @@
 #define DIRECTORY_INDEX(x) ((x & DIRECTORY_MASK) >> DIRECTORY_OFFSET)
 #define TABLE_INDEX(x) ((x & TABLE_MASK) >> TABLE_OFFSET)
 
+/* Entries of a second level table, and the contiguous frames holding them, a block ut_alloc can serve */
+#define TABLE_ENTRIES BIT(TABLE_SIZE_BITS)
+#define TABLE_FRAMES 4
+compile_time_assert(table_fits_frames, TABLE_ENTRIES * sizeof(page_table_entry) <= TABLE_FRAMES * PAGE_SIZE_4K);
+
+/* Translation cache, direct mapped on the page number */
+#define TLB_INDEX(page_id) (((page_id) >> seL4_PageBits) & (VM_TLB_ENTRIES - 1))
+#define TLB_WRITABLE BIT(0)
+
 /* Fault handling */
 #define INSTRUCTION_FAULT 1
 #define DATA_FAULT 0
@@ -56,15 +67,30 @@
 #define PERMISSION_FAULT_SECTION 0b001101
 #define PERMISSION_FAULT_PAGE 0b001111
 
-/* Check if the evicted bit is set */
-#define IS_EVICTED(x) (x & EVICTED_BIT)
-
 /* Private functions */
 static seL4_Word get_fault_status(seL4_Word fault_cause);
 static int page_table_is_evicted(proc *curproc, seL4_Word page_id);
+static int page_table_is_resident(proc *curproc, seL4_Word page_id);
+static int page_table_is_zero(proc *curproc, seL4_Word page_id);
+static bool vm_is_anonymous(proc *curproc, seL4_Word vaddr);
 static int page_table_destroy(page_table_entry *table);
-static int page_destroy(seL4_CPtr page_cap);
+static int page_destroy(page_table_entry *entry);
+static void page_directory_tlb_invalidate(page_directory *dir, seL4_Word page_id, seL4_Word npages);
 static int vm_translate(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *sos_vaddr);
+static int vm_make_dirty(proc *curproc, seL4_Word page_id);
+static int vm_soft_fault(proc *curproc, seL4_Word page_id, seL4_Word access_type);
+static int vm_copy_on_write(proc *curproc, seL4_Word page_id);
+static page_table_entry *page_directory_second_level(page_directory *dir, seL4_Word page_id);
+static int page_share(proc *parent, proc *child, seL4_Word page_id, page_table_entry *entry);
+static int page_unshare(proc *curproc, seL4_Word page_id);
+static int page_map_shared(proc *sharer, seL4_Word page_id, seL4_Word frame_id, seL4_Word permissions);
+static int vm_share_prepare(proc *curproc, seL4_Word page_id);
+static int vm_share_join(proc *curproc, proc *member, seL4_Word page_id);
+static void vm_share_protect(seL4_Word page_id);
+#ifdef CONFIG_SOS_LARGE_PAGES
+static bool page_directory_range_unused(page_directory *dir, seL4_Word page_id, seL4_Word npages);
+static bool vm_can_promote(addrspace *as, region *reg, seL4_Word vaddr);
+#endif
 
 void 
 vm_fault(seL4_Word pid)
@@ -73,6 +99,7 @@ vm_fault(seL4_Word pid)
 
     proc *curproc = get_proc(pid);
     assert(curproc != NULL);
+    curproc->p_vmstats.faults++;
     
     /* Mark process as blocked */
     proc_mark(curproc, BLOCKED);
@@ -97,12 +124,47 @@ vm_fault(seL4_Word pid)
     );
 
     if (fault_status == PERMISSION_FAULT_PAGE) {
+        /* Writable pages with a clean copy in the pagefile are mapped read only until the first write */
+        if (access_type == ACCESS_WRITE && vm_make_dirty(curproc, PAGE_ALIGN_4K(fault_addr)) == 0)
+            goto thread_restart;
+
+        /* The first write to a page sharing the zero page gives it a frame of its own */
+        if (access_type == ACCESS_WRITE && page_table_is_zero(curproc, fault_addr)) {
+            if (vm_map_zero(curproc, PAGE_ALIGN_4K(fault_addr), ACCESS_WRITE) != 0) {
+                LOG_ERROR("Failed to copy the zero page");
+                goto fault_error;
+            }
+
+            goto thread_restart;
+        }
+
+        /* The first write to a page shared since a fork gives it a frame of its own */
+        if (access_type == ACCESS_WRITE && page_table_is_resident(curproc, fault_addr)) {
+            if (vm_copy_on_write(curproc, PAGE_ALIGN_4K(fault_addr)) != 0) {
+                LOG_ERROR("Failed to copy on write");
+                goto fault_error;
+            }
+
+            goto thread_restart;
+        }
+
         LOG_ERROR("Incorrect permissions");
         goto fault_error;
     }
 
+    /* A page evicted as all zeros is recreated without a read */
+    if (page_table_is_evicted(curproc, fault_addr) && page_table_is_zero(curproc, fault_addr)) {
+        if (vm_map_zero(curproc, PAGE_ALIGN_4K(fault_addr), access_type) != 0) {
+            LOG_ERROR("Failed to map the zero page");
+            goto fault_error;
+        }
+
+        goto thread_restart;
+    }
+
     /* If the page is marked as evicted, page it in */
     if (page_table_is_evicted(curproc, fault_addr)) {
+        curproc->p_vmstats.hard_faults++;
         if (page_in(curproc, fault_addr, access_type) != 0) {
             LOG_ERROR("Failed to page in");
             goto fault_error;
@@ -111,9 +173,36 @@ vm_fault(seL4_Word pid)
         goto thread_restart;
     }
 
+    /*
+     * A resident page was unmapped to track its references, map it back in.
+     * A page being written back to its file is unmapped until the write lands, and may be gone after it.
+     */
+    if (page_table_is_resident(curproc, fault_addr)) {
+        if (page_wait(curproc->pid, PAGE_ALIGN_4K(fault_addr)) != 0)
+            goto fault_error;
+
+        if (page_table_is_resident(curproc, fault_addr) &&
+            vm_soft_fault(curproc, PAGE_ALIGN_4K(fault_addr), access_type) != 0) {
+            LOG_ERROR("Failed to map the resident page");
+            goto fault_error;
+        }
+
+        goto thread_restart;
+    }
+
+    /* Untouched anonymous memory reads as zeros, it shares the zero page until its first write */
+    if (access_type == ACCESS_READ && fault_type == DATA_FAULT && vm_is_anonymous(curproc, fault_addr)) {
+        if (vm_map_zero(curproc, PAGE_ALIGN_4K(fault_addr), ACCESS_READ) != 0) {
+            LOG_ERROR("Failed to map the zero page");
+            goto fault_error;
+        }
+
+        goto thread_restart;
+    }
+
     /* Otherwise, try to create a new mapping for this address */
     seL4_Word kvaddr;
-    if (vm_map(curproc, PAGE_ALIGN_4K(fault_addr), access_type, &kvaddr) != 0) {
+    if (vm_map_new(curproc, PAGE_ALIGN_4K(fault_addr), access_type, &kvaddr) != 0) {
         LOG_ERROR("Failed to map in new page");
         goto fault_error;
     }
@@ -160,7 +249,7 @@ page_directory_create(void)
     }
 
     /* Allocate the frame for the page directory where 2nd level caps are stored */
-    if ((frame_id = frame_alloc(&directory_vaddr)) == -1) {
+    if ((frame_id = frame_alloc(&directory_vaddr, FRAME_ALLOC_ZERO)) == -1) {
         LOG_ERROR("Failed to allocate frame for directory");
         free(top_level);
         return NULL;
@@ -182,6 +271,9 @@ page_directory_create(void)
 
     top_level->directory = (seL4_Word *)directory_vaddr;
     top_level->kernel_page_table_caps = (seL4_CPtr *)kernel_cap_table_vaddr;
+    for (seL4_Word i = 0; i < VM_TLB_ENTRIES; i++)
+        top_level->tlb[i].page_id = VM_TLB_INVALID;
+    top_level->hand = 0;
 
     return top_level;
 }
@@ -240,13 +332,10 @@ page_directory_destroy(page_directory *dir)
 }
 
 int 
-page_directory_insert(page_directory *dir, seL4_Word page_id, seL4_CPtr cap, seL4_CPtr kernel_cap)
+page_directory_insert(page_directory *dir, seL4_Word page_id, seL4_CPtr cap, seL4_Word frame, seL4_CPtr kernel_cap)
 {
-    seL4_Word frame_id;
-
     assert(IS_ALIGNED_4K(page_id));
 
-    seL4_Word directory_index = DIRECTORY_INDEX(page_id);
     seL4_Word table_index = TABLE_INDEX(page_id);
 
     if (!dir || !(dir->directory)) {
@@ -254,31 +343,20 @@ page_directory_insert(page_directory *dir, seL4_Word page_id, seL4_CPtr cap, seL
         return 1;
     }
 
-    seL4_Word *directory = dir->directory;
-
-    /* Alloc the second level if it doesnt exist */
-    if (!directory[directory_index]) {
-        LOG_INFO("Creating second level page table at index %d", directory_index);
-        seL4_Word page_table_vaddr;
-        if ((frame_id = frame_alloc(&page_table_vaddr)) == -1) {
-            LOG_ERROR("Failed to allocate second level");
-            return 1;
-        }
-        /* Pin the frame */
-        assert(frame_table_set_chance(frame_id, PINNED) == 0);
-        directory[directory_index] = page_table_vaddr;
-    }
-
-    page_table_entry *second_level = (page_table_entry *)directory[directory_index];
+    page_table_entry *second_level = page_directory_second_level(dir, page_id);
+    if (!second_level)
+        return 1;
 
-    /* Must be less than, as we use the highest bit to represent evicted or not */
-    if (IS_EVICTED(cap)) {
-        LOG_ERROR("MSB is required to be 0");
+    /* Must be less than, as we use the highest bits to represent evicted or large */
+    if (IS_EVICTED(cap) || IS_LARGE(cap)) {
+        LOG_ERROR("Two MSBs are required to be 0");
         return 1;
     }
 
-    /* Store the cap in the pagetable */
+    /* Store the cap and frame in the pagetable */
     second_level[table_index].page = cap;
+    second_level[table_index].frame = frame;
+    page_directory_tlb_invalidate(dir, page_id, 1);
 
     /* Add the kernel cap to our bookkeeping table if one was given to us */
     if (kernel_cap) {
@@ -292,6 +370,30 @@ page_directory_insert(page_directory *dir, seL4_Word page_id, seL4_CPtr cap, seL
     return 0;
 }
 
+int
+page_directory_insert_large(page_directory *dir, seL4_Word page_id, seL4_CPtr cap, seL4_Word frame_id,
+                            seL4_CPtr kernel_cap)
+{
+    assert(IS_ALIGNED_LARGE(page_id));
+
+    /* Insert the first entry as usual, creating the second level and recording the kernel cap */
+    if (page_directory_insert(dir, page_id, cap, frame_id, kernel_cap) != 0) {
+        LOG_ERROR("Failed to insert the large page");
+        return 1;
+    }
+
+    /* A large page never crosses second levels, every entry it covers holds the same cap */
+    page_table_entry *second_level = (page_table_entry *)dir->directory[DIRECTORY_INDEX(page_id)];
+    seL4_Word table_index = TABLE_INDEX(page_id);
+    for (seL4_Word i = 0; i < FRAMES_PER_LARGE; i++) {
+        second_level[table_index + i].page = cap | LARGE_BIT;
+        second_level[table_index + i].frame = frame_id + i;
+    }
+
+    page_directory_tlb_invalidate(dir, page_id, FRAMES_PER_LARGE);
+    return 0;
+}
+
 int
 page_directory_lookup(page_directory *dir, seL4_Word page_id, seL4_CPtr *cap)
 {
@@ -321,6 +423,28 @@ page_directory_lookup(page_directory *dir, seL4_Word page_id, seL4_CPtr *cap)
     return 0;
 }
 
+int
+page_directory_lookup_frame(page_directory *dir, seL4_Word page_id, seL4_Word *frame)
+{
+    assert(IS_ALIGNED_4K(page_id));
+
+    if (!dir || !(dir->directory)) {
+        LOG_ERROR("Directory doesnt exist");
+        return 1;
+    }
+
+    page_table_entry *second_level = (page_table_entry *)dir->directory[DIRECTORY_INDEX(page_id)];
+    if (!second_level)
+        return 1;
+
+    page_table_entry *entry = &second_level[TABLE_INDEX(page_id)];
+    if (!entry->page || IS_EVICTED(entry->page))
+        return 1;
+
+    *frame = entry->frame;
+    return 0;
+}
+
 int
 page_directory_evict(page_directory *dir, seL4_Word page_id, seL4_Word free_id)
 {
@@ -348,6 +472,7 @@ page_directory_evict(page_directory *dir, seL4_Word page_id, seL4_Word free_id)
 
     seL4_CPtr cap = second_level[table_index].page;
     assert(!IS_EVICTED(cap));
+    assert(!IS_LARGE(cap));
 
     /* Must be less than, as we use the highest bit to represent evicted or not */
     if (IS_EVICTED(free_id)) {
@@ -357,6 +482,8 @@ page_directory_evict(page_directory *dir, seL4_Word page_id, seL4_Word free_id)
 
     second_level[table_index].page = free_id;
     second_level[table_index].page |= EVICTED_BIT; /* Mark as evicted */
+    second_level[table_index].frame = 0;
+    page_directory_tlb_invalidate(dir, page_id, 1);
 
     /* Unmap and delete the cap */
     seL4_ARM_Page_Unmap(cap);
@@ -365,20 +492,162 @@ page_directory_evict(page_directory *dir, seL4_Word page_id, seL4_Word free_id)
     return 0;
 }
 
+int
+page_directory_evict_large(page_directory *dir, seL4_Word page_id, seL4_Word *free_ids)
+{
+    assert(IS_ALIGNED_LARGE(page_id));
+
+    seL4_Word directory_index = DIRECTORY_INDEX(page_id);
+    seL4_Word table_index = TABLE_INDEX(page_id);
+
+    if (!dir || !(dir->directory)) {
+        LOG_ERROR("Directory doesnt exist");
+        return 1;
+    }
+
+    seL4_Word *directory = dir->directory;
+    page_table_entry *second_level = (page_table_entry *)directory[directory_index];
+    if (!second_level) {
+        LOG_ERROR("Second level doesnt exist");
+        return 1; 
+    }
+
+    seL4_CPtr cap = second_level[table_index].page;
+    if (!cap || IS_EVICTED(cap) || !IS_LARGE(cap)) {
+        LOG_ERROR("Large page doesnt exist");
+        return 1;
+    }
+
+    /* Must be less than, as we use the highest bit to represent evicted or not */
+    for (seL4_Word i = 0; i < FRAMES_PER_LARGE; i++) {
+        if (IS_EVICTED(free_ids[i])) {
+            LOG_ERROR("MSB is required to be 0");
+            return 1;
+        }
+    }
+
+    /* Each 4K page is paged back in on its own */
+    for (seL4_Word i = 0; i < FRAMES_PER_LARGE; i++) {
+        second_level[table_index + i].page = free_ids[i] | EVICTED_BIT;
+        second_level[table_index + i].frame = 0;
+    }
+    page_directory_tlb_invalidate(dir, page_id, FRAMES_PER_LARGE);
+
+    /* Unmap and delete the cap */
+    seL4_ARM_Page_Unmap(PTE_CAP(cap));
+    cspace_delete_cap(cur_cspace, PTE_CAP(cap));
+
+    return 0;
+}
+
+int
+page_directory_remove(page_directory *dir, seL4_Word page_id)
+{
+    assert(IS_ALIGNED_4K(page_id));
+
+    if (!dir || !(dir->directory)) {
+        LOG_ERROR("Directory doesnt exist");
+        return 1;
+    }
+
+    page_table_entry *second_level = (page_table_entry *)dir->directory[DIRECTORY_INDEX(page_id)];
+    if (!second_level) {
+        LOG_ERROR("Second level doesnt exist");
+        return 1;
+    }
+
+    seL4_CPtr cap = second_level[TABLE_INDEX(page_id)].page;
+    if (!cap || IS_EVICTED(cap)) {
+        LOG_ERROR("Page is not resident");
+        return 1;
+    }
+
+    /* A large page goes whole, from its first entry */
+    seL4_Word npages = 1;
+    if (IS_LARGE(cap)) {
+        page_id = LARGE_FRAME_ALIGN(page_id);
+        npages = FRAMES_PER_LARGE;
+    }
+
+    page_table_entry *entry = &second_level[TABLE_INDEX(page_id)];
+    for (seL4_Word i = 0; i < npages; i++) {
+        entry[i].page = 0;
+        entry[i].frame = 0;
+    }
+    page_directory_tlb_invalidate(dir, page_id, npages);
+
+    /* Unmap and delete the cap */
+    seL4_ARM_Page_Unmap(PTE_CAP(cap));
+    cspace_delete_cap(cur_cspace, PTE_CAP(cap));
+
+    return 0;
+}
+
+seL4_Word
+page_directory_next_victim(page_directory *dir)
+{
+    seL4_Word npages = BIT(DIRECTORY_SIZE_BITS + TABLE_SIZE_BITS);
+
+    /* The first revolution may only clear references, the second finds a victim among them */
+    for (seL4_Word i = 0; i < 2 * npages; i++) {
+        seL4_Word page = dir->hand;
+        dir->hand = (dir->hand + 1) % npages;
+
+        /* A missing second level is passed over whole */
+        page_table_entry *second_level = (page_table_entry *)dir->directory[page / TABLE_ENTRIES];
+        if (!second_level) {
+            i += TABLE_ENTRIES - (page % TABLE_ENTRIES) - 1;
+            dir->hand = ((page / TABLE_ENTRIES) + 1) * TABLE_ENTRIES % npages;
+            continue;
+        }
+
+        /* A large page is looked at once, from its first entry */
+        page_table_entry *entry = &second_level[page % TABLE_ENTRIES];
+        if (!entry->page || IS_EVICTED(entry->page) || (entry->frame & PTE_ZERO_PAGE) ||
+            (IS_LARGE(entry->page) && (page % FRAMES_PER_LARGE) != 0))
+            continue;
+
+        seL4_Word frame_id = frame_table_get_head(PTE_FRAME(entry->frame));
+        enum chance_type chance;
+        if (frame_table_get_sharers(frame_id) != 0 || frame_table_get_chance(frame_id, &chance) != 0 ||
+            chance == PINNED)
+            continue;
+
+        if (chance == SECOND_CHANCE)
+            return frame_id;
+
+        /* Unmapped, so its next use takes a soft fault that references it again */
+        assert(frame_table_set_chance(frame_id, SECOND_CHANCE) == 0);
+        seL4_ARM_Page_Unmap(PTE_CAP(entry->page));
+    }
+
+    return -1;
+}
+
 seL4_Word
 vaddr_to_sos_vaddr(proc *curproc, seL4_Word vaddr, seL4_Word access_type)
 {
-    seL4_Word offset = (vaddr & PAGE_MASK_4K);
     seL4_Word page_id = PAGE_ALIGN_4K(vaddr);
     seL4_Word sos_vaddr;
 
+    /* A cached translation needs no page table walk, region search or kernel call */
+    vm_tlb_entry *entry = &curproc->p_addrspace->directory->tlb[TLB_INDEX(page_id)];
+    if (entry->page_id == page_id && (access_type != ACCESS_WRITE || (entry->sos_vaddr & TLB_WRITABLE)))
+        return PAGE_ALIGN_4K(entry->sos_vaddr) + (vaddr & PAGE_MASK_4K);
+
+    /* A page shared with sos_share_vm is only writable once every other process sharing it has shared it writable */
+    if (access_type == ACCESS_WRITE && !share_can_write(page_id, curproc->pid)) {
+        LOG_INFO("Incorrect Permissions");
+        return (seL4_Word)NULL;
+    }
+
     /*
      * Attempt to translate vaddr to kvaddr
      * If it failed, try to map in the addr
      * Then the translation should succeed
      */
     if (vm_translate(curproc, vaddr, access_type, &sos_vaddr) != 0) {
-        if (vm_map(curproc, page_id, access_type, &sos_vaddr) != 0) {
+        if (vm_map_new(curproc, page_id, access_type, &sos_vaddr) != 0) {
             LOG_ERROR("Failed to map in file");
             return (seL4_Word)NULL;
         }
@@ -392,12 +661,22 @@ vaddr_to_sos_vaddr(proc *curproc, seL4_Word vaddr, seL4_Word access_type)
             LOG_INFO("Incorrect Permissions");
             return (seL4_Word)NULL;
         }
+
+        /* SOS is about to write through its own mapping, so any clean copy is now stale */
+        if (access_type == ACCESS_WRITE)
+            vm_make_dirty(curproc, page_id);
     }
 
-    /* Return the sos virtual address */
-    seL4_ARM_Page frame_cap = frame_table_get_capability(frame_table_sos_vaddr_to_index(sos_vaddr));
-    seL4_ARM_Page_GetAddress_t paddr_obj = seL4_ARM_Page_GetAddress(frame_cap);
-    return frame_table_paddr_to_sos_vaddr(paddr_obj.paddr + offset);
+    /*
+     * Cache the translation. After a write the page has no clean copy in the pagefile,
+     * so later writes through the entry leave nothing stale.
+     */
+    entry = &curproc->p_addrspace->directory->tlb[TLB_INDEX(page_id)];
+    entry->page_id = page_id;
+    entry->sos_vaddr = PAGE_ALIGN_4K(sos_vaddr) | ((access_type == ACCESS_WRITE) ? TLB_WRITABLE : 0);
+
+    /* Return the sos virtual address, translation includes the offset into the frame */
+    return sos_vaddr;
 }
 
 int
@@ -447,7 +726,7 @@ copy_out(proc *curproc, seL4_Word dst, char *src, seL4_Word nbytes)
 }
 
 int
-vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr)
+vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word flags, seL4_Word *kvaddr)
 {
     addrspace *as = curproc->p_addrspace;
 
@@ -467,7 +746,15 @@ vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr)
                 return 1;
             }
 
-            as->region_stack->start = PAGE_ALIGN_4K(vaddr);
+            seL4_Word stack_start = PAGE_ALIGN_4K(vaddr);
+#ifdef CONFIG_SOS_LARGE_PAGES
+            /* Extend the stack a whole large page at a time where it fits, so it can be promoted */
+            if (as_region_collision_check(as, as->region_stack, LARGE_FRAME_ALIGN(vaddr), as->region_stack->end) == 0 &&
+                (seL4_Word)(as->region_stack->end - LARGE_FRAME_ALIGN(vaddr)) <= RLIMIT_STACK_SZ)
+                stack_start = LARGE_FRAME_ALIGN(vaddr);
+#endif
+
+            as->region_stack->start = stack_start;
             LOG_INFO("Extended the stack to %p -> %p", (void *)as->region_stack->start, (void *)as->region_stack->end);
         } else {
             LOG_ERROR("Failed to extend the stack");
@@ -482,7 +769,21 @@ vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr)
             return 1;
         }
 
-        if (sos_map_page(curproc, PAGE_ALIGN_4K(vaddr), vaddr_region->permissions, kvaddr) != 0) {
+        /* A process at its hard limit replaces one of its own pages, rather than one of another process */
+        if (curproc->rss_hard != 0 && curproc->rss >= curproc->rss_hard && page_trim(curproc) != 0)
+            LOG_INFO("Process %d is at its hard limit with no page to replace", curproc->pid);
+
+#ifdef CONFIG_SOS_LARGE_PAGES
+        /* Try to map the whole large page around vaddr, falling back to a 4K page if there is no room */
+        if ((curproc->rss_hard == 0 || curproc->rss + FRAMES_PER_LARGE <= curproc->rss_hard) &&
+            vm_can_promote(as, vaddr_region, vaddr) &&
+            sos_map_large_page(curproc, LARGE_FRAME_ALIGN(vaddr), vaddr_region->permissions, kvaddr) == 0) {
+            *kvaddr += PAGE_ALIGN_4K(vaddr) - LARGE_FRAME_ALIGN(vaddr);
+            return 0;
+        }
+#endif
+
+        if (sos_map_page(curproc, PAGE_ALIGN_4K(vaddr), vaddr_region->permissions, flags, kvaddr) != 0) {
             LOG_ERROR("Failed to map page into sos");
             return 1;
         }
@@ -490,107 +791,476 @@ vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr)
         return 0;
 }
 
-/* The status of the fault is indicated by bits 12, 10 and 3:0 all strung together */
-static seL4_Word
-get_fault_status(seL4_Word fault_cause)
+int
+vm_map_new(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr)
 {
-    seL4_Word bit_12 = fault_cause & BIT(12);
-    seL4_Word bit_10 = fault_cause & BIT(10);
-    seL4_Word lower_bits = fault_cause & (BIT(3) | BIT(2) | BIT(1) | BIT(0));
-    return (bit_12 << 5) | (bit_10 << 4) | lower_bits;
-}
+    region *vaddr_region;
+    if (as_find_region(curproc->p_addrspace, vaddr, &vaddr_region) != 0 || vaddr_region->vn == NULL)
+        return vm_map(curproc, vaddr, access_type, FRAME_ALLOC_ZERO, kvaddr);
 
-static int
-page_table_is_evicted(proc *curproc, seL4_Word page_id)
-{
-    seL4_CPtr cap;
-    if (page_directory_lookup(curproc->p_addrspace->directory, PAGE_ALIGN_4K(page_id), &cap) != 0) {
-        LOG_INFO("Page entry doesnt exist, cannot be evicted");
-        return FALSE;
+    if (!as_region_permission_check(vaddr_region, access_type)) {
+        LOG_ERROR("Incorrect Permissions");
+        return 1;
     }
 
-    return IS_EVICTED(cap);
+    return page_in_file(curproc, vaddr_region, PAGE_ALIGN_4K(vaddr), access_type, kvaddr);
 }
 
-unsigned
-page_directory_count(proc *curproc)
+int
+vm_map_zero(proc *curproc, seL4_Word page_id, seL4_Word access_type)
 {
-    unsigned pages_count = 0;
-
-    /* If we are counting a zombie process */
-    if (!curproc->p_addrspace)
-        return pages_count;
+    addrspace *as = curproc->p_addrspace;
+    seL4_Word frame;
 
-    seL4_Word *top_pd = curproc->p_addrspace->directory->directory;
-    page_table_entry *sec_pd;
-    for (int i = 0; i < PAGE_SIZE_4K / sizeof(seL4_Word); i++) {
-        /* If second level, count all second level pages */
-        if (top_pd[i]) {
-            sec_pd = (page_table_entry *)top_pd[i];
-            for (int j = 0; j < PAGE_SIZE_4K / sizeof(seL4_Word); j++) {
-                if (sec_pd[j].page)
-                    pages_count++;
-            }
+    /* A write needs a frame of its own, any mapping of the zero page is dropped for it */
+    if (access_type == ACCESS_WRITE) {
+        if (page_directory_lookup_frame(as->directory, page_id, &frame) == 0 && (frame & PTE_ZERO_PAGE) &&
+            page_directory_evict(as->directory, page_id, ZERO_ID) != 0) {
+            LOG_ERROR("Failed to unmap the zero page");
+            return 1;
         }
+
+        seL4_Word kvaddr;
+        return vm_map(curproc, page_id, ACCESS_WRITE, FRAME_ALLOC_ZERO, &kvaddr);
     }
 
-    return pages_count;
+    region *vaddr_region;
+    if (as_find_region(as, page_id, &vaddr_region) != 0 ||
+        !as_region_permission_check(vaddr_region, ACCESS_READ)) {
+        LOG_ERROR("Incorrect Permissions");
+        return 1;
+    }
+
+    return sos_map_zero_page(curproc, page_id, vaddr_region->permissions & ~seL4_CanWrite);
 }
 
-/*
- * Destroy a page table
- * @returns 0 on success else 1
- */
-static int
-page_table_destroy(page_table_entry *table)
+int
+vm_unmap(proc *curproc, seL4_Word start, seL4_Word end)
 {
-    for (size_t i = 0; i < PAGE_SIZE_4K / sizeof(seL4_CPtr); ++i) {
-        if (table[i].page && (page_destroy(table[i].page) != 0)) {
+    addrspace *as = curproc->p_addrspace;
+    page_directory *dir = as->directory;
+
+    for (seL4_Word page_id = start; page_id < end; page_id += PAGE_SIZE_4K) {
+        region *page_region;
+        if (as_find_region(as, page_id, &page_region) != 0)
+            continue;
+
+        /* A large page is released whole, through its first entry, and kept if the range only covers part of it */
+        page_table_entry *second_level = (page_table_entry *)dir->directory[DIRECTORY_INDEX(page_id)];
+        if (second_level && !IS_EVICTED(second_level[TABLE_INDEX(page_id)].page) &&
+            IS_LARGE(second_level[TABLE_INDEX(page_id)].page) &&
+            (!IS_ALIGNED_LARGE(page_id) || page_id + LARGE_FRAME_SIZE > end))
+            continue;
+
+        /* The file keeps the changes to a shared mapping, a page that failed to write back stays mapped */
+        if (page_region->vn != NULL && (page_region->flags & REGION_SHARED) &&
+            page_out_file(curproc, page_region, page_id) != 0) {
+            LOG_ERROR("Failed to write back %p", (void *)page_id);
+            return 1;
+        }
+
+        /* The other processes sharing the frame keep it */
+        if (page_unshare(curproc, page_id) != 0) {
+            LOG_ERROR("Failed to unshare page");
+            return 1;
+        }
+        share_remove(page_id, curproc->pid);
+
+        if (!second_level || !second_level[TABLE_INDEX(page_id)].page)
+            continue;
+
+        page_table_entry *entry = &second_level[TABLE_INDEX(page_id)];
+        seL4_Word npages = (!IS_EVICTED(entry->page) && IS_LARGE(entry->page)) ? FRAMES_PER_LARGE : 1;
+        if (page_destroy(entry) != 0) {
             LOG_ERROR("Failed to destroy page");
             return 1;
         }
+
+        for (seL4_Word i = 0; i < npages; i++) {
+            entry[i].page = 0;
+            entry[i].frame = 0;
+        }
+        page_directory_tlb_invalidate(dir, page_id, npages);
+        page_id += (npages - 1) * PAGE_SIZE_4K;
     }
 
-    /* Free the frame backing the page table */
-    frame_free(frame_table_sos_vaddr_to_index((seL4_Word)table));
     return 0;
 }
 
-/*
- * Destroy a page
- * @returns 0 on success else 1
- */
-static int
-page_destroy(seL4_CPtr page_cap)
+int
+vm_protect(proc *curproc, seL4_Word start, seL4_Word end)
 {
-    seL4_CPtr pagefile_id = page_cap;
-    if (IS_EVICTED(page_cap)) {
-        pagefile_id &= (~EVICTED_BIT);
-        pagefile_free_add(pagefile_id);
-        return 0;
-    }
+    page_directory *dir = curproc->p_addrspace->directory;
 
-    if (seL4_ARM_Page_Unmap(page_cap) != 0) {
-        LOG_ERROR("Failed to unmap page");
-        return 1;
-    }
+    for (seL4_Word page_id = start; page_id < end; page_id += PAGE_SIZE_4K) {
+        seL4_Word frame;
+        if (page_directory_lookup_frame(dir, page_id, &frame) != 0)
+            continue;
 
-    seL4_ARM_Page_GetAddress_t paddr_obj = seL4_ARM_Page_GetAddress(page_cap);
-    seL4_Word paddr = paddr_obj.paddr;
+        /* A soft fault would map the zero page with the permissions of the region, so it is dropped instead */
+        if (frame & PTE_ZERO_PAGE) {
+            if (page_directory_evict(dir, page_id, ZERO_ID) != 0) {
+                LOG_ERROR("Failed to unmap the zero page");
+                return 1;
+            }
+            continue;
+        }
 
-    if (cspace_delete_cap(cur_cspace, page_cap) != CSPACE_NOERROR) {
-        LOG_ERROR("Failed to delete cap for frame");
-        return 1;
+        /* The next access soft faults, mapping the page back with the permissions of its region */
+        seL4_CPtr cap;
+        assert(page_directory_lookup(dir, page_id, &cap) == 0);
+        seL4_ARM_Page_Unmap(PTE_CAP(cap));
     }
 
-    /* Free the frame */
-    seL4_Word frame_id = frame_table_sos_vaddr_to_index(frame_table_paddr_to_sos_vaddr(paddr));
-    frame_free(frame_id);
-
+    /* SOS checks permissions again on its next translation */
+    page_directory_tlb_invalidate(dir, start, (end - start) / PAGE_SIZE_4K);
     return 0;
 }
 
-/*
+int
+vm_prefault(proc *curproc, seL4_Word start, seL4_Word end)
+{
+    addrspace *as = curproc->p_addrspace;
+
+    for (seL4_Word page_id = start; page_id < end; page_id += PAGE_SIZE_4K) {
+        region *page_region;
+        if (as_find_region(as, page_id, &page_region) != 0 || !as_region_permission_check(page_region, ACCESS_READ))
+            continue;
+
+        page_table_entry *second_level = (page_table_entry *)as->directory->directory[DIRECTORY_INDEX(page_id)];
+        page_table_entry *entry = second_level ? &second_level[TABLE_INDEX(page_id)] : NULL;
+
+        /* Evicted pages are read back in batches, the pages read ahead are resident on the next pass */
+        if (entry && IS_EVICTED(entry->page) && !IS_ZERO(entry->page)) {
+            if (page_in_ahead(curproc, page_id, (end - page_id) / PAGE_SIZE_4K) != 0) {
+                LOG_ERROR("Failed to page in %p", (void *)page_id);
+                return 1;
+            }
+            continue;
+        }
+
+        /* Anonymous pages never touched are left to read as zeros, a file mapping is read from its file */
+        seL4_Word kvaddr;
+        if ((!entry || !entry->page) && page_region->vn != NULL &&
+            page_in_file(curproc, page_region, page_id, ACCESS_READ, &kvaddr) != 0) {
+            LOG_ERROR("Failed to read in %p", (void *)page_id);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+vm_fork(proc *parent, proc *child)
+{
+    page_directory *dir = parent->p_addrspace->directory;
+
+    /* SOS checks the shared frames again on its next translation, rather than writing through to them */
+    for (seL4_Word i = 0; i < VM_TLB_ENTRIES; i++)
+        dir->tlb[i].page_id = VM_TLB_INVALID;
+
+    for (seL4_Word directory_index = 0; directory_index < PAGE_SIZE_4K / sizeof(seL4_Word); directory_index++) {
+        page_table_entry *second_level = (page_table_entry *)dir->directory[directory_index];
+        if (!second_level)
+            continue;
+
+        for (seL4_Word table_index = 0; table_index < TABLE_ENTRIES; table_index++) {
+            page_table_entry *entry = &second_level[table_index];
+            if (!entry->page)
+                continue;
+
+            /* A large page is shared once, through its first entry */
+            if (!IS_EVICTED(entry->page) && IS_LARGE(entry->page) && (table_index % FRAMES_PER_LARGE) != 0)
+                continue;
+
+            seL4_Word page_id = (directory_index << DIRECTORY_OFFSET) | (table_index << TABLE_OFFSET);
+            if (page_share(parent, child, page_id, entry) != 0) {
+                LOG_ERROR("Failed to share %p", (void *)page_id);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int
+vm_unshare(proc *curproc)
+{
+    page_directory *dir = curproc->p_addrspace->directory;
+
+    for (seL4_Word directory_index = 0; directory_index < PAGE_SIZE_4K / sizeof(seL4_Word); directory_index++) {
+        page_table_entry *second_level = (page_table_entry *)dir->directory[directory_index];
+        if (!second_level)
+            continue;
+
+        for (seL4_Word table_index = 0; table_index < TABLE_ENTRIES; table_index++) {
+            if (!second_level[table_index].page || IS_EVICTED(second_level[table_index].page))
+                continue;
+
+            seL4_Word page_id = (directory_index << DIRECTORY_OFFSET) | (table_index << TABLE_OFFSET);
+            if (page_unshare(curproc, page_id) != 0) {
+                LOG_ERROR("Failed to unshare %p", (void *)page_id);
+                return 1;
+            }
+        }
+    }
+
+    share_remove_all(curproc->pid);
+    return 0;
+}
+
+int
+vm_share(proc *curproc, seL4_Word page_id, bool writable)
+{
+    for (;;) {
+        /* Sharing the page again only changes whether the others may write to it */
+        if (share_is_member(page_id, curproc->pid)) {
+            if (share_add(page_id, curproc->pid, writable) != 0)
+                return 1;
+            break;
+        }
+
+        /* A page already shared is taken from a process sharing it, once any paging of it has completed */
+        seL4_Word members = share_get_members(page_id);
+        if (members) {
+            seL4_Word pid = CTZ(members);
+            if (page_wait(pid, page_id) != 0)
+                return 1;
+
+            if (!share_is_member(page_id, pid))
+                continue;
+
+            if (vm_share_join(curproc, get_proc(pid), page_id) != 0 ||
+                share_add(page_id, curproc->pid, writable) != 0) {
+                LOG_ERROR("Failed to join the shared page");
+                return 1;
+            }
+            break;
+        }
+
+        /* The first process to share the page shares its own page, once it is resident with a frame of its own */
+        seL4_Word frame;
+        if (page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) == 0 &&
+            !(frame & PTE_ZERO_PAGE) && frame_table_get_sharers(PTE_FRAME(frame)) == 0) {
+            if (share_add(page_id, curproc->pid, writable) != 0)
+                return 1;
+            break;
+        }
+
+        if (vm_share_prepare(curproc, page_id) != 0)
+            return 1;
+    }
+
+    vm_share_protect(page_id);
+    return 0;
+}
+
+void
+vm_share_propagate(proc *curproc, seL4_Word page_id)
+{
+    seL4_Word members = share_get_members(page_id) & ~BIT(curproc->pid);
+    if (!members)
+        return;
+
+    seL4_Word frame;
+    if (page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) != 0 || (frame & PTE_ZERO_PAGE))
+        return;
+
+    while (members) {
+        seL4_Word pid = CTZ(members);
+        members &= ~BIT(pid);
+
+        /* Every process sharing the page references the slot the frame was read from */
+        proc *member = get_proc(pid);
+        seL4_CPtr pagefile_id;
+        region *page_region;
+        if (member == NULL || member->p_addrspace == NULL ||
+            page_directory_lookup(member->p_addrspace->directory, page_id, &pagefile_id) != 0 ||
+            !IS_EVICTED(pagefile_id) || as_find_region(member->p_addrspace, page_id, &page_region) != 0)
+            continue;
+
+        /* Mapped read only, the next write soft faults to check the process may write */
+        if (page_map_shared(member, page_id, PTE_FRAME(frame), page_region->permissions & ~seL4_CanWrite) != 0) {
+            LOG_ERROR("Failed to map the shared page into %d", pid);
+            continue;
+        }
+
+        pagefile_free_add(pagefile_id & ~EVICTED_BIT);
+    }
+}
+
+/* The status of the fault is indicated by bits 12, 10 and 3:0 all strung together */
+static seL4_Word
+get_fault_status(seL4_Word fault_cause)
+{
+    seL4_Word bit_12 = fault_cause & BIT(12);
+    seL4_Word bit_10 = fault_cause & BIT(10);
+    seL4_Word lower_bits = fault_cause & (BIT(3) | BIT(2) | BIT(1) | BIT(0));
+    return (bit_12 << 5) | (bit_10 << 4) | lower_bits;
+}
+
+static int
+page_table_is_evicted(proc *curproc, seL4_Word page_id)
+{
+    seL4_CPtr cap;
+    if (page_directory_lookup(curproc->p_addrspace->directory, PAGE_ALIGN_4K(page_id), &cap) != 0) {
+        LOG_INFO("Page entry doesnt exist, cannot be evicted");
+        return FALSE;
+    }
+
+    return IS_EVICTED(cap);
+}
+
+static int
+page_table_is_resident(proc *curproc, seL4_Word page_id)
+{
+    seL4_CPtr cap;
+    if (page_directory_lookup(curproc->p_addrspace->directory, PAGE_ALIGN_4K(page_id), &cap) != 0)
+        return FALSE;
+
+    return !IS_EVICTED(cap);
+}
+
+/* Either evicted as all zeros, or mapped to the shared zero page */
+static int
+page_table_is_zero(proc *curproc, seL4_Word page_id)
+{
+    seL4_CPtr cap;
+    if (page_directory_lookup(curproc->p_addrspace->directory, PAGE_ALIGN_4K(page_id), &cap) != 0)
+        return FALSE;
+
+    if (IS_EVICTED(cap))
+        return IS_ZERO(cap) != 0;
+
+    seL4_Word frame;
+    return page_directory_lookup_frame(curproc->p_addrspace->directory, PAGE_ALIGN_4K(page_id), &frame) == 0 &&
+           (frame & PTE_ZERO_PAGE);
+}
+
+/* Heap, stack and anonymous mapping pages have no contents until they are written */
+static bool
+vm_is_anonymous(proc *curproc, seL4_Word vaddr)
+{
+    addrspace *as = curproc->p_addrspace;
+    region *vaddr_region;
+    if (as_find_region(as, vaddr, &vaddr_region) != 0)
+        return FALSE;
+
+    return vaddr_region == as->region_heap || vaddr_region == as->region_stack ||
+           ((vaddr_region->flags & REGION_MMAP) && vaddr_region->vn == NULL);
+}
+
+unsigned
+page_directory_count(proc *curproc)
+{
+    unsigned pages_count = 0;
+
+    /* If we are counting a zombie process */
+    if (!curproc->p_addrspace)
+        return pages_count;
+
+    seL4_Word *top_pd = curproc->p_addrspace->directory->directory;
+    page_table_entry *sec_pd;
+    for (int i = 0; i < PAGE_SIZE_4K / sizeof(seL4_Word); i++) {
+        /* If second level, count all second level pages */
+        if (top_pd[i]) {
+            sec_pd = (page_table_entry *)top_pd[i];
+            for (int j = 0; j < TABLE_ENTRIES; j++) {
+                if (sec_pd[j].page)
+                    pages_count++;
+            }
+        }
+    }
+
+    return pages_count;
+}
+
+/*
+ * Destroy a page table
+ * @returns 0 on success else 1
+ */
+static int
+page_table_destroy(page_table_entry *table)
+{
+    for (size_t i = 0; i < TABLE_ENTRIES; ++i) {
+        /* A large page is destroyed once, through its first entry */
+        if (!IS_EVICTED(table[i].page) && IS_LARGE(table[i].page) && (i % FRAMES_PER_LARGE) != 0)
+            continue;
+
+        if (table[i].page && (page_destroy(&table[i]) != 0)) {
+            LOG_ERROR("Failed to destroy page");
+            return 1;
+        }
+    }
+
+    /* Free the frames backing the page table */
+    seL4_Word frame_id = frame_table_sos_vaddr_to_index((seL4_Word)table);
+    for (seL4_Word i = 0; i < TABLE_FRAMES; i++)
+        frame_free(frame_id + i);
+    return 0;
+}
+
+/*
+ * Destroy a page
+ * @returns 0 on success else 1
+ */
+static int
+page_destroy(page_table_entry *entry)
+{
+    if (IS_EVICTED(entry->page)) {
+        pagefile_free_add(entry->page & (~EVICTED_BIT));
+        return 0;
+    }
+
+    seL4_CPtr page_cap = PTE_CAP(entry->page);
+    if (seL4_ARM_Page_Unmap(page_cap) != 0) {
+        LOG_ERROR("Failed to unmap page");
+        return 1;
+    }
+
+    if (cspace_delete_cap(cur_cspace, page_cap) != CSPACE_NOERROR) {
+        LOG_ERROR("Failed to delete cap for frame");
+        return 1;
+    }
+
+    /* The zero page is shared, only this mapping of it goes */
+    if (entry->frame & PTE_ZERO_PAGE)
+        return 0;
+
+    /* Frames shared since a fork are left to the other processes by vm_unshare */
+    assert(frame_table_get_sharers(PTE_FRAME(entry->frame)) == 0);
+
+    /* Free the frame, it no longer counts towards the resident set of its process */
+    seL4_Word frame_id = PTE_FRAME(entry->frame);
+    seL4_Word pid;
+    seL4_Word page_id;
+    proc *owner;
+    if (frame_table_get_page_id(frame_id, &pid, &page_id) == 0 && (owner = get_proc(pid)) != NULL)
+        owner->rss -= frame_table_is_large(frame_id) ? FRAMES_PER_LARGE : 1;
+
+    frame_free(frame_id);
+    return 0;
+}
+
+/*
+ * Drop the cached translations of a range of pages
+ * @param dir, the page directory
+ * @param page_id, the first page of the range
+ * @param npages, the number of pages in the range
+ */
+static void
+page_directory_tlb_invalidate(page_directory *dir, seL4_Word page_id, seL4_Word npages)
+{
+    for (seL4_Word i = 0; i < npages; i++, page_id += PAGE_SIZE_4K) {
+        vm_tlb_entry *entry = &dir->tlb[TLB_INDEX(page_id)];
+        if (entry->page_id == page_id)
+            entry->page_id = VM_TLB_INVALID;
+    }
+}
+
+/*
  * Given a vaddr, translate it to the sos vaddr of the frame 
  * @param vaddr, the process virtual address
  * @param access_type, the type of access to this address (for page in)
@@ -600,9 +1270,8 @@ page_destroy(seL4_CPtr page_cap)
 static int
 vm_translate(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *sos_vaddr)
 {
-    seL4_Word offset = (vaddr & PAGE_MASK_4K);
     seL4_Word page_id = PAGE_ALIGN_4K(vaddr);
-    seL4_ARM_Page page_cap;
+    seL4_Word frame;
 
     if (page_table_is_evicted(curproc, page_id)) {
         LOG_INFO("Page is evicted, trying to page in");
@@ -612,14 +1281,551 @@ vm_translate(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *s
         }
     }
 
-    if (page_directory_lookup(curproc->p_addrspace->directory, page_id, &page_cap) != 0) {
+    if (page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) != 0) {
         LOG_ERROR("Failed to find mapping");
         return 1;
     }
 
-    /* Return the sos vaddr of this frame */
-    seL4_ARM_Page_GetAddress_t paddr_obj = seL4_ARM_Page_GetAddress(page_cap);
-    *sos_vaddr = frame_table_paddr_to_sos_vaddr(paddr_obj.paddr + offset);
+    /* SOS must never write through to the shared zero page */
+    if (access_type == ACCESS_WRITE && (frame & PTE_ZERO_PAGE)) {
+        if (vm_map_zero(curproc, page_id, ACCESS_WRITE) != 0 ||
+            page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) != 0) {
+            LOG_ERROR("Failed to copy the zero page");
+            return 1;
+        }
+    }
+
+    /* Nor through to a frame shared since a fork */
+    if (access_type == ACCESS_WRITE && frame_table_get_sharers(PTE_FRAME(frame)) != 0) {
+        if (vm_copy_on_write(curproc, page_id) != 0 ||
+            page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) != 0) {
+            LOG_ERROR("Failed to copy on write");
+            return 1;
+        }
+    }
+
+    /* Return the sos vaddr of this frame, each entry of a large page holds its own 4K of the frame */
+    *sos_vaddr = frame_table_index_to_sos_vaddr(PTE_FRAME(frame)) + (vaddr & PAGE_MASK_4K);
+    return 0;
+}
+
+/*
+ * Give a process write access to a resident page that has a clean copy in the pagefile.
+ * The copy is released, as the page will no longer match it.
+ * @param curproc, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @returns 0 if the page was clean and is now writable, else 1
+ */
+static int
+vm_make_dirty(proc *curproc, seL4_Word page_id)
+{
+    seL4_Word frame;
+    if (page_directory_lookup_frame(curproc->p_addrspace->directory, page_id, &frame) != 0)
+        return 1;
+
+    /* Large pages are never clean */
+    seL4_Word frame_id = PTE_FRAME(frame);
+    if (frame_table_is_large(frame_id))
+        return 1;
+
+    /* A shared frame is copied rather than written, see vm_copy_on_write */
+    if (frame_table_get_sharers(frame_id) != 0)
+        return 1;
+
+    seL4_Word pagefile_id;
+    if (frame_table_get_swap(frame_id, &pagefile_id) != 0)
+        return 1;
+
+    region *vaddr_region;
+    if (as_find_region(curproc->p_addrspace, page_id, &vaddr_region) != 0 ||
+        !as_region_permission_check(vaddr_region, ACCESS_WRITE))
+        return 1;
+
+    if (sos_remap_page(curproc, page_id, vaddr_region->permissions) != 0) {
+        LOG_ERROR("Failed to make the page writable");
+        return 1;
+    }
+
+    frame_table_clear_swap(frame_id);
+    pagefile_free_add(pagefile_id);
+    frame_table_reference(frame_id);
+    return 0;
+}
+
+/*
+ * Map a resident page back into a process, after the replacement policy unmapped it to track its references.
+ * The frame is marked referenced. A clean page is mapped read only, unless this access is the write that dirties it.
+ * A page shared since a fork is always mapped read only, its first write copies it.
+ * A page shared with sos_share_vm is mapped writable only if the process may write to it.
+ * @param curproc, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @param access_type, the type of access that faulted
+ * @returns 0 on success, else 1
+ */
+static int
+vm_soft_fault(proc *curproc, seL4_Word page_id, seL4_Word access_type)
+{
+    addrspace *as = curproc->p_addrspace;
+
+    bool writable = share_can_write(page_id, curproc->pid);
+
+    region *vaddr_region;
+    if (as_find_region(as, page_id, &vaddr_region) != 0 ||
+        !as_region_permission_check(vaddr_region, access_type) || (access_type == ACCESS_WRITE && !writable)) {
+        LOG_ERROR("Incorrect Permissions");
+        return 1;
+    }
+
+    seL4_CPtr page_cap;
+    seL4_Word frame;
+    if (page_directory_lookup(as->directory, page_id, &page_cap) != 0 ||
+        page_directory_lookup_frame(as->directory, page_id, &frame) != 0)
+        return 1;
 
+    /* A large page is mapped whole, from its 64K aligned address, and its state is kept by the first frame */
+    seL4_Word vaddr = IS_LARGE(page_cap) ? LARGE_FRAME_ALIGN(page_id) : page_id;
+    seL4_Word frame_id = frame_table_get_head(PTE_FRAME(frame));
+    page_cap = PTE_CAP(page_cap);
+
+    seL4_Word permissions = vaddr_region->permissions;
+    seL4_Word pagefile_id;
+    bool clean = (frame_table_get_swap(frame_id, &pagefile_id) == 0);
+    bool copy_on_write = (frame_table_get_sharers(frame_id) != 0 && !share_is_member(page_id, curproc->pid));
+    if (copy_on_write || !writable || (clean && access_type != ACCESS_WRITE))
+        permissions &= ~seL4_CanWrite;
+
+    if (seL4_ARM_Page_Map(page_cap, as->vspace, vaddr, permissions, seL4_ARM_Default_VMAttributes) != 0) {
+        LOG_ERROR("Failed to map the page");
+        return 1;
+    }
+
+    /* Writing to a clean page makes its copy in the pagefile stale */
+    if (clean && !copy_on_write && access_type == ACCESS_WRITE) {
+        frame_table_clear_swap(frame_id);
+        pagefile_free_add(pagefile_id);
+    }
+
+    frame_table_reference(frame_id);
+    curproc->p_vmstats.soft_faults++;
     return 0;
 }
+
+/*
+ * Give a process a private copy of a page it has shared with other processes since a fork.
+ * The frames for the copy are allocated first, as allocating may page out the shared frame.
+ * If the other processes dropped the frame meanwhile, the frame is mapped writable instead.
+ * A large page is copied as 4K pages, which unlike large frames can be paged out to make room.
+ * @param curproc, the process writing to the page
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, else 1
+ */
+static int
+vm_copy_on_write(proc *curproc, seL4_Word page_id)
+{
+    addrspace *as = curproc->p_addrspace;
+    seL4_Word frame_ids[FRAMES_PER_LARGE];
+    seL4_Word nframes = 0;
+    seL4_Word mapped = 0;
+    seL4_Word frame_vaddr;
+    int err = 1;
+
+    region *vaddr_region;
+    if (as_find_region(as, page_id, &vaddr_region) != 0 ||
+        !as_region_permission_check(vaddr_region, ACCESS_WRITE)) {
+        LOG_ERROR("Incorrect Permissions");
+        return 1;
+    }
+
+    seL4_CPtr page_cap;
+    if (page_directory_lookup(as->directory, page_id, &page_cap) != 0)
+        return 1;
+
+    /* A page shared with sos_share_vm is written in place, by the processes allowed to */
+    if (share_is_member(page_id, curproc->pid)) {
+        if (!share_can_write(page_id, curproc->pid)) {
+            LOG_ERROR("Incorrect Permissions");
+            return 1;
+        }
+
+        seL4_ARM_Page_Unmap(PTE_CAP(page_cap));
+        return vm_soft_fault(curproc, page_id, ACCESS_WRITE);
+    }
+
+    seL4_Word vaddr = IS_LARGE(page_cap) ? LARGE_FRAME_ALIGN(page_id) : page_id;
+    seL4_Word ncopies = IS_LARGE(page_cap) ? FRAMES_PER_LARGE : 1;
+    for (nframes = 0; nframes < ncopies; nframes++) {
+        if ((frame_ids[nframes] = frame_alloc(&frame_vaddr, FRAME_ALLOC_NOZERO)) == -1) {
+            LOG_ERROR("Failed to allocate frame");
+            goto copy_on_write_epilogue;
+        }
+        /* Prevent the frame from being paged before it is mapped */
+        assert(frame_table_set_chance(frame_ids[nframes], PINNED) == 0);
+    }
+
+    /* The page was paged out while allocating, it is paged back in as a page of its own */
+    if (page_directory_lookup(as->directory, page_id, &page_cap) != 0)
+        goto copy_on_write_epilogue;
+
+    if (IS_EVICTED(page_cap)) {
+        for (; mapped < nframes; mapped++)
+            frame_free(frame_ids[mapped]);
+
+        if (IS_ZERO(page_cap))
+            return vm_map_zero(curproc, page_id, ACCESS_WRITE);
+
+        return page_in(curproc, page_id, ACCESS_WRITE);
+    }
+
+    seL4_Word frame;
+    assert(page_directory_lookup_frame(as->directory, page_id, &frame) == 0);
+    seL4_Word frame_id = frame_table_get_head(PTE_FRAME(frame));
+
+    /* The other processes have dropped the frame, it is written in place */
+    if (frame_table_get_sharers(frame_id) == 0) {
+        for (; mapped < nframes; mapped++)
+            frame_free(frame_ids[mapped]);
+
+        seL4_ARM_Page_Unmap(PTE_CAP(page_cap));
+        return vm_soft_fault(curproc, page_id, ACCESS_WRITE);
+    }
+
+    for (seL4_Word i = 0; i < nframes; i++)
+        memcpy((void *)frame_table_index_to_sos_vaddr(frame_ids[i]),
+               (void *)frame_table_index_to_sos_vaddr(frame_id + i), PAGE_SIZE_4K);
+
+    /* The other processes keep the shared frame */
+    if (page_directory_remove(as->directory, vaddr) != 0) {
+        LOG_ERROR("Failed to remove the shared page");
+        goto copy_on_write_epilogue;
+    }
+    frame_table_unshare(frame_id, curproc->pid);
+    curproc->rss -= nframes;
+
+    for (; mapped < nframes; mapped++) {
+        if (sos_map_frame(curproc, vaddr + (mapped * PAGE_SIZE_4K), frame_ids[mapped],
+                          vaddr_region->permissions) != 0) {
+            LOG_ERROR("Failed to map the copy");
+            goto copy_on_write_epilogue;
+        }
+    }
+
+    err = 0;
+
+    copy_on_write_epilogue:
+        for (; mapped < nframes; mapped++)
+            frame_free(frame_ids[mapped]);
+
+        return err;
+}
+
+/*
+ * Find the second level table holding the entry for a page, creating it if it doesnt exist
+ * @param dir, the page directory
+ * @param page_id, the virtual address of the page
+ * @returns the second level table on success, else NULL
+ */
+static page_table_entry *
+page_directory_second_level(page_directory *dir, seL4_Word page_id)
+{
+    seL4_Word directory_index = DIRECTORY_INDEX(page_id);
+    seL4_Word *directory = dir->directory;
+
+    /* Alloc the second level if it doesnt exist */
+    if (!directory[directory_index]) {
+        LOG_INFO("Creating second level page table at index %d", directory_index);
+        seL4_Word page_table_vaddr;
+        seL4_Word frame_id;
+        if ((frame_id = multi_frame_alloc(&page_table_vaddr, TABLE_FRAMES)) == -1) {
+            LOG_ERROR("Failed to allocate second level");
+            return NULL;
+        }
+        /* Pin the frames */
+        for (seL4_Word i = 0; i < TABLE_FRAMES; i++)
+            assert(frame_table_set_chance(frame_id + i, PINNED) == 0);
+        directory[directory_index] = page_table_vaddr;
+    }
+
+    return (page_table_entry *)directory[directory_index];
+}
+
+/*
+ * Share a page of a process with its forked child.
+ * An evicted page shares its slot in the pagefile, a resident page shares its frame,
+ * mapped read only in both processes until one of them writes to it.
+ * Pages of shared file mappings are left out, the child reads them from the file.
+ * The child joins the pages its parent shared with sos_share_vm, which are written in place rather than copied.
+ * @param parent, the process forking
+ * @param child, the forked process
+ * @param page_id, the virtual address of the page
+ * @param entry, the page table entry of the page in the parent
+ * @returns 0 on success, else 1
+ */
+static int
+page_share(proc *parent, proc *child, seL4_Word page_id, page_table_entry *entry)
+{
+    region *page_region;
+    if (as_find_region(parent->p_addrspace, page_id, &page_region) != 0 ||
+        (page_region->vn != NULL && (page_region->flags & REGION_SHARED)))
+        return 0;
+
+    page_directory *child_dir = child->p_addrspace->directory;
+
+    /* The child shares the pages its parent shared with sos_share_vm, as the parent did */
+    if (share_is_member(page_id, parent->pid) &&
+        share_add(page_id, child->pid, (share_get_writers(page_id) & BIT(parent->pid)) != 0) != 0)
+        return 1;
+
+    /* Both processes page in from the same slot, a page of zeros shares no slot at all */
+    if (IS_EVICTED(entry->page) || (entry->frame & PTE_ZERO_PAGE)) {
+        seL4_Word pagefile_id = IS_EVICTED(entry->page) ? (entry->page & ~EVICTED_BIT) : ZERO_ID;
+        page_table_entry *second_level = page_directory_second_level(child_dir, page_id);
+        if (!second_level || pagefile_share(pagefile_id) != 0)
+            return 1;
+
+        second_level[TABLE_INDEX(page_id)].page = pagefile_id | EVICTED_BIT;
+        second_level[TABLE_INDEX(page_id)].frame = 0;
+        return 0;
+    }
+
+    if (page_map_shared(child, page_id, PTE_FRAME(entry->frame), page_region->permissions & ~seL4_CanWrite) != 0)
+        return 1;
+
+    /* The next access of the parent soft faults, mapping the frame back read only */
+    if (page_region->permissions & seL4_CanWrite)
+        seL4_ARM_Page_Unmap(PTE_CAP(entry->page));
+
+    return 0;
+}
+
+/*
+ * Map a resident frame into another process sharing it, at the same address
+ * @param sharer, the process to map into
+ * @param page_id, the virtual address of the page, the first of a large page
+ * @param frame_id, the id of the frame
+ * @param permissions, the permissions of the mapping
+ * @returns 0 on success, else 1
+ */
+static int
+page_map_shared(proc *sharer, seL4_Word page_id, seL4_Word frame_id, seL4_Word permissions)
+{
+    page_directory *dir = sharer->p_addrspace->directory;
+    bool large = frame_table_is_large(frame_id);
+
+    seL4_CPtr new_cap = cspace_copy_cap(cur_cspace, cur_cspace, frame_table_get_capability(frame_id), seL4_AllRights);
+    if (new_cap == (seL4_CPtr)NULL) {
+        LOG_ERROR("Failed to copy the capability");
+        return 1;
+    }
+
+    seL4_CPtr pt_cap;
+    if (map_page(new_cap, sharer->p_addrspace->vspace, page_id, permissions,
+                 seL4_ARM_Default_VMAttributes, &pt_cap) != 0) {
+        LOG_ERROR("Failed to map page");
+        cspace_delete_cap(cur_cspace, new_cap);
+        return 1;
+    }
+
+    if ((large ? page_directory_insert_large(dir, page_id, new_cap, frame_id, pt_cap) :
+                 page_directory_insert(dir, page_id, new_cap, frame_id, pt_cap)) != 0) {
+        LOG_ERROR("Failed to insert cap into the page table");
+        seL4_ARM_Page_Unmap(new_cap);
+        cspace_delete_cap(cur_cspace, new_cap);
+        return 1;
+    }
+
+    assert(frame_table_share(frame_id, sharer->pid) == 0);
+    sharer->rss += large ? FRAMES_PER_LARGE : 1;
+    return 0;
+}
+
+/*
+ * Make the page a process is the first to share a resident page with a frame of its own.
+ * An untouched page is given a 4K frame of zeros, rather than being promoted to a large page.
+ * @param curproc, the process sharing the page
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, else 1
+ */
+static int
+vm_share_prepare(proc *curproc, seL4_Word page_id)
+{
+    addrspace *as = curproc->p_addrspace;
+    page_table_entry *second_level = (page_table_entry *)as->directory->directory[DIRECTORY_INDEX(page_id)];
+    page_table_entry *entry = second_level ? &second_level[TABLE_INDEX(page_id)] : NULL;
+
+    if (!entry || !entry->page) {
+        region *page_region;
+        seL4_Word kvaddr;
+        if (as_find_region(as, page_id, &page_region) != 0)
+            return 1;
+
+        return sos_map_page(curproc, page_id, page_region->permissions, FRAME_ALLOC_ZERO, &kvaddr);
+    }
+
+    if (!IS_EVICTED(entry->page) && IS_LARGE(entry->page)) {
+        LOG_ERROR("Large pages cannot be shared");
+        return 1;
+    }
+
+    /* Writing pages it in, gives a page of zeros a frame, and copies a page shared since a fork */
+    return vaddr_to_sos_vaddr(curproc, page_id, ACCESS_WRITE) == (seL4_Word)NULL;
+}
+
+/*
+ * Replace the page of a process with a page already shared by another process.
+ * The process takes the frame of the page, or its slot in the pagefile while it is evicted.
+ * @param curproc, the process joining
+ * @param member, a process sharing the page, with no paging of the page in flight
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, else 1
+ */
+static int
+vm_share_join(proc *curproc, proc *member, seL4_Word page_id)
+{
+    page_directory *dir = curproc->p_addrspace->directory;
+    seL4_CPtr cap;
+    seL4_Word frame;
+
+    page_table_entry *second_level = (page_table_entry *)dir->directory[DIRECTORY_INDEX(page_id)];
+    if (second_level && !IS_EVICTED(second_level[TABLE_INDEX(page_id)].page) &&
+        IS_LARGE(second_level[TABLE_INDEX(page_id)].page)) {
+        LOG_ERROR("Large pages cannot be shared");
+        return 1;
+    }
+
+    region *page_region;
+    if (member == NULL || member->p_addrspace == NULL ||
+        page_directory_lookup(member->p_addrspace->directory, page_id, &cap) != 0 ||
+        as_find_region(curproc->p_addrspace, page_id, &page_region) != 0)
+        return 1;
+
+    bool resident = !IS_EVICTED(cap);
+    if (resident && page_directory_lookup_frame(member->p_addrspace->directory, page_id, &frame) != 0)
+        return 1;
+
+    /* The shared page always has a frame or slot of its own */
+    if (resident ? (IS_LARGE(cap) || (frame & PTE_ZERO_PAGE)) : IS_ZERO(cap)) {
+        LOG_ERROR("Shared page has no frame of its own");
+        return 1;
+    }
+
+    if (vm_unmap(curproc, page_id, page_id + PAGE_SIZE_4K) != 0)
+        return 1;
+
+    /* Mapped read only, the next write soft faults to check the process may write */
+    if (resident)
+        return page_map_shared(curproc, page_id, PTE_FRAME(frame), page_region->permissions & ~seL4_CanWrite);
+
+    seL4_Word pagefile_id = cap & ~EVICTED_BIT;
+    if ((second_level = page_directory_second_level(dir, page_id)) == NULL || pagefile_share(pagefile_id) != 0)
+        return 1;
+
+    second_level[TABLE_INDEX(page_id)].page = pagefile_id | EVICTED_BIT;
+    second_level[TABLE_INDEX(page_id)].frame = 0;
+    return 0;
+}
+
+/*
+ * Unmap a shared page from every process sharing it, after the processes allowed to write to it have changed.
+ * The next access of each process soft faults, mapping the page back with its new permissions.
+ * @param page_id, the virtual address of the page
+ */
+static void
+vm_share_protect(seL4_Word page_id)
+{
+    seL4_Word members = share_get_members(page_id);
+    while (members) {
+        seL4_Word pid = CTZ(members);
+        members &= ~BIT(pid);
+
+        proc *member = get_proc(pid);
+        if (member == NULL || member->p_addrspace == NULL)
+            continue;
+
+        page_directory *dir = member->p_addrspace->directory;
+        seL4_Word frame;
+        seL4_CPtr cap;
+        if (page_directory_lookup_frame(dir, page_id, &frame) == 0 && page_directory_lookup(dir, page_id, &cap) == 0)
+            seL4_ARM_Page_Unmap(PTE_CAP(cap));
+
+        /* SOS checks the permissions again on its next translation */
+        page_directory_tlb_invalidate(dir, page_id, 1);
+    }
+}
+
+/*
+ * Drop the mapping of a frame a process has shared since a fork, leaving the frame to the other processes
+ * @param curproc, the process the page belongs to
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, else 1
+ */
+static int
+page_unshare(proc *curproc, seL4_Word page_id)
+{
+    page_directory *dir = curproc->p_addrspace->directory;
+
+    seL4_Word frame;
+    if (page_directory_lookup_frame(dir, page_id, &frame) != 0 || (frame & PTE_ZERO_PAGE))
+        return 0;
+
+    seL4_Word frame_id = frame_table_get_head(PTE_FRAME(frame));
+    if (frame_table_get_sharers(frame_id) == 0)
+        return 0;
+
+    seL4_CPtr page_cap;
+    assert(page_directory_lookup(dir, page_id, &page_cap) == 0);
+    if (page_directory_remove(dir, page_id) != 0)
+        return 1;
+
+    frame_table_unshare(frame_id, curproc->pid);
+    curproc->rss -= IS_LARGE(page_cap) ? FRAMES_PER_LARGE : 1;
+    return 0;
+}
+
+#ifdef CONFIG_SOS_LARGE_PAGES
+/*
+ * Check that no page in a range is mapped or evicted
+ * The range must not cross a second level table
+ * @param dir, the page directory
+ * @param page_id, the first page of the range
+ * @param npages, the number of pages in the range
+ * @returns TRUE if the range is unused, else FALSE
+ */
+static bool
+page_directory_range_unused(page_directory *dir, seL4_Word page_id, seL4_Word npages)
+{
+    page_table_entry *second_level = (page_table_entry *)dir->directory[DIRECTORY_INDEX(page_id)];
+    if (!second_level)
+        return TRUE;
+
+    seL4_Word table_index = TABLE_INDEX(page_id);
+    for (seL4_Word i = 0; i < npages; i++) {
+        if (second_level[table_index + i].page)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Determine if the page containing vaddr can be mapped as part of a large page.
+ * Only the heap and stack are promoted on a fault, when the region covers
+ * the whole 64K aligned range and none of the range has been mapped yet.
+ * @param as, the address space
+ * @param reg, the region vaddr belongs to
+ * @param vaddr, the faulting address
+ * @returns TRUE if the page can be promoted, else FALSE
+ */
+static bool
+vm_can_promote(addrspace *as, region *reg, seL4_Word vaddr)
+{
+    seL4_Word page_id = LARGE_FRAME_ALIGN(vaddr);
+
+    if (reg != as->region_heap && reg != as->region_stack)
+        return FALSE;
+
+    if (page_id < reg->start || page_id + LARGE_FRAME_SIZE > reg->end)
+        return FALSE;
+
+    return page_directory_range_unused(as->directory, page_id, FRAMES_PER_LARGE);
+}
+#endif /* CONFIG_SOS_LARGE_PAGES */
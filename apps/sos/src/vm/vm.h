@@ -20,23 +20,67 @@
 /* Max id is also the mask to get the evicted bit */
 #define EVICTED_BIT MAX_CAP_ID
 
+/* Check if the evicted bit is set */
+#define IS_EVICTED(x) (x & EVICTED_BIT)
+
+/* The next bit specifies if a resident page is part of a large page mapping */
+#define LARGE_BIT (MAX_CAP_ID >> 1) /* 2^30 */
+
+/* Check if the large bit is set, and strip it to get the cap */
+#define IS_LARGE(x) (x & LARGE_BIT)
+#define PTE_CAP(x) (x & ~LARGE_BIT)
+
+/* An evicted page that held only zeros keeps no slot in the pagefile, its entry has the large bit set instead */
+#define ZERO_ID LARGE_BIT
+#define IS_ZERO(x) (IS_EVICTED(x) && (x & ZERO_ID))
+
 /* Forward declaration of a process */
 typedef struct _proc proc;
 
+/* Number of translations cached by each page directory, a power of two */
+#define VM_TLB_ENTRIES 16
+
+/* Page id of an empty translation, never page aligned */
+#define VM_TLB_INVALID ((seL4_Word)-1)
+
+/*
+ * A cached translation from a process page to the sos vaddr of its frame.
+ * The low bit of the sos vaddr is set if SOS may write through the translation,
+ * the region is writable and the page has no clean copy in the pagefile.
+ */
+typedef struct {
+    seL4_Word page_id; /* Virtual address of the page, VM_TLB_INVALID if the entry is empty */
+    seL4_Word sos_vaddr; /* Sos vaddr of the page, with the writable bit */
+} vm_tlb_entry;
+
 /* Struct for the top level of the page table. Known as a page directory */
 typedef struct page_dir {
     seL4_Word *directory; /* Virtual address to the top level page directory */
     seL4_CPtr *kernel_page_table_caps; /* Array of in-kernel page table caps */
+    vm_tlb_entry tlb[VM_TLB_ENTRIES]; /* Translations of copy_in and copy_out, dropped as pages are inserted or evicted */
+    seL4_Word hand; /* Next page the process looks at when it replaces a page of its own */
 } page_directory;
 
-/* WARNING: If this grows in size, algorithms will have to change */
+/* Flags kept with the frame id of a resident page */
+#define PTE_ZERO_PAGE BIT(31) /* Mapped to the shared zero page */
+#define PTE_FLAGS (PTE_ZERO_PAGE)
+
+/* Strip the flags to get the frame id */
+#define PTE_FRAME(x) ((x) & ~PTE_FLAGS)
+
 /* 
- * Left most bit represents if the page is evicted or not.
+ * Left most bit of the page represents if the page is evicted or not.
  * If evicted (1), the id is the section in the pagefile where the page is stored
  * else (0), the value is the cap value.
+ * An evicted page that was all zeros has ZERO_ID in place of an id, and is recreated without a read.
+ * A resident page with the large bit set is one of the entries covered by a 64K mapping,
+ * every entry of the large page holds the same cap.
+ * The frame of a resident page is the id of the 4K frame backing it, so translating an address
+ * needs no kernel call. Each entry of a large page holds the id of its own 4K of the large frame.
  */
 typedef struct {
-    seL4_CPtr page; 
+    seL4_CPtr page;
+    seL4_Word frame; /* Frame id and PTE_ flags of a resident page, 0 if evicted */
 } page_table_entry;
 
 /* 
@@ -63,20 +107,43 @@ int page_directory_destroy(page_directory *dir);
  * @param directory, the page directory to insert into
  * @param vaddr, the virtual address of the page
  * @param sos_cap, the capability of the page created by sos
+ * @param frame, the id of the frame backing the page, with any PTE_ flags
+ * @param kernel_cap, a capability of the page table created by the kernel
+ * @returns 0 on success, else 1
+ */
+int page_directory_insert(page_directory *directory, seL4_Word vaddr, seL4_CPtr sos_cap, seL4_Word frame,
+                          seL4_CPtr kernel_cap);
+
+/*
+ * Insert a large page into the two level page table, covering every 4K entry of the large page
+ * @param directory, the page directory to insert into
+ * @param vaddr, the 64K aligned virtual address of the page
+ * @param sos_cap, the capability of the large page created by sos
+ * @param frame_id, the id of the first frame of the large frame backing the page
  * @param kernel_cap, a capability of the page table created by the kernel
  * @returns 0 on success, else 1
  */
-int page_directory_insert(page_directory *directory, seL4_Word vaddr, seL4_CPtr sos_cap, seL4_CPtr kernel_cap);
+int page_directory_insert_large(page_directory *directory, seL4_Word vaddr, seL4_CPtr sos_cap, seL4_Word frame_id,
+                                seL4_CPtr kernel_cap);
 
 /*
  * Given a vaddr, retrieve the cap for the page
  * @param directory, the page directory to insert into
  * @param vaddr, the virtual address of the page
- * @param cap, the cap for the page represented by vaddr
+ * @param cap, the cap for the page represented by vaddr, with the large bit set if part of a large page
  * @returns 0 on success, else 1
  */
 int page_directory_lookup(page_directory *dir, seL4_Word page_id, seL4_CPtr *cap);
 
+/*
+ * Given a vaddr, retrieve the frame backing a resident page
+ * @param directory, the page directory to search
+ * @param page_id, the virtual address of the page
+ * @param[out] frame, the id of the 4K frame backing the page, with its PTE_ flags
+ * @returns 0 on success, else 1 if the page is not resident
+ */
+int page_directory_lookup_frame(page_directory *dir, seL4_Word page_id, seL4_Word *frame);
+
 /*
  * Given a vaddr, mark the page as evicted
  * @param directory, the page directory to insert into
@@ -86,6 +153,33 @@ int page_directory_lookup(page_directory *dir, seL4_Word page_id, seL4_CPtr *cap
  */
 int page_directory_evict(page_directory *dir, seL4_Word page_id, seL4_Word free_id);
 
+/*
+ * Given the vaddr of a large page, mark every 4K page it covers as evicted
+ * @param directory, the page directory to insert into
+ * @param page_id, the 64K aligned virtual address of the large page
+ * @param free_ids, ids in the pagefile where each 4K page is now stored
+ * @returns 0 on success, else 1
+ */
+int page_directory_evict_large(page_directory *dir, seL4_Word page_id, seL4_Word *free_ids);
+
+/*
+ * Given a vaddr, drop a resident page from the page table, leaving no entry.
+ * The page is unmapped from the process, but its frame is left to the caller.
+ * Every entry of a large page is dropped together.
+ * @param directory, the page directory
+ * @param page_id, the virtual address of the page
+ * @returns 0 on success, else 1
+ */
+int page_directory_remove(page_directory *dir, seL4_Word page_id);
+
+/*
+ * Select a victim among the resident pages of a page directory, with a clock over its entries.
+ * Frames shared with other processes and pinned frames are passed over, so the pages and references of other processes are untouched.
+ * @param directory, the page directory
+ * @returns id of the victim frame, else -1 if there is none
+ */
+seL4_Word page_directory_next_victim(page_directory *dir);
+
 /*
  * Translate a process virtual address to the sos vaddr of the frame.
  * The frame is mapped in if translation failed.
@@ -120,10 +214,99 @@ int copy_out(proc *curproc, seL4_Word dst, char *src, seL4_Word nbytes);
  * @param curproc, the process to map the page into
  * @param vaddr, the vaddr of the page to map in
  * @param access_type, the type of access requested to that memory
+ * @param flags, frame allocation flags for the new frame
+ * @param kvaddr[out], the kvaddr of the frame
+ * @returns 0 on success, else 1
+ */
+int vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word flags, seL4_Word *kvaddr);
+
+/*
+ * Map in a page that has no page table entry.
+ * Anonymous memory starts as zeros, a page of a file mapping is read from its file.
+ * @param curproc, the process to map the page into
+ * @param vaddr, the vaddr of the page to map in
+ * @param access_type, the type of access requested to that memory
  * @param kvaddr[out], the kvaddr of the frame
  * @returns 0 on success, else 1
  */
-int vm_map(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr);
+int vm_map_new(proc *curproc, seL4_Word vaddr, seL4_Word access_type, seL4_Word *kvaddr);
+
+/*
+ * Map a page that reads as zeros.
+ * A read maps the shared zero page read only, a write maps a new zeroed frame in its place.
+ * @param curproc, the process to map the page into
+ * @param page_id, the virtual address of the page
+ * @param access_type, the type of access requested to that memory
+ * @returns 0 on success, else 1
+ */
+int vm_map_zero(proc *curproc, seL4_Word page_id, seL4_Word access_type);
+
+/*
+ * Release every page in a range, leaving no page table entries.
+ * Resident pages of a shared file mapping are first written back to the file.
+ * A large page is only released when the range covers the whole of it.
+ * @param curproc, the process the range belongs to
+ * @param start, the page aligned start of the range
+ * @param end, the page aligned end of the range
+ * @returns 0 on success, else 1
+ */
+int vm_unmap(proc *curproc, seL4_Word start, seL4_Word end);
+
+/*
+ * Apply new region permissions to the pages in a range.
+ * Resident pages are unmapped, to be mapped back with the new permissions on their next fault.
+ * @param curproc, the process the range belongs to
+ * @param start, the page aligned start of the range
+ * @param end, the page aligned end of the range
+ * @returns 0 on success, else 1
+ */
+int vm_protect(proc *curproc, seL4_Word start, seL4_Word end);
+
+/*
+ * Bring the pages of a range into memory ahead of their use.
+ * Evicted pages are read back in batches and pages of a file mapping are read from the file,
+ * pages already resident and anonymous pages that read as zeros are left as they are.
+ * @param curproc, the process the range belongs to
+ * @param start, the page aligned start of the range
+ * @param end, the page aligned end of the range
+ * @returns 0 on success, else 1
+ */
+int vm_prefault(proc *curproc, seL4_Word start, seL4_Word end);
+
+/*
+ * Share the pages of a process with its forked child, copy on write.
+ * Resident frames are mapped read only in both processes, evicted pages share their pagefile slot.
+ * @param parent, the process forking
+ * @param child, the forked process, with a copy of the regions of the parent and no pages
+ * @returns 0 on success, else 1
+ */
+int vm_fork(proc *parent, proc *child);
+
+/*
+ * Drop the mappings of every frame a process shares with other processes, leaving the frames
+ * to the other processes, and stop sharing its pages. Called before the address space is destroyed.
+ * @param curproc, the process
+ * @returns 0 on success, else 1
+ */
+int vm_unshare(proc *curproc);
+
+/*
+ * Share a page with the other processes sharing the same address with sos_share_vm.
+ * The first process to share the page shares its own page, a later one replaces its page with the shared page.
+ * @param curproc, the process sharing the page
+ * @param page_id, the virtual address of the page, in a writable anonymous region
+ * @param writable, whether the other processes sharing the page may write to it
+ * @returns 0 on success, else 1
+ */
+int vm_share(proc *curproc, seL4_Word page_id, bool writable);
+
+/*
+ * Map a page just paged in into the other processes sharing it with sos_share_vm.
+ * They were evicted with the page, to the slot it was read from.
+ * @param curproc, the process that paged the page in
+ * @param page_id, the virtual address of the page
+ */
+void vm_share_propagate(proc *curproc, seL4_Word page_id);
 
 /*
  * Given a process, counts the number of used pages
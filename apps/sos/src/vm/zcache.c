@@ -0,0 +1,394 @@
+/*
+ * Compressed Page Cache Implementation
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include "zcache.h"
+
+#include <autoconf.h>
+#include "frametable.h"
+#include "lz.h"
+#include "pagefile_map.h"
+#include <string.h>
+#include <utils/util.h>
+
+/* Frames reserved for the cache, a power of two so they split evenly into blocks */
+#ifdef CONFIG_SOS_ZCACHE
+#define ZCACHE_FRAMES BIT(LOG_BASE_2(CONFIG_SOS_ZCACHE_FRAMES))
+#define ZCACHE_FRAMES_MAX CONFIG_SOS_ZCACHE_FRAMES
+#else
+#define ZCACHE_FRAMES 0
+#define ZCACHE_FRAMES_MAX 0
+#endif
+
+/* The cache is allocated as 64K blocks, the largest contiguous run of frames the allocator serves */
+#define ZCACHE_BLOCK_FRAMES FRAMES_PER_LARGE
+#define ZCACHE_BLOCK_SIZE (ZCACHE_BLOCK_FRAMES * PAGE_SIZE_4K)
+#define ZCACHE_BLOCKS (ZCACHE_FRAMES / ZCACHE_BLOCK_FRAMES)
+
+/* Compressed pages are stored in runs of chunks */
+#define ZCACHE_CHUNK_BITS 6
+#define ZCACHE_CHUNK_SIZE BIT(ZCACHE_CHUNK_BITS)
+#define BYTES_TO_CHUNKS(b) (((b) + ZCACHE_CHUNK_SIZE - 1) >> ZCACHE_CHUNK_BITS)
+
+/* Pages that do not compress to within this size are not worth keeping in memory */
+#define ZCACHE_MAX_STORED ((PAGE_SIZE_4K * 3) / 4)
+
+/* Entries per frame of the cache, the best average compression the cache can make use of */
+#define ZCACHE_ENTRIES_PER_FRAME 8
+
+/* Percentage of chunks in use at which cold pages start being written back */
+#define ZCACHE_WRITEBACK_PERCENT 90
+
+/* Marks the end of a list of entries, or a free staging buffer */
+#define ZCACHE_NONE 0xFFFF
+
+/* Entries of a block, and words of its chunk map, enough to map every chunk of a block */
+#define ZCACHE_BLOCK_ENTRIES (ZCACHE_BLOCK_FRAMES * ZCACHE_ENTRIES_PER_FRAME)
+#define ZCACHE_BLOCK_MAP_WORDS 64
+
+/* Cached page, entries are linked into a hash bucket and into the age order of the cache */
+typedef struct {
+    seL4_Word pagefile_id; /* Slot of the pagefile the page belongs to */
+    seL4_Word chunk; /* First chunk of the compressed page */
+    uint16_t length; /* Length of the compressed page in bytes */
+    uint16_t staging; /* Staging buffer holding the page while it is written back, else ZCACHE_NONE */
+    uint16_t next; /* Next entry in the hash bucket, or the free list */
+    uint16_t older; /* Neighbours in the age order, the oldest are written back first */
+    uint16_t newer;
+} zcache_entry;
+
+/* Start of a block, its share of the entries and hash buckets and the map of its chunks, which fill the rest */
+typedef struct {
+    zcache_entry entries[ZCACHE_BLOCK_ENTRIES];
+    uint16_t buckets[ZCACHE_BLOCK_ENTRIES];
+    seL4_Word chunk_map[ZCACHE_BLOCK_MAP_WORDS];
+} zcache_block;
+
+/* Chunks of a block, a compressed page is stored in the chunks of one block */
+#define ZCACHE_BLOCK_HEADER_CHUNKS BYTES_TO_CHUNKS(sizeof(zcache_block))
+#define ZCACHE_BLOCK_CHUNKS ((ZCACHE_BLOCK_SIZE / ZCACHE_CHUNK_SIZE) - ZCACHE_BLOCK_HEADER_CHUNKS)
+
+/* The staging buffers take the end of the first block */
+#define ZCACHE_STAGING_CHUNKS BYTES_TO_CHUNKS(ZCACHE_WRITEBACK_BATCH * PAGE_SIZE_4K)
+
+compile_time_assert(zcache_whole_blocks, ZCACHE_FRAMES_MAX == 0 || ZCACHE_FRAMES_MAX >= ZCACHE_BLOCK_FRAMES);
+compile_time_assert(zcache_page_fits_block, BYTES_TO_CHUNKS(ZCACHE_MAX_STORED) <= ZCACHE_BLOCK_CHUNKS - ZCACHE_STAGING_CHUNKS);
+
+/* Entries, hash buckets and chunks are numbered across the blocks */
+#define ENTRY(i) (&blocks[(i) / ZCACHE_BLOCK_ENTRIES]->entries[(i) % ZCACHE_BLOCK_ENTRIES])
+#define BUCKET(b) (blocks[(b) / ZCACHE_BLOCK_ENTRIES]->buckets[(b) % ZCACHE_BLOCK_ENTRIES])
+#define CHUNK_ADDR(c) ((uint8_t *)blocks[(c) / ZCACHE_BLOCK_CHUNKS] + \
+                       ((ZCACHE_BLOCK_HEADER_CHUNKS + ((c) % ZCACHE_BLOCK_CHUNKS)) * ZCACHE_CHUNK_SIZE))
+
+static zcache_block *blocks[ZCACHE_FRAMES_MAX / ZCACHE_BLOCK_FRAMES];
+
+/* Entries of the cache, one hash bucket per entry */
+static seL4_Word nentries = 0;
+
+/* Free list of entries */
+static uint16_t free_entries = ZCACHE_NONE;
+static seL4_Word nfree = 0;
+
+/* Ends of the age order */
+static uint16_t oldest = ZCACHE_NONE;
+static uint16_t newest = ZCACHE_NONE;
+
+/* Map of the chunks in use in each block, and the block the next store is tried in first */
+static pagefile_map chunk_maps[ZCACHE_FRAMES_MAX / ZCACHE_BLOCK_FRAMES];
+static seL4_Word next_block = 0;
+static seL4_Word nchunks = 0;
+static seL4_Word used_chunks = 0;
+
+/* Uncompressed copies of the pages being written back, and the slot each belongs to */
+static uint8_t *staging = NULL;
+static seL4_Word staging_owner[ZCACHE_WRITEBACK_BATCH];
+
+/* Compression output, before its size is known */
+static uint8_t scratch[PAGE_SIZE_4K];
+
+static zcache_stats stats;
+
+/* Private functions */
+static uint16_t entry_find(seL4_Word pagefile_id);
+static void entry_remove(uint16_t index);
+static int chunks_alloc(seL4_Word nchunks_run, seL4_Word *first);
+
+int
+zcache_init(void)
+{
+    if (ZCACHE_FRAMES == 0)
+        return 0;
+
+    for (seL4_Word b = 0; b < ZCACHE_BLOCKS; b++) {
+        seL4_Word vaddr;
+        seL4_Word frame_id = multi_frame_alloc(&vaddr, ZCACHE_BLOCK_FRAMES);
+        if (frame_id == -1) {
+            LOG_ERROR("Failed to reserve frames for the compressed page cache");
+            return 1;
+        }
+
+        /* The cache is memory of SOS, it is never paged */
+        for (seL4_Word i = 0; i < ZCACHE_BLOCK_FRAMES; i++)
+            assert(frame_table_set_chance(frame_id + i, PINNED) == 0);
+
+        blocks[b] = (zcache_block *)vaddr;
+
+        /* The chunks under the staging buffers are left out of the map of the first block */
+        seL4_Word block_chunks = ZCACHE_BLOCK_CHUNKS - ((b == 0) ? ZCACHE_STAGING_CHUNKS : 0);
+        assert(pagefile_map_bytes(block_chunks) <= sizeof(blocks[b]->chunk_map));
+        if (pagefile_map_init(&chunk_maps[b], blocks[b]->chunk_map, block_chunks) != 0) {
+            LOG_ERROR("Failed to initialise the chunk map");
+            return 1;
+        }
+
+        nchunks += block_chunks;
+    }
+
+    staging = (uint8_t *)blocks[0] + ZCACHE_BLOCK_SIZE - (ZCACHE_WRITEBACK_BATCH * PAGE_SIZE_4K);
+
+    for (seL4_Word i = 0; i < ZCACHE_FRAMES * ZCACHE_ENTRIES_PER_FRAME; i++) {
+        ENTRY(i)->next = (i + 1 < ZCACHE_FRAMES * ZCACHE_ENTRIES_PER_FRAME) ? i + 1 : ZCACHE_NONE;
+        BUCKET(i) = ZCACHE_NONE;
+    }
+
+    nentries = ZCACHE_FRAMES * ZCACHE_ENTRIES_PER_FRAME;
+    free_entries = 0;
+    nfree = nentries;
+
+    for (seL4_Word i = 0; i < ZCACHE_WRITEBACK_BATCH; i++)
+        staging_owner[i] = -1;
+
+    stats.frames = ZCACHE_FRAMES;
+    LOG_INFO("Compressed page cache of %d frames, %d chunks", ZCACHE_FRAMES, nchunks);
+    return 0;
+}
+
+int
+zcache_store(seL4_Word pagefile_id, void *page)
+{
+    if (nentries == 0)
+        return 1;
+
+    /* A reused slot replaces whatever the cache held for it */
+    zcache_drop(pagefile_id);
+
+    seL4_Word length = lz_compress(page, PAGE_SIZE_4K, scratch, ZCACHE_MAX_STORED);
+    seL4_Word first;
+    if (length == 0 || free_entries == ZCACHE_NONE ||
+        chunks_alloc(BYTES_TO_CHUNKS(length), &first) != 0) {
+        stats.rejects++;
+        return 1;
+    }
+
+    memcpy(CHUNK_ADDR(first), scratch, length);
+    used_chunks += BYTES_TO_CHUNKS(length);
+
+    uint16_t index = free_entries;
+    zcache_entry *entry = ENTRY(index);
+    free_entries = entry->next;
+    nfree--;
+
+    entry->pagefile_id = pagefile_id;
+    entry->chunk = first;
+    entry->length = length;
+    entry->staging = ZCACHE_NONE;
+
+    /* Insert into its bucket, and as the newest page */
+    seL4_Word bucket = pagefile_id & (nentries - 1);
+    entry->next = BUCKET(bucket);
+    BUCKET(bucket) = index;
+
+    entry->older = newest;
+    entry->newer = ZCACHE_NONE;
+    if (newest != ZCACHE_NONE)
+        ENTRY(newest)->newer = index;
+    else
+        oldest = index;
+    newest = index;
+
+    stats.stores++;
+    stats.pages++;
+    stats.bytes += length;
+    return 0;
+}
+
+int
+zcache_load(seL4_Word pagefile_id, void *page)
+{
+    if (nentries == 0)
+        return 1;
+
+    uint16_t index = entry_find(pagefile_id);
+    if (index == ZCACHE_NONE)
+        return 1;
+
+    /* The cache holds the only copy of the page, it must decompress */
+    zcache_entry *entry = ENTRY(index);
+    assert(lz_decompress(CHUNK_ADDR(entry->chunk), entry->length, page, PAGE_SIZE_4K) == PAGE_SIZE_4K);
+
+    stats.loads++;
+    return 0;
+}
+
+void
+zcache_drop(seL4_Word pagefile_id)
+{
+    if (nentries == 0)
+        return;
+
+    uint16_t index = entry_find(pagefile_id);
+    if (index != ZCACHE_NONE)
+        entry_remove(index);
+}
+
+bool
+zcache_needs_writeback(void)
+{
+    if (nentries == 0)
+        return FALSE;
+
+    return (used_chunks * 100) / nchunks >= ZCACHE_WRITEBACK_PERCENT || nfree < ZCACHE_WRITEBACK_BATCH;
+}
+
+int
+zcache_writeback_begin(seL4_Word *pagefile_id, void **page)
+{
+    if (nentries == 0)
+        return 1;
+
+    seL4_Word buffer;
+    for (buffer = 0; buffer < ZCACHE_WRITEBACK_BATCH; buffer++) {
+        if (staging_owner[buffer] == -1)
+            break;
+    }
+
+    if (buffer == ZCACHE_WRITEBACK_BATCH)
+        return 1;
+
+    /* The oldest page not already on its way to the pagefile */
+    uint16_t index = oldest;
+    while (index != ZCACHE_NONE && ENTRY(index)->staging != ZCACHE_NONE)
+        index = ENTRY(index)->newer;
+
+    if (index == ZCACHE_NONE)
+        return 1;
+
+    zcache_entry *entry = ENTRY(index);
+    *page = staging + (buffer * PAGE_SIZE_4K);
+    assert(lz_decompress(CHUNK_ADDR(entry->chunk), entry->length, *page, PAGE_SIZE_4K) == PAGE_SIZE_4K);
+
+    entry->staging = buffer;
+    staging_owner[buffer] = entry->pagefile_id;
+    *pagefile_id = entry->pagefile_id;
+    return 0;
+}
+
+void
+zcache_writeback_end(seL4_Word pagefile_id, bool written)
+{
+    if (nentries == 0)
+        return;
+
+    for (seL4_Word buffer = 0; buffer < ZCACHE_WRITEBACK_BATCH; buffer++) {
+        if (staging_owner[buffer] != pagefile_id)
+            continue;
+
+        staging_owner[buffer] = -1;
+
+        /* The page may have been dropped while it was being written */
+        uint16_t index = entry_find(pagefile_id);
+        if (index == ZCACHE_NONE || ENTRY(index)->staging != buffer)
+            return;
+
+        ENTRY(index)->staging = ZCACHE_NONE;
+        if (written) {
+            entry_remove(index);
+            stats.writebacks++;
+        }
+        return;
+    }
+}
+
+void
+zcache_get_stats(zcache_stats *out)
+{
+    *out = stats;
+}
+
+/*
+ * Find the entry of a pagefile slot
+ * @param pagefile_id, the slot in the pagefile
+ * @returns index of the entry, else ZCACHE_NONE
+ */
+static uint16_t
+entry_find(seL4_Word pagefile_id)
+{
+    uint16_t index = BUCKET(pagefile_id & (nentries - 1));
+    while (index != ZCACHE_NONE && ENTRY(index)->pagefile_id != pagefile_id)
+        index = ENTRY(index)->next;
+
+    return index;
+}
+
+/*
+ * Remove an entry from the cache, releasing its chunks
+ * @param index, index of the entry
+ */
+static void
+entry_remove(uint16_t index)
+{
+    zcache_entry *entry = ENTRY(index);
+
+    /* Unlink from the bucket */
+    uint16_t *link = &BUCKET(entry->pagefile_id & (nentries - 1));
+    while (*link != index)
+        link = &ENTRY(*link)->next;
+    *link = entry->next;
+
+    /* Unlink from the age order */
+    if (entry->older != ZCACHE_NONE)
+        ENTRY(entry->older)->newer = entry->newer;
+    else
+        oldest = entry->newer;
+
+    if (entry->newer != ZCACHE_NONE)
+        ENTRY(entry->newer)->older = entry->older;
+    else
+        newest = entry->older;
+
+    seL4_Word nchunks_used = BYTES_TO_CHUNKS(entry->length);
+    for (seL4_Word i = 0; i < nchunks_used; i++)
+        pagefile_map_free(&chunk_maps[entry->chunk / ZCACHE_BLOCK_CHUNKS], (entry->chunk % ZCACHE_BLOCK_CHUNKS) + i);
+    used_chunks -= nchunks_used;
+
+    stats.pages--;
+    stats.bytes -= entry->length;
+
+    entry->next = free_entries;
+    free_entries = index;
+    nfree++;
+}
+
+/*
+ * Allocate a run of chunks within a block, starting with the block the last run came from
+ * @param nchunks_run, the number of chunks
+ * @param[out] first, the first chunk of the run
+ * @returns 0 on success, else 1 if no block has room
+ */
+static int
+chunks_alloc(seL4_Word nchunks_run, seL4_Word *first)
+{
+    for (seL4_Word i = 0; i < ZCACHE_BLOCKS; i++) {
+        seL4_Word block = (next_block + i) % ZCACHE_BLOCKS;
+        seL4_Word chunk;
+        if (pagefile_map_alloc_run(&chunk_maps[block], nchunks_run, &chunk) == 0) {
+            next_block = block;
+            *first = (block * ZCACHE_BLOCK_CHUNKS) + chunk;
+            return 0;
+        }
+    }
+
+    return 1;
+}
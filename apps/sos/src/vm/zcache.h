@@ -0,0 +1,84 @@
+/*
+ * Compressed Page Cache
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#ifndef _ZCACHE_H_
+#define _ZCACHE_H_
+
+#include <sel4/sel4.h>
+#include <stdbool.h>
+
+/* Number of cold pages written back to the pagefile together */
+#define ZCACHE_WRITEBACK_BATCH 8
+
+/* Statistics of the compressed page cache */
+typedef struct {
+    seL4_Word frames; /* Frames reserved for the cache */
+    seL4_Word pages; /* Pages currently held */
+    seL4_Word bytes; /* Compressed bytes currently held */
+    seL4_Word stores; /* Pages compressed into the cache */
+    seL4_Word rejects; /* Pages that did not compress well enough, or found the cache full */
+    seL4_Word loads; /* Page ins served from the cache */
+    seL4_Word writebacks; /* Pages written back to the pagefile to make room */
+} zcache_stats;
+
+/*
+ * Reserve the frames of the compressed page cache
+ * @returns 0 on success, else 1
+ */
+int zcache_init(void);
+
+/*
+ * Compress a page into the cache.
+ * The cache holds the contents of the pagefile slot until the slot is dropped or written back.
+ * @param pagefile_id, the slot in the pagefile the page belongs to
+ * @param page, the contents of the page
+ * @returns 0 if the page was stored, else 1 if it must be written to the pagefile
+ */
+int zcache_store(seL4_Word pagefile_id, void *page);
+
+/*
+ * Decompress a page from the cache, the page stays in the cache
+ * @param pagefile_id, the slot in the pagefile the page belongs to
+ * @param[out] page, buffer for the contents of the page
+ * @returns 0 if the page was in the cache, else 1 if it must be read from the pagefile
+ */
+int zcache_load(seL4_Word pagefile_id, void *page);
+
+/*
+ * Forget the page of a pagefile slot, as the slot is being released
+ * @param pagefile_id, the slot in the pagefile
+ */
+void zcache_drop(seL4_Word pagefile_id);
+
+/*
+ * Determine if the cache is full enough that cold pages should be written back
+ * @returns TRUE if pages should be written back, else FALSE
+ */
+bool zcache_needs_writeback(void);
+
+/*
+ * Take the oldest page not already being written back, to write back to the pagefile.
+ * The page stays in the cache and is served from it until the write completes.
+ * @param[out] pagefile_id, the slot the page belongs to
+ * @param[out] page, the contents of the page, valid until zcache_writeback_end
+ * @returns 0 on success, else 1 if there is nothing to write back
+ */
+int zcache_writeback_begin(seL4_Word *pagefile_id, void **page);
+
+/*
+ * Finish writing a page back to the pagefile
+ * @param pagefile_id, the slot the page belongs to
+ * @param written, TRUE if the pagefile now holds the page and it can leave the cache
+ */
+void zcache_writeback_end(seL4_Word pagefile_id, bool written);
+
+/*
+ * Retrieve the statistics of the cache
+ * @param[out] stats, the statistics of the cache
+ */
+void zcache_get_stats(zcache_stats *stats);
+
+#endif /* _ZCACHE_H_ */
@@ -21,6 +21,8 @@
 
 #include <sos.h>
 
+#include "benchmark.h"
+
 /* number of times to run the benchmark before recording results
  * this primes the caches etc so we don't use cold cache results */
 #define WARMUPS     1
@@ -64,12 +66,6 @@ _Static_assert(MAX_BUF_SIZE >= MIN_BUF_SIZE, "min buf size smaller than or eq to
 /* max size for output lines in results.tsv */
 #define LINE_SIZE 200
 
-#define READ_CCNT(var) do { \
-    asm volatile("mrc p15, 0, %0, c9, c13, 0\n" \
-        : "=r"(var) \
-    ); \
-} while(0)
-
 /* amount of loops to do for each benchmark */
 #define LOOPS (TOTAL_FILE_SIZE/BIT(MAX_BUF_SIZE))
 
@@ -243,7 +239,7 @@ static uint32_t find_overhead(void)
     return overhead;
 }
 
-int sos_benchmark(int debug_mode)
+uint32_t sos_ccnt_init(void)
 {
     /* allow the cycle counter to be read from user level */
 #ifndef CONFIG_DANGEROUS_CODE_INJECTION
@@ -255,7 +251,12 @@ int sos_benchmark(int debug_mode)
     seL4_DebugRun(init_ccnt, NULL);
 
     /* find overhead of measuring cycle counter */
-    uint32_t overhead = find_overhead();
+    return find_overhead();
+}
+
+int sos_benchmark(int debug_mode)
+{
+    uint32_t overhead = sos_ccnt_init();
 
 
     /* create benchmark results file */
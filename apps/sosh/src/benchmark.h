@@ -10,5 +10,23 @@
 /* tell the compiler to only include this file once */
 #pragma once
 
+#include <stdint.h>
+
+/* the cycle counter ticks once every 64 cycles */
+#define CCNT_SCALE 64
+
+#define READ_CCNT(var) do { \
+    asm volatile("mrc p15, 0, %0, c9, c13, 0\n" \
+        : "=r"(var) \
+    ); \
+} while(0)
+
 /* run the benchmark */
 int sos_benchmark(int debug_mode);
+
+/* allow the cycle counter to be read from user level,
+ * returns the overhead of reading it */
+uint32_t sos_ccnt_init(void);
+
+/* printf to a sos file descriptor */
+void sos_fprintf(int fd, const char *format, ...);
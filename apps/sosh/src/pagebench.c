@@ -0,0 +1,255 @@
+/*
+ * Paging Benchmark
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/page.h>
+#include <utils/util.h>
+
+#include <sos.h>
+
+#include "benchmark.h"
+#include "pagebench.h"
+
+/* runs of each pattern before recording results, this populates the working set */
+#define WARMUPS 1
+
+/* runs of each pattern recorded */
+#define ITERATIONS 3
+
+#define N_RESULTS (WARMUPS + ITERATIONS)
+
+/* largest working set, in pages */
+#define MAX_PAGES (4 * PAGEBENCH_FRAME_LIMIT)
+
+/* stride of the strided pattern in pages, prime so it visits every page of the working sets used */
+#define STRIDE 17
+
+/* an access taking longer than this many cycle counter ticks took a fault */
+#define FAULT_TICKS 16
+
+/* fault latencies kept for the percentiles, a uniform sample of them if there are more */
+#define MAX_LATENCIES 16384
+
+/* name of file to write results to */
+#define PAGEBENCH_RESULTS_FILE "pagebench.json"
+
+/* working sets, as a percentage of the frame limit */
+static const unsigned working_sets[] = {50, 100, 150, 200};
+
+typedef size_t (*pattern_fn_t)(size_t i, size_t npages);
+
+static uint32_t latencies[MAX_LATENCIES];
+static uint32_t nlatencies;
+static uint32_t nfaults;
+
+/* cumulative weights of the zipf ranks, fixed point */
+static uint32_t zipf_cdf[MAX_PAGES];
+
+/* state of the random number generator, fixed so runs are repeatable */
+static uint32_t random_state;
+
+/* xorshift generator, good enough to pick pages */
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static size_t pattern_sequential(size_t i, size_t npages) {
+    return i % npages;
+}
+
+static size_t pattern_strided(size_t i, size_t npages) {
+    return (i * STRIDE) % npages;
+}
+
+static size_t pattern_random(size_t i, size_t npages) {
+    return next_random() % npages;
+}
+
+/* rank k is chosen with weight 1/k, ranks are scattered over the working set by a prime so the hot pages are not adjacent */
+static size_t pattern_zipf(size_t i, size_t npages) {
+    uint32_t target = next_random() % zipf_cdf[npages - 1];
+    size_t lo = 0, hi = npages - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] > target)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return ((uint64_t)lo * 8191) % npages;
+}
+
+static void zipf_init(size_t npages) {
+    uint32_t total = 0;
+    for (size_t k = 0; k < npages; k++) {
+        total += BIT(24) / (k + 1);
+        zipf_cdf[k] = total;
+    }
+}
+
+struct pattern {
+    char *name;
+    pattern_fn_t fn;
+};
+
+static struct pattern patterns[] = { {"sequential", pattern_sequential}, {"strided", pattern_strided},
+        {"random", pattern_random}, {"zipf", pattern_zipf} };
+
+/* keep a uniform sample of the fault latencies */
+static void record_latency(uint32_t ticks) {
+    nfaults++;
+    if (nlatencies < MAX_LATENCIES) {
+        latencies[nlatencies++] = ticks;
+        return;
+    }
+
+    uint32_t slot = next_random() % nfaults;
+    if (slot < MAX_LATENCIES)
+        latencies[slot] = ticks;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(unsigned pct) {
+    if (nlatencies == 0)
+        return 0;
+
+    return latencies[((nlatencies - 1) * pct) / 100];
+}
+
+/* fill every page with data that compresses to about half, like typical heap data */
+static void populate(seL4_Word heap, size_t npages) {
+    for (size_t page = 0; page < npages; page++) {
+        uint32_t *words = (uint32_t *)(heap + (page * PAGE_SIZE_4K));
+        for (size_t j = 0; j < PAGE_SIZE_4K / sizeof(uint32_t); j++)
+            words[j] = (j % 2) ? 0 : next_random();
+    }
+}
+
+static int run_pagebench(struct pattern *pattern, seL4_Word heap, size_t npages, size_t frames,
+                         uint32_t overhead, int results_fd) {
+    uint32_t results[N_RESULTS];
+    sos_vm_stats_t before, after;
+
+    nlatencies = 0;
+    nfaults = 0;
+    random_state = 2463534242u;
+    populate(heap, npages);
+
+    for (int i = 0; i < N_RESULTS; i++) {
+        if (i == WARMUPS) {
+            nlatencies = 0;
+            nfaults = 0;
+            sos_vm_stats(&before);
+        }
+
+        uint32_t total = 0;
+        for (size_t j = 0; j < npages; j++) {
+            volatile uint32_t *word = (uint32_t *)(heap + (pattern->fn(j, npages) * PAGE_SIZE_4K));
+            uint32_t start, end;
+
+            READ_CCNT(start);
+            *word += 1;
+            READ_CCNT(end);
+
+            uint32_t ticks = (end - start > overhead) ? end - start - overhead : 0;
+            if (ticks > FAULT_TICKS)
+                record_latency(ticks);
+            total += ticks;
+        }
+
+        results[i] = total;
+    }
+
+    sos_vm_stats(&after);
+    qsort(latencies, nlatencies, sizeof(uint32_t), compare_latency);
+
+    unsigned major = after.hard_faults - before.hard_faults;
+    unsigned minor = (after.faults - before.faults) - major;
+
+    /* output to results file, calculate results offline */
+    sos_fprintf(results_fd, "{\"name\": \"%s\",", pattern->name);
+    sos_fprintf(results_fd, "\"buf_size\": %u,", npages * PAGE_SIZE_4K);
+    sos_fprintf(results_fd, "\"file_size\": %u,", npages * PAGE_SIZE_4K);
+    sos_fprintf(results_fd, "\"frames\": %u,\"major_faults\": %u,\"minor_faults\": %u,", frames, major, minor);
+    sos_fprintf(results_fd, "\"latency_p50\": %u,\"latency_p90\": %u,\"latency_p99\": %u,\"latency_max\": %u,",
+                percentile(50), percentile(90), percentile(99), percentile(100));
+    sos_fprintf(results_fd, "\"samples\": [");
+
+    uint64_t check_sum = 0;
+    for (int i = WARMUPS; i < N_RESULTS; i++) {
+        sos_fprintf(results_fd, "%u", results[i]);
+        sos_fprintf(results_fd, (i < N_RESULTS - 1) ? "," : "]");
+        /* store a checksum, so we can validate the results */
+        check_sum += results[i];
+    }
+    sos_fprintf(results_fd, ",\"check_sum\":%llu}\n", check_sum);
+
+    printf("%s: %u pages, %u major, %u minor faults, latency p50 %u p90 %u p99 %u max %u ticks\n",
+           pattern->name, npages, major, minor, percentile(50), percentile(90), percentile(99), percentile(100));
+    return 0;
+}
+
+int sos_pagebench(size_t frames, const char *pattern) {
+    uint32_t overhead = sos_ccnt_init();
+
+    int results_fd = sos_sys_open(PAGEBENCH_RESULTS_FILE, O_WRONLY);
+    if (results_fd == -1) {
+        printf("Failed to open file %s\n", PAGEBENCH_RESULTS_FILE);
+        return -1;
+    }
+
+    seL4_Word brk = sos_sys_brk(0);
+    seL4_Word heap = ROUND_UP(brk, PAGE_SIZE_4K);
+    int res = 0;
+    int rows = 0;
+
+    sos_fprintf(results_fd, "[");
+    for (size_t i = 0; i < sizeof(working_sets) / sizeof(working_sets[0]) && res == 0; i++) {
+        size_t npages = (frames * working_sets[i]) / 100;
+        if (npages == 0 || npages > MAX_PAGES) {
+            printf("Skipping working set of %u pages\n", npages);
+            continue;
+        }
+
+        seL4_Word newbrk = heap + (npages * PAGE_SIZE_4K);
+        if (sos_sys_brk(newbrk) != newbrk) {
+            printf("Failed to extend the heap to %u pages\n", npages);
+            res = -1;
+            break;
+        }
+
+        zipf_init(npages);
+        for (size_t j = 0; j < sizeof(patterns) / sizeof(patterns[0]); j++) {
+            if (pattern != NULL && strcmp(pattern, patterns[j].name) != 0)
+                continue;
+
+            if (rows++ > 0)
+                sos_fprintf(results_fd, ",");
+
+            if ((res = run_pagebench(&patterns[j], heap, npages, frames, overhead, results_fd)) != 0)
+                break;
+        }
+    }
+    sos_fprintf(results_fd, "]");
+
+    sos_sys_brk(brk);
+    sos_sys_close(results_fd);
+    return res;
+}
@@ -0,0 +1,21 @@
+/*
+ * Paging Benchmark
+ *
+ * Glenn McGuire & Cameron Lonsdale
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* frames available to processes, the frame table limit of SOS */
+#define PAGEBENCH_FRAME_LIMIT 2048
+
+/*
+ * run the paging benchmark over working sets sized relative to the frame limit,
+ * writing the results to pagebench.json in the format parse_results.py reads
+ * @param frames, the frame limit the working sets are sized against
+ * @param pattern, the access pattern to run, NULL to run every pattern
+ * @returns 0 on success, else -1
+ */
+int sos_pagebench(size_t frames, const char *pattern);
@@ -19,12 +19,14 @@
 #include <fcntl.h>
 #include <time.h>
 #include <sys/time.h>
+#include <utils/page.h>
 #include <utils/time.h>
 
 /* Your OS header file */
 #include <sos.h>
 
 #include "benchmark.h"
+#include "pagebench.h"
 
 #define BUF_SIZ    6144
 #define MAX_ARGS   32
@@ -305,6 +307,70 @@ static int thrash(int argc, char *argv[]) {
     return 0;
 }
 
+/* Touch one byte in each page of a stack buffer */
+static void faultbench_stack(size_t npages) {
+    volatile char buffer[npages * PAGE_SIZE_4K];
+
+    for (size_t i = 0; i < npages; i++)
+        buffer[i * PAGE_SIZE_4K] = i;
+}
+
+/* Grow the heap, touch one byte in each new page, then restore the heap */
+static int faultbench_heap(size_t npages) {
+    seL4_Word heap = sos_sys_brk(0);
+    seL4_Word newbrk = heap + (npages * PAGE_SIZE_4K);
+
+    if (sos_sys_brk(newbrk) != newbrk) {
+        printf("Failed to extend the heap\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < npages; i++)
+        ((volatile char *)heap)[i * PAGE_SIZE_4K] = i;
+
+    sos_sys_brk(heap);
+    return 0;
+}
+
+static void faultbench_report(const char *name, size_t npages, sos_vm_stats_t *before,
+                              sos_vm_stats_t *after, int64_t time) {
+    printf("%s: %u pages, %u faults (%u soft, %u hard), %u small maps, %u large maps, %u zero maps, %u page ins, %u readahead, %lld us\n",
+           name, npages, after->faults - before->faults, after->soft_faults - before->soft_faults,
+           after->hard_faults - before->hard_faults, after->small_maps - before->small_maps,
+           after->large_maps - before->large_maps, after->zero_maps - before->zero_maps,
+           after->page_ins - before->page_ins, after->readahead - before->readahead, time);
+    printf("%s: frame cache %u hits, %u misses, %u zero hits, %u releases, %u/%u frames (%u zeroed, low %u)\n",
+           name, after->cache_hits - before->cache_hits, after->cache_misses - before->cache_misses,
+           after->cache_zero_hits - before->cache_zero_hits, after->cache_releases - before->cache_releases,
+           after->cache_size, after->cache_high, after->cache_zeroed, after->cache_low);
+}
+
+static int faultbench(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Usage: faultbench npage\n");
+        return 1;
+    }
+
+    size_t npages = atoi(argv[1]);
+    sos_vm_stats_t before, after;
+    int64_t start;
+
+    sos_vm_stats(&before);
+    start = sos_sys_time_stamp();
+    faultbench_stack(npages);
+    sos_vm_stats(&after);
+    faultbench_report("stack", npages, &before, &after, sos_sys_time_stamp() - start);
+
+    sos_vm_stats(&before);
+    start = sos_sys_time_stamp();
+    if (faultbench_heap(npages) != 0)
+        return 1;
+    sos_vm_stats(&after);
+    faultbench_report("heap", npages, &before, &after, sos_sys_time_stamp() - start);
+
+    return 0;
+}
+
 static void sosh_exit(int argc, char *argv[]) {
     printf("[SOSH Exiting]\n");
     exit(0);
@@ -323,6 +389,45 @@ static int benchmark(int argc, char *argv[]) {
     }
 }
 
+static int pagebench(int argc, char *argv[]) {
+    if (argc > 3) {
+        printf("Usage: pagebench [frames [sequential|strided|random|zipf]]\n");
+        return 1;
+    }
+
+    size_t frames = (argc > 1) ? atoi(argv[1]) : PAGEBENCH_FRAME_LIMIT;
+    printf("Running paging benchmark against %u frames\n", frames);
+    return sos_pagebench(frames, (argc > 2) ? argv[2] : NULL);
+}
+
+static int swap(int argc, char *argv[]) {
+    sos_swap_stats_t stats;
+
+    printf("%-16s %8s %8s %8s %8s %8s %8s %8s %8s\n", "backend", "priority", "slots", "limit", "used",
+           "allocs", "reads", "writes", "errors");
+    for (int i = 0; sos_swap_stats(i, &stats) == 0; i++) {
+        printf("%-16s %8u %8u %8u %8u %8u %8u %8u %8u\n", stats.name, stats.priority, stats.slots, stats.limit,
+               stats.used, stats.allocs, stats.reads, stats.writes, stats.errors);
+    }
+
+    return 0;
+}
+
+static int rsslimit(int argc, char *argv[]) {
+    if (argc != 4) {
+        printf("Usage: rsslimit pid soft hard\n");
+        return 1;
+    }
+
+    pid_t pid = atoi(argv[1]);
+    if (sos_rss_limit(pid, atoi(argv[2]), atoi(argv[3])) != 0) {
+        printf("Failed to set the limits of %d\n", pid);
+        return 1;
+    }
+
+    return 0;
+}
+
 struct command {
     char *name;
     int (*command)(int argc, char **argv);
@@ -331,7 +436,9 @@ struct command {
 struct command commands[] = { { "dir", dir }, { "ls", dir }, { "cat", cat }, {
         "cp", cp }, { "ps", ps }, { "exec", exec }, {"sleep",second_sleep}, {"msleep",milli_sleep},
         {"time", second_time}, {"mtime", micro_time}, {"kill", kill}, {"mypid", mypid},
-        {"fg", fg}, {"benchmark", benchmark}, {"thrash", thrash}, {"exit", sosh_exit}};
+        {"fg", fg}, {"benchmark", benchmark}, {"thrash", thrash},
+        {"faultbench", faultbench}, {"pagebench", pagebench}, {"swap", swap}, {"rsslimit", rsslimit},
+        {"exit", sosh_exit}};
 
 int main(void) {
     char buf[BUF_SIZ];
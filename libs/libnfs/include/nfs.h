@@ -425,6 +425,25 @@ enum rpc_stat nfs_print_exports(void);
 enum rpc_stat nfs_getattr(const fhandle_t *fh, 
                           nfs_getattr_cb_t callback, uintptr_t token);
 
+/**
+ * An asynchronous function used for changing the attributes of a file.
+ * Setting the size of the file truncates or extends it. Fields of "sattr"
+ * set to -1 are left unchanged. The new attributes are passed back through
+ * the provided callback function (@ref nfs_getattr_cb_t) with the provided
+ * token passed, unmodified, as an argument.
+ * @param[in] fh       An NFS handle to the file in question.
+ * @param[in] sattr    The attributes to set.
+ * @param[in] callback An @ref nfs_getattr_cb_t callback function to call once
+ *                     a response arrives.
+ * @param[in] token    A token to pass, unmodified, to the callback function.
+ * @return             RPC_OK if the request was successfully sent. Otherwise
+ *                     an appropriate error code will be returned. "callback"
+ *                     will be called once the response to this request has been
+ *                     received.
+ */
+enum rpc_stat nfs_setattr(const fhandle_t *fh, const sattr_t *sattr,
+                          nfs_getattr_cb_t callback, uintptr_t token);
+
 
 /**
  * Asynchronous function used for retrieving an NFS file handle (@ref fhandle_t)
@@ -550,6 +569,30 @@ enum rpc_stat nfs_readdir(const fhandle_t *pfh, nfscookie_t cookie,
 enum rpc_stat nfs_read(const fhandle_t *fh, int offset, int count,
                        nfs_read_cb_t callback, uintptr_t token);
 
+/**
+ * An asynchronous function used for reading data from a file directly into a
+ * buffer. As for @ref nfs_read, except that the file data is copied from the
+ * reply straight into "buf", with no intermediate buffer. The callback is
+ * passed "buf" as its data. "buf" must remain valid until the callback has
+ * been called.
+ * @param[in] fh       An NFS file handle (@ref fhandle_t) to the file which
+ *                     should be read from.
+ * @param[in] offset   The position, in bytes, at which to begin reading data.
+ * @param[in] count    The number of bytes to read from the file.
+ * @param[in] buf      The buffer to read the data into, of at least "count"
+ *                     bytes.
+ * @param[in] callback An @ref nfs_read_cb_t callback function to call once a
+ *                     response arrives.
+ * @param[in] token    A token to pass, unmodified, to the callback function.
+ * @return             RPC_OK if the request was successfully sent. Otherwise
+ *                     an appropriate error code will be returned. "callback"
+ *                     will be called once the response to this request has been
+ *                     received.
+ */
+enum rpc_stat nfs_read_into(const fhandle_t *fh, int offset, int count,
+                            void *buf,
+                            nfs_read_cb_t callback, uintptr_t token);
+
 /**
  * Asynchronous function used for writing data to a file.
  * nfs_write will start at "offset" bytes within the file provided as "fh" and
@@ -190,6 +190,27 @@ nfs_getattr(const fhandle_t *fh,
     return rpc_send(pbuf, pos, _nfs_pcb, &_nfs_getattr_cb, func, token);
 }
 
+enum rpc_stat
+nfs_setattr(const fhandle_t *fh, const sattr_t *sat,
+            nfs_getattr_cb_t func, uintptr_t token)
+{
+    struct pbuf *pbuf;
+    int pos;
+
+    pbuf = rpcpbuf_init(NFS_NUMBER, NFS_VERSION, NFSPROC_SETATTR, &pos);
+    if(pbuf == NULL){
+        return RPCERR_NOBUF;
+    }
+
+    /* put in the fhandle */
+    pb_write(pbuf, fh, sizeof(*fh), &pos);
+    /* put in the attributes */
+    pb_write_arrl(pbuf, (uint32_t*)sat, sizeof(*sat), &pos);
+
+    /* the reply is an attrstat, the same as for getattr */
+    return rpc_send(pbuf, pos, _nfs_pcb, &_nfs_getattr_cb, func, token);
+}
+
 static void
 _nfs_lookup_cb(void * callback, uintptr_t token, struct pbuf *pbuf)
 {
@@ -302,6 +323,89 @@ nfs_read(const fhandle_t *fh, int offset, int count,
     return rpc_send(pbuf, pos, _nfs_pcb, &_nfs_read_cb, func, token);
 }
 
+struct read_token_wrapper {
+    uintptr_t token;
+    void *buf;
+    int count;
+};
+
+static void
+_nfs_read_into_cb(void * callback, uintptr_t token, struct pbuf *pbuf)
+{
+    struct read_token_wrapper *t = (struct read_token_wrapper*)token;
+    uint32_t status = NFSERR_COMM;
+    fattr_t pattrs;
+    uint32_t size = 0;
+    struct rpc_reply_hdr hdr; 
+    int pos;
+    nfs_read_cb_t cb = callback;
+
+    assert(callback != NULL);
+
+    if (rpc_read_hdr(pbuf, &hdr, &pos) == RPCERR_OK){
+        /* get the status out */
+        pb_readl(pbuf, &status, &pos);
+
+        if (status == NFS_OK) {
+            /* it worked, so take out the return stuff! */
+            pb_read_arrl(pbuf, (uint32_t*)&pattrs, sizeof(pattrs), &pos);
+            pb_readl(pbuf, &size, &pos);
+            /* copy straight out of the pbuf chain into the caller's buffer */
+            if(size > t->count){
+                size = t->count;
+            }
+            pb_read(pbuf, t->buf, size, &pos);
+        }
+    }
+
+    cb(t->token, status, &pattrs, size, t->buf);
+
+    free(t);
+}
+
+enum rpc_stat
+nfs_read_into(const fhandle_t *fh, int offset, int count, void *buf,
+              nfs_read_cb_t func, uintptr_t token)
+{
+    struct pbuf *pbuf;
+    struct read_token_wrapper *t;
+    int pos;
+    int err;
+
+    t = (struct read_token_wrapper*)malloc(sizeof(*t));
+    if(t == NULL){
+        return RPCERR_NOMEM;
+    }
+
+    pbuf = rpcpbuf_init(NFS_NUMBER, NFS_VERSION, NFSPROC_READ, &pos);
+    if(pbuf == NULL){
+        free(t);
+        return RPCERR_NOBUF;
+    }
+
+    /* Limit the number of bytes to receive, as for nfs_read */
+    if (count > NFS_READ_MAX){
+        count = NFS_READ_MAX;
+    }
+
+    /* Fill in the call data */
+    pb_write(pbuf, fh, sizeof(*fh), &pos);
+    pb_writel(pbuf, offset, &pos);
+    pb_writel(pbuf, count, &pos);
+    /* total count unused as per RFC */
+    pb_writel(pbuf, 0, &pos);
+
+    /* Wrap the token up with the destination for the call back */
+    t->token = token;
+    t->buf = buf;
+    t->count = count;
+    err = rpc_send(pbuf, pos, _nfs_pcb, &_nfs_read_into_cb, func, (uintptr_t)t);
+    if(err){
+        free(t);
+    }
+    return err;
+}
+
 struct write_token_wrapper {
     uintptr_t token;
     int count;
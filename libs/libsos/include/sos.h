@@ -44,6 +44,25 @@
 #define SOS_SYS_PROC_WAIT 13
 #define SOS_SYS_EXIT 14
 
+/* Memory statistics syscalls */
+#define SOS_SYS_VM_STATS 15
+#define SOS_SYS_SWAP_STATS 16
+#define SOS_SYS_RSS_LIMIT 17
+
+/* Mapping syscalls */
+#define SOS_SYS_MMAP 18
+#define SOS_SYS_MUNMAP 19
+#define SOS_SYS_MPROTECT 20
+
+/* Fork syscall */
+#define SOS_SYS_PROC_FORK 21
+
+/* Shared memory syscall */
+#define SOS_SYS_SHARE_VM 22
+
+/* Memory advice syscall */
+#define SOS_SYS_MADVISE 23
+
 /* Endpoint for talking to SOS */
 #define SOS_IPC_EP_CAP     (0x1)
 #define TIMER_IPC_EP_CAP   (0x2)
@@ -52,6 +71,7 @@
 #define PROCESS_MAX_FILES 16
 #define MAX_IO_BUF 0x1000
 #define N_NAME 32
+#define N_SWAP_NAME 16
 
 /* file modes */
 #define FM_EXEC  1
@@ -75,6 +95,39 @@ typedef struct {
 
 typedef int pid_t;
 
+typedef struct {
+  unsigned  faults;          /* vm faults taken */
+  unsigned  small_maps;      /* 4K pages mapped */
+  unsigned  large_maps;      /* 64K pages mapped */
+  unsigned  page_ins;        /* pages read back from the pagefile on demand */
+  unsigned  readahead;       /* pages read back ahead of a page in */
+  unsigned  soft_faults;     /* faults that mapped a resident page back in */
+  unsigned  hard_faults;     /* faults that read a page from the pagefile */
+  unsigned  zero_maps;       /* pages mapped to the shared zero page */
+  unsigned  resident;        /* frames currently resident */
+  /* The frame cache is shared by every process */
+  unsigned  cache_size;      /* frames held in the frame cache */
+  unsigned  cache_zeroed;    /* cached frames already zeroed */
+  unsigned  cache_low;       /* frames the cache is trimmed down to */
+  unsigned  cache_high;      /* frames held before the cache is trimmed */
+  unsigned  cache_hits;      /* allocations served from the cache */
+  unsigned  cache_misses;    /* allocations that retyped new memory or paged */
+  unsigned  cache_releases;  /* frames released back to the untyped pool */
+  unsigned  cache_zero_hits; /* zeroed allocations served without zeroing */
+} sos_vm_stats_t;
+
+typedef struct {
+  char      name[N_SWAP_NAME]; /* name of the swap backend */
+  unsigned  priority;        /* backends of equal priority are striped */
+  unsigned  slots;           /* current size in pages */
+  unsigned  limit;           /* size the backend may grow to, in pages */
+  unsigned  used;            /* slots in use */
+  unsigned  allocs;          /* slots allocated from the backend */
+  unsigned  reads;           /* pages read */
+  unsigned  writes;          /* pages written */
+  unsigned  errors;          /* batches of reads or writes that failed */
+} sos_swap_stats_t;
+
 typedef struct {
   pid_t     pid;
   unsigned  size;            /* in pages */
@@ -133,6 +186,13 @@ int sos_process_delete(pid_t pid);
  * Returns 0 if successful, -1 otherwise (invalid process).
  */
 
+pid_t sos_process_fork(void);
+/* Create a copy of the calling process, which shares its memory copy on
+ * write and has its own copy of its open files, except the console opened for
+ * reading. Returns ID of the child in the parent and 0 in the child, -1 if
+ * error (too many processes, out of memory).
+ */
+
 pid_t sos_my_id(void);
 /* Returns ID of caller's process. */
 
@@ -167,6 +227,58 @@ void sos_sys_exit(void);
  */
 seL4_Word sos_sys_brk(seL4_Word newbrk);
 
+int sos_vm_stats(sos_vm_stats_t *stats);
+/* Returns the virtual memory statistics of the calling process through "stats".
+ * Counts other than "resident" are cumulative since the process started.
+ * Returns 0 if successful.
+ */
+
+int sos_swap_stats(int backend, sos_swap_stats_t *stats);
+/* Returns the statistics of swap backend "backend" through "stats". Backends
+ * are numbered from 0 in order of decreasing priority, slots are allocated from
+ * the first backend with space. Counts are cumulative since SOS started.
+ * Returns 0 if successful, -1 if there is no such backend.
+ */
+
+int sos_rss_limit(pid_t pid, unsigned soft, unsigned hard);
+/* Sets the resident set limits of process "pid", the caller or one of its
+ * children, in frames. While memory is short, pages of processes above their
+ * "soft" limit are paged out in preference to those of other processes; with
+ * a soft limit of 0 the process is entitled to an equal share of memory.
+ * A process at its "hard" limit pages out its own pages to map new ones, 0
+ * for no hard limit. Returns 0 if successful, -1 otherwise (invalid process,
+ * or a soft limit above the hard limit).
+ */
+
+void *sos_sys_mmap(void *addr, size_t length, int prot, int flags, int fd, unsigned offset);
+/* Maps "length" bytes of anonymous memory, or of file "fd" from page aligned
+ * "offset", with "prot" and "flags" as for mmap. The mapping is placed at
+ * "addr" if it is page aligned and free, else wherever it fits. Pages are
+ * faulted in on demand, changes to a MAP_SHARED file mapping are written back
+ * to the file. Returns the address of the mapping, NULL otherwise (invalid
+ * arguments, file not open for the access, or no room).
+ */
+
+int sos_sys_munmap(void *addr, size_t length);
+/* Unmaps the mappings in ["addr","addr"+"length"), which must have been made
+ * by sos_sys_mmap. Returns 0 if successful, -1 otherwise.
+ */
+
+int sos_sys_mprotect(void *addr, size_t length, int prot);
+/* Sets the protection of the mappings covering ["addr","addr"+"length"),
+ * which must have been made by sos_sys_mmap. Returns 0 if successful, -1
+ * otherwise.
+ */
+
+int sos_sys_madvise(void *addr, size_t length, int advice);
+/* Advises how ["addr","addr"+"length") will be used, with "advice" as for
+ * madvise. MADV_WILLNEED pages in the range ahead of use, MADV_DONTNEED
+ * releases its frames and pagefile slots; anonymous memory then reads as
+ * zeros and a file mapping is read from its file again. MADV_SEQUENTIAL,
+ * MADV_RANDOM and MADV_NORMAL set the read ahead of every region the range
+ * overlaps. Returns 0 if successful, -1 otherwise.
+ */
+
 
 /*************************************************************************/
 /*                                   */
@@ -184,6 +296,11 @@ int sos_share_vm(void *adr, size_t size, int writable);
  * Once a page is shared, a process may write to it if and only if all
  * _other_ processes have set up the page as shared writable.
  *
+ * Pages are shared at the same address in every process, within memory that
+ * can be read and written and is not a file mapping. A page shared by a
+ * forked process is shared by its child as well. Pages of the heap and stack
+ * mapped as large pages cannot be shared, memory from sos_sys_mmap always can.
+ *
  * Returns 0 if successful, -1 otherwise (invalid address or size).
  */
 
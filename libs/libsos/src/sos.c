@@ -114,6 +114,13 @@ sos_process_create(const char *path)
     return (pid_t)seL4_GetMR(0); /* -1 on error, 0 on success */
 }
 
+pid_t
+sos_process_fork(void)
+{
+    MAKE_SYSCALL(SOS_SYS_PROC_FORK);
+    return (pid_t)seL4_GetMR(0); /* -1 on error, 0 in the child */
+}
+
 int
 sos_process_delete(pid_t pid)
 {
@@ -172,3 +179,94 @@ sos_sys_exit(void)
 {
     MAKE_SYSCALL(SOS_SYS_EXIT);
 }
+
+int
+sos_vm_stats(sos_vm_stats_t *stats)
+{
+    MAKE_SYSCALL(SOS_SYS_VM_STATS);
+    stats->faults = seL4_GetMR(0);
+    stats->small_maps = seL4_GetMR(1);
+    stats->large_maps = seL4_GetMR(2);
+    stats->page_ins = seL4_GetMR(3);
+    stats->readahead = seL4_GetMR(4);
+    stats->soft_faults = seL4_GetMR(5);
+    stats->hard_faults = seL4_GetMR(6);
+    stats->zero_maps = seL4_GetMR(7);
+    stats->resident = seL4_GetMR(8);
+    stats->cache_size = seL4_GetMR(9);
+    stats->cache_zeroed = seL4_GetMR(10);
+    stats->cache_low = seL4_GetMR(11);
+    stats->cache_high = seL4_GetMR(12);
+    stats->cache_hits = seL4_GetMR(13);
+    stats->cache_misses = seL4_GetMR(14);
+    stats->cache_releases = seL4_GetMR(15);
+    stats->cache_zero_hits = seL4_GetMR(16);
+    return 0;
+}
+
+int
+sos_swap_stats(int backend, sos_swap_stats_t *stats)
+{
+    MAKE_SYSCALL(SOS_SYS_SWAP_STATS, backend);
+    if ((int)seL4_GetMR(0) == -1)
+        return -1;
+
+    stats->priority = seL4_GetMR(1);
+    stats->slots = seL4_GetMR(2);
+    stats->used = seL4_GetMR(3);
+    stats->allocs = seL4_GetMR(4);
+    stats->reads = seL4_GetMR(5);
+    stats->writes = seL4_GetMR(6);
+    stats->errors = seL4_GetMR(7);
+    stats->limit = seL4_GetMR(8);
+
+    /* The name is packed into the words that follow */
+    seL4_Word name[N_SWAP_NAME / sizeof(seL4_Word)];
+    for (int i = 0; i < N_SWAP_NAME / sizeof(seL4_Word); i++)
+        name[i] = seL4_GetMR(9 + i);
+    memcpy(stats->name, name, N_SWAP_NAME);
+    stats->name[N_SWAP_NAME - 1] = '\0';
+    return 0;
+}
+
+int
+sos_rss_limit(pid_t pid, unsigned soft, unsigned hard)
+{
+    MAKE_SYSCALL(SOS_SYS_RSS_LIMIT, pid, soft, hard);
+    return (int)seL4_GetMR(0);
+}
+
+void *
+sos_sys_mmap(void *addr, size_t length, int prot, int flags, int fd, unsigned offset)
+{
+    MAKE_SYSCALL(SOS_SYS_MMAP, addr, length, prot, flags, fd, offset);
+    return (void *)seL4_GetMR(0); /* NULL on error */
+}
+
+int
+sos_sys_munmap(void *addr, size_t length)
+{
+    MAKE_SYSCALL(SOS_SYS_MUNMAP, addr, length);
+    return (int)seL4_GetMR(0);
+}
+
+int
+sos_sys_mprotect(void *addr, size_t length, int prot)
+{
+    MAKE_SYSCALL(SOS_SYS_MPROTECT, addr, length, prot);
+    return (int)seL4_GetMR(0);
+}
+
+int
+sos_sys_madvise(void *addr, size_t length, int advice)
+{
+    MAKE_SYSCALL(SOS_SYS_MADVISE, addr, length, advice);
+    return (int)seL4_GetMR(0);
+}
+
+int
+sos_share_vm(void *adr, size_t size, int writable)
+{
+    MAKE_SYSCALL(SOS_SYS_SHARE_VM, adr, size, writable);
+    return (int)seL4_GetMR(0);
+}
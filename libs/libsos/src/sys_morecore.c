@@ -17,21 +17,9 @@
 #include <errno.h>
 #include <assert.h>
 
+#include <utils/page.h>
 #include <utils/util.h>
 
-/*
- * Statically allocated morecore area.
- *
- * This is rather terrible, but is the simplest option without a
- * huge amount of infrastructure.
- */
-#define MORECORE_AREA_BYTE_SIZE 0x100000
-char morecore_area[MORECORE_AREA_BYTE_SIZE];
-
-/* Pointer to free space in the morecore area. */
-static uintptr_t morecore_base = (uintptr_t) &morecore_area;
-static uintptr_t morecore_top = (uintptr_t) &morecore_area[MORECORE_AREA_BYTE_SIZE];
-
 /* Actual morecore implementation
    returns 0 if failure, returns newbrk if success.
 */
@@ -43,8 +31,7 @@ sys_brk(va_list ap)
     return sos_sys_brk((seL4_Word)newbrk);
 }
 
-/* Large mallocs will result in muslc calling mmap, so we do a minimal implementation
-   here to support that. We make a bunch of assumptions in the process */
+/* Large mallocs will result in muslc calling mmap, the mapping is made by SOS */
 long
 sys_mmap2(va_list ap)
 {
@@ -53,25 +40,42 @@ sys_mmap2(va_list ap)
     int prot = va_arg(ap, int);
     int flags = va_arg(ap, int);
     int fd = va_arg(ap, int);
-    off_t offset = va_arg(ap, off_t);
+    long offset = va_arg(ap, long); /* In pages */
 
-    (void)addr;
-    (void)prot;
-    (void)fd;
-    (void)offset;
+    void *base = sos_sys_mmap(addr, length, prot, flags, fd, (unsigned)offset * PAGE_SIZE_4K);
+    if (base == NULL)
+        return -ENOMEM;
 
-    if (flags & MAP_ANONYMOUS) {
-        /* Steal from the top */
-        uintptr_t base = morecore_top - length;
-        if (base < morecore_base) {
-            return -ENOMEM;
-        }
-        morecore_top = base;
-        return base;
-    }
+    return (long)base;
+}
 
-    assert(!"not implemented");
-    return -ENOMEM;
+long
+sys_munmap(va_list ap)
+{
+    void *addr = va_arg(ap, void*);
+    size_t length = va_arg(ap, size_t);
+
+    return (sos_sys_munmap(addr, length) == 0) ? 0 : -EINVAL;
+}
+
+long
+sys_mprotect(va_list ap)
+{
+    void *addr = va_arg(ap, void*);
+    size_t length = va_arg(ap, size_t);
+    int prot = va_arg(ap, int);
+
+    return (sos_sys_mprotect(addr, length, prot) == 0) ? 0 : -ENOMEM;
+}
+
+long
+sys_madvise(va_list ap)
+{
+    void *addr = va_arg(ap, void*);
+    size_t length = va_arg(ap, size_t);
+    int advice = va_arg(ap, int);
+
+    return (sos_sys_madvise(addr, length, advice) == 0) ? 0 : -EINVAL;
 }
 
 long